@@ -0,0 +1,403 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE  // for dl_iterate_phdr
+#endif
+#include <stddef.h>  // for size_t
+#include <errno.h>   // for ENOMEM, EINVAL
+
+#include "alloc_stats.h"
+
+/*
+ * The allocator is only replaced in programs that report allocations (hbr
+ * for --mem-profile and hbr-bench), which build this file with
+ * ALLOC_STATS defined. Everywhere else the stubs below are linked.
+ */
+#if defined(__GLIBC__) && defined(ALLOC_STATS)
+
+#include <execinfo.h>  // for backtrace
+#include <link.h>      // for dl_iterate_phdr
+#include <malloc.h>    // for malloc_usable_size, mallinfo2
+
+/*
+ * GLib no longer lets programs replace its allocator (g_mem_set_vtable()
+ * is a no-op), but g_malloc() and friends call malloc(), so wrapping the C
+ * library's allocator counts GLib's allocations too. glibc exports its
+ * allocator under __libc_* names for exactly this.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+/// frames of the call stack looked at for an allocation site
+#define SITE_FRAMES 24
+/// distinct allocation sites kept, later sites are counted at address 0
+#define SITE_SLOTS 8192
+
+/// set once by alloc_stats_enable(), read by every allocation on any
+/// thread, always accessed atomically
+static gint counting = FALSE;
+static gint tracking_sites = FALSE;
+static guint64 allocations = 0;
+static guint64 bytes = 0;
+static gint64 live = 0;
+static gint64 peak_live = 0;
+/// counters of the allocations made on this thread, see
+/// alloc_stats_get_thread()
+static __thread alloc_stats_t thread_stats;
+
+/// executable code of the program itself, sites are the first frame in it
+static guintptr exe_base = 0;
+static guintptr exe_start = 0;
+static guintptr exe_end = 0;
+/// open addressing table of allocation sites, address 0 is unused
+static alloc_site_t sites[SITE_SLOTS];
+static alloc_site_t outside_sites = { 0, 0, 0 };
+static GMutex sites_lock;
+/// backtrace() may allocate, those allocations are not sites
+static __thread gboolean in_site = FALSE;
+
+/**
+ * @brief Count an allocation of size bytes that returned ptr
+ */
+static void count_alloc(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&bytes, size, __ATOMIC_RELAXED);
+    gint64 now = __atomic_add_fetch(&live, malloc_usable_size(ptr),
+            __ATOMIC_RELAXED);
+    gint64 peak = __atomic_load_n(&peak_live, __ATOMIC_RELAXED);
+    while (now > peak && !__atomic_compare_exchange_n(&peak_live, &peak, now,
+                TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        continue;
+    }
+    thread_stats.allocations++;
+    thread_stats.bytes += size;
+    thread_stats.live += malloc_usable_size(ptr);
+    thread_stats.peak_live = MAX(thread_stats.peak_live, thread_stats.live);
+}
+
+/**
+ * @brief Count ptr as freed
+ */
+static void count_free(void *ptr)
+{
+    if (ptr != NULL) {
+        gsize size = malloc_usable_size(ptr);
+        __atomic_sub_fetch(&live, size, __ATOMIC_RELAXED);
+        thread_stats.live -= size;
+    }
+}
+
+/**
+ * @brief Check if alloc_stats_enable() was called, from any thread
+ */
+static inline gboolean is_counting(void)
+{
+    return __atomic_load_n(&counting, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Check if alloc_stats_enable() asked for sites, from any thread
+ */
+static inline gboolean is_tracking_sites(void)
+{
+    return __atomic_load_n(&tracking_sites, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @brief Add an allocation to the first caller inside the executable.
+ *        Called straight from the allocator wrappers so the first two
+ *        frames (this function and the wrapper) can be skipped.
+ */
+static void __attribute__((noinline)) count_site(void *ptr, size_t size)
+{
+    if (ptr == NULL || in_site) {
+        return;
+    }
+    in_site = TRUE;
+    void *frames[SITE_FRAMES];
+    gint depth = backtrace(frames, SITE_FRAMES);
+    guintptr address = 0;
+    for (gint i = 2; i < depth && address == 0; i++) {
+        guintptr frame = (guintptr) frames[i];
+        if (frame > exe_start && frame <= exe_end) {
+            // point into the call instruction, not the one after it
+            address = frame - 1 - exe_base;
+        }
+    }
+
+    g_mutex_lock(&sites_lock);
+    alloc_site_t *site = &outside_sites;
+    if (address != 0) {
+        guint slot = (guint) (address * 2654435761u) % SITE_SLOTS;
+        for (guint probe = 0; probe < SITE_SLOTS; probe++) {
+            alloc_site_t *s = &sites[(slot + probe) % SITE_SLOTS];
+            if (s->address == address || s->address == 0) {
+                s->address = address;
+                site = s;
+                break;
+            }
+        }
+    }
+    site->allocations++;
+    site->bytes += size;
+    g_mutex_unlock(&sites_lock);
+    in_site = FALSE;
+}
+
+void *malloc(size_t size)
+{
+    void *ptr = __libc_malloc(size);
+    if (is_counting()) {
+        count_alloc(ptr, size);
+        if (is_tracking_sites()) {
+            count_site(ptr, size);
+        }
+    }
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = __libc_calloc(count, size);
+    if (is_counting()) {
+        count_alloc(ptr, count * size);
+        if (is_tracking_sites()) {
+            count_site(ptr, count * size);
+        }
+    }
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (!is_counting()) {
+        return __libc_realloc(ptr, size);
+    }
+    count_free(ptr);
+    void *moved = __libc_realloc(ptr, size);
+    if (moved == NULL && size > 0) {
+        // the old block is still allocated
+        if (ptr != NULL) {
+            __atomic_add_fetch(&live, malloc_usable_size(ptr),
+                    __ATOMIC_RELAXED);
+            thread_stats.live += malloc_usable_size(ptr);
+        }
+        return NULL;
+    }
+    count_alloc(moved, size);
+    if (is_tracking_sites()) {
+        count_site(moved, size);
+    }
+    return moved;
+}
+
+void free(void *ptr)
+{
+    if (is_counting()) {
+        count_free(ptr);
+    }
+    __libc_free(ptr);
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *ptr = __libc_memalign(alignment, size);
+    if (is_counting()) {
+        count_alloc(ptr, size);
+        if (is_tracking_sites()) {
+            count_site(ptr, size);
+        }
+    }
+    return ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 ||
+            (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    *ptr = memalign(alignment, size);
+    return *ptr == NULL ? ENOMEM : 0;
+}
+
+/**
+ * @brief dl_iterate_phdr() callback finding the executable code of the
+ *        program, always the first object listed
+ */
+static int find_executable(struct dl_phdr_info *info, size_t size,
+        void *data)
+{
+    exe_base = info->dlpi_addr;
+    for (gint i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type == PT_LOAD && (phdr->p_flags & PF_X)) {
+            guintptr start = exe_base + phdr->p_vaddr;
+            if (exe_start == 0 || start < exe_start) {
+                exe_start = start;
+            }
+            exe_end = MAX(exe_end, start + phdr->p_memsz);
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Check if allocations can be counted
+ */
+gboolean alloc_stats_available(void)
+{
+    return TRUE;
+}
+
+/**
+ * @brief Start counting allocations. Blocks allocated before this are
+ *        included in live bytes so freeing them later keeps the count right.
+ *
+ * @param track_sites also record where each allocation was made, this
+ *                    walks the stack for every allocation
+ *
+ * @return FALSE when allocations can't be counted
+ */
+gboolean alloc_stats_enable(gboolean track_sites)
+{
+    if (track_sites && !is_tracking_sites()) {
+        dl_iterate_phdr(find_executable, NULL);
+        // the first backtrace() loads libgcc, do it before counting
+        void *frame;
+        backtrace(&frame, 1);
+        // publishes exe_base, exe_start and exe_end to the other threads
+        __atomic_store_n(&tracking_sites, TRUE, __ATOMIC_RELEASE);
+    }
+    if (!is_counting()) {
+#if __GLIBC_PREREQ(2, 33)
+        gint64 in_use = mallinfo2().uordblks;
+#else
+        gint64 in_use = (guint) mallinfo().uordblks;
+#endif
+        __atomic_store_n(&live, in_use, __ATOMIC_RELAXED);
+        __atomic_store_n(&peak_live, in_use, __ATOMIC_RELAXED);
+        __atomic_store_n(&counting, TRUE, __ATOMIC_RELEASE);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Copy the current allocation counters
+ */
+void alloc_stats_get(alloc_stats_t *stats)
+{
+    stats->allocations = __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&bytes, __ATOMIC_RELAXED);
+    stats->live = __atomic_load_n(&live, __ATOMIC_RELAXED);
+    stats->peak_live = __atomic_load_n(&peak_live, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Copy the counters of the allocations made on this thread. live
+ *        is what this thread allocated minus what it freed (including
+ *        blocks other threads allocated), so it is only meaningful as a
+ *        difference, and may be negative.
+ */
+void alloc_stats_get_thread(alloc_stats_t *stats)
+{
+    *stats = thread_stats;
+}
+
+/**
+ * @brief Start measuring this thread's peak_live again from its live bytes
+ *        now, other threads' peaks are left alone
+ */
+void alloc_stats_reset_thread_peak(void)
+{
+    thread_stats.peak_live = thread_stats.live;
+}
+
+/**
+ * @brief Copy the allocation sites recorded since alloc_stats_enable()
+ *
+ * @return array of alloc_site_t in no particular order, free with
+ *         g_array_free()
+ */
+GArray * alloc_stats_get_sites(void)
+{
+    GArray *copy = g_array_new(FALSE, FALSE, sizeof(alloc_site_t));
+    g_mutex_lock(&sites_lock);
+    in_site = TRUE;
+    for (guint i = 0; i < SITE_SLOTS; i++) {
+        if (sites[i].address != 0) {
+            g_array_append_val(copy, sites[i]);
+        }
+    }
+    if (outside_sites.allocations > 0) {
+        g_array_append_val(copy, outside_sites);
+    }
+    in_site = FALSE;
+    g_mutex_unlock(&sites_lock);
+    return copy;
+}
+
+#else
+
+gboolean alloc_stats_available(void)
+{
+    return FALSE;
+}
+
+gboolean alloc_stats_enable(gboolean track_sites)
+{
+    return FALSE;
+}
+
+void alloc_stats_get(alloc_stats_t *stats)
+{
+    stats->allocations = 0;
+    stats->bytes = 0;
+    stats->live = 0;
+    stats->peak_live = 0;
+}
+
+void alloc_stats_get_thread(alloc_stats_t *stats)
+{
+    alloc_stats_get(stats);
+}
+
+void alloc_stats_reset_thread_peak(void)
+{
+}
+
+GArray * alloc_stats_get_sites(void)
+{
+    return g_array_new(FALSE, FALSE, sizeof(alloc_site_t));
+}
+
+#endif
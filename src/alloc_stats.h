@@ -0,0 +1,61 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _alloc_stats_h
+#define _alloc_stats_h
+
+#include <glib.h>
+
+/**
+ * @brief Allocation counters since alloc_stats_enable(). Building
+ *        alloc_stats.c with ALLOC_STATS defined replaces malloc() and
+ *        friends with wrappers around the C library's allocator (glibc
+ *        only) that count once enabled, only hbr and hbr-bench do.
+ */
+typedef struct {
+    /// calls to malloc, calloc, realloc, and the aligned allocators
+    guint64 allocations;
+    /// bytes requested by those calls
+    guint64 bytes;
+    /// usable bytes currently allocated
+    gint64 live;
+    /// most usable bytes allocated at once
+    gint64 peak_live;
+} alloc_stats_t;
+
+/**
+ * @brief Allocations made from one place in the program
+ */
+typedef struct {
+    /// return address in the executable, relative to where it was loaded
+    /// (what addr2line expects), 0 for allocations no frame of the
+    /// executable asked for
+    guintptr address;
+    guint64 allocations;
+    guint64 bytes;
+} alloc_site_t;
+
+gboolean alloc_stats_available(void);
+gboolean alloc_stats_enable(gboolean track_sites);
+void alloc_stats_get(alloc_stats_t *stats);
+void alloc_stats_get_thread(alloc_stats_t *stats);
+void alloc_stats_reset_thread_peak(void);
+GArray * alloc_stats_get_sites(void);
+
+#endif
@@ -19,16 +19,21 @@
 
 #include <stdio.h>    // for NULL
 #include <stdlib.h>   // for exit
-#include <string.h>   // for strcmp, memcpy
+#include <string.h>   // for strcmp, strlen, memcpy, memmove
 #include <assert.h>   // for assert
 
 #include "util.h"
 #include "build_args.h"
 #include "options.h"
 #include "validate.h"
+#include "value.h"
 
 extern option_data_t option_data;
 
+static const gchar * typed_string(GKeyFile *config, const gchar *group,
+        const gchar *key);
+static gint available_cpus(void);
+
 /**
  * @brief Produce options to be passed to HandBrakeCLI
  *
@@ -120,15 +125,13 @@ GPtrArray * build_args(GKeyFile *config, const gchar *group, gboolean quoted)
      */
     // input file arg (depends on input_basedir, iso_filename)
     g_ptr_array_add(args, g_strdup("-i"));
-    gchar *temp = g_key_file_get_string(config, group, "input_basedir", NULL);
-    GString *infile = g_string_new(temp);
-    g_free(temp);
+    GString *infile = g_string_new(typed_string(config, group,
+                "input_basedir"));
     if (infile->str[infile->len-1] != G_DIR_SEPARATOR){
         g_string_append(infile, G_DIR_SEPARATOR_S);
     }
-    temp = g_key_file_get_string(config, group, "iso_filename", NULL);
-    g_string_append_printf(infile, "%s", temp);
-    g_free(temp);
+    g_string_append_printf(infile, "%s", typed_string(config, group,
+                "iso_filename"));
     if (quoted) {
         g_ptr_array_add(args, g_shell_quote(infile->str));
         g_string_free(infile, TRUE); // g_shell_quote made a copy
@@ -155,6 +158,112 @@ GPtrArray * build_args(GKeyFile *config, const gchar *group, gboolean quoted)
     return args;
 }
 
+/**
+ * @brief Size the encoder's thread pool for the encodes sharing the host.
+ *        x264 and x265 size theirs for every CPU, so with -j each encode is
+ *        given its share through encopts (threads= for x264, pools= for
+ *        x265). A thread count already in encopts is kept, other encoders
+ *        and single encodes are left alone.
+ *
+ * @param argv HandBrakeCLI arguments, NULL terminated, reused or freed
+ * @param jobs encodes sharing the CPUs
+ *
+ * @return arguments with the thread budget, free with g_strfreev()
+ */
+gchar ** build_thread_budget(gchar **argv, gint jobs)
+{
+    const gchar *encoder = NULL;
+    gint encopts = -1;
+    gint input = -1;
+    gint count = 0;
+    for (; argv[count] != NULL; count++) {
+        if (g_str_has_prefix(argv[count], "--encoder=")) {
+            encoder = argv[count] + strlen("--encoder=");
+        } else if (g_str_has_prefix(argv[count], "--encopts=")) {
+            encopts = count;
+        } else if (input < 0 && strcmp(argv[count], "-i") == 0) {
+            input = count;
+        }
+    }
+    const gchar *key = NULL;
+    if (encoder != NULL && g_str_has_prefix(encoder, "x264")) {
+        key = "threads";
+    } else if (encoder != NULL && g_str_has_prefix(encoder, "x265")) {
+        key = "pools";
+    }
+    if (key == NULL || jobs <= 1) {
+        return argv;
+    }
+    gchar *budget = g_strdup_printf("%s=%d", key,
+            MAX(1, available_cpus() / jobs));
+
+    if (encopts >= 0) {
+        const gchar *value = argv[encopts] + strlen("--encopts=");
+        gchar *search = g_strdup_printf(":%s", value);
+        gchar *needle = g_strdup_printf(":%s=", key);
+        // merged options must still pass valid_encopts
+        if (strstr(search, needle) == NULL && encopts_valid(value)) {
+            gchar *merged = g_strdup_printf("%s:%s", argv[encopts], budget);
+            g_free(argv[encopts]);
+            argv[encopts] = merged;
+        }
+        g_free(needle);
+        g_free(search);
+    } else {
+        // options come before -i <source> -o <filename>
+        gint at = input >= 0 ? input : count;
+        argv = g_renew(gchar *, argv, count + 2);
+        memmove(argv + at + 1, argv + at, (count - at + 1) * sizeof(gchar *));
+        argv[at] = g_strdup_printf("--encopts=%s", budget);
+    }
+    g_free(budget);
+    return argv;
+}
+
+/**
+ * @brief CPUs hbr may use: those in its affinity mask, capped by the cgroup
+ *        v2 CPU quotas of hbr's cgroup and the cgroups above it
+ */
+static gint available_cpus(void)
+{
+    gint cpus = g_get_num_processors();
+    gchar *contents = NULL;
+    if (!g_file_get_contents("/proc/self/cgroup", &contents, NULL, NULL)) {
+        return cpus;
+    }
+    // the cgroup v2 hierarchy is the "0::/path" line
+    gchar *path = NULL;
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for (gint i = 0; lines[i] != NULL; i++) {
+        if (g_str_has_prefix(lines[i], "0::/")) {
+            path = g_strdup(lines[i] + strlen("0::"));
+        }
+    }
+    g_strfreev(lines);
+    g_free(contents);
+
+    // a quota on any cgroup above hbr's limits it too
+    while (path != NULL) {
+        gchar *filename = g_build_filename("/sys/fs/cgroup", path, "cpu.max",
+                NULL);
+        if (g_file_get_contents(filename, &contents, NULL, NULL)) {
+            gint64 quota, period;
+            // "max 100000" when there is no quota
+            if (sscanf(contents, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT,
+                        &quota, &period) == 2 && quota > 0 && period > 0) {
+                cpus = MIN(cpus, MAX(1, (quota + period - 1) / period));
+            }
+            g_free(contents);
+        }
+        g_free(filename);
+        gchar *parent = strcmp(path, "/") != 0 ? g_path_get_dirname(path) :
+            NULL;
+        g_free(path);
+        path = parent;
+    }
+    return cpus;
+}
+
 /**
  * @brief Builds arguments where the key type is a string
  *
@@ -167,38 +276,33 @@ GPtrArray * build_args(GKeyFile *config, const gchar *group, gboolean quoted)
 void build_arg_string(GKeyFile *config, const gchar *group,
         GPtrArray *args, gint i, gboolean param_quoted) {
     option_t *options = option_data.options;
-    gchar *string_value;
     // handle boolean values for keys without optional arguments
     if (options[i].arg_type == optional_argument) {
-        GError *error = NULL;
-        gboolean b = g_key_file_get_boolean(config, group,
-                options[i].name, &error);
-        if (error == NULL) {
-            if (b == TRUE) {
+        const typed_value_t *b = get_typed_value(config, group,
+                options[i].name, k_boolean);
+        if (b != NULL && b->error == NULL) {
+            if (b->boolean == TRUE) {
                 g_ptr_array_add(args, g_strdup_printf("--%s",
                             options[i].name));
             } else if (options[i].negation_option){
                 gchar * negation_name = g_strdup_printf("no-%s",
                         options[i].name);
-                if (g_key_file_has_key(config, group, negation_name,
-                            NULL)) {
-                    if (g_key_file_get_boolean(config, group,
-                                negation_name, NULL)) {
-                        g_ptr_array_add(args,
-                                g_strdup_printf("--%s",
-                                    negation_name));
-                    }
+                const typed_value_t *negation = get_typed_value(config,
+                        group, negation_name, k_boolean);
+                if (negation != NULL && negation->boolean) {
+                    g_ptr_array_add(args,
+                            g_strdup_printf("--%s",
+                                negation_name));
                 }
                 g_free(negation_name);
             }
             return;
-        } else {
-            g_error_free(error);
         }
     }
     // regular string option
-    string_value = g_key_file_get_string(config, group,
-            options[i].name, NULL);
+    const typed_value_t *value = get_typed_value(config, group,
+            options[i].name, k_string);
+    const gchar *string_value = value ? value->string : NULL;
     if (string_value != NULL) {
         if (param_quoted) {
             g_ptr_array_add(args, g_strdup_printf("--%s=\"%s\"",
@@ -208,7 +312,6 @@ void build_arg_string(GKeyFile *config, const gchar *group,
                         options[i].name, string_value));
         }
     }
-    g_free(string_value);
     return;
 }
 
@@ -224,16 +327,17 @@ void build_arg_boolean(GKeyFile *config, const gchar *group,
         GPtrArray *args, gint i) {
     option_t *options = option_data.options;
     // check for affirmative boolean (i.e. markers)
-    if (g_key_file_get_boolean(config, group, options[i].name, NULL)) {
+    const typed_value_t *value = get_option_value(config, group, &options[i]);
+    if (value != NULL && value->boolean) {
         g_ptr_array_add(args, g_strdup_printf("--%s", options[i].name));
     }
     // check for negating boolean (i.e. no-markers)
     if (options[i].negation_option) {
         gchar * negation_name = g_strdup_printf("no-%s", options[i].name);
-        if (g_key_file_has_key(config, group, negation_name, NULL)) {
-            if (g_key_file_get_boolean(config, group, negation_name, NULL)) {
-                g_ptr_array_add(args, g_strdup_printf("--%s", negation_name));
-            }
+        const typed_value_t *negation = get_typed_value(config, group,
+                negation_name, k_boolean);
+        if (negation != NULL && negation->boolean) {
+            g_ptr_array_add(args, g_strdup_printf("--%s", negation_name));
         }
         g_free(negation_name);
     }
@@ -253,28 +357,25 @@ void build_arg_integer(GKeyFile *config, const gchar *group,
     // special case for keys with arg_type optional_argument
     // if integer value is 0 or 1, take integer value
     // otherwise interpret as boolean and output bare option if true
-    gint integer_value = g_key_file_get_integer(config, group,
-            options[i].name, NULL);
+    const typed_value_t *value = get_option_value(config, group, &options[i]);
+    gint integer_value = value ? value->integer : 0;
     if (options[i].arg_type == optional_argument &&
             integer_value != 0 && integer_value != 1) {
-        GError *error = NULL;
-        gboolean b = g_key_file_get_boolean(config, group,
-                options[i].name, &error);
-        if (error == NULL) {
-            if (b == TRUE) {
+        const typed_value_t *b = get_typed_value(config, group,
+                options[i].name, k_boolean);
+        if (b != NULL && b->error == NULL) {
+            if (b->boolean == TRUE) {
                 g_ptr_array_add(args, g_strdup_printf("--%s",
                             options[i].name));
             } else if (options[i].negation_option){
                 gchar * negation_name = g_strdup_printf("no-%s",
                         options[i].name);
-                if (g_key_file_has_key(config, group, negation_name,
-                            NULL)) {
-                    if (g_key_file_get_boolean(config, group,
-                                negation_name, NULL)) {
-                        g_ptr_array_add(args,
-                                g_strdup_printf("--%s",
-                                    negation_name));
-                    }
+                const typed_value_t *negation = get_typed_value(config,
+                        group, negation_name, k_boolean);
+                if (negation != NULL && negation->boolean) {
+                    g_ptr_array_add(args,
+                            g_strdup_printf("--%s",
+                                negation_name));
                 }
                 g_free(negation_name);
             }
@@ -296,8 +397,8 @@ void build_arg_integer(GKeyFile *config, const gchar *group,
 void build_arg_double(GKeyFile *config, const gchar *group, GPtrArray *args,
         gint i) {
     option_t *options = option_data.options;
-    gdouble double_value = g_key_file_get_double(config, group,
-            options[i].name, NULL);
+    const typed_value_t *value = get_option_value(config, group, &options[i]);
+    gdouble double_value = value ? value->number : 0.0;
     g_ptr_array_add(args, g_strdup_printf("--%s=%f",
                 options[i].name, double_value));
 }
@@ -318,47 +419,43 @@ void build_arg_string_list(GKeyFile *config, const gchar *group, GPtrArray *args
     option_t *options = option_data.options;
     // handle boolean values for keys with optional arguments
     if (options[i].arg_type == optional_argument) {
-        GError *error = NULL;
-        gboolean b = g_key_file_get_boolean(config, group,
-                options[i].name, &error);
-        if (error == NULL) {
-            if (b == TRUE) {
+        const typed_value_t *b = get_typed_value(config, group,
+                options[i].name, k_boolean);
+        if (b != NULL && b->error == NULL) {
+            if (b->boolean == TRUE) {
                 g_ptr_array_add(args, g_strdup_printf("--%s",
                             options[i].name));
             } else if (options[i].negation_option){
                 gchar * negation_name = g_strdup_printf("no-%s",
                         options[i].name);
-                if (g_key_file_has_key(config, group, negation_name,
-                            NULL)) {
-                    if (g_key_file_get_boolean(config, group,
-                                negation_name, NULL)) {
-                        g_ptr_array_add(args,
-                                g_strdup_printf("--%s",
-                                    negation_name));
-                    }
+                const typed_value_t *negation = get_typed_value(config,
+                        group, negation_name, k_boolean);
+                if (negation != NULL && negation->boolean) {
+                    g_ptr_array_add(args,
+                            g_strdup_printf("--%s",
+                                negation_name));
                 }
                 g_free(negation_name);
             }
             return;
         }
     }
-    gchar **string_list_values = g_key_file_get_string_list(config, group,
-            options[i].name, &count, NULL);
+    // list elements are already stripped of leading/trailing whitespace
+    const typed_value_t *value = get_typed_value(config, group,
+            options[i].name, k_string_list);
+    count = value ? value->count : 0;
     arg = g_string_new(NULL);
     g_string_append_printf(arg, "--%s=", options[i].name);
     for (gsize m = 0; m < count; m++) {
         if (param_quoted) {
-            g_string_append_printf(arg, "\"%s\"",
-                    g_strstrip(string_list_values[m]));
+            g_string_append_printf(arg, "\"%s\"", value->strings[m]);
         } else {
-            g_string_append_printf(arg, "%s",
-                    g_strstrip(string_list_values[m]));
+            g_string_append_printf(arg, "%s", value->strings[m]);
         }
         if (m < count-1) {
             g_string_append(arg, ",");
         }
     }
-    g_strfreev(string_list_values);
     g_ptr_array_add(args, arg->str);
     g_string_free(arg, FALSE);
 }
@@ -376,17 +473,16 @@ void build_arg_integer_list(GKeyFile *config, const gchar *group,
     GString *arg;
     gsize count;
     option_t *options = option_data.options;
-    gint *integer_list_values = g_key_file_get_integer_list(config, group,
-            options[i].name, &count, NULL);
+    const typed_value_t *value = get_option_value(config, group, &options[i]);
+    count = value ? value->count : 0;
     arg = g_string_new(NULL);
     g_string_append_printf(arg, "--%s=", options[i].name);
     for (gsize n = 0; n < count; n++) {
-        g_string_append_printf(arg, "%d", integer_list_values[n]);
+        g_string_append_printf(arg, "%d", value->integers[n]);
         if (n < count-1) {
             g_string_append(arg, ",");
         }
     }
-    g_free(integer_list_values);
     g_ptr_array_add(args, arg->str);
     g_string_free(arg, FALSE);
 }
@@ -404,21 +500,36 @@ void build_arg_double_list(GKeyFile *config, const gchar *group,
     GString *arg;
     gsize count;
     option_t *options = option_data.options;
-    gdouble *double_list_values = g_key_file_get_double_list(config, group,
-            options[i].name, &count, NULL);
+    const typed_value_t *value = get_option_value(config, group, &options[i]);
+    count = value ? value->count : 0;
     arg = g_string_new(NULL);
     g_string_append_printf(arg, "--%s=", options[i].name);
     for (gsize o = 0; o < count; o++) {
-        g_string_append_printf(arg, "%.1f", double_list_values[o]);
+        g_string_append_printf(arg, "%.1f", value->doubles[o]);
         if (o < count-1) {
             g_string_append(arg, ",");
         }
     }
-    g_free(double_list_values);
     g_ptr_array_add(args, arg->str);
     g_string_free(arg, FALSE);
 }
 
+/**
+ * @brief Fetch a string value through the typed value cache
+ *
+ * @param config keyfile to pull the value from
+ * @param group  group to pull the value from
+ * @param key    key name
+ *
+ * @return shared string (do not free), NULL when the key is not set
+ */
+static const gchar * typed_string(GKeyFile *config, const gchar *group,
+        const gchar *key)
+{
+    const typed_value_t *value = get_typed_value(config, group, key, k_string);
+    return value ? value->string : NULL;
+}
+
 /**
  * @brief Generate a filename for an OUTFILE group
  *
@@ -429,16 +540,22 @@ void build_arg_double_list(GKeyFile *config, const gchar *group,
  */
 gchar * build_filename(GKeyFile *config, const gchar *group)
 {
-    gchar* output_basedir = g_key_file_get_string(config, group, "output_basedir", NULL);
-    gchar* name = g_key_file_get_string(config, group, "name", NULL);
-    gchar* type = g_key_file_get_string(config, group, "type", NULL);
-    gchar* year = g_key_file_get_string(config, group, "year", NULL);
-    gint season = g_key_file_get_integer(config, group, "season", NULL);
-    gint episode = g_key_file_get_integer(config, group, "episode", NULL);
-    gchar* specific_name = g_key_file_get_string(config, group, "specific_name", NULL);
-    gchar* format = g_key_file_get_string(config, group, "format", NULL);
-    gchar* extra_type = g_key_file_get_string(config, group, "extra", NULL);
-    gboolean add_year = g_key_file_get_boolean(config, group, "add_year", NULL);
+    const gchar* output_basedir = typed_string(config, group, "output_basedir");
+    const gchar* name = typed_string(config, group, "name");
+    const gchar* type = typed_string(config, group, "type");
+    const gchar* year = typed_string(config, group, "year");
+    const typed_value_t *season_value = get_typed_value(config, group,
+            "season", k_integer);
+    const typed_value_t *episode_value = get_typed_value(config, group,
+            "episode", k_integer);
+    gint season = season_value ? season_value->integer : 0;
+    gint episode = episode_value ? episode_value->integer : 0;
+    const gchar* specific_name = typed_string(config, group, "specific_name");
+    const gchar* format = typed_string(config, group, "format");
+    const gchar* extra_type = typed_string(config, group, "extra");
+    const typed_value_t *add_year_value = get_typed_value(config, group,
+            "add_year", k_boolean);
+    gboolean add_year = add_year_value ? add_year_value->boolean : FALSE;
 
     GString* filename = g_string_new(NULL);
 
@@ -448,7 +565,6 @@ gchar * build_filename(GKeyFile *config, const gchar *group)
             g_string_append(filename, G_DIR_SEPARATOR_S);
         }
     }
-    g_free(output_basedir);
 
     if (year && add_year) {
         // year in the output directory
@@ -481,7 +597,6 @@ gchar * build_filename(GKeyFile *config, const gchar *group)
                 }
                 i++;
             }
-            g_free(extra_type);
         } else {
             g_string_append(filename, name);
         }
@@ -490,8 +605,8 @@ gchar * build_filename(GKeyFile *config, const gchar *group)
         }
     } else if (strcmp(type, "series") == 0) {
         g_string_append(filename, name);
-        gboolean has_season = g_key_file_has_key(config, group, "season", NULL);
-        gboolean has_episode = g_key_file_has_key(config, group, "episode", NULL);
+        gboolean has_season = season_value != NULL;
+        gboolean has_episode = episode_value != NULL;
         if (has_season) {
             g_string_append_printf(filename, " - s%02d", season);
         }
@@ -523,11 +638,6 @@ gchar * build_filename(GKeyFile *config, const gchar *group)
     // check filename length doesn't exceed MAXPATHLEN (sys/param.h)
     // grab basename, check for leading -, leading/trailing spaces
 
-    g_free(name);
-    g_free(type);
-    g_free(year);
-    g_free(specific_name);
-    g_free(format);
     return g_string_free(filename, FALSE);
 }
 
@@ -40,6 +40,7 @@ void build_arg_integer_list(GKeyFile *config, const gchar *group,
         GPtrArray *args, gint i);
 void build_arg_double_list(GKeyFile *config, const gchar *group,
         GPtrArray *args, gint i);
+gchar **build_thread_budget(gchar **argv, gint jobs);
 gchar *build_filename(GKeyFile *config, const gchar *group);
 void append_year(GKeyFile *config, const gchar *group, GString *path);
 
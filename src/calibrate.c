@@ -0,0 +1,552 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>   // for NULL
+#include <stdlib.h>  // for EXIT_SUCCESS, EXIT_FAILURE
+#include <string.h>  // for strcmp
+#include <glib/gstdio.h>
+
+#include "calibrate.h"
+#include "jobs.h"
+#include "keyfile.h"
+#include "options.h"
+#include "util.h"
+#include "validate.h"
+
+extern option_data_t option_data;
+
+/**
+ * @brief An encoder and encoder preset to calibrate
+ */
+typedef struct {
+    const gchar *encoder;
+    /// NULL for encoders that take no preset
+    const gchar *preset;
+} calibrate_target_t;
+
+/// profile loaded by calibration_fps(), NULL until then
+static GKeyFile *profile = NULL;
+static GMutex profile_lock;
+
+static gchar *profile_path(void);
+static gchar *group_name(const gchar *encoder, const gchar *preset);
+static GArray *parse_levels(const gchar *levels);
+static GArray *pick_targets(const gchar *encoders, const gchar *presets);
+static gchar *sample_clip(gint clip_seconds);
+static gboolean measure(const calibrate_target_t *target, const gchar *clip,
+        const gchar *dir, gint jobs, gdouble *fps, gdouble *rate);
+static void remove_dir(const gchar *dir);
+static gint compare_ints(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief Encode a sample clip with every encoder and encoder preset of the
+ *        HandBrake option table, at each concurrency level, and record the
+ *        speeds in the calibration profile (hbr calibrate)
+ *
+ * @param clip         sample clip, NULL to generate one with ffmpeg
+ * @param clip_seconds length of a generated clip
+ * @param levels       comma separated numbers of encodes to run at once
+ * @param encoders     comma separated encoders to calibrate, NULL for all
+ * @param presets      comma separated encoder presets to calibrate, NULL
+ *                     for all. Encoders without presets are calibrated once
+ *
+ * @return exit status, EXIT_FAILURE when nothing could be calibrated
+ */
+gint calibrate_run(const gchar *clip, gint clip_seconds, const gchar *levels,
+        const gchar *encoders, const gchar *presets)
+{
+    GArray *jobs = parse_levels(levels);
+    if (jobs == NULL) {
+        return EXIT_FAILURE;
+    }
+    GArray *targets = pick_targets(encoders, presets);
+    if (targets == NULL) {
+        g_array_free(jobs, TRUE);
+        return EXIT_FAILURE;
+    }
+    gchar *sample = NULL;
+    if (clip != NULL) {
+        if (!g_file_test(clip, G_FILE_TEST_IS_REGULAR)) {
+            hbr_error("Sample clip does not exist", clip, NULL, NULL, NULL);
+        } else {
+            sample = g_strdup(clip);
+        }
+    } else {
+        sample = sample_clip(clip_seconds);
+    }
+    GError *error = NULL;
+    gchar *dir = sample == NULL ? NULL :
+        g_dir_make_tmp("hbr-calibrate-XXXXXX", &error);
+    if (sample != NULL && dir == NULL) {
+        hbr_error("Failed to create a directory for calibration encodes: %s",
+                NULL, NULL, NULL, NULL, error->message);
+        g_error_free(error);
+    }
+    if (dir == NULL) {
+        g_free(sample);
+        g_array_free(targets, TRUE);
+        g_array_free(jobs, TRUE);
+        return EXIT_FAILURE;
+    }
+
+    gchar *path = profile_path();
+    GKeyFile *keyfile = g_key_file_new();
+    g_key_file_load_from_file(keyfile, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+    gchar *basename = g_path_get_basename(sample);
+    g_print("Calibrating %u encoder presets with %s\n", targets->len,
+            basename);
+    g_free(basename);
+    g_print("  %-24s", "encoder preset");
+    for (guint i = 0; i < jobs->len; i++) {
+        gint count = g_array_index(jobs, gint, i);
+        gchar *heading = g_strdup_printf("%d %s", count,
+                count == 1 ? "job" : "jobs");
+        g_print(" %10s", heading);
+        g_free(heading);
+    }
+    g_print(" %8s %8s\n", "scaling", "best -j");
+
+    guint calibrated = 0;
+    guint failed = 0;
+    const gchar *failed_encoder = NULL;
+    gdouble *fps = g_new0(gdouble, jobs->len);
+    gdouble *rates = g_new0(gdouble, jobs->len);
+    for (guint t = 0; t < targets->len; t++) {
+        const calibrate_target_t *target = &g_array_index(targets,
+                calibrate_target_t, t);
+        gchar *name = group_name(target->encoder, target->preset);
+        // an encoder that failed once isn't available on this host
+        if (failed_encoder != NULL &&
+                strcmp(failed_encoder, target->encoder) == 0) {
+            g_print("  %-24s skipped, %s failed\n", name, target->encoder);
+            g_free(name);
+            continue;
+        }
+        g_print("  %-24s", name);
+        fflush(stdout);
+        guint measured = 0;
+        while (measured < jobs->len &&
+                measure(target, sample, dir,
+                    g_array_index(jobs, gint, measured), &fps[measured],
+                    &rates[measured])) {
+            g_print(" %10.2f", fps[measured]);
+            fflush(stdout);
+            measured++;
+        }
+        if (measured < jobs->len) {
+            g_print(" failed\n");
+            failed_encoder = target->encoder;
+            failed++;
+            g_free(name);
+            continue;
+        }
+
+        gint best = 0;
+        gdouble *scaling = g_new(gdouble, jobs->len);
+        for (guint i = 0; i < jobs->len; i++) {
+            scaling[i] = fps[0] > 0 ? fps[i] / fps[0] *
+                g_array_index(jobs, gint, 0) : 0;
+            if (fps[i] > fps[best]) {
+                best = i;
+            }
+        }
+        g_print(" %7.2fx %8d\n", scaling[jobs->len - 1],
+                g_array_index(jobs, gint, best));
+        g_key_file_remove_group(keyfile, name, NULL);
+        g_key_file_set_integer_list(keyfile, name, "jobs",
+                (gint *) jobs->data, jobs->len);
+        g_key_file_set_double_list(keyfile, name, "fps", fps, jobs->len);
+        g_key_file_set_double_list(keyfile, name, "scaling", scaling,
+                jobs->len);
+        g_key_file_set_double_list(keyfile, name,
+                "seconds_per_source_second", rates, jobs->len);
+        g_key_file_set_string(keyfile, name, "handbrake_version",
+                option_data.handbrake_version);
+        g_key_file_set_integer(keyfile, name, "clip_seconds",
+                clip != NULL ? 0 : clip_seconds);
+        g_key_file_set_int64(keyfile, name, "time",
+                g_get_real_time() / G_USEC_PER_SEC);
+        calibrated++;
+        g_free(scaling);
+        g_free(name);
+    }
+
+    if (calibrated > 0) {
+        gchar *profile_dir = g_path_get_dirname(path);
+        g_mkdir_with_parents(profile_dir, 0777);
+        g_free(profile_dir);
+        if (g_key_file_save_to_file(keyfile, path, &error)) {
+            g_print("Wrote calibration profile: %s\n", path);
+        } else {
+            hbr_error("Failed to write calibration profile: %s", path, NULL,
+                    NULL, NULL, error->message);
+            g_error_free(error);
+            calibrated = 0;
+        }
+    }
+    // keep the logs of failed encodes
+    if (failed > 0) {
+        hbr_warn("%u encoder presets failed, their logs are kept", dir, NULL,
+                NULL, NULL, failed);
+    } else {
+        remove_dir(dir);
+    }
+
+    g_free(rates);
+    g_free(fps);
+    free_key_file(keyfile);
+    g_free(path);
+    g_free(dir);
+    g_free(sample);
+    g_array_free(targets, TRUE);
+    g_array_free(jobs, TRUE);
+    return calibrated > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * @brief Look up the combined speed of encodes running at once from the
+ *        calibration profile. Speeds between calibrated levels are
+ *        interpolated, outside them the nearest level is used. Encodes
+ *        without a preset use the medium preset when the encoder has no
+ *        calibration of its own.
+ *
+ * @param encoder video encoder
+ * @param preset  encoder preset, "" or NULL for the default
+ * @param jobs    encodes running at once
+ * @param fps     set to their combined frames per second
+ *
+ * @return FALSE when the encoder and preset weren't calibrated
+ */
+gboolean calibration_fps(const gchar *encoder, const gchar *preset,
+        gdouble jobs, gdouble *fps)
+{
+    g_mutex_lock(&profile_lock);
+    if (profile == NULL) {
+        gchar *path = profile_path();
+        profile = g_key_file_new();
+        g_key_file_load_from_file(profile, path, G_KEY_FILE_NONE, NULL);
+        g_free(path);
+    }
+    g_mutex_unlock(&profile_lock);
+
+    if (encoder == NULL || encoder[0] == '\0') {
+        return FALSE;
+    }
+    gboolean no_preset = preset == NULL || preset[0] == '\0';
+    gchar *name = group_name(encoder, no_preset ? NULL : preset);
+    if (no_preset && !g_key_file_has_group(profile, name)) {
+        g_free(name);
+        name = group_name(encoder, "medium");
+    }
+    gsize level_count = 0;
+    gsize fps_count = 0;
+    gint *levels = g_key_file_get_integer_list(profile, name, "jobs",
+            &level_count, NULL);
+    gdouble *speeds = g_key_file_get_double_list(profile, name, "fps",
+            &fps_count, NULL);
+    g_free(name);
+    gboolean found = levels != NULL && speeds != NULL && level_count > 0 &&
+        level_count == fps_count;
+    if (found) {
+        gsize i = 0;
+        while (i < level_count - 1 && levels[i+1] <= jobs) {
+            i++;
+        }
+        if (jobs <= levels[0] || i == level_count - 1) {
+            *fps = speeds[jobs <= levels[0] ? 0 : i];
+        } else {
+            gdouble part = (jobs - levels[i]) / (levels[i+1] - levels[i]);
+            *fps = speeds[i] + (speeds[i+1] - speeds[i]) * part;
+        }
+    }
+    g_free(speeds);
+    g_free(levels);
+    return found;
+}
+
+/**
+ * @brief Free the calibration profile loaded by calibration_fps()
+ */
+void calibration_cleanup(void)
+{
+    g_mutex_lock(&profile_lock);
+    if (profile != NULL) {
+        free_key_file(profile);
+        profile = NULL;
+    }
+    g_mutex_unlock(&profile_lock);
+}
+
+/**
+ * @brief Calibration profile filename
+ */
+static gchar *profile_path(void)
+{
+    return g_build_filename(g_get_user_data_dir(), "hbr", "calibration",
+            NULL);
+}
+
+/**
+ * @brief Profile group of an encoder and preset, "encoder preset" or just
+ *        "encoder" when preset is NULL
+ */
+static gchar *group_name(const gchar *encoder, const gchar *preset)
+{
+    return preset != NULL ? g_strdup_printf("%s %s", encoder, preset) :
+        g_strdup(encoder);
+}
+
+/**
+ * @brief Parse comma separated concurrency levels into sorted unique gints
+ *
+ * @return NULL (with an error printed) when a level isn't a number from 1
+ *         to JOB_QUEUE_MAX_JOBS
+ */
+static GArray *parse_levels(const gchar *levels)
+{
+    GArray *jobs = g_array_new(FALSE, FALSE, sizeof(gint));
+    gchar **split = g_strsplit(levels, ",", -1);
+    for (gint i = 0; split[i] != NULL; i++) {
+        guint64 level;
+        if (!g_ascii_string_to_unsigned(g_strstrip(split[i]), 10, 1,
+                    JOB_QUEUE_MAX_JOBS, &level, NULL)) {
+            hbr_error("Calibration levels must be from 1 to %d: %s", NULL,
+                    NULL, NULL, NULL, JOB_QUEUE_MAX_JOBS, split[i]);
+            g_strfreev(split);
+            g_array_free(jobs, TRUE);
+            return NULL;
+        }
+        gint value = level;
+        g_array_append_val(jobs, value);
+    }
+    g_strfreev(split);
+    g_array_sort(jobs, compare_ints);
+    for (guint i = 1; i < jobs->len; i++) {
+        if (g_array_index(jobs, gint, i) == g_array_index(jobs, gint, i-1)) {
+            g_array_remove_index(jobs, i--);
+        }
+    }
+    if (jobs->len == 0) {
+        hbr_error("No calibration levels given", NULL, NULL, NULL, NULL);
+        g_array_free(jobs, TRUE);
+        return NULL;
+    }
+    return jobs;
+}
+
+/**
+ * @brief List the encoder and preset pairs to calibrate from the encoders in
+ *        the HandBrake option table
+ *
+ * @return calibrate_target_t array, NULL (with an error printed) when an
+ *         encoder isn't in the table or nothing is left to calibrate
+ */
+static GArray *pick_targets(const gchar *encoders, const gchar *presets)
+{
+    const option_t *option = &option_data.options[option_index("encoder")];
+    const gchar **known = option->valid_values;
+    gchar **wanted_encoders = encoders != NULL ?
+        g_strsplit(encoders, ",", -1) : NULL;
+    gchar **wanted_presets = presets != NULL ?
+        g_strsplit(presets, ",", -1) : NULL;
+    for (gint i = 0; wanted_encoders != NULL && wanted_encoders[i] != NULL;
+            i++) {
+        gboolean found = FALSE;
+        for (gint j = 0; j < option->valid_values_count; j++) {
+            found = found || strcmp(known[j], wanted_encoders[i]) == 0;
+        }
+        if (!found) {
+            hbr_error("Unknown encoder for HandBrake %s: %s", NULL, NULL,
+                    NULL, NULL, option_data.handbrake_version,
+                    wanted_encoders[i]);
+            g_strfreev(wanted_presets);
+            g_strfreev(wanted_encoders);
+            return NULL;
+        }
+    }
+
+    GArray *targets = g_array_new(FALSE, FALSE, sizeof(calibrate_target_t));
+    for (gint i = 0; i < option->valid_values_count; i++) {
+        if (wanted_encoders != NULL &&
+                !g_strv_contains((const gchar * const *) wanted_encoders,
+                    known[i])) {
+            continue;
+        }
+        calibrate_target_t target = { known[i], NULL };
+        const gchar * const *encoder_preset = encoder_presets(known[i]);
+        if (encoder_preset == NULL) {
+            g_array_append_val(targets, target);
+            continue;
+        }
+        for (gint j = 0; encoder_preset[j] != NULL; j++) {
+            if (wanted_presets == NULL ||
+                    g_strv_contains((const gchar * const *) wanted_presets,
+                        encoder_preset[j])) {
+                target.preset = encoder_preset[j];
+                g_array_append_val(targets, target);
+            }
+        }
+    }
+    g_strfreev(wanted_presets);
+    g_strfreev(wanted_encoders);
+    if (targets->len == 0) {
+        hbr_error("No encoder presets left to calibrate", NULL, NULL, NULL,
+                NULL);
+        g_array_free(targets, TRUE);
+        return NULL;
+    }
+    return targets;
+}
+
+/**
+ * @brief Find or generate (with ffmpeg) the standard sample clip, a 720p
+ *        test pattern kept in the user cache directory
+ *
+ * @return clip filename, NULL (with an error printed) when ffmpeg failed
+ */
+static gchar *sample_clip(gint clip_seconds)
+{
+    gchar *name = g_strdup_printf("sample-%ds.mkv", clip_seconds);
+    gchar *path = g_build_filename(g_get_user_cache_dir(), "hbr",
+            "calibrate", name, NULL);
+    g_free(name);
+    if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+        return path;
+    }
+    gchar *dir = g_path_get_dirname(path);
+    g_mkdir_with_parents(dir, 0777);
+    g_free(dir);
+
+    // written under another name so an interrupted run isn't reused
+    gchar *partial = g_strdup_printf("%s.part.mkv", path);
+    gchar *seconds = g_strdup_printf("%d", clip_seconds);
+    const gchar *argv[] = { "ffmpeg", "-nostdin", "-y", "-loglevel",
+        "error", "-f", "lavfi", "-i", "testsrc2=size=1280x720:rate=24", "-t",
+        seconds, "-c:v", "mpeg2video", "-q:v", "2", partial, NULL };
+    gint status = -1;
+    GError *error = NULL;
+    g_print("Generating a %d second sample clip with ffmpeg\n", clip_seconds);
+    if (!g_spawn_sync(NULL, (gchar **) argv, NULL, G_SPAWN_SEARCH_PATH |
+                G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL, NULL, NULL, &status,
+                &error) || status != 0 || g_rename(partial, path) != 0) {
+        hbr_error("Failed to generate a sample clip, give one with --clip:"
+                " %s", path, NULL, NULL, NULL, error != NULL ?
+                error->message : "ffmpeg failed");
+        if (error != NULL) {
+            g_error_free(error);
+        }
+        g_unlink(partial);
+        g_free(path);
+        path = NULL;
+    }
+    g_free(seconds);
+    g_free(partial);
+    return path;
+}
+
+/**
+ * @brief Run identical encodes of the clip at once and measure them
+ *
+ * @param target encoder and preset
+ * @param clip   sample clip
+ * @param dir    directory for outputs and logs
+ * @param jobs   encodes to run at once
+ * @param fps    set to their combined speed from the HandBrakeCLI logs
+ * @param rate   set to the average seconds an encode ran per source second
+ *
+ * @return FALSE when an encode failed
+ */
+static gboolean measure(const calibrate_target_t *target, const gchar *clip,
+        const gchar *dir, gint jobs, gdouble *fps, gdouble *rate)
+{
+    job_queue_t *queue = job_queue_new(jobs);
+    queue->quiet = TRUE;
+    for (gint i = 0; i < jobs; i++) {
+        gchar *name = g_strdup_printf("%s%s%s-%d-%d.mkv", target->encoder,
+                target->preset != NULL ? "-" : "",
+                target->preset != NULL ? target->preset : "", jobs, i + 1);
+        gchar *output = g_build_filename(dir, name, NULL);
+        GPtrArray *args = g_ptr_array_new_with_free_func(g_free);
+        g_ptr_array_add(args, g_strdup("-i"));
+        g_ptr_array_add(args, g_strdup(clip));
+        g_ptr_array_add(args, g_strdup("-o"));
+        g_ptr_array_add(args, g_strdup(output));
+        g_ptr_array_add(args, g_strdup_printf("--encoder=%s",
+                    target->encoder));
+        if (target->preset != NULL) {
+            g_ptr_array_add(args, g_strdup_printf("--encoder-preset=%s",
+                        target->preset));
+        }
+        g_ptr_array_add(args, g_strdup("--audio=none"));
+        job_t *job = job_new(args, output, i, jobs, FALSE);
+        // calibration encodes aren't past encodes of the library
+        perf_key_free(job->perf_key);
+        job->perf_key = NULL;
+        job_queue_push(queue, job);
+        g_ptr_array_free(args, TRUE);
+        g_free(output);
+        g_free(name);
+    }
+    job_queue_run(queue);
+
+    gboolean success = queue->failed == 0 &&
+        queue->records->len == (guint) jobs;
+    *fps = 0;
+    *rate = 0;
+    for (guint i = 0; success && i < queue->records->len; i++) {
+        const job_record_t *record = &g_array_index(queue->records,
+                job_record_t, i);
+        *fps += record->avg_fps;
+        if (record->source_seconds > 0) {
+            *rate += record->wall_seconds / record->source_seconds / jobs;
+        }
+    }
+    job_queue_free(queue);
+    return success;
+}
+
+/**
+ * @brief Remove a directory and the files in it
+ */
+static void remove_dir(const gchar *dir)
+{
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    const gchar *name;
+    while (handle != NULL && (name = g_dir_read_name(handle)) != NULL) {
+        gchar *path = g_build_filename(dir, name, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    if (handle != NULL) {
+        g_dir_close(handle);
+    }
+    g_rmdir(dir);
+}
+
+/**
+ * @brief GCompareFunc for sorting gints
+ */
+static gint compare_ints(gconstpointer a, gconstpointer b)
+{
+    gint int_a = *(const gint *) a;
+    gint int_b = *(const gint *) b;
+    return (int_a > int_b) - (int_a < int_b);
+}
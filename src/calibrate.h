@@ -0,0 +1,55 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _calibrate_h
+#define _calibrate_h
+
+#include <glib.h>
+
+/*
+ * hbr calibrate measures how fast this host encodes a sample clip with each
+ * encoder and encoder preset, running 1 or more identical encodes at once.
+ * The profile is a keyfile in the user data directory, calibration, with a
+ * group per encoder and preset ("x264 fast", or "theora" for encoders that
+ * take no preset):
+ *
+ *   jobs=1;2;4               encodes run at once
+ *   fps=250.0;480.0;700.0    their combined speed at each of those
+ *   scaling=1.00;1.92;2.80   combined speed over the speed of one encode
+ *   seconds_per_source_second=0.004;0.004;0.006   run time of one encode
+ *   handbrake_version=1.3.0
+ *   clip_seconds=10
+ *   time=1700000000
+ *
+ * Calibrating again replaces only the groups it measured.
+ */
+
+/// concurrency levels measured by default
+#define CALIBRATE_LEVELS "1,2,4"
+/// length of the generated sample clip in seconds
+#define CALIBRATE_CLIP_SECONDS 10
+
+gint calibrate_run(const gchar *clip, gint clip_seconds, const gchar *levels,
+        const gchar *encoders, const gchar *presets);
+gboolean calibration_fps(const gchar *encoder, const gchar *preset,
+        gdouble jobs, gdouble *fps);
+void calibration_cleanup(void);
+
+#endif
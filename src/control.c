@@ -0,0 +1,689 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <errno.h>       // for errno, EAGAIN, EINTR, ECONNREFUSED
+#include <fcntl.h>       // for fcntl, O_NONBLOCK
+#include <stdio.h>       // for NULL
+#include <stdlib.h>      // for EXIT_FAILURE
+#include <string.h>      // for strcmp, strlen
+#include <sys/socket.h>  // for socket, bind, accept, send
+#include <sys/time.h>    // for struct timeval
+#include <sys/un.h>      // for struct sockaddr_un
+#include <unistd.h>      // for close, getpid, read
+#include <glib/gstdio.h>
+
+#include "control.h"
+#include "util.h"
+
+/**
+ * @brief An hbr ctl connection waiting to send its whole request line
+ */
+typedef struct {
+    int fd;
+    GString *request;
+} control_client_t;
+
+/// listening socket, -1 when closed
+static int listen_fd = -1;
+/// socket filename, removed by control_close()
+static gchar *socket_path = NULL;
+/// connected clients (control_client_t)
+static GPtrArray *clients = NULL;
+/// clients passed to poll() by the last control_add_fds()
+static guint polled_clients = 0;
+
+static gchar *socket_dir(void);
+static gboolean socket_address(struct sockaddr_un *address,
+        const gchar *path);
+static void client_free(gpointer data);
+static gboolean client_read(control_client_t *client);
+static void client_respond(control_client_t *client, const gchar *response);
+static gchar *run_command(job_queue_t *queue, const gchar *request);
+static gboolean parse_id(const gchar *word, guint *value);
+static gchar *status_text(const job_queue_t *queue);
+static gint compare_job_ids(gconstpointer a, gconstpointer b);
+static gdouble job_remaining(const job_t *job, gint64 now);
+static gchar *format_duration(gdouble seconds);
+static int connect_socket(const gchar *path);
+static int find_socket(void);
+
+/**
+ * @brief Listen for hbr ctl commands on a Unix domain socket named by the
+ *        process id in $XDG_RUNTIME_DIR/hbr, answered by job_queue_run()
+ *
+ * @return FALSE when the socket could not be created (hbr runs without it)
+ */
+gboolean control_open(void)
+{
+    gchar *dir = socket_dir();
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        hbr_warn("Failed to create control socket directory: %s", dir, NULL,
+                NULL, NULL, g_strerror(errno));
+        g_free(dir);
+        return FALSE;
+    }
+    gchar *name = g_strdup_printf("%d.sock", (gint) getpid());
+    gchar *path = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(dir);
+
+    struct sockaddr_un address;
+    if (!socket_address(&address, path)) {
+        g_free(path);
+        return FALSE;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    // a socket left by an earlier process with this pid
+    g_unlink(path);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &address,
+                sizeof(address)) != 0 || listen(fd, 4) != 0) {
+        hbr_warn("Failed to create control socket: %s", path, NULL, NULL,
+                NULL, g_strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        g_free(path);
+        return FALSE;
+    }
+    listen_fd = fd;
+    socket_path = path;
+    clients = g_ptr_array_new_with_free_func(client_free);
+    return TRUE;
+}
+
+/**
+ * @brief Stop listening, dropping unanswered clients, and remove the socket
+ */
+void control_close(void)
+{
+    if (listen_fd < 0) {
+        return;
+    }
+    close(listen_fd);
+    listen_fd = -1;
+    g_unlink(socket_path);
+    g_free(socket_path);
+    socket_path = NULL;
+    g_ptr_array_free(clients, TRUE);
+    clients = NULL;
+    polled_clients = 0;
+}
+
+/**
+ * @brief Append the listening socket and connected clients to a poll() set,
+ *        in the order control_handle() expects them. Nothing is added when
+ *        control_open() wasn't called.
+ *
+ * @param fds array of struct pollfd
+ */
+void control_add_fds(GArray *fds)
+{
+    if (listen_fd < 0) {
+        return;
+    }
+    struct pollfd fd = { listen_fd, POLLIN, 0 };
+    g_array_append_val(fds, fd);
+    for (guint i = 0; i < clients->len; i++) {
+        fd.fd = ((control_client_t *) clients->pdata[i])->fd;
+        g_array_append_val(fds, fd);
+    }
+    polled_clients = clients->len;
+}
+
+/**
+ * @brief Accept clients and answer the requests they finished sending
+ *
+ * @param queue queue commands apply to
+ * @param fds   the entries control_add_fds() appended, after poll()
+ */
+void control_handle(job_queue_t *queue, const struct pollfd *fds)
+{
+    if (listen_fd < 0) {
+        return;
+    }
+    // backwards so answered clients can be removed
+    for (guint i = polled_clients; i > 0; i--) {
+        control_client_t *client = clients->pdata[i-1];
+        if (fds[i].revents == 0 || !client_read(client)) {
+            continue;
+        }
+        // empty when hbr ctl only connected to find running batches
+        if (client->request->len > CONTROL_MAX_REQUEST) {
+            client_respond(client, "error: request too long\n");
+        } else if (client->request->len > 0) {
+            gchar *response = run_command(queue, client->request->str);
+            client_respond(client, response);
+            g_free(response);
+        }
+        g_ptr_array_remove_index(clients, i-1);
+    }
+    polled_clients = 0;
+    if (fds[0].revents == 0) {
+        return;
+    }
+    while (TRUE) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0 && errno == EINTR) {
+            continue;
+        }
+        if (fd < 0) {
+            break;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        control_client_t *client = g_malloc(sizeof(control_client_t));
+        client->fd = fd;
+        client->request = g_string_new(NULL);
+        g_ptr_array_add(clients, client);
+    }
+}
+
+/**
+ * @brief Send a command to a running hbr and print its answer (hbr ctl)
+ *
+ * @param pid   process id of the hbr to control, NULL when only one runs
+ * @param words command and its arguments
+ *
+ * @return exit status, EXIT_FAILURE when the command was refused
+ */
+gint control_client(const gchar *pid, gchar **words)
+{
+    if (words == NULL || words[0] == NULL) {
+        hbr_error("No command given. Expected status, pause, resume, jobs N,"
+                " cancel ID, or move ID POSITION", NULL, NULL, NULL, NULL);
+        return EXIT_FAILURE;
+    }
+    int fd;
+    if (pid != NULL) {
+        gchar *dir = socket_dir();
+        gchar *name = g_strdup_printf("%s.sock", pid);
+        gchar *path = g_build_filename(dir, name, NULL);
+        fd = connect_socket(path);
+        if (fd < 0) {
+            hbr_error("No hbr batch is running as pid %s", path, NULL, NULL,
+                    NULL, pid);
+        }
+        g_free(path);
+        g_free(name);
+        g_free(dir);
+    } else {
+        fd = find_socket();
+    }
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+
+    gchar *joined = g_strjoinv(" ", words);
+    gchar *request = g_strdup_printf("%s\n", joined);
+    gsize sent = 0;
+    gsize length = strlen(request);
+    while (sent < length) {
+        ssize_t count = send(fd, request + sent, length - sent,
+                MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            break;
+        }
+        sent += count;
+    }
+    shutdown(fd, SHUT_WR);
+    g_free(request);
+    g_free(joined);
+
+    GString *response = g_string_new(NULL);
+    gchar buffer[4096];
+    while (TRUE) {
+        ssize_t count = read(fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        g_string_append_len(response, buffer, count);
+    }
+    close(fd);
+
+    gint status = EXIT_SUCCESS;
+    if (response->len == 0) {
+        hbr_error("hbr closed the control connection without answering",
+                NULL, NULL, NULL, NULL);
+        status = EXIT_FAILURE;
+    } else if (g_str_has_prefix(response->str, "error: ")) {
+        hbr_error("%s", NULL, NULL, NULL, NULL,
+                g_strchomp(response->str + strlen("error: ")));
+        status = EXIT_FAILURE;
+    } else {
+        g_print("%s", response->str);
+    }
+    g_string_free(response, TRUE);
+    return status;
+}
+
+/**
+ * @brief Directory holding the control sockets of running batches
+ *
+ * @return newly allocated path
+ */
+static gchar *socket_dir(void)
+{
+    return g_build_filename(g_get_user_runtime_dir(), "hbr", NULL);
+}
+
+/**
+ * @brief Fill a socket address, checking the path fits
+ *
+ * @return FALSE when the path is too long for a Unix domain socket
+ */
+static gboolean socket_address(struct sockaddr_un *address,
+        const gchar *path)
+{
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address->sun_path)) {
+        hbr_warn("Control socket path is too long", path, NULL, NULL, NULL);
+        return FALSE;
+    }
+    strcpy(address->sun_path, path);
+    return TRUE;
+}
+
+/**
+ * @brief GDestroyNotify closing a control_client_t
+ */
+static void client_free(gpointer data)
+{
+    control_client_t *client = data;
+    close(client->fd);
+    g_string_free(client->request, TRUE);
+    g_free(client);
+}
+
+/**
+ * @brief Read what a client has sent
+ *
+ * @return TRUE once the request line is complete (or too long to wait for)
+ */
+static gboolean client_read(control_client_t *client)
+{
+    gchar buffer[CONTROL_MAX_REQUEST];
+    while (TRUE) {
+        ssize_t count = read(client->fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && errno == EAGAIN) {
+            return FALSE;
+        }
+        if (count <= 0) {
+            // closed or failed, answer what was sent
+            return TRUE;
+        }
+        g_string_append_len(client->request, buffer, count);
+        gchar *newline = memchr(client->request->str, '\n',
+                client->request->len);
+        if (newline != NULL) {
+            g_string_truncate(client->request,
+                    newline - client->request->str);
+            return TRUE;
+        }
+        if (client->request->len > CONTROL_MAX_REQUEST) {
+            return TRUE;
+        }
+    }
+}
+
+/**
+ * @brief Send a response to a client. A client that stops reading is given
+ *        up on after a second so encodes aren't left waiting.
+ */
+static void client_respond(control_client_t *client, const gchar *response)
+{
+    struct timeval timeout = { 1, 0 };
+    fcntl(client->fd, F_SETFL, 0);
+    setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+            sizeof(timeout));
+    gsize sent = 0;
+    gsize length = strlen(response);
+    while (sent < length) {
+        ssize_t count = send(client->fd, response + sent, length - sent,
+                MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            return;
+        }
+        sent += count;
+    }
+}
+
+/**
+ * @brief Run one hbr ctl command against the queue
+ *
+ * @param queue   queue being run
+ * @param request command line sent by the client
+ *
+ * @return response for the client, "error: " followed by the reason when
+ *         the command was refused
+ */
+static gchar *run_command(job_queue_t *queue, const gchar *request)
+{
+    // split on runs of white space
+    gchar **words = g_strsplit_set(request, " \t\r", -1);
+    gint count = 0;
+    for (gint i = 0; words[i] != NULL; i++) {
+        if (words[i][0] != '\0') {
+            words[count++] = words[i];
+        } else {
+            g_free(words[i]);
+        }
+    }
+    words[count] = NULL;
+
+    gchar *response;
+    guint id, number;
+    if (count == 1 && strcmp(words[0], "status") == 0) {
+        response = status_text(queue);
+    } else if (count == 1 && strcmp(words[0], "pause") == 0) {
+        queue->paused = TRUE;
+        response = g_strdup("paused, running encodes continue\n");
+    } else if (count == 1 && strcmp(words[0], "resume") == 0) {
+        queue->paused = FALSE;
+        response = g_strdup("resumed\n");
+    } else if (count == 2 && strcmp(words[0], "jobs") == 0) {
+        if (parse_id(words[1], &number) && number <= JOB_QUEUE_MAX_JOBS) {
+            job_queue_set_max_jobs(queue, number);
+            response = g_strdup_printf("running at most %d jobs at once\n",
+                    queue->max_jobs);
+        } else {
+            response = g_strdup_printf("error: jobs must be from 1 to %d: "
+                    "%s\n", JOB_QUEUE_MAX_JOBS, words[1]);
+        }
+    } else if (count == 2 && strcmp(words[0], "cancel") == 0) {
+        if (parse_id(words[1], &id) && job_queue_cancel(queue, id)) {
+            response = g_strdup_printf("cancelled job %u\n", id);
+        } else {
+            response = g_strdup_printf("error: no queued or running job %s\n",
+                    words[1]);
+        }
+    } else if (count == 3 && strcmp(words[0], "move") == 0) {
+        if (!parse_id(words[2], &number)) {
+            response = g_strdup_printf("error: position must be at least 1:"
+                    " %s\n", words[2]);
+        } else if (parse_id(words[1], &id) &&
+                job_queue_move(queue, id, number)) {
+            response = g_strdup_printf("moved job %u to position %u\n", id,
+                    MIN(number, g_queue_get_length(queue->pending)));
+        } else {
+            response = g_strdup_printf("error: no queued job %s\n",
+                    words[1]);
+        }
+    } else {
+        response = g_strdup_printf("error: unknown command '%s'. Expected"
+                " status, pause, resume, jobs N, cancel ID, or move ID"
+                " POSITION\n", request);
+    }
+    g_strfreev(words);
+    return response;
+}
+
+/**
+ * @brief Parse a job id, job count, or queue position
+ *
+ * @return FALSE unless word is a number of at least 1
+ */
+static gboolean parse_id(const gchar *word, guint *value)
+{
+    guint64 number;
+    if (!g_ascii_string_to_unsigned(word, 10, 1, G_MAXINT, &number, NULL)) {
+        return FALSE;
+    }
+    *value = number;
+    return TRUE;
+}
+
+/**
+ * @brief Describe the queue for hbr ctl status: job counts, an estimate of
+ *        when the batch finishes, running jobs and their progress, and the
+ *        first CONTROL_STATUS_PENDING pending jobs in the order they start
+ */
+static gchar *status_text(const job_queue_t *queue)
+{
+    gint64 now = g_get_monotonic_time();
+    GString *out = g_string_new(NULL);
+    guint running = g_hash_table_size(queue->running);
+    guint pending = g_queue_get_length(queue->pending);
+    g_string_append_printf(out, "hbr %d: %s, %u of %d jobs running\n",
+            (gint) getpid(), queue->paused ? "paused" : "running", running,
+            queue->max_jobs);
+    g_string_append_printf(out, "%u queued, %lu done, %lu failed, %lu"
+            " cancelled\n", pending, queue->completed, queue->failed,
+            queue->cancelled);
+
+    // running jobs in id order, with the longest remaining
+    GPtrArray *jobs = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, queue->running);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(jobs, value);
+    }
+    g_ptr_array_sort(jobs, compare_job_ids);
+    gdouble running_left = 0;
+    gdouble longest_left = 0;
+    gdouble running_estimate = 0;
+    gboolean known = TRUE;
+    for (guint i = 0; i < jobs->len; i++) {
+        const job_t *job = jobs->pdata[i];
+        gdouble left = job_remaining(job, now);
+        if (left < 0) {
+            known = FALSE;
+            continue;
+        }
+        running_left += left;
+        longest_left = MAX(longest_left, left);
+        running_estimate += (now - job->started) / 1e6 + left;
+    }
+
+    // pending jobs are assumed to take as long as successful ones did
+    gdouble job_seconds = -1;
+    guint successes = 0;
+    gdouble success_seconds = 0;
+    for (guint i = 0; i < queue->records->len; i++) {
+        const job_record_t *record = &g_array_index(queue->records,
+                job_record_t, i);
+        if (record->success) {
+            success_seconds += record->wall_seconds;
+            successes++;
+        }
+    }
+    if (successes > 0) {
+        job_seconds = success_seconds / successes;
+    } else if (known && jobs->len > 0) {
+        job_seconds = running_estimate / jobs->len;
+    }
+    gchar *eta = NULL;
+    if (known && (pending == 0 || job_seconds >= 0)) {
+        gdouble left = (running_left + pending * MAX(job_seconds, 0)) /
+            queue->max_jobs;
+        eta = format_duration(MAX(left, longest_left));
+    } else {
+        eta = format_duration(-1);
+    }
+    g_string_append_printf(out, "eta %s\n", eta);
+    g_free(eta);
+
+    if (jobs->len > 0) {
+        g_string_append_printf(out, "running:\n  %4s %4s %8s %8s %9s  %s\n",
+                "id", "slot", "progress", "fps", "eta", "output");
+    }
+    for (guint i = 0; i < jobs->len; i++) {
+        const job_t *job = jobs->pdata[i];
+        gchar *basename = g_path_get_basename(job->filename);
+        gchar *left = format_duration(job_remaining(job, now));
+        g_string_append_printf(out, "  %4u %4d %7.1f%% %8.2f %9s  %s%s\n",
+                job->id, job->slot + 1, job->progress * 100, job->fps, left,
+                basename, job->cancelled ? " (cancelling)" : "");
+        g_free(left);
+        g_free(basename);
+    }
+    g_ptr_array_free(jobs, TRUE);
+
+    if (g_hash_table_size(queue->joining) > 0) {
+        g_string_append(out, "joining:\n");
+    }
+    g_hash_table_iter_init(&iter, queue->joining);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        gchar *basename = g_path_get_basename(((job_t *)value)->filename);
+        g_string_append_printf(out, "  %s\n", basename);
+        g_free(basename);
+    }
+
+    if (pending > 0) {
+        g_string_append_printf(out, "queued:\n  %4s  %s\n", "id", "output");
+    }
+    guint listed = 0;
+    for (GList *link = queue->pending->head;
+            link != NULL && listed < CONTROL_STATUS_PENDING;
+            link = link->next, listed++) {
+        const job_t *job = link->data;
+        gchar *basename = g_path_get_basename(job->filename);
+        g_string_append_printf(out, "  %4u  %s\n", job->id, basename);
+        g_free(basename);
+    }
+    if (pending > listed) {
+        g_string_append_printf(out, "  ... and %u more\n", pending - listed);
+    }
+    return g_string_free(out, FALSE);
+}
+
+/**
+ * @brief GCompareFunc ordering job_t pointers by id
+ */
+static gint compare_job_ids(gconstpointer a, gconstpointer b)
+{
+    const job_t *job_a = *(job_t * const *) a;
+    const job_t *job_b = *(job_t * const *) b;
+    return (job_a->id > job_b->id) - (job_a->id < job_b->id);
+}
+
+/**
+ * @brief Estimate the seconds left in a running job from its progress so far
+ *
+ * @return seconds, -1 before HandBrakeCLI reports any progress
+ */
+static gdouble job_remaining(const job_t *job, gint64 now)
+{
+    if (job->progress <= 0) {
+        return -1;
+    }
+    gdouble elapsed = (now - job->started) / 1e6;
+    return elapsed * (1 - job->progress) / job->progress;
+}
+
+/**
+ * @brief Format seconds as H:MM:SS, "-" when unknown (negative)
+ */
+static gchar *format_duration(gdouble seconds)
+{
+    if (seconds < 0) {
+        return g_strdup("-");
+    }
+    gint64 total = (gint64) (seconds + 0.5);
+    return g_strdup_printf("%" G_GINT64_FORMAT ":%02d:%02d", total / 3600,
+            (gint) (total / 60 % 60), (gint) (total % 60));
+}
+
+/**
+ * @brief Connect to a control socket
+ *
+ * @return socket, -1 when nothing listens on path
+ */
+static int connect_socket(const gchar *path)
+{
+    struct sockaddr_un address;
+    if (!socket_address(&address, path)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        if (errno == ECONNREFUSED) {
+            // left behind by an hbr that was killed
+            g_unlink(path);
+        }
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Connect to the only running batch
+ *
+ * @return socket, -1 (with an error printed) when no batch or several are
+ *         running
+ */
+static int find_socket(void)
+{
+    gchar *dir = socket_dir();
+    GDir *handle = g_dir_open(dir, 0, NULL);
+    GString *pids = g_string_new(NULL);
+    int found = -1;
+    guint count = 0;
+    const gchar *name;
+    while (handle != NULL && (name = g_dir_read_name(handle)) != NULL) {
+        if (!g_str_has_suffix(name, ".sock")) {
+            continue;
+        }
+        gchar *path = g_build_filename(dir, name, NULL);
+        int fd = connect_socket(path);
+        g_free(path);
+        if (fd < 0) {
+            continue;
+        }
+        g_string_append_printf(pids, "%s%.*s", count > 0 ? ", " : "",
+                (gint) (strlen(name) - strlen(".sock")), name);
+        count++;
+        if (found >= 0) {
+            close(found);
+        }
+        found = fd;
+    }
+    if (handle != NULL) {
+        g_dir_close(handle);
+    }
+    if (count == 0) {
+        hbr_error("No running hbr batch found", dir, NULL, NULL, NULL);
+    } else if (count > 1) {
+        hbr_error("Several hbr batches are running (%s), pick one with --pid",
+                dir, NULL, NULL, NULL, pids->str);
+        close(found);
+        found = -1;
+    }
+    g_string_free(pids, TRUE);
+    g_free(dir);
+    return found;
+}
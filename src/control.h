@@ -0,0 +1,40 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef _control_h
+#define _control_h
+
+#include <glib.h>
+#include <poll.h>
+
+#include "jobs.h"
+
+/// pending jobs listed by hbr ctl status
+#define CONTROL_STATUS_PENDING 20
+/// longest request line accepted from hbr ctl
+#define CONTROL_MAX_REQUEST 256
+
+gboolean control_open(void);
+void control_close(void);
+void control_add_fds(GArray *fds);
+void control_handle(job_queue_t *queue, const struct pollfd *fds);
+gint control_client(const gchar *pid, gchar **words);
+
+#endif
@@ -0,0 +1,398 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+#include <string.h>  // for strcmp
+
+#include "diff_config.h"
+#include "build_args.h"
+#include "keyfile.h"
+#include "perf_store.h"
+#include "util.h"
+
+/**
+ * @brief Argument differences for one outfile
+ */
+typedef struct {
+    gchar *group;
+    /// arguments only produced with the old config
+    GPtrArray *removed;
+    /// arguments only produced with the new config
+    GPtrArray *added;
+    /// key options with the new config, for the time estimate
+    perf_key_t *key;
+} outfile_diff_t;
+
+/**
+ * @brief One keyfile and its outfile differences. Each is handled entirely
+ *        by one thread, nothing here is shared.
+ */
+typedef struct {
+    const gchar *infile;
+    GKeyFile *keyfile;
+    /// keyfile CONFIG merged with each global config
+    GKeyFile *merged_old;
+    GKeyFile *merged_new;
+    gchar **outfiles;
+    /// number of outfiles compared
+    gsize checked;
+    /// outfile_diff_t for outfiles with different arguments
+    GPtrArray *changed;
+} file_diff_t;
+
+/**
+ * @brief How many outfiles gained or lost one argument
+ */
+typedef struct {
+    gchar sign;
+    const gchar *arg;
+    guint count;
+} arg_count_t;
+
+static void diff_file(gpointer data, gpointer user_data);
+static GPtrArray * effective_args(GKeyFile *keyfile, const gchar *group,
+        GKeyFile *merged_config);
+static GPtrArray * arg_difference(GPtrArray *a, GPtrArray *b);
+static void count_args(GHashTable *counts, GPtrArray *args);
+static void add_arg_counts(GPtrArray *list, GHashTable *counts, gchar sign);
+static gint compare_arg_counts(gconstpointer a, gconstpointer b);
+static void outfile_diff_free(gpointer data);
+static void file_diff_free(file_diff_t *file);
+
+/**
+ * @brief Report how changing the global config changes the HandBrakeCLI
+ *        arguments of every outfile. Arguments are built the same way an
+ *        encode would build them, so key overrides and conflict removal
+ *        are taken into account. Keyfiles are validated against the new
+ *        config and compared in parallel.
+ *
+ * @param old_config     current global config
+ * @param new_config     proposed global config
+ * @param infiles        keyfiles to check
+ * @param episodes       episode ranges to check (-e), NULL for all outfiles
+ * @param encode_minutes assumed length of an encode for the estimate when
+ *                       the performance store has nothing like it
+ *
+ * @return TRUE when every keyfile could be compared
+ */
+gboolean diff_config(GKeyFile *old_config, GKeyFile *new_config,
+        gchar **infiles, const GArray *episodes, gint encode_minutes)
+{
+    gboolean complete = TRUE;
+    GPtrArray *files = g_ptr_array_new();
+    GThreadPool *pool = g_thread_pool_new(diff_file, NULL,
+            g_get_num_processors(), FALSE, NULL);
+
+    // validation stays on this thread, comparing runs in the pool
+    message_level_warn();
+    for (gint i = 0; infiles[i] != NULL; i++) {
+        gchar **outfiles = NULL;
+        GKeyFile *keyfile = parse_validate_key_file(infiles[i], new_config,
+                episodes, &outfiles);
+        if (keyfile == NULL) {
+            hbr_error("Could not complete input file", infiles[i], NULL, NULL,
+                    NULL);
+            complete = FALSE;
+            continue;
+        }
+        file_diff_t *file = g_malloc0(sizeof(file_diff_t));
+        file->infile = infiles[i];
+        file->keyfile = keyfile;
+        file->outfiles = outfiles;
+        file->changed = g_ptr_array_new_with_free_func(outfile_diff_free);
+        file->merged_old = merge_key_group(keyfile, "CONFIG", old_config,
+                "CONFIG", "MERGED_CONFIG");
+        file->merged_new = merge_key_group(keyfile, "CONFIG", new_config,
+                "CONFIG", "MERGED_CONFIG");
+        if (file->merged_old == NULL || file->merged_new == NULL) {
+            hbr_error("Failed to merge global config and local config",
+                    infiles[i], NULL, NULL, NULL);
+            file_diff_free(file);
+            complete = FALSE;
+            continue;
+        }
+        g_ptr_array_add(files, file);
+        g_thread_pool_push(pool, file, NULL);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+    message_level_info();
+
+    // totals
+    gsize checked = 0;
+    gsize changed = 0;
+    gsize predicted = 0;
+    gdouble seconds = 0;
+    GHashTable *removed_counts = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *added_counts = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < files->len; i++) {
+        file_diff_t *file = files->pdata[i];
+        checked += file->checked;
+        changed += file->changed->len;
+        for (guint j = 0; j < file->changed->len; j++) {
+            outfile_diff_t *diff = file->changed->pdata[j];
+            count_args(removed_counts, diff->removed);
+            count_args(added_counts, diff->added);
+            perf_prediction_t prediction;
+            if (perf_predict(diff->key, 0, &prediction)) {
+                seconds += prediction.seconds;
+                predicted++;
+            } else {
+                seconds += encode_minutes * 60;
+            }
+        }
+    }
+    g_print("Checked %lu outfiles in %u keyfiles\n", checked, files->len);
+    if (predicted == 0) {
+        g_print("Changed %lu outfiles (estimated %.1f encode hours at %d"
+                " minutes each)\n", changed, seconds / 3600, encode_minutes);
+    } else if (predicted == changed) {
+        g_print("Changed %lu outfiles (estimated %.1f encode hours from past"
+                " encodes)\n", changed, seconds / 3600);
+    } else {
+        g_print("Changed %lu outfiles (estimated %.1f encode hours, %lu from"
+                " past encodes and %lu at %d minutes each)\n", changed,
+                seconds / 3600, predicted, changed - predicted,
+                encode_minutes);
+    }
+
+    if (changed > 0) {
+        GPtrArray *counts = g_ptr_array_new_with_free_func(g_free);
+        add_arg_counts(counts, removed_counts, '-');
+        add_arg_counts(counts, added_counts, '+');
+        g_ptr_array_sort(counts, compare_arg_counts);
+        g_print("\nArgument changes:\n");
+        for (guint i = 0; i < counts->len; i++) {
+            arg_count_t *c = counts->pdata[i];
+            g_print("%7u %c %s\n", c->count, c->sign, c->arg);
+        }
+        g_ptr_array_free(counts, TRUE);
+
+        g_print("\nChanged outfiles:\n");
+        for (guint i = 0; i < files->len; i++) {
+            file_diff_t *file = files->pdata[i];
+            for (guint j = 0; j < file->changed->len; j++) {
+                outfile_diff_t *diff = file->changed->pdata[j];
+                g_print("%s [%s]\n", file->infile, diff->group);
+                for (guint k = 0; k < diff->removed->len; k++) {
+                    g_print("    - %s\n", (gchar *)diff->removed->pdata[k]);
+                }
+                for (guint k = 0; k < diff->added->len; k++) {
+                    g_print("    + %s\n", (gchar *)diff->added->pdata[k]);
+                }
+            }
+        }
+    }
+
+    g_hash_table_destroy(removed_counts);
+    g_hash_table_destroy(added_counts);
+    for (guint i = 0; i < files->len; i++) {
+        file_diff_free(files->pdata[i]);
+    }
+    g_ptr_array_free(files, TRUE);
+    return complete;
+}
+
+/**
+ * @brief Thread pool function comparing every selected outfile of one
+ *        keyfile
+ *
+ * @param data      file_diff_t
+ * @param user_data unused
+ */
+static void diff_file(gpointer data,
+        __attribute__((unused)) gpointer user_data)
+{
+    file_diff_t *file = data;
+    for (gsize i = 0; file->outfiles[i] != NULL; i++) {
+        const gchar *group = file->outfiles[i];
+        GPtrArray *old_args = effective_args(file->keyfile, group,
+                file->merged_old);
+        GPtrArray *new_args = effective_args(file->keyfile, group,
+                file->merged_new);
+        if (old_args == NULL || new_args == NULL) {
+            if (old_args != NULL) {
+                g_ptr_array_free(old_args, TRUE);
+            }
+            if (new_args != NULL) {
+                g_ptr_array_free(new_args, TRUE);
+            }
+            continue;
+        }
+        file->checked++;
+        outfile_diff_t *diff = g_malloc(sizeof(outfile_diff_t));
+        diff->group = g_strdup(group);
+        diff->removed = arg_difference(old_args, new_args);
+        diff->added = arg_difference(new_args, old_args);
+        diff->key = perf_key_new(new_args);
+        if (diff->removed->len > 0 || diff->added->len > 0) {
+            g_ptr_array_add(file->changed, diff);
+        } else {
+            outfile_diff_free(diff);
+        }
+        g_ptr_array_free(old_args, TRUE);
+        g_ptr_array_free(new_args, TRUE);
+    }
+}
+
+/**
+ * @brief Build an outfile's HandBrakeCLI arguments against a merged config.
+ *        -i and -o are joined with their value so a changed path is one
+ *        difference.
+ *
+ * @return arguments, NULL when the outfile could not be merged
+ */
+static GPtrArray * effective_args(GKeyFile *keyfile, const gchar *group,
+        GKeyFile *merged_config)
+{
+    GKeyFile *outfile = merge_key_group(keyfile, group, merged_config,
+            "MERGED_CONFIG", "CURRENT_OUTFILE");
+    if (outfile == NULL) {
+        return NULL;
+    }
+    GPtrArray *args = build_args(outfile, "CURRENT_OUTFILE", FALSE);
+    GPtrArray *joined = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        const gchar *arg = args->pdata[i];
+        if ((strcmp(arg, "-i") == 0 || strcmp(arg, "-o") == 0) &&
+                i + 1 < args->len && args->pdata[i+1] != NULL) {
+            g_ptr_array_add(joined, g_strdup_printf("%s %s", arg,
+                        (gchar *)args->pdata[i+1]));
+            i++;
+        } else {
+            g_ptr_array_add(joined, g_strdup(arg));
+        }
+    }
+    g_ptr_array_free(args, TRUE);
+    free_key_file(outfile);
+    return joined;
+}
+
+/**
+ * @brief Arguments of a that are not in b, counting repeats
+ *
+ * @return new array of copied arguments, in the order of a
+ */
+static GPtrArray * arg_difference(GPtrArray *a, GPtrArray *b)
+{
+    GHashTable *counts = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < b->len; i++) {
+        guint count = GPOINTER_TO_UINT(g_hash_table_lookup(counts,
+                    b->pdata[i]));
+        g_hash_table_insert(counts, b->pdata[i], GUINT_TO_POINTER(count + 1));
+    }
+    GPtrArray *difference = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < a->len; i++) {
+        guint count = GPOINTER_TO_UINT(g_hash_table_lookup(counts,
+                    a->pdata[i]));
+        if (count > 0) {
+            g_hash_table_insert(counts, a->pdata[i],
+                    GUINT_TO_POINTER(count - 1));
+        } else {
+            g_ptr_array_add(difference, g_strdup(a->pdata[i]));
+        }
+    }
+    g_hash_table_destroy(counts);
+    return difference;
+}
+
+/**
+ * @brief Count each argument in args for the summary. Input and output
+ *        paths are counted together since every outfile has its own.
+ *
+ * @param counts argument to count, arguments are not copied
+ * @param args   arguments to count
+ */
+static void count_args(GHashTable *counts, GPtrArray *args)
+{
+    for (guint i = 0; i < args->len; i++) {
+        const gchar *arg = args->pdata[i];
+        if (g_str_has_prefix(arg, "-i ")) {
+            arg = "-i (input path)";
+        } else if (g_str_has_prefix(arg, "-o ")) {
+            arg = "-o (output filename)";
+        }
+        guint count = GPOINTER_TO_UINT(g_hash_table_lookup(counts, arg));
+        g_hash_table_insert(counts, (gpointer)arg, GUINT_TO_POINTER(count + 1));
+    }
+}
+
+/**
+ * @brief Append an arg_count_t to list for each entry of counts
+ */
+static void add_arg_counts(GPtrArray *list, GHashTable *counts, gchar sign)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, counts);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        arg_count_t *c = g_malloc(sizeof(arg_count_t));
+        c->sign = sign;
+        c->arg = key;
+        c->count = GPOINTER_TO_UINT(value);
+        g_ptr_array_add(list, c);
+    }
+}
+
+/**
+ * @brief GCompareFunc ordering arg_count_t by count (largest first), then
+ *        argument, then removals before additions
+ */
+static gint compare_arg_counts(gconstpointer a, gconstpointer b)
+{
+    const arg_count_t *x = *(const arg_count_t * const *)a;
+    const arg_count_t *y = *(const arg_count_t * const *)b;
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+    gint order = strcmp(x->arg, y->arg);
+    if (order != 0) {
+        return order;
+    }
+    return x->sign == '-' ? -1 : 1;
+}
+
+/**
+ * @brief GDestroyNotify for outfile_diff_t
+ */
+static void outfile_diff_free(gpointer data)
+{
+    outfile_diff_t *diff = data;
+    g_free(diff->group);
+    g_ptr_array_free(diff->removed, TRUE);
+    g_ptr_array_free(diff->added, TRUE);
+    perf_key_free(diff->key);
+    g_free(diff);
+}
+
+/**
+ * @brief Free a file_diff_t and the keyfiles it holds
+ */
+static void file_diff_free(file_diff_t *file)
+{
+    free_key_file(file->keyfile);
+    if (file->merged_old != NULL) {
+        free_key_file(file->merged_old);
+    }
+    if (file->merged_new != NULL) {
+        free_key_file(file->merged_new);
+    }
+    g_strfreev(file->outfiles);
+    g_ptr_array_free(file->changed, TRUE);
+    g_free(file);
+}
@@ -0,0 +1,180 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+#include <string.h>  // for strcmp
+
+#include "discover.h"
+#include "util.h"
+
+/**
+ * @brief State shared by the threads walking one directory tree
+ */
+typedef struct {
+    GThreadPool *pool;
+    GMutex lock;
+    /// signalled when pending reaches 0
+    GCond done;
+    /// directories queued or being read, protected by lock
+    gint pending;
+    /// keyfiles found so far, protected by lock
+    GPtrArray *files;
+} walk_t;
+
+static GPtrArray * walk_tree(walk_t *walk, const gchar *path);
+static void walk_directory(gpointer data, gpointer user_data);
+static gint compare_paths(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief Expand directory arguments into the keyfiles below them.
+ *        Directories are walked recursively by a thread pool and every
+ *        regular file ending in .hbr is kept. Symlinked directories are not
+ *        followed so links can't make a loop. Files found in a directory are
+ *        sorted, other arguments are kept as given and in order.
+ *
+ * @param paths NULL terminated list of files and directories
+ *
+ * @return NULL terminated list of files, free with g_strfreev()
+ */
+gchar ** discover_input_files(gchar **paths)
+{
+    GPtrArray *inputs = g_ptr_array_new();
+    walk_t walk;
+    walk.pool = NULL;
+    g_mutex_init(&walk.lock);
+    g_cond_init(&walk.done);
+    for (gint i = 0; paths[i] != NULL; i++) {
+        if (!g_file_test(paths[i], G_FILE_TEST_IS_DIR)) {
+            g_ptr_array_add(inputs, g_strdup(paths[i]));
+            continue;
+        }
+        if (walk.pool == NULL) {
+            walk.pool = g_thread_pool_new(walk_directory, &walk,
+                    g_get_num_processors(), FALSE, NULL);
+        }
+        GPtrArray *files = walk_tree(&walk, paths[i]);
+        if (files->len == 0) {
+            hbr_warn("No keyfiles (*.hbr) found in directory", paths[i], NULL,
+                    NULL, NULL);
+        }
+        g_ptr_array_sort(files, compare_paths);
+        for (guint j = 0; j < files->len; j++) {
+            g_ptr_array_add(inputs, files->pdata[j]);
+        }
+        g_ptr_array_free(files, TRUE);
+    }
+    if (walk.pool != NULL) {
+        g_thread_pool_free(walk.pool, FALSE, TRUE);
+    }
+    g_cond_clear(&walk.done);
+    g_mutex_clear(&walk.lock);
+    g_ptr_array_add(inputs, NULL);
+    return (gchar **)g_ptr_array_free(inputs, FALSE);
+}
+
+/**
+ * @brief Walk one directory tree and wait for every thread to finish
+ *
+ * @param walk shared walk state with a running pool
+ * @param path directory to walk
+ *
+ * @return keyfile paths found, unsorted
+ */
+static GPtrArray * walk_tree(walk_t *walk, const gchar *path)
+{
+    g_mutex_lock(&walk->lock);
+    walk->files = g_ptr_array_new();
+    walk->pending = 1;
+    g_thread_pool_push(walk->pool, g_strdup(path), NULL);
+    while (walk->pending > 0) {
+        g_cond_wait(&walk->done, &walk->lock);
+    }
+    GPtrArray *files = walk->files;
+    walk->files = NULL;
+    g_mutex_unlock(&walk->lock);
+    return files;
+}
+
+/**
+ * @brief Thread pool function reading a single directory. Keyfiles are
+ *        added to the results and subdirectories are queued for other
+ *        threads.
+ *
+ * @param data      directory path, freed by this function
+ * @param user_data walk_t
+ */
+static void walk_directory(gpointer data, gpointer user_data)
+{
+    gchar *dirname = data;
+    walk_t *walk = user_data;
+    GPtrArray *found = g_ptr_array_new();
+    GPtrArray *subdirs = g_ptr_array_new();
+
+    GError *error = NULL;
+    GDir *directory = g_dir_open(dirname, 0, &error);
+    if (directory == NULL) {
+        hbr_warn("Could not read directory: %s", dirname, NULL, NULL, NULL,
+                error->message);
+        g_error_free(error);
+    } else {
+        const gchar *name;
+        while ((name = g_dir_read_name(directory)) != NULL) {
+            gchar *path = g_build_filename(dirname, name, NULL);
+            if (g_file_test(path, G_FILE_TEST_IS_SYMLINK) &&
+                    g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                g_free(path);
+            } else if (g_file_test(path, G_FILE_TEST_IS_DIR)) {
+                g_ptr_array_add(subdirs, path);
+            } else if (g_str_has_suffix(name, ".hbr") &&
+                    g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+                g_ptr_array_add(found, path);
+            } else {
+                g_free(path);
+            }
+        }
+        g_dir_close(directory);
+    }
+
+    g_mutex_lock(&walk->lock);
+    for (guint i = 0; i < found->len; i++) {
+        g_ptr_array_add(walk->files, found->pdata[i]);
+    }
+    // count queued subdirectories before this one finishes
+    walk->pending += subdirs->len;
+    for (guint i = 0; i < subdirs->len; i++) {
+        g_thread_pool_push(walk->pool, subdirs->pdata[i], NULL);
+    }
+    walk->pending--;
+    if (walk->pending == 0) {
+        g_cond_signal(&walk->done);
+    }
+    g_mutex_unlock(&walk->lock);
+
+    g_ptr_array_free(found, TRUE);
+    g_ptr_array_free(subdirs, TRUE);
+    g_free(dirname);
+}
+
+/**
+ * @brief GCompareFunc for g_ptr_array_sort() on an array of paths
+ */
+static gint compare_paths(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const gchar * const *)a, *(const gchar * const *)b);
+}
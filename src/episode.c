@@ -0,0 +1,354 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+#include <stdlib.h>  // for strtol
+#include <string.h>  // for strchr
+
+#include "episode.h"
+#include "keyfile.h"
+#include "util.h"
+#include "value.h"
+
+static gboolean parse_episode_number(const gchar *text, gint *number,
+        const gchar **end);
+static gint64 pack_season_episode(gint season, gint episode);
+static void select_groups(GHashTable *selected, const GPtrArray *groups);
+static const typed_value_t * outfile_integer(GKeyFile *keyfile,
+        const gchar *group, const gchar *key);
+
+/**
+ * @brief Parse an episode selection such as "3-12,15" or "2:1-4".
+ *        Items are comma separated. Each is an episode number or an
+ *        inclusive range, optionally prefixed with a season and a colon.
+ *
+ * @param selection text given to -e
+ * @param error     set on parse failure (G_OPTION_ERROR_BAD_VALUE)
+ *
+ * @return array of episode_range_t, NULL on failure. Free with
+ *         g_array_free().
+ */
+GArray * parse_episode_selection(const gchar *selection, GError **error)
+{
+    GArray *ranges = g_array_new(FALSE, FALSE, sizeof(episode_range_t));
+    gchar **items = g_strsplit(selection, ",", -1);
+    for (gint i = 0; items[i] != NULL; i++) {
+        episode_range_t range = { -1, 0, 0 };
+        const gchar *p = g_strstrip(items[i]);
+        const gchar *end = NULL;
+        gboolean valid = parse_episode_number(p, &range.first, &end);
+        if (valid && *end == ':') {
+            // first number was a season
+            range.season = range.first;
+            valid = parse_episode_number(end + 1, &range.first, &end);
+        }
+        range.last = range.first;
+        if (valid && *end == '-') {
+            valid = parse_episode_number(end + 1, &range.last, &end);
+        }
+        if (!valid || *end != '\0' || range.last < range.first) {
+            g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                    "Invalid episode selection \"%s\"", items[i]);
+            g_strfreev(items);
+            g_array_free(ranges, TRUE);
+            return NULL;
+        }
+        g_array_append_val(ranges, range);
+    }
+    g_strfreev(items);
+    if (ranges->len == 0) {
+        g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+                "Empty episode selection");
+        g_array_free(ranges, TRUE);
+        return NULL;
+    }
+    return ranges;
+}
+
+/**
+ * @brief Index the outfile groups of a keyfile by season and episode.
+ *        An outfile's season comes from its own section, then CONFIG.
+ *        Outfiles without a valid episode number are not indexed.
+ *
+ * @param keyfile keyfile to index
+ *
+ * @return new index, free with episode_index_free()
+ */
+episode_index_t * episode_index_new(GKeyFile *keyfile)
+{
+    gsize count = 0;
+    gchar **groups = get_outfile_list(keyfile, &count);
+    episode_index_t *index = episode_index_alloc(groups, count);
+    for (gsize i = 0; i < index->count; i++) {
+        gint season, episode;
+        if (outfile_episode(keyfile, index->groups[i], &season, &episode)) {
+            episode_index_add(index, index->groups[i], season, episode);
+        }
+    }
+    return index;
+}
+
+/**
+ * @brief Create an empty index over a list of outfile groups
+ *
+ * @param groups outfile group names in file order, owned by the index
+ * @param count  number of groups
+ *
+ * @return new index, free with episode_index_free()
+ */
+episode_index_t * episode_index_alloc(gchar **groups, gsize count)
+{
+    episode_index_t *index = g_malloc(sizeof(episode_index_t));
+    index->groups = groups;
+    index->count = count;
+    index->by_season_episode = g_hash_table_new_full(g_int64_hash,
+            g_int64_equal, g_free, NULL);
+    index->by_episode = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+            NULL, (GDestroyNotify) g_ptr_array_unref);
+    return index;
+}
+
+/**
+ * @brief Add an outfile's numbers to an index. The first outfile added with
+ *        the same season and episode wins, outfiles of other seasons with
+ *        the same episode are all kept for matches without a season.
+ *
+ * @param index   index to add to
+ * @param group   group name, must be one of index->groups
+ * @param season  season number, negative when the outfile has none
+ * @param episode episode number
+ */
+void episode_index_add(episode_index_t *index, const gchar *group,
+        gint season, gint episode)
+{
+    gint64 *key = g_new(gint64, 1);
+    *key = pack_season_episode(season, episode);
+    if (g_hash_table_contains(index->by_season_episode, key)) {
+        g_free(key);
+        return;
+    }
+    g_hash_table_insert(index->by_season_episode, key, (gpointer)group);
+    GPtrArray *groups = g_hash_table_lookup(index->by_episode,
+            GINT_TO_POINTER(episode));
+    if (groups == NULL) {
+        groups = g_ptr_array_new();
+        g_hash_table_insert(index->by_episode, GINT_TO_POINTER(episode),
+                groups);
+    }
+    g_ptr_array_add(groups, (gpointer)group);
+}
+
+/**
+ * @brief Look up the season and episode numbers of an outfile group.
+ *        Either number may come from CONFIG.
+ *
+ * @param keyfile keyfile containing group
+ * @param group   outfile group
+ * @param season  output for the season, -1 when not set
+ * @param episode output for the episode
+ *
+ * @return TRUE when the outfile has a valid episode number
+ */
+gboolean outfile_episode(GKeyFile *keyfile, const gchar *group,
+        gint *season, gint *episode)
+{
+    const typed_value_t *e = outfile_integer(keyfile, group, "episode");
+    if (e == NULL) {
+        *season = -1;
+        return FALSE;
+    }
+    const typed_value_t *s = outfile_integer(keyfile, group, "season");
+    *season = s ? s->integer : -1;
+    *episode = e->integer;
+    return TRUE;
+}
+
+/**
+ * @brief Free an index created by episode_index_new()
+ */
+void episode_index_free(episode_index_t *index)
+{
+    if (index == NULL) {
+        return;
+    }
+    g_hash_table_destroy(index->by_season_episode);
+    g_hash_table_destroy(index->by_episode);
+    g_strfreev(index->groups);
+    g_free(index);
+}
+
+/**
+ * @brief Find the outfile groups for an episode
+ *
+ * @param index    index to search
+ * @param season   season number, negative to match any season
+ * @param episode  episode number
+ * @param selected set the matching groups (owned by index) are added to
+ *
+ * @return FALSE when no group matches
+ */
+gboolean episode_index_lookup(const episode_index_t *index, gint season,
+        gint episode, GHashTable *selected)
+{
+    if (season < 0) {
+        GPtrArray *groups = g_hash_table_lookup(index->by_episode,
+                GINT_TO_POINTER(episode));
+        if (groups == NULL) {
+            return FALSE;
+        }
+        select_groups(selected, groups);
+        return TRUE;
+    }
+    gint64 key = pack_season_episode(season, episode);
+    gpointer group = g_hash_table_lookup(index->by_season_episode, &key);
+    if (group == NULL) {
+        return FALSE;
+    }
+    g_hash_table_add(selected, group);
+    return TRUE;
+}
+
+/**
+ * @brief List the outfile groups selected by ranges, in file order.
+ *        Ranges without a season match their episodes in every season.
+ *        Single episodes that match nothing produce a warning.
+ *
+ * @param index  index of the keyfile's outfiles
+ * @param ranges episode_range_t array from parse_episode_selection(), NULL
+ *               selects every outfile
+ *
+ * @return NULL terminated list of group names, free with g_strfreev()
+ */
+gchar ** select_outfiles(const episode_index_t *index, const GArray *ranges)
+{
+    if (ranges == NULL) {
+        return g_strdupv(index->groups);
+    }
+    GHashTable *selected = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < ranges->len; i++) {
+        episode_range_t range = g_array_index(ranges, episode_range_t, i);
+        if (range.first == range.last) {
+            if (!episode_index_lookup(index, range.season, range.first,
+                        selected)) {
+                hbr_warn("Could not find specified episode (-e %d)", NULL,
+                        NULL, NULL, NULL, range.first);
+            }
+            continue;
+        }
+        // ranges may be open ended (1-2147483647), test the indexed
+        // episodes against the range instead of counting through it
+        GHashTableIter iter;
+        gpointer key, group;
+        if (range.season < 0) {
+            g_hash_table_iter_init(&iter, index->by_episode);
+            while (g_hash_table_iter_next(&iter, &key, &group)) {
+                gint episode = GPOINTER_TO_INT(key);
+                if (episode >= range.first && episode <= range.last) {
+                    select_groups(selected, group);
+                }
+            }
+        } else {
+            g_hash_table_iter_init(&iter, index->by_season_episode);
+            while (g_hash_table_iter_next(&iter, &key, &group)) {
+                guint64 packed = *(gint64 *)key;
+                gint season = (gint)(guint32)(packed >> 32);
+                gint episode = (gint)(guint32)packed;
+                if (season == range.season && episode >= range.first &&
+                        episode <= range.last) {
+                    g_hash_table_add(selected, group);
+                }
+            }
+        }
+    }
+    GPtrArray *groups = g_ptr_array_new();
+    for (gsize i = 0; i < index->count; i++) {
+        if (g_hash_table_contains(selected, index->groups[i])) {
+            g_ptr_array_add(groups, g_strdup(index->groups[i]));
+        }
+    }
+    g_ptr_array_add(groups, NULL);
+    g_hash_table_destroy(selected);
+    return (gchar **)g_ptr_array_free(groups, FALSE);
+}
+
+/**
+ * @brief Parse a non-negative decimal number
+ *
+ * @param text   text to parse
+ * @param number output for the parsed value
+ * @param end    output for the first character after the number
+ *
+ * @return TRUE when at least one digit was parsed
+ */
+static gboolean parse_episode_number(const gchar *text, gint *number,
+        const gchar **end)
+{
+    if (!g_ascii_isdigit(*text)) {
+        *end = text;
+        return FALSE;
+    }
+    gchar *stop = NULL;
+    glong value = strtol(text, &stop, 10);
+    *end = stop;
+    if (value > G_MAXINT) {
+        return FALSE;
+    }
+    *number = (gint)value;
+    return TRUE;
+}
+
+/**
+ * @brief Pack a season and episode into a by_season_episode key. The
+ *        season is shifted unsigned, it is -1 for outfiles without one.
+ */
+static gint64 pack_season_episode(gint season, gint episode)
+{
+    return (gint64)(((guint64)(guint32)season << 32) | (guint32)episode);
+}
+
+/**
+ * @brief Add every group of a by_episode list to a set
+ */
+static void select_groups(GHashTable *selected, const GPtrArray *groups)
+{
+    for (guint i = 0; i < groups->len; i++) {
+        g_hash_table_add(selected, groups->pdata[i]);
+    }
+}
+
+/**
+ * @brief Fetch an integer key from an outfile group, falling back to CONFIG
+ *
+ * @return decoded value, NULL when unset or not an integer
+ */
+static gint64 pack_season_episode(gint season, gint episode);
+static void select_groups(GHashTable *selected, const GPtrArray *groups);
+static const typed_value_t * outfile_integer(GKeyFile *keyfile,
+        const gchar *group, const gchar *key)
+{
+    const typed_value_t *value = get_typed_value(keyfile, group, key,
+            k_integer);
+    if (value == NULL) {
+        value = get_typed_value(keyfile, "CONFIG", key, k_integer);
+    }
+    if (value == NULL || value->error != NULL) {
+        return NULL;
+    }
+    return value;
+}
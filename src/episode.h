@@ -0,0 +1,67 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _episode_h
+#define _episode_h
+
+#include <glib.h>
+
+/**
+ * @brief Range of episode numbers selected with -e, inclusive
+ */
+typedef struct {
+    /**
+     * @brief season to match, negative matches the first outfile with the
+     *        episode number in any season
+     */
+    gint season;
+    /// first episode in range
+    gint first;
+    /// last episode in range
+    gint last;
+} episode_range_t;
+
+/**
+ * @brief Lookup of outfile groups by season and episode number. Built once
+ *        per keyfile with episode_index_new().
+ */
+typedef struct {
+    /// outfile group names in file order
+    gchar **groups;
+    /// number of outfile groups
+    gsize count;
+    /// (season, episode) packed in a gint64 to first matching group
+    GHashTable *by_season_episode;
+    /// episode to a GPtrArray of the matching groups, one per season
+    GHashTable *by_episode;
+} episode_index_t;
+
+GArray *parse_episode_selection(const gchar *selection, GError **error);
+episode_index_t *episode_index_new(GKeyFile *keyfile);
+episode_index_t *episode_index_alloc(gchar **groups, gsize count);
+void episode_index_add(episode_index_t *index, const gchar *group,
+        gint season, gint episode);
+gboolean outfile_episode(GKeyFile *keyfile, const gchar *group,
+        gint *season, gint *episode);
+void episode_index_free(episode_index_t *index);
+gboolean episode_index_lookup(const episode_index_t *index, gint season,
+        gint episode, GHashTable *selected);
+gchar **select_outfiles(const episode_index_t *index, const GArray *ranges);
+
+#endif
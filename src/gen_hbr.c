@@ -22,7 +22,14 @@
 #include <stdlib.h>
 
 #include "gen_hbr.h"
+#include "keyfile.h"
+#include "options.h"
 #include "util.h"
+#include "value.h"
+
+/* Global data for options, random options are drawn from these tables */
+extern option_data_t option_data;
+option_data_t option_data;
 
 /**
  * @brief Episode structure used to build episode list when -l option is used.
@@ -33,114 +40,55 @@ struct episode {
     gchar *name;
 };
 
-/**
- * @brief Episode list structure
- */
-struct episode_list {
-    gint count;
-    struct episode *array;
-};
-
-static struct episode_list read_episode_list(const gchar *episode_filename);
-static void free_episode_list(struct episode_list list);
-static void create_outfile_section(GKeyFile *config, gint outfile_count, gint episode,
+static GArray *read_episode_list(const gchar *episode_filename);
+static void free_episode(gpointer data);
+static gboolean parse_episode_line(gchar *line, struct episode *ep);
+static void write_group(FILE *out, const gchar *group, gboolean first);
+static void write_outfile_section(FILE *out, gint outfile_count, gint episode,
         gint title, gint season, const gchar *type, const gchar *iso_filename,
         const gchar *audio, const gchar *subtitle, const gchar *chapters,
         const gchar *specific_name);
+static GArray *random_pool(const gen_random_t *mix);
+static void write_random_options(FILE *out, const gen_random_t *mix,
+        GArray *pool);
+static gboolean options_conflict(gint a, gint b);
+static gchar *format_valid_value(const option_t *option, gint v);
+static gboolean option_accepts_values(gint index);
+
 /**
- * @brief Builds an episode_list from a file
+ * @brief Builds a list of episodes from a file
  *
  * @param episode_filename Path to the episode list.
  *
- * @return List of episodes, must be free'd with free_episode_list()
+ * @return array of struct episode, NULL on failure. Free with
+ *         g_array_free().
  */
-static struct episode_list read_episode_list(const gchar *episode_filename)
+static GArray *read_episode_list(const gchar *episode_filename)
 {
-    int max_count = 30;
-    struct episode_list list = {0, NULL};
     GDataInputStream *episode_list_file = open_datastream(episode_filename);
     if (episode_list_file == NULL)  {
         hbr_error("Failed to open episode list", episode_filename, NULL, NULL, NULL);
-        return list;
+        return NULL;
     }
 
-    list.array = calloc(max_count, sizeof(struct episode));
+    // GArray doubles its allocation as it grows
+    GArray *list = g_array_new(FALSE, FALSE, sizeof(struct episode));
+    g_array_set_clear_func(list, free_episode);
     gchar *line;
-    gchar *episode;
     gsize line_length = 0;
     while ((line = g_data_input_stream_read_line_utf8(episode_list_file,
-                    &line_length, NULL, NULL)) && list.count < max_count) {
-        g_strchug(line);
-        gchar **split_line = g_strsplit_set(line, " \t", 2);
-        // Check for season/episode string (s1e1)
-        if (split_line[0][0] == 's') {
-            gchar *season = split_line[0]+1;
-            episode = g_strrstr(season, "e");
-            if (episode != NULL) {
-                episode[0] = '\0';
-                episode++;
-                gchar *endptr;
-                list.array[list.count].number = g_ascii_strtoll(episode, &endptr, 10);
-                if (endptr == episode) {
-                    hbr_error("No season number found on line: %d", episode_filename,
-                            NULL, NULL, NULL, list.count+1);
-                    free_episode_list(list);
-                    list.count = 0;
-                    list.array = NULL;
-                    break;
-                }
-                list.array[list.count].season =  g_ascii_strtoll(season, &endptr, 10);
-                if (endptr == season) {
-                    hbr_error("No episode number found on line: %d", episode_filename,
-                            NULL, NULL, NULL, list.count+1);
-                    free_episode_list(list);
-                    list.count = 0;
-                    list.array = NULL;
-                    break;
-                }
-            }
-        } else {
-            // Check for episode string (e1) or digit only string
-            if (split_line[0][0] == 'e') {
-                episode = split_line[0]+1;
-            } else {
-                episode = split_line[0];
-            }
-            gchar *endptr;
-            list.array[list.count].number = g_ascii_strtoll(episode, &endptr, 10);
-            if (endptr == episode) {
-                hbr_error("No episode number found on line: %d", episode_filename,
-                        NULL, NULL, NULL, list.count+1);
-                free_episode_list(list);
-                list.count = 0;
-                list.array = NULL;
-                break;
-            }
-            list.array[list.count].season = -1;
-        }
-
-        // store the rest of the string as the episode name
-        list.array[list.count].name = g_strdup(split_line[1]);
-        if (list.array[list.count].name == NULL) {
-            hbr_error("No episode name found on line: %d", NULL, NULL, NULL,
-                    NULL, list.count+1);
-            free_episode_list(list);
-            list.count = 0;
-            list.array = NULL;
-            break;
-        }
-        g_strfreev(split_line);
+                    &line_length, NULL, NULL))) {
+        struct episode ep = {0, -1, NULL};
+        gboolean parsed = parse_episode_line(line, &ep);
         g_free(line);
-        // Allocate more space if episodes is about to exceed max_count
-        if ( list.count == max_count - 1 ) {
-            struct episode *temp;
-            if ((temp = realloc(list.array, (max_count+20) *
-                            sizeof(struct episode))) != NULL){
-                list.array = temp;
-                max_count += 20;
-            }
+        if (!parsed) {
+            hbr_error("Failed to parse line: %u", episode_filename, NULL,
+                    NULL, NULL, list->len+1);
+            g_array_free(list, TRUE);
+            list = NULL;
+            break;
         }
-        list.count++;
+        g_array_append_val(list, ep);
     }
     g_input_stream_close((GInputStream *)episode_list_file, NULL, NULL);
     g_object_unref(episode_list_file);
@@ -148,24 +96,108 @@ static struct episode_list read_episode_list(const gchar *episode_filename)
 }
 
 /**
- * @brief Frees episode_array allocated by read_episode_list()
+ * @brief Parse one episode list line: "s1e2 Name", "e2 Name" or "2 Name"
  *
- * @param list packed list of episodes
+ * @param line line to parse, modified in place
+ * @param ep   episode to fill, season is left alone without a season
+ *
+ * @return FALSE when the episode number, season number, or name is missing
  */
-static void free_episode_list(struct episode_list list)
+static gboolean parse_episode_line(gchar *line, struct episode *ep)
 {
-    int i;
-    for ( i = 0; i < list.count; i++) {
-        free(list.array[i].name);
+    g_strchug(line);
+    gchar **split_line = g_strsplit_set(line, " \t", 2);
+    gchar *episode;
+    gchar *endptr;
+    gboolean parsed = FALSE;
+    if (split_line[0] == NULL) {
+        g_strfreev(split_line);
+        return FALSE;
     }
-    free(list.array);
-    list.count = 0;
-    list.array = NULL;
+    // Check for season/episode string (s1e1)
+    if (split_line[0][0] == 's') {
+        gchar *season = split_line[0]+1;
+        episode = g_strrstr(season, "e");
+        if (episode == NULL) {
+            g_strfreev(split_line);
+            return FALSE;
+        }
+        episode[0] = '\0';
+        episode++;
+        ep->season = g_ascii_strtoll(season, &endptr, 10);
+        parsed = (endptr != season);
+    } else {
+        // Check for episode string (e1) or digit only string
+        if (split_line[0][0] == 'e') {
+            episode = split_line[0]+1;
+        } else {
+            episode = split_line[0];
+        }
+        parsed = TRUE;
+    }
+    ep->number = g_ascii_strtoll(episode, &endptr, 10);
+    parsed = parsed && endptr != episode && split_line[1] != NULL;
+    // store the rest of the string as the episode name
+    if (parsed) {
+        ep->name = g_strdup(split_line[1]);
+    }
+    g_strfreev(split_line);
+    return parsed;
 }
 
 /**
- * @brief Generates GKeyFile template for hbr input
+ * @brief GDestroyNotify for episodes kept in a GArray
+ */
+static void free_episode(gpointer data)
+{
+    g_free(((struct episode *) data)->name);
+}
+
+/**
+ * @brief Load the option tables random options are drawn from
+ *
+ * @param mix       random options to set up
+ * @param count     options to add to each outfile
+ * @param keys      comma-separated options to draw from, NULL for all
+ * @param seed      seed for repeatable output, NULL for a random seed
+ * @param hbversion HandBrake version, NULL to ask HandBrakeCLI
+ */
+void gen_random_init(gen_random_t *mix, gint count, const gchar *keys,
+        const gchar *seed, const gchar *hbversion)
+{
+    // determine_handbrake_version() takes ownership of the version
+    determine_handbrake_version(g_strdup(hbversion));
+    arg_hash_generate();
+    mix->count = count;
+    mix->keys = keys ? g_strsplit(keys, ",", -1) : NULL;
+    if (seed != NULL) {
+        mix->rand = g_rand_new_with_seed(g_ascii_strtoull(seed, NULL, 10));
+    } else {
+        mix->rand = g_rand_new();
+    }
+}
+
+/**
+ * @brief Free what gen_random_init() set up
+ */
+void gen_random_cleanup(gen_random_t *mix)
+{
+    if (mix->rand == NULL) {
+        return;
+    }
+    g_strfreev(mix->keys);
+    g_rand_free(mix->rand);
+    arg_hash_cleanup();
+    typed_value_cache_cleanup();
+    mix->count = 0;
+    mix->keys = NULL;
+    mix->rand = NULL;
+}
+
+/**
+ * @brief Writes a hbr input template to out one section at a time
  *
+ * @param out Stream to write the keyfile to
  * @param outfiles_count Number of outfile sections to generate.
  *                       Ignored if episodes argument is given.
  * @param title DVD title number
@@ -179,125 +211,148 @@ static void free_episode_list(struct episode_list list)
  * @param output_basedir Location for output file(s)
  * @param audio Audio track list (comma-separated)
  * @param subtitle Subtitle track list (comma-separated)
- * @param episodes Path for episode list file. Overrides outfiles_count.
  * @param chapters Chapter range (i.e. 2-18)
+ * @param episodes Path for episode list file. Overrides outfiles_count.
+ * @param mix Random options to add to each outfile, may be NULL
  *
- * @return GKeyFile pointer for the generated config
+ * @return FALSE when the arguments are invalid or writing failed
  */
-GKeyFile *gen_hbr(gint outfiles_count, gint title, gint season, const gchar *type,
-        const gchar *iso_filename, const gchar *year, const gchar *crop,
-        const gchar *name, const gchar *input_basedir, const gchar *output_basedir,
-        const gchar *audio, const gchar *subtitle, const gchar *chapters,
-        const gchar *episodes)
+gboolean gen_hbr(FILE *out, gint outfiles_count, gint title, gint season,
+        const gchar *type, const gchar *iso_filename, const gchar *year,
+        const gchar *crop, const gchar *name, const gchar *input_basedir,
+        const gchar *output_basedir, const gchar *audio, const gchar *subtitle,
+        const gchar *chapters, const gchar *episodes,
+        const gen_random_t *mix)
 {
-    struct episode_list list;
-    list.count = 0;
-    list.array = NULL;
+    GArray *list = NULL;
     if (episodes != NULL) {
         list = read_episode_list(episodes);
-        outfiles_count = list.count;
-        if (outfiles_count == 0) {
+        if (list == NULL || list->len == 0) {
             hbr_error("Failed to parse episode list", NULL, NULL, NULL, NULL);
-            free_episode_list(list);
-            return NULL;
+            if (list != NULL) {
+                g_array_free(list, TRUE);
+            }
+            return FALSE;
         }
+        outfiles_count = list->len;
     }
-    if (outfiles_count <= 0 || outfiles_count > 999) {
+    if (outfiles_count <= 0) {
         hbr_error("Invalid number of outfile sections (%d)", NULL, NULL, NULL,
                 NULL, outfiles_count);
-        free_episode_list(list);
-        return NULL;
+        return FALSE;
     }
 
-    GKeyFile *config = g_key_file_new();
-    const gchar *group = "CONFIG";
-
-    gchar *inferred_type;
+    const gchar *inferred_type;
     if (episodes && type == NULL) {
-        inferred_type = g_strdup("series");
+        inferred_type = "series";
     } else if (!type) {
-        inferred_type = g_strdup("movie");
+        inferred_type = "movie";
     } else {
-        inferred_type = g_strdup(type);
+        inferred_type = type;
     }
     gboolean is_movie = (g_strcmp0(inferred_type, "movie") == 0);
     gboolean is_series = (g_strcmp0(inferred_type, "series") == 0);
-
-    // create CONFIG section with values
-    // keys that are always in CONFIG
-    g_key_file_set_value(config, group, "input_basedir", input_basedir ? input_basedir : "");
-    g_key_file_set_value(config, group, "output_basedir", output_basedir ? output_basedir : "");
-    if (is_movie || is_series) {
-        g_key_file_set_value(config, group, "type", inferred_type);
-    } else {
+    if (!is_movie && !is_series) {
         hbr_error("Unknown type=%s. Should be \'movies\' or \'series\'", NULL,
                 NULL, NULL, NULL, inferred_type);
-        g_free(inferred_type);
-        g_key_file_unref(config);
-        free_episode_list(list);
-        return NULL;
+        if (list != NULL) {
+            g_array_free(list, TRUE);
+        }
+        return FALSE;
+    }
+    GArray *pool = NULL;
+    if (mix != NULL && mix->count > 0) {
+        pool = random_pool(mix);
+        if (pool == NULL) {
+            if (list != NULL) {
+                g_array_free(list, TRUE);
+            }
+            return FALSE;
+        }
     }
+
+    // create CONFIG section with values
+    // keys that are always in CONFIG
+    write_group(out, "CONFIG", TRUE);
+    fprintf(out, "input_basedir=%s\n", input_basedir ? input_basedir : "");
+    fprintf(out, "output_basedir=%s\n", output_basedir ? output_basedir : "");
+    fprintf(out, "type=%s\n", inferred_type);
     if (is_movie) {
-        g_key_file_set_value(config, group, "year", year ? year : "");
+        fprintf(out, "year=%s\n", year ? year : "");
     }
-    g_key_file_set_value(config, group, "name", name ? name : "");
+    fprintf(out, "name=%s\n", name ? name : "");
 
     // keys that are only in config if a value is given
     if (title) {
-        g_key_file_set_integer(config, group, "title", title);
+        fprintf(out, "title=%d\n", title);
     }
     if (season) {
-        g_key_file_set_integer(config, group, "season", season);
+        fprintf(out, "season=%d\n", season);
     }
     if (iso_filename) {
-        g_key_file_set_value(config, group, "iso_filename", iso_filename);
+        fprintf(out, "iso_filename=%s\n", iso_filename);
     }
     if (crop) {
-        g_key_file_set_value(config, group, "crop", crop);
+        fprintf(out, "crop=%s\n", crop);
     }
     if (audio) {
-        g_key_file_set_value(config, group, "audio", audio);
+        fprintf(out, "audio=%s\n", audio);
     }
     if (subtitle) {
-        g_key_file_set_value(config, group, "subtitle", subtitle);
+        fprintf(out, "subtitle=%s\n", subtitle);
     }
     if (chapters) {
-        g_key_file_set_value(config, group, "chapters", chapters);
+        fprintf(out, "chapters=%s\n", chapters);
     }
 
-    int i;
-    for (i = 0; i< outfiles_count; i++) {
-        if (episodes != NULL){
-            create_outfile_section(config, i+1, list.array[i].number, title,
-                    list.array[i].season, inferred_type, iso_filename, audio, subtitle,
-                    chapters, list.array[i].name);
+    for (gint i = 0; i < outfiles_count; i++) {
+        if (list != NULL){
+            struct episode *ep = &g_array_index(list, struct episode, i);
+            write_outfile_section(out, i+1, ep->number, title, ep->season,
+                    inferred_type, iso_filename, audio, subtitle, chapters,
+                    ep->name);
         } else {
-            int episode;
+            int episode = 0;
             if (is_series) {
                 episode = i;
             }
-            if (is_movie) {
-                episode = 0;
-            }
             if (season != 0) {
                 // season was already set in the CONFIG section
                 season = -1;
             }
-            create_outfile_section(config, i+1, episode, title, season, inferred_type,
-                    iso_filename, audio, subtitle, chapters, "");
+            write_outfile_section(out, i+1, episode, title, season,
+                    inferred_type, iso_filename, audio, subtitle, chapters, "");
+        }
+        if (pool != NULL) {
+            write_random_options(out, mix, pool);
         }
     }
-    if (episodes != NULL) {
-        free_episode_list(list);
+    if (list != NULL) {
+        g_array_free(list, TRUE);
+    }
+    if (pool != NULL) {
+        g_array_free(pool, TRUE);
     }
-    g_free(inferred_type);
-    return config;
+    if (fflush(out) != 0 || ferror(out)) {
+        hbr_error("Failed to write generated keyfile", NULL, NULL, NULL, NULL);
+        return FALSE;
+    }
+    return TRUE;
 }
 
 /**
- * @brief Create an outfile section in an GKeyfile given the parent.
+ * @brief Start a group, separated from the previous one by a blank line
+ *        like g_key_file_to_data()
+ */
+static void write_group(FILE *out, const gchar *group, gboolean first)
+{
+    fprintf(out, first ? "[%s]\n" : "\n[%s]\n", group);
+}
+
+/**
+ * @brief Write an outfile section
  *
- * @param config a GKeyFile pointer to add this outfile section to
+ * @param out Stream to write the section to
  * @param outfile_count
  * @param episode Episode number
  * @param title numeric dvd title (1-99)
@@ -309,49 +364,175 @@ GKeyFile *gen_hbr(gint outfiles_count, gint title, gint season, const gchar *typ
  * @param chapters Chapter range (i.e. 2-18)
  * @param specific_name Name of the episode or particular movie version
  */
-static void create_outfile_section(GKeyFile *config, gint outfile_count, gint episode,
+static void write_outfile_section(FILE *out, gint outfile_count, gint episode,
         gint title, gint season, const gchar *type, const gchar *iso_filename,
         const gchar *audio, const gchar *subtitle, const gchar *chapters,
         const gchar *specific_name)
 {
     gboolean is_series = (g_strcmp0(type, "series") == 0);
-    gchar *group = g_strdup_printf("OUTFILE%d", outfile_count);
+    gchar group[32];
+    g_snprintf(group, sizeof(group), "OUTFILE%d", outfile_count);
+    write_group(out, group, FALSE);
     if (!iso_filename) {
-        g_key_file_set_value(config, group, "iso_filename", "");
+        fputs("iso_filename=\n", out);
     }
     if (title == 0) {
-        g_key_file_set_integer(config, group, "title", 0);
+        fputs("title=0\n", out);
     }
     if (is_series) {
         if (season >= 0) {
-            g_key_file_set_integer(config, group, "season", season);
+            fprintf(out, "season=%d\n", season);
         }
         if (episode) {
-            g_key_file_set_integer(config, group, "episode", episode);
+            fprintf(out, "episode=%d\n", episode);
         }
     }
-    g_key_file_set_value(config, group, "specific_name",
-            specific_name ? specific_name : "");
+    fprintf(out, "specific_name=%s\n", specific_name ? specific_name : "");
     if (!chapters) {
-        g_key_file_set_value(config, group, "chapters", "");
+        fputs("chapters=\n", out);
     }
     if (!audio) {
-        g_key_file_set_value(config, group, "audio", "");
+        fputs("audio=\n", out);
     }
     if (!subtitle) {
-        g_key_file_set_value(config, group, "subtitle", "");
+        fputs("subtitle=\n", out);
     }
-    g_free(group);
 }
 
 /**
- * @brief Writes an GKeyFile to STDOUT with formatting and no short tags
+ * @brief Collect the options random values are drawn from
+ *
+ * @param mix mix->keys names the options, or NULL for every
+ *               HandBrake option that lists its valid values and requires
+ *               no other option
  *
- * @param config pointer to a key file to be printed
+ * @return array of option indexes, NULL when a named option can't be used
+ */
+static GArray *random_pool(const gen_random_t *mix)
+{
+    GArray *pool = g_array_new(FALSE, FALSE, sizeof(gint));
+    if (mix->keys != NULL) {
+        for (gint i = 0; mix->keys[i] != NULL; i++) {
+            gint index = option_index(mix->keys[i]);
+            if (index < 0 ||
+                    option_data.options[index].valid_values_count == 0) {
+                hbr_error("Option has no list of valid values: %s", NULL,
+                        NULL, NULL, NULL, mix->keys[i]);
+                g_array_free(pool, TRUE);
+                return NULL;
+            }
+            g_array_append_val(pool, index);
+        }
+        return pool;
+    }
+    for (gint i = 0; i < option_data.option_count; i++) {
+        option_t *option = &option_data.options[i];
+        if (option->valid_values_count > 0 &&
+                option->arg_type != hbr_only &&
+                option->key_type != k_double &&
+                option->key_type != k_double_list &&
+                option_requires(i) == NULL &&
+                option_accepts_values(i)) {
+            g_array_append_val(pool, i);
+        }
+    }
+    if (pool->len == 0) {
+        hbr_error("No options with valid values to draw from", NULL, NULL,
+                NULL, NULL);
+        g_array_free(pool, TRUE);
+        return NULL;
+    }
+    return pool;
+}
+
+/**
+ * @brief Append mix->count options from pool to the current section,
+ *        each with a random value from its valid values. Options that
+ *        conflict with one already picked are skipped.
+ */
+static void write_random_options(FILE *out, const gen_random_t *mix,
+        GArray *pool)
+{
+    gint *chosen = g_new(gint, mix->count);
+    gint picked = 0;
+    // partial Fisher-Yates shuffle, stopping once enough options are picked
+    for (guint i = 0; i < pool->len && picked < mix->count; i++) {
+        guint j = g_rand_int_range(mix->rand, i, pool->len);
+        gint index = g_array_index(pool, gint, j);
+        g_array_index(pool, gint, j) = g_array_index(pool, gint, i);
+        g_array_index(pool, gint, i) = index;
+
+        gboolean conflicts = FALSE;
+        for (gint k = 0; k < picked && !conflicts; k++) {
+            conflicts = options_conflict(index, chosen[k]);
+        }
+        if (conflicts) {
+            continue;
+        }
+        chosen[picked++] = index;
+
+        option_t *option = &option_data.options[index];
+        gint v = g_rand_int_range(mix->rand, 0, option->valid_values_count);
+        gchar *value = format_valid_value(option, v);
+        fprintf(out, "%s=%s\n", option->name, value);
+        g_free(value);
+    }
+    g_free(chosen);
+}
+
+/**
+ * @brief Check if either option lists the other as a conflict
+ */
+static gboolean options_conflict(gint a, gint b)
+{
+    GSList *conflicts = option_conflicts(a);
+    for (; conflicts != NULL; conflicts = g_slist_next(conflicts)) {
+        if (option_data.conflict_targets[GPOINTER_TO_INT(conflicts->data)] == b) {
+            return TRUE;
+        }
+    }
+    conflicts = option_conflicts(b);
+    for (; conflicts != NULL; conflicts = g_slist_next(conflicts)) {
+        if (option_data.conflict_targets[GPOINTER_TO_INT(conflicts->data)] == a) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Format one of an option's valid values as keyfile text
+ *
+ * @return new string, free with g_free()
+ */
+static gchar *format_valid_value(const option_t *option, gint v)
+{
+    switch (option->key_type) {
+        case k_integer:
+        case k_integer_list:
+            return g_strdup_printf("%d", ((gint *) option->valid_values)[v]);
+        case k_double:
+        case k_double_list:
+            return g_strdup_printf("%g", ((gdouble *) option->valid_values)[v]);
+        default:
+            return g_strdup(((const gchar **) option->valid_values)[v]);
+    }
+}
+
+/**
+ * @brief Check that hbr's validation accepts the option's first valid
+ *        value. Some validators are not written yet and reject everything,
+ *        random values for those options would only produce keyfiles hbr
+ *        refuses.
  */
-void print_hbr(GKeyFile *config)
+static gboolean option_accepts_values(gint index)
 {
-    gchar *keyfile_string = g_key_file_to_data(config, NULL, NULL);
-    g_print("%s", keyfile_string);
-    g_free(keyfile_string);
+    option_t *option = &option_data.options[index];
+    GKeyFile *probe = new_key_file();
+    gchar *value = format_valid_value(option, 0);
+    set_key_string(probe, "OUTFILE", option->name, value);
+    gboolean valid = option->valid_option(option, "OUTFILE", probe, "probe");
+    g_free(value);
+    free_key_file(probe);
+    return valid;
 }
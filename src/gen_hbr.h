@@ -20,14 +20,27 @@
 #ifndef _gen_hbr_h
 #define _gen_hbr_h
 
+#include <stdio.h>  // for FILE
 #include <glib.h>
 
-GKeyFile *gen_hbr(gint outfiles_count, gint title, gint season, const gchar *type,
-        const gchar *iso_filename, const gchar *year, const gchar *crop,
-        const gchar *name, const gchar *input_basedir, const gchar *output_basedir,
-        const gchar *audio, const gchar *subtitle, const gchar *chapters,
-        const gchar *episodes);
+/**
+ * @brief Random options hbr-gen adds to every outfile section
+ */
+typedef struct {
+    /// options to add to each outfile
+    gint count;
+    /// option names to draw from, NULL for every option with valid values
+    gchar **keys;
+    GRand *rand;
+} gen_random_t;
 
-void print_hbr(GKeyFile *config);
+void gen_random_init(gen_random_t *mix, gint count, const gchar *keys,
+        const gchar *seed, const gchar *hbversion);
+void gen_random_cleanup(gen_random_t *mix);
+gboolean gen_hbr(FILE *out, gint outfiles_count, gint title, gint season,
+        const gchar *type, const gchar *iso_filename, const gchar *year,
+        const gchar *crop, const gchar *name, const gchar *input_basedir,
+        const gchar *output_basedir, const gchar *audio, const gchar *subtitle,
+        const gchar *chapters, const gchar *episodes, const gen_random_t *mix);
 
 #endif
@@ -116,7 +116,7 @@ static option_t option_v0_10_0[] =
     { "turbo", no_argument, k_boolean, FALSE, valid_boolean, 0, NULL},
     { "maxHeight", required_argument, k_integer, FALSE, valid_positive_integer, 0, NULL},
     { "maxWidth", required_argument, k_integer, FALSE, valid_positive_integer, 0, NULL},
-    { "preset", required_argument, k_string, FALSE, valid_string_list, 12,
+    { "preset", required_argument, k_string, FALSE, valid_string_set, 12,
         (const gchar*[]){"Universal", "iPod", "iPhone & iPod touch", "iPad",
             "AppleTV", "AppleTV 2", "AppleTV 3", "Android", "Android Tablet",
             "Windows Phone 8", "Normal", "High Profile"}},
@@ -0,0 +1,379 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Microbenchmarks for the keyfile pipeline hbr runs for every outfile.
+ * Each size generates a keyfile with that many outfiles, then each
+ * function is run repeatedly for at least --min-time milliseconds.
+ */
+
+#include <stdlib.h>        // for EXIT_SUCCESS, EXIT_FAILURE
+#include <sys/resource.h>  // for getrusage
+#include <unistd.h>        // for close
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "alloc_stats.h"
+#include "build_args.h"
+#include "keyfile.h"
+#include "keyset.h"
+#include "options.h"
+#include "util.h"
+#include "value.h"
+
+/**
+ * @brief State shared by every benchmark of one keyfile size
+ */
+typedef struct {
+    gchar *filename;
+    GKeyFile *config;
+    GKeyFile *keyfile;
+    gchar **outfiles;
+    gsize outfile_count;
+    GKeyFile *merged;
+    /// outfiles merged with merged, for build_args() and build_filename()
+    GKeyFile **current;
+    /// copy of merged for remove_conflicts() to remove keys from
+    GKeyFile *modified;
+    keyset_t *merged_keys;
+} bench_state_t;
+
+/**
+ * @brief One operation, i counts up from 0 and wraps at the outfile count
+ */
+typedef void (*bench_func)(bench_state_t *state, gsize i);
+
+static gchar *opt_sizes = NULL;
+static gint opt_min_time = 200;
+static gchar *opt_filter = NULL;
+
+static GOptionEntry entries[] =
+{
+    {"sizes",    's', 0, G_OPTION_ARG_STRING, &opt_sizes,
+        "outfile counts to benchmark (default 10,1000,100000)", "LIST"},
+    {"min-time", 't', 0, G_OPTION_ARG_INT,    &opt_min_time,
+        "run each benchmark for at least MS milliseconds", "MS"},
+    {"filter",   'f', 0, G_OPTION_ARG_STRING, &opt_filter,
+        "only run benchmarks whose name contains TEXT", "TEXT"},
+    { NULL }
+};
+
+/* Global data for options */
+extern option_data_t option_data;
+option_data_t option_data;
+
+/**
+ * @brief Write a series keyfile with count outfiles to a temporary file
+ *
+ * @return filename of the keyfile, NULL on failure
+ */
+static gchar * write_keyfile(gsize count)
+{
+    GString *text = g_string_new("[CONFIG]\n"
+            "type=series\n"
+            "name=Bench\n"
+            "season=1\n"
+            "iso_filename=bench.iso\n"
+            "encoder=x264\n"
+            "quality=20\n"
+            "markers=true\n"
+            "audio=1,2\n");
+    for (gsize i = 0; i < count; i++) {
+        g_string_append_printf(text, "\n[OUTFILE_%" G_GSIZE_FORMAT "]\n"
+                "title=%" G_GSIZE_FORMAT "\n"
+                "episode=%" G_GSIZE_FORMAT "\n"
+                "specific_name=Episode %" G_GSIZE_FORMAT "\n",
+                i, i % 99 + 1, i + 1, i + 1);
+        // vary a few outfiles so merging also overrides and drops keys
+        if (i % 3 == 0) {
+            g_string_append(text, "vb=2000\n");
+        }
+        if (i % 5 == 0) {
+            g_string_append(text, "chapters=1-4\n");
+        }
+    }
+
+    gchar *filename = NULL;
+    GError *error = NULL;
+    gint fd = g_file_open_tmp("hbr-bench-XXXXXX.hbr", &filename, &error);
+    if (fd < 0) {
+        hbr_error("Failed to create benchmark keyfile: %s", NULL, NULL, NULL,
+                NULL, error->message);
+        g_error_free(error);
+        g_string_free(text, TRUE);
+        return NULL;
+    }
+    close(fd);
+    if (!g_file_set_contents(filename, text->str, text->len, &error)) {
+        hbr_error("Failed to write benchmark keyfile: %s", filename, NULL,
+                NULL, NULL, error->message);
+        g_error_free(error);
+        g_unlink(filename);
+        g_free(filename);
+        filename = NULL;
+    }
+    g_string_free(text, TRUE);
+    return filename;
+}
+
+/**
+ * @brief Parse and merge a generated keyfile the way hbr plans one
+ *
+ * @return FALSE when the generated keyfile did not validate
+ */
+static gboolean state_init(bench_state_t *state, gsize count)
+{
+    state->filename = write_keyfile(count);
+    if (state->filename == NULL) {
+        return FALSE;
+    }
+    state->config = generate_default_key_file();
+    state->keyfile = parse_validate_key_file(state->filename, state->config,
+            NULL, &state->outfiles);
+    if (state->keyfile == NULL) {
+        hbr_error("Generated keyfile did not validate", state->filename,
+                NULL, NULL, NULL);
+        return FALSE;
+    }
+    state->outfile_count = g_strv_length(state->outfiles);
+    state->merged = merge_key_group(state->keyfile, "CONFIG", state->config,
+            "CONFIG", "MERGED_CONFIG");
+    state->current = g_malloc0_n(state->outfile_count, sizeof(GKeyFile *));
+    for (gsize i = 0; i < state->outfile_count; i++) {
+        state->current[i] = merge_key_group(state->keyfile,
+                state->outfiles[i], state->merged, "MERGED_CONFIG",
+                "CURRENT_OUTFILE");
+    }
+    state->modified = copy_group_new(state->merged, "MERGED_CONFIG",
+            "MERGED_CONFIG");
+    state->merged_keys = keyset_from_group(state->merged, "MERGED_CONFIG");
+    return TRUE;
+}
+
+static void state_free(bench_state_t *state)
+{
+    if (state->current != NULL) {
+        for (gsize i = 0; i < state->outfile_count; i++) {
+            if (state->current[i] != NULL) {
+                free_key_file(state->current[i]);
+            }
+        }
+        g_free(state->current);
+    }
+    if (state->merged_keys != NULL) {
+        keyset_free(state->merged_keys);
+    }
+    if (state->modified != NULL) {
+        free_key_file(state->modified);
+    }
+    if (state->merged != NULL) {
+        free_key_file(state->merged);
+    }
+    if (state->keyfile != NULL) {
+        free_key_file(state->keyfile);
+    }
+    if (state->config != NULL) {
+        free_key_file(state->config);
+    }
+    g_strfreev(state->outfiles);
+    if (state->filename != NULL) {
+        g_unlink(state->filename);
+        g_free(state->filename);
+    }
+}
+
+static void bench_parse_validate(bench_state_t *state, gsize i)
+{
+    gchar **outfiles = NULL;
+    GKeyFile *keyfile = parse_validate_key_file(state->filename,
+            state->config, NULL, &outfiles);
+    if (keyfile != NULL) {
+        free_key_file(keyfile);
+    }
+    g_strfreev(outfiles);
+}
+
+static void bench_merge_key_group(bench_state_t *state, gsize i)
+{
+    GKeyFile *merged = merge_key_group(state->keyfile, state->outfiles[i],
+            state->merged, "MERGED_CONFIG", "CURRENT_OUTFILE");
+    if (merged != NULL) {
+        free_key_file(merged);
+    }
+}
+
+static void bench_remove_conflicts(bench_state_t *state, gsize i)
+{
+    // vb conflicts with the quality set in CONFIG, put it back so every
+    // operation has a conflict to remove
+    remove_conflicts("vb", "2000", state->modified, "MERGED_CONFIG",
+            state->merged, "MERGED_CONFIG", state->merged_keys);
+    set_key_value(state->modified, "MERGED_CONFIG", "quality", "20");
+}
+
+static void bench_build_args(bench_state_t *state, gsize i)
+{
+    // start without cached lookups, as hbr does for each outfile
+    typed_value_cache_forget(state->current[i]);
+    GPtrArray *args = build_args(state->current[i], "CURRENT_OUTFILE", FALSE);
+    g_ptr_array_free(args, TRUE);
+}
+
+static void bench_build_filename(bench_state_t *state, gsize i)
+{
+    typed_value_cache_forget(state->current[i]);
+    g_free(build_filename(state->current[i], "CURRENT_OUTFILE"));
+}
+
+static void bench_handbrake_version(bench_state_t *state, gsize i)
+{
+    arg_hash_cleanup();
+    // takes ownership of the version string
+    determine_handbrake_version(g_strdup("1.3.0"));
+    arg_hash_generate();
+}
+
+/**
+ * @brief A benchmark and whether one operation covers the whole keyfile
+ */
+typedef struct {
+    const gchar *name;
+    bench_func func;
+    gboolean per_file;
+} bench_t;
+
+static const bench_t benchmarks[] = {
+    {"parse_validate_key_file", bench_parse_validate, TRUE},
+    {"merge_key_group", bench_merge_key_group, FALSE},
+    {"remove_conflicts", bench_remove_conflicts, FALSE},
+    {"build_args", bench_build_args, FALSE},
+    {"build_filename", bench_build_filename, FALSE},
+    {"determine_handbrake_version", bench_handbrake_version, TRUE},
+};
+
+/**
+ * @brief Run one benchmark for at least opt_min_time and print its row
+ */
+static void run_benchmark(const bench_t *bench, bench_state_t *state)
+{
+    gint64 min_time = (gint64) opt_min_time * 1000;
+    alloc_stats_t before, after;
+    guint64 ops = 0;
+    guint64 batch = 1;
+    gsize i = 0;
+
+    alloc_stats_get(&before);
+    gint64 start = g_get_monotonic_time();
+    gint64 elapsed;
+    do {
+        // double the batch each round so slow operations run only a few
+        // times and the clock isn't read after every fast one
+        for (guint64 n = 0; n < batch; n++) {
+            bench->func(state, i);
+            if (++i == state->outfile_count) {
+                i = 0;
+            }
+        }
+        ops += batch;
+        batch *= 2;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < min_time);
+    alloc_stats_get(&after);
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    g_print("%9" G_GSIZE_FORMAT " %-28s %10" G_GUINT64_FORMAT
+            " %12.1f", state->outfile_count, bench->name, ops,
+            elapsed * 1000.0 / ops);
+    if (alloc_stats_available()) {
+        g_print(" %11.1f %12.1f", (gdouble) (after.allocations -
+                    before.allocations) / ops,
+                (gdouble) (after.bytes - before.bytes) / ops);
+    } else {
+        g_print(" %11s %12s", "-", "-");
+    }
+    g_print(" %12ld\n", usage.ru_maxrss);
+}
+
+/**
+ * @brief Benchmark every function against a keyfile with count outfiles
+ */
+static gboolean run_size(gsize count)
+{
+    bench_state_t state = { 0 };
+    // validation and conflict removal report at info level
+    message_level_warn();
+    gboolean ok = state_init(&state, count);
+    if (ok) {
+        for (gsize b = 0; b < G_N_ELEMENTS(benchmarks); b++) {
+            if (opt_filter == NULL ||
+                    g_strstr_len(benchmarks[b].name, -1, opt_filter)) {
+                run_benchmark(&benchmarks[b], &state);
+            }
+        }
+    }
+    message_level_info();
+    state_free(&state);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    GOptionContext *context = g_option_context_new(NULL);
+    g_option_context_set_summary(context,
+            "Time the keyfile functions hbr runs for every outfile.");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        hbr_error("Option parsing failed: %s", NULL, NULL, NULL, NULL,
+                error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        exit(EXIT_FAILURE);
+    }
+    g_option_context_free(context);
+
+    gchar **sizes = g_strsplit(opt_sizes ? opt_sizes : "10,1000,100000",
+            ",", -1);
+    alloc_stats_enable(FALSE);
+    // takes ownership of the version string
+    determine_handbrake_version(g_strdup("1.3.0"));
+    arg_hash_generate();
+
+    g_print("%9s %-28s %10s %12s %11s %12s %12s\n", "outfiles", "function",
+            "ops", "ns/op", "allocs/op", "bytes/op", "maxrss KiB");
+    gint status = EXIT_SUCCESS;
+    for (gint i = 0; sizes[i] != NULL; i++) {
+        guint64 count;
+        if (!g_ascii_string_to_unsigned(sizes[i], 10, 1, G_MAXINT, &count,
+                    NULL)) {
+            hbr_error("Invalid size: %s", NULL, NULL, NULL, NULL, sizes[i]);
+            status = EXIT_FAILURE;
+            continue;
+        }
+        if (!run_size(count)) {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    g_strfreev(sizes);
+    arg_hash_cleanup();
+    typed_value_cache_cleanup();
+    exit(status);
+}
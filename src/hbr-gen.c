@@ -51,6 +51,10 @@ static const struct argp_option gen_options[] = {
     {"audio",          'a', "AUDIO",        0, "Comma-separated audio track list", 3},
     {"subtitle",       's', "SUBTITLE",     0, "Comma-separated subtitle track list", 3},
     {"chapters",       'C', "CHAPTERS",     0, "Chapter range", 3},
+    {"random-options", 'r', "NUM",          0, "Add NUM random options with valid values to each outfile", 4},
+    {"random-keys",    'k', "LIST",         0, "Comma-separated options to draw random options from", 4},
+    {"seed",           'e', "NUM",          0, "Random seed, for repeatable output", 4},
+    {"hbversion",      'H', "X.Y.Z",        0, "HandBrake version whose options are drawn from", 4},
     {"help",           '?', NULL,              0, "Give this help list", -1 },
     {"usage",          '@', NULL,              OPTION_HIDDEN, "Give this help list", -1 },
     { NULL, 0, NULL, 0, NULL, 0 }
@@ -74,6 +78,10 @@ struct gen_arguments {
     char *subtitle;       // Subtitle track list (comma-separated)
     char *chapters;       // Chapter range (i.e. 2-18)
     char *episodes;       // Filename for list of episodes.
+    int random_options;   // Random options added to each outfile.
+    char *random_keys;    // Options to draw random options from (comma-separated)
+    char *seed;           // Random seed.
+    char *hbversion;      // HandBrake version for the option tables.
 };
 
 // Function prototype
@@ -93,24 +101,30 @@ static const struct argp gen_argp = {gen_options, parse_gen_opt, gen_args_doc,
 int main(int argc, char * argv[])
 {
     struct gen_arguments gen_arguments = {1, 0, 0,
-    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+    0, NULL, NULL, NULL};
 
     argp_parse(&gen_argp, argc, argv, ARGP_NO_HELP, NULL, &gen_arguments);
 
-    GKeyFile *config = gen_hbr(gen_arguments.generate, gen_arguments.title,
-        gen_arguments.season, gen_arguments.type,
+    gen_random_t mix = {0, NULL, NULL};
+    if (gen_arguments.random_options > 0) {
+        gen_random_init(&mix, gen_arguments.random_options,
+                gen_arguments.random_keys, gen_arguments.seed,
+                gen_arguments.hbversion);
+    }
+
+    gboolean generated = gen_hbr(stdout, gen_arguments.generate,
+        gen_arguments.title, gen_arguments.season, gen_arguments.type,
         gen_arguments.iso_filename, gen_arguments.year, gen_arguments.crop,
         gen_arguments.name, gen_arguments.input_basedir,
         gen_arguments.output_basedir, gen_arguments.audio,
         gen_arguments.subtitle, gen_arguments.chapters,
-        gen_arguments.episodes);
-    if (config != NULL) {
-    print_hbr(config);
-    g_key_file_free(config);
-    } else {
-    hbr_error("hbr file generation failed", NULL, NULL, NULL, NULL);
+        gen_arguments.episodes, &mix);
+    if (!generated) {
+        hbr_error("hbr file generation failed", NULL, NULL, NULL, NULL);
     }
-    return 0;
+    gen_random_cleanup(&mix);
+    return generated ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 /**
@@ -182,6 +196,18 @@ static error_t parse_gen_opt(int token, char *arg, struct argp_state *state)
     case 'C':
         gen_arguments->chapters = arg;
         break;
+    case 'r':
+        gen_arguments->random_options = g_ascii_strtoll(arg, NULL, 10);
+        break;
+    case 'k':
+        gen_arguments->random_keys = arg;
+        break;
+    case 'e':
+        gen_arguments->seed = arg;
+        break;
+    case 'H':
+        gen_arguments->hbversion = arg;
+        break;
     default:
         return ARGP_ERR_UNKNOWN;
     }
@@ -20,32 +20,75 @@
 #include <ctype.h>                      // for toupper
 #include <errno.h>                      // for errno
 #include <stdlib.h>                     // for NULL, exit
-#include <sys/wait.h>                   // for wait
-#include <sys/types.h>                  // for pid_t
+#include <string.h>                     // for strcmp
 #include <glib.h>
 #include <glib/gstdio.h>
 
 #include "config.h"
 #include "util.h"
+#include "calibrate.h"
+#include "control.h"
+#include "diff_config.h"
+#include "discover.h"
+#include "episode.h"
+#include "jobs.h"
 #include "keyfile.h"
+#include "mem_profile.h"
+#include "metrics.h"
 #include "validate.h"
 #include "build_args.h"
 #include "options.h"
+#include "output_index.h"
+#include "plan.h"
+#include "report.h"
+#include "perf_store.h"
+#include "split.h"
+#include "timings.h"
+#include "trace.h"
+#include "value.h"
 
 // PROTOTYPES
 GKeyFile * fetch_or_generate_keyfile(void);
-void encode_loop(GKeyFile *inkeyfile, GKeyFile *merged_config,
-        const gchar *infile);
-void generate_thumbnail(gchar *filename, int outfile_count, int total_outfiles,
-        gboolean debug);
-int call_handbrake(GPtrArray *args, int out_count, gboolean overwrite,
-        gboolean skip, gchar *filename);
-int hb_fork(gchar *args[], gchar *log_filename);
-gboolean make_output_directory(GKeyFile *outfile, const gchar *group,
-        const gchar* infile_path);
+int run_diff_config(GOptionContext *context);
+void index_plan(const plan_t *plan, const gchar *infile);
+plan_t * plan_keyfile(const gchar *infile, GKeyFile *config,
+        const GArray *episodes, const plan_fingerprint_t *fingerprint);
+void plan_outfiles(plan_builder_t *builder, GKeyFile *inkeyfile,
+        GKeyFile *merged_config, const gchar *infile, gchar **outfiles);
+gboolean encode_loop(const plan_t *plan, const gchar *infile,
+        const GArray *episodes, job_queue_t *queue);
+void print_split(GPtrArray *args, GPtrArray *ranges, const gchar *filename,
+        gsize number, gsize total);
+split_t * queue_split(job_queue_t *queue, GPtrArray *args, GPtrArray *ranges,
+        const gchar *filename, gsize number, gsize total, gboolean preview);
+gboolean confirm_encode(int out_count, gboolean overwrite, gboolean skip,
+        gchar *filename);
 
 // Command line options
 
+/// Write encode plans instead of encoding (hbr plan)
+static gboolean opt_plan          = FALSE;
+/// Compare two global configs instead of encoding (hbr diff-config)
+static gboolean opt_diff_config   = FALSE;
+/// Report indexed outputs instead of encoding (hbr status)
+static gboolean opt_status        = FALSE;
+/// Send a command to a running batch instead of encoding (hbr ctl)
+static gboolean opt_ctl           = FALSE;
+/// Process id of the batch hbr ctl controls, NULL for the only one running
+static gchar    *opt_ctl_pid      = NULL;
+/// Measure encoder speeds instead of encoding (hbr calibrate)
+static gboolean opt_calibrate     = FALSE;
+/// Sample clip for hbr calibrate, NULL to generate one
+static gchar    *opt_clip         = NULL;
+/// Length of the sample clip hbr calibrate generates
+static gint     opt_clip_seconds  = CALIBRATE_CLIP_SECONDS;
+/// Comma separated encodes at once for hbr calibrate
+static gchar    *opt_levels       = NULL;
+/// Comma separated encoders and encoder presets for hbr calibrate
+static gchar    *opt_encoders     = NULL;
+static gchar    *opt_presets      = NULL;
+/// Assumed minutes per encode for diff-config estimates
+static gint     opt_encode_minutes = 60;
 /// Print commands instead of executing
 static gboolean opt_debug         = FALSE;
 /// Generate preview image using ffmpegthumbnailer
@@ -54,12 +97,26 @@ static gboolean opt_preview       = FALSE;
 static gboolean opt_overwrite     = FALSE;
 /// Skip encode if existing file would be overwritten
 static gboolean opt_skip_existing = FALSE;
-/// Specifies a particular episode number to be encoded
-static int      opt_episode       = -1;
+/// Episode ranges to be encoded (episode_range_t), NULL for all
+static GArray   *opt_episodes     = NULL;
+/// Number of encodes to run at once
+static gint     opt_jobs          = 1;
 /// Override handbrake version detection
 static gchar    *opt_hbversion    = NULL;
 /// Override config file location
 static gchar    *opt_config       = NULL;
+/// Print how long each phase took when hbr exits
+static gboolean opt_timings       = FALSE;
+/// Also write every phase timing to this file
+static gchar    *opt_timings_file = NULL;
+/// Write a Chrome trace-event file of the run
+static gchar    *opt_trace        = NULL;
+/// Keep Prometheus metrics of the batch in this file
+static gchar    *opt_metrics      = NULL;
+/// Print allocations per phase and the top allocation sites on exit
+static gboolean opt_mem_profile   = FALSE;
+/// Write the batch throughput report to this file as JSON
+static gchar    *opt_report       = NULL;
 /// Override location to write output files
 static gchar    *opt_output       = NULL;
 /// List of files for hbr to use as input
@@ -80,6 +137,25 @@ static gboolean print_version(
     exit(EXIT_SUCCESS);
 }
 
+static gboolean parse_episodes(
+        __attribute__((unused)) const gchar *option_name,
+        const gchar *value,
+        __attribute__((unused)) gpointer data,
+        GError **error) {
+    GArray *episodes = parse_episode_selection(value, error);
+    if (episodes == NULL) {
+        return FALSE;
+    }
+    if (opt_episodes != NULL) {
+        // repeated -e options add to the selection
+        g_array_append_vals(opt_episodes, episodes->data, episodes->len);
+        g_array_free(episodes, TRUE);
+    } else {
+        opt_episodes = episodes;
+    }
+    return TRUE;
+}
+
 /**
  * @brief Command line options for GOption parser
  */
@@ -95,12 +171,27 @@ static GOptionEntry entries[] =
         "overwrite encoded files without confirmation", NULL},
     {"skip",      'n', 0, G_OPTION_ARG_NONE,      &opt_skip_existing,
         "skip encoding if output file already exists", NULL},
-    {"episode",   'e', 0, G_OPTION_ARG_INT,       &opt_episode,
-        "encodes first entry with matching episode number", "NUMBER"},
+    {"episode",   'e', 0, G_OPTION_ARG_CALLBACK,  (gpointer) parse_episodes,
+        "encodes entries with matching episode numbers (i.e. 3-12,15)", "LIST"},
+    {"jobs",      'j', 0, G_OPTION_ARG_INT,       &opt_jobs,
+        "number of encodes to run at once", "N"},
     {"output",    'o', 0, G_OPTION_ARG_FILENAME,  &opt_output,
         "override location to write output files", "PATH"},
     {"hbversion", 'H', 0, G_OPTION_ARG_STRING,    &opt_hbversion,
         "override handbrake version detection", "X.Y.Z"},
+    {"timings",   0,   0, G_OPTION_ARG_NONE,      &opt_timings,
+        "print how long each phase took on exit", NULL},
+    {"timings-file", 0, 0, G_OPTION_ARG_FILENAME, &opt_timings_file,
+        "write every phase timing to FILE (implies --timings)", "FILE"},
+    {"trace",     0,   0, G_OPTION_ARG_FILENAME,  &opt_trace,
+        "write a Chrome trace-event timeline of the run to FILE", "FILE"},
+    {"metrics",   0,   0, G_OPTION_ARG_FILENAME,  &opt_metrics,
+        "keep Prometheus metrics of the batch in FILE", "FILE"},
+    {"mem-profile", 0, 0, G_OPTION_ARG_NONE,      &opt_mem_profile,
+        "print allocations per phase and the top allocation sites on exit",
+        NULL},
+    {"report",    0,   0, G_OPTION_ARG_FILENAME,  &opt_report,
+        "write the batch throughput report to FILE as JSON", "FILE"},
     {"version",   'V', G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, (gpointer) print_version,
         "prints version info and exit", NULL},
     {G_OPTION_REMAINING, (gchar) 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_input_files,
@@ -108,6 +199,44 @@ static GOptionEntry entries[] =
     { NULL }
 };
 
+/**
+ * @brief Extra command line options for hbr diff-config
+ */
+static GOptionEntry diff_entries[] =
+{
+    {"encode-minutes", 0, 0, G_OPTION_ARG_INT,   &opt_encode_minutes,
+        "minutes one encode takes for the estimate (default 60)", "N"},
+    { NULL }
+};
+
+/**
+ * @brief Extra command line options for hbr ctl
+ */
+static GOptionEntry ctl_entries[] =
+{
+    {"pid",       0,   0, G_OPTION_ARG_STRING,    &opt_ctl_pid,
+        "batch to control when several are running", "PID"},
+    { NULL }
+};
+
+/**
+ * @brief Extra command line options for hbr calibrate
+ */
+static GOptionEntry calibrate_entries[] =
+{
+    {"clip",      0,   0, G_OPTION_ARG_FILENAME,  &opt_clip,
+        "encode FILE instead of a generated test pattern", "FILE"},
+    {"clip-seconds", 0, 0, G_OPTION_ARG_INT,      &opt_clip_seconds,
+        "length of the generated clip (default 10)", "N"},
+    {"levels",    0,   0, G_OPTION_ARG_STRING,    &opt_levels,
+        "encodes to run at once, comma separated (default 1,2,4)", "N,..."},
+    {"encoders",  0,   0, G_OPTION_ARG_STRING,    &opt_encoders,
+        "only calibrate these encoders", "ENCODER,..."},
+    {"presets",   0,   0, G_OPTION_ARG_STRING,    &opt_presets,
+        "only calibrate these encoder presets", "PRESET,..."},
+    { NULL }
+};
+
 /* Global data for options */
 extern option_data_t option_data;
 option_data_t option_data;
@@ -122,13 +251,53 @@ option_data_t option_data;
  */
 int main(int argc, char * argv[])
 {
+    // subcommands come before any options
+    const gchar *usage = "[FILE|DIR...]";
+    if (argc > 1 && strcmp(argv[1], "plan") == 0) {
+        // "hbr plan FILE..." writes plans instead of encoding
+        opt_plan = TRUE;
+        usage = "plan [FILE|DIR...]";
+    } else if (argc > 1 && strcmp(argv[1], "diff-config") == 0) {
+        // "hbr diff-config OLD NEW FILE..." compares two global configs
+        opt_diff_config = TRUE;
+        usage = "diff-config OLD NEW [FILE|DIR...]";
+    } else if (argc > 1 && strcmp(argv[1], "status") == 0) {
+        // "hbr status FILE..." reports on outputs in the output index
+        opt_status = TRUE;
+        usage = "status [FILE|DIR...]";
+    } else if (argc > 1 && strcmp(argv[1], "ctl") == 0) {
+        // "hbr ctl COMMAND" controls a running batch
+        opt_ctl = TRUE;
+        usage = "ctl [--pid PID] status|pause|resume|jobs N|cancel ID|"
+            "move ID POSITION";
+    } else if (argc > 1 && strcmp(argv[1], "calibrate") == 0) {
+        // "hbr calibrate" measures encoder speeds on this host
+        opt_calibrate = TRUE;
+        usage = "calibrate";
+    }
+    if (opt_plan || opt_diff_config || opt_status || opt_ctl ||
+            opt_calibrate) {
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
     // parse command line options/args
-    GOptionContext *context = g_option_context_new("[FILE...]");
+    GOptionContext *context = g_option_context_new(usage);
     g_option_context_set_summary(context,
             "handbrake runner -- runs handbrake with setting from key-value pair file(s)");
     g_option_context_set_description(context,
             "Report bugs at <https://github.com/epakai/hbr/issues>\n");
     g_option_context_add_main_entries (context, entries, NULL);
+    if (opt_diff_config) {
+        g_option_context_add_main_entries (context, diff_entries, NULL);
+    }
+    if (opt_ctl) {
+        g_option_context_add_main_entries (context, ctl_entries, NULL);
+    }
+    if (opt_calibrate) {
+        g_option_context_add_main_entries (context, calibrate_entries, NULL);
+    }
     GError *error = NULL;
     if (!g_option_context_parse(context, &argc, &argv, &error)) {
         hbr_error("Option parsing failed: %s\n", NULL, NULL, NULL, NULL, error->message);
@@ -144,11 +313,65 @@ int main(int argc, char * argv[])
         g_option_context_free(context);
         exit(EXIT_FAILURE);
     }
+    if (opt_jobs < 1 || opt_jobs > JOB_QUEUE_MAX_JOBS) {
+        hbr_error("Option 'jobs' (-j) must be from 1 to %d.", NULL, NULL, NULL,
+                NULL, JOB_QUEUE_MAX_JOBS);
+        g_option_context_free(context);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opt_timings || opt_timings_file != NULL) {
+        timings_enable(opt_timings_file);
+    }
+    if (opt_metrics != NULL) {
+        metrics_enable(opt_metrics);
+    }
+    if (opt_mem_profile) {
+        mem_profile_enable();
+    }
+    if (opt_trace != NULL && !trace_open(opt_trace)) {
+        g_option_context_free(context);
+        exit(EXIT_FAILURE);
+    }
+
+    // ctl only talks to a running batch
+    if (opt_ctl) {
+        gint status = control_client(opt_ctl_pid, opt_input_files);
+        g_option_context_free(context);
+        g_strfreev(opt_input_files);
+        exit(status);
+    }
+
+    // status only reads the output index
+    if (opt_status) {
+        gboolean read = output_index_status(opt_input_files);
+        g_option_context_free(context);
+        g_strfreev(opt_input_files);
+        exit(read ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
 
     // setup options pointers and lookup tables
+    gint64 start = timing_start();
     determine_handbrake_version(opt_hbversion);
+    timing_end(t_version, NULL, start);
     arg_hash_generate();
 
+    if (opt_diff_config) {
+        exit(run_diff_config(context));
+    }
+    if (opt_calibrate) {
+        if (opt_clip_seconds < 1) {
+            hbr_error("Option 'clip-seconds' must be at least 1.", NULL, NULL,
+                    NULL, NULL);
+            exit(EXIT_FAILURE);
+        }
+        gint status = calibrate_run(opt_clip, opt_clip_seconds,
+                opt_levels != NULL ? opt_levels : CALIBRATE_LEVELS,
+                opt_encoders, opt_presets);
+        g_option_context_free(context);
+        exit(status);
+    }
+
     // parse hbr config or create a default
     GKeyFile *config;
     if ((config = fetch_or_generate_keyfile()) == NULL) {
@@ -165,76 +388,175 @@ int main(int argc, char * argv[])
 
         g_option_context_free(context);
         g_strfreev(opt_input_files);
-        g_key_file_free(config);
+        free_key_file(config);
         exit(EXIT_FAILURE);
     }
 
     // check the output path from command line option
-    GKeyFile *temp = g_key_file_new();
+    GKeyFile *temp = new_key_file();
     if (opt_output != NULL) {
-        g_key_file_set_string(temp, "--output", "output_basedir", opt_output);
-        gint option_index = GPOINTER_TO_INT(g_hash_table_lookup(
-                    option_data.options_index,
-                    "output_basedir"));
+        set_key_string(temp, "--output", "output_basedir", opt_output);
+        gint index = option_index("output_basedir");
         // NOTE error output is a little weird when reusing valid_ functions
-        if (!valid_writable_path(&option_data.options[option_index], "--output", temp, NULL)) {
+        if (!valid_writable_path(&option_data.options[index], "--output", temp, NULL)) {
             g_option_context_free(context);
             g_strfreev(opt_input_files);
-            g_key_file_free(config);
+            free_key_file(temp);
+            free_key_file(config);
             exit(EXIT_FAILURE);
         }
     }
+    free_key_file(temp);
 
-    // loop over each input file
+    // expand directories into the keyfiles they contain
+    start = timing_start();
+    gchar **input_files = discover_input_files(opt_input_files);
+    timing_end(t_discover, NULL, start);
+    g_strfreev(opt_input_files);
+    opt_input_files = input_files;
+
+    // settings that change the plan for every input file
+    gchar *settings = g_strdup_printf("handbrake=%s\nconfig=%s\noutput=%s\n",
+            option_data.handbrake_version, config_file_path,
+            opt_output ? opt_output : "");
+
+    // loop over each input file, queueing encodes. A keyfile that fails is
+    // skipped so the rest of the batch still runs.
+    job_queue_t *queue = job_queue_new(opt_jobs);
+    gboolean failed = FALSE;
     int i = 0;
     while (opt_input_files[i] != NULL) {
-        // Disable info messages that occur during some utilities used for
-        // input file validation (merge_key_group(), etc.)
-        message_level_warn();
-        // parse input file
-        GKeyFile *current_infile = parse_validate_key_file(opt_input_files[i], config);
-        // re-enable info level messages
-        message_level_info();
-        if (current_infile == NULL) {
+        plan_fingerprint_t fingerprint;
+        plan_fingerprint_init(&fingerprint, opt_input_files[i],
+                config_file_path, settings);
+        gchar *path = plan_path(opt_input_files[i]);
+
+        // use a stored plan when nothing it depends on has changed
+        plan_t *plan = NULL;
+        const GArray *episodes = opt_episodes;
+        if (!opt_plan) {
+            start = timing_start();
+            plan = plan_load(path, &fingerprint);
+            timing_end(t_plan_load, opt_input_files[i], start);
+        }
+        if (plan == NULL) {
+            // stored plans hold every outfile so any -e works with them
+            plan = plan_keyfile(opt_input_files[i], config,
+                    opt_plan ? NULL : opt_episodes, &fingerprint);
+            // the keyfile was only validated for the selected outfiles
+            episodes = NULL;
+        }
+        if (plan == NULL) {
             hbr_error("Could not complete input file", opt_input_files[i], NULL,
                     NULL, NULL);
-            i++;
-            continue;
-        }
-
-        // merge config sections from global config and current infile
-        GKeyFile *merged = merge_key_group(current_infile, "CONFIG", config,
-                "CONFIG", "MERGED_CONFIG");
-
-        /*
-         * merged may be null if both CONFIG sections are empty or
-         * one group doesn't exist (CONFIG groups are already validated
-         * to exist at this point though)
-         */
-        if (merged == NULL) {
-            hbr_error("Failed to merge global config (%s) and local config",
-                    opt_input_files[i], NULL, NULL, NULL, config_file_path);
+            failed = TRUE;
+        } else if (opt_plan) {
+            GError *write_error = NULL;
+            start = timing_start();
+            gboolean written = plan_write(plan, path, &write_error);
+            timing_end(t_plan_write, opt_input_files[i], start);
+            if (written) {
+                g_print("Planned %u encodes: %s\n", plan_count(plan), path);
+                index_plan(plan, opt_input_files[i]);
+            } else {
+                hbr_error("Failed to write plan: %s", opt_input_files[i], NULL,
+                        NULL, NULL, write_error->message);
+                g_error_free(write_error);
+                failed = TRUE;
+            }
         } else {
-            // override output path if option given
-            if (opt_output != NULL) {
-                g_key_file_set_string(merged, "MERGED_CONFIG", "output_basedir",
-                        opt_output);
+            // encode each selected outfile
+            if (!encode_loop(plan, opt_input_files[i], episodes, queue)) {
+                failed = TRUE;
             }
-
-            // encode each outfile
-            encode_loop(current_infile, merged, opt_input_files[i]);
         }
-
-        // clean up
-        g_key_file_free(current_infile);
-        g_key_file_free(merged);
+        plan_free(plan);
+        g_free(path);
         i++;
     }
+    g_free(settings);
+    // run queued encodes, answering hbr ctl while they run
+    if (!g_queue_is_empty(queue->pending)) {
+        control_open();
+    }
+    job_queue_run(queue);
+    control_close();
+    job_queue_print_usage(queue);
+    report_print(queue);
+    if (opt_report != NULL && queue->records->len > 0) {
+        report_write(queue, opt_report);
+    }
+    if (queue->failed > 0) {
+        failed = TRUE;
+    }
+    job_queue_free(queue);
+    if (opt_episodes != NULL) {
+        g_array_free(opt_episodes, TRUE);
+    }
     arg_hash_cleanup();
-    g_key_file_free(config);
+    typed_value_cache_cleanup();
+    free_key_file(config);
     g_option_context_free(context);
     g_strfreev(opt_input_files);
-    exit(EXIT_SUCCESS);
+    exit(failed ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/**
+ * @brief Runs hbr diff-config with the OLD and NEW configs and the keyfiles
+ *        left in opt_input_files
+ *
+ * @param context option context for printing help
+ *
+ * @return exit status
+ */
+int run_diff_config(GOptionContext *context)
+{
+    if (opt_input_files == NULL || g_strv_length(opt_input_files) < 3) {
+        gchar *temp = g_option_context_get_help(context, TRUE, NULL);
+        printf("%s", temp);
+        g_free(temp);
+        g_option_context_free(context);
+        g_strfreev(opt_input_files);
+        arg_hash_cleanup();
+        return EXIT_FAILURE;
+    }
+    if (opt_encode_minutes < 0) {
+        hbr_error("Option 'encode-minutes' must not be negative.", NULL, NULL,
+                NULL, NULL);
+        g_option_context_free(context);
+        g_strfreev(opt_input_files);
+        arg_hash_cleanup();
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_FAILURE;
+    GKeyFile *old_config = parse_validate_key_file(opt_input_files[0], NULL,
+            NULL, NULL);
+    GKeyFile *new_config = parse_validate_key_file(opt_input_files[1], NULL,
+            NULL, NULL);
+    if (old_config != NULL && new_config != NULL) {
+        gchar **input_files = discover_input_files(opt_input_files + 2);
+        if (diff_config(old_config, new_config, input_files, opt_episodes,
+                    opt_encode_minutes)) {
+            status = EXIT_SUCCESS;
+        }
+        g_strfreev(input_files);
+    }
+    if (old_config != NULL) {
+        free_key_file(old_config);
+    }
+    if (new_config != NULL) {
+        free_key_file(new_config);
+    }
+    if (opt_episodes != NULL) {
+        g_array_free(opt_episodes, TRUE);
+    }
+    arg_hash_cleanup();
+    typed_value_cache_cleanup();
+    perf_store_cleanup();
+    calibration_cleanup();
+    g_option_context_free(context);
+    g_strfreev(opt_input_files);
+    return status;
 }
 
 /**
@@ -288,7 +610,7 @@ GKeyFile *fetch_or_generate_keyfile(void)
     if (g_file_test (config_file->str,
                 (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR))) {
         // parse config file
-        keyfile = parse_validate_key_file(config_file->str, NULL);
+        keyfile = parse_validate_key_file(config_file->str, NULL, NULL, NULL);
         if (keyfile == NULL) {
             // Quit, parse_validate_key_file() will report errors
             (void) g_string_free(config_file, TRUE);
@@ -297,7 +619,7 @@ GKeyFile *fetch_or_generate_keyfile(void)
     } else if (g_file_test (alt_config_file->str,
                 (G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR))) {
         // parse config file
-        keyfile = parse_validate_key_file(config_file->str, NULL);
+        keyfile = parse_validate_key_file(config_file->str, NULL, NULL, NULL);
         if (keyfile == NULL) {
             // Quit, parse_validate_key_file() will report errors
             (void) g_string_free(config_file, TRUE);
@@ -325,46 +647,83 @@ GKeyFile *fetch_or_generate_keyfile(void)
 }
 
 /**
- * @brief Loops through each encode or the specified encode to call handbrake
+ * @brief Parse and validate a keyfile, then build the plan for its selected
+ *        outfiles
  *
- * @param inkeyfile     Input keyfile
- * @param merged_config Input keyfile merged with global config
- * @param infile        Input file path for error reporting
+ * @param infile      path to the keyfile
+ * @param config      global config
+ * @param episodes    episode ranges to plan, NULL for every outfile
+ * @param fingerprint inputs the plan depends on
+ *
+ * @return new plan, NULL when the keyfile is not valid
  */
-void encode_loop(GKeyFile *inkeyfile, GKeyFile *merged_config,
-        const gchar *infile) {
-    // loop for each OUTFILE tag in keyfile
-    gsize out_count = 0;
-    gchar **outfiles = get_outfile_list(inkeyfile, &out_count);
-    if (out_count < 1) {
-        hbr_error("No valid outfile sections found. Quitting", infile, NULL,
-                NULL, NULL);
-        exit(EXIT_FAILURE);
+plan_t * plan_keyfile(const gchar *infile, GKeyFile *config,
+        const GArray *episodes, const plan_fingerprint_t *fingerprint)
+{
+    // Disable info messages that occur during some utilities used for
+    // input file validation (merge_key_group(), etc.)
+    message_level_warn();
+    // parse input file
+    gchar **outfiles = NULL;
+    GKeyFile *current_infile = parse_validate_key_file((gchar *)infile, config,
+            episodes, &outfiles);
+    // re-enable info level messages
+    message_level_info();
+    if (current_infile == NULL) {
+        return NULL;
     }
-    // Handle -e option to encode a single episode
-    if (opt_episode >= 0) {
-        // adjust parameters for following loop so it runs once
-        gchar *group = get_group_from_episode(inkeyfile, opt_episode);
-        if (group != NULL) {
-            // replace outfiles list with list of single episode
-            gchar ** new_outfiles = g_malloc(2*sizeof(gchar *));
-            new_outfiles[0] = g_strdup(group);
-            new_outfiles[1] = NULL;
-            g_free(group);
-            g_strfreev(outfiles);
-            outfiles = new_outfiles;
-            out_count = 1;
-        } else {
-            hbr_error("Could not find specified episode (-e %d). Quitting",
-                    NULL, NULL, NULL, NULL, opt_episode);
-            exit(EXIT_FAILURE);
+
+    // merge config sections from global config and current infile
+    gint64 start = timing_start();
+    GKeyFile *merged = merge_key_group(current_infile, "CONFIG", config,
+            "CONFIG", "MERGED_CONFIG");
+    timing_end(t_merge, infile, start);
+
+    /*
+     * merged may be null if both CONFIG sections are empty or
+     * one group doesn't exist (CONFIG groups are already validated
+     * to exist at this point though)
+     */
+    plan_t *plan = NULL;
+    if (merged == NULL) {
+        hbr_error("Failed to merge global config (%s) and local config",
+                infile, NULL, NULL, NULL, config_file_path);
+    } else {
+        // override output path if option given
+        if (opt_output != NULL) {
+            set_key_string(merged, "MERGED_CONFIG", "output_basedir",
+                    opt_output);
         }
+        plan_builder_t *builder = plan_builder_new();
+        plan_outfiles(builder, current_infile, merged, infile, outfiles);
+        plan = plan_builder_finish(builder, fingerprint);
     }
-    // encode all the episodes if loop parameters weren't modified above
-    for (gsize i = 0; i < out_count; i++) {
+
+    // clean up
+    g_strfreev(outfiles);
+    free_key_file(current_infile);
+    free_key_file(merged);
+    return plan;
+}
+
+/**
+ * @brief Resolves the HandBrakeCLI call for each outfile into a plan
+ *
+ * @param builder       Plan to add encodes to
+ * @param inkeyfile     Input keyfile
+ * @param merged_config Input keyfile merged with global config
+ * @param infile        Input file path for error reporting
+ * @param outfiles      Outfile groups to plan, from parse_validate_key_file()
+ */
+void plan_outfiles(plan_builder_t *builder, GKeyFile *inkeyfile,
+        GKeyFile *merged_config, const gchar *infile, gchar **outfiles)
+{
+    for (gsize i = 0; outfiles[i] != NULL; i++) {
         // merge current outfile section with config section
+        gint64 start = timing_start();
         GKeyFile *current_outfile = merge_key_group(inkeyfile, outfiles[i],
                 merged_config, "MERGED_CONFIG", "CURRENT_OUTFILE");
+        timing_end(t_merge, infile, start);
 
         if (current_outfile == NULL) {
             hbr_error("Failed to merge config and outfile sections. Skipping.",
@@ -372,191 +731,308 @@ void encode_loop(GKeyFile *inkeyfile, GKeyFile *merged_config,
             continue;
         }
 
-        // Determine if we should produce debug output or actually run HandBrake.
-        // This is a special case where outfile config's debug=true only matters
-        // if opt_debug is not true
-        gboolean debug = opt_debug;
+        // outfile config's debug=true only matters if opt_debug is not true,
+        // so it is kept as a flag and applied when the plan runs
+        guint32 flags = 0;
         if (g_key_file_get_boolean(current_outfile, "CURRENT_OUTFILE", "debug", NULL)) {
-            debug = TRUE;
+            flags |= PLAN_DEBUG;
+        }
+        // produce a thumbnail after encoding
+        if (g_key_file_get_boolean(current_outfile, "CURRENT_OUTFILE",
+                    "preview", NULL)) {
+            flags |= PLAN_PREVIEW;
         }
 
-        // build full HandBrakeCLI command
-        GPtrArray *args = build_args(current_outfile, "CURRENT_OUTFILE", debug);
+        // build full HandBrakeCLI command, and a quoted copy for debug output
+        start = timing_start();
+        GPtrArray *args = build_args(current_outfile, "CURRENT_OUTFILE", FALSE);
+        GPtrArray *debug_args = build_args(current_outfile, "CURRENT_OUTFILE",
+                TRUE);
+        timing_end(t_build_args, infile, start);
+        start = timing_start();
         gchar *filename = build_filename(current_outfile, "CURRENT_OUTFILE");
-        gchar *basename = g_path_get_basename(filename);
+        timing_end(t_filename, infile, start);
+        gint season, episode = -1;
+        outfile_episode(inkeyfile, outfiles[i], &season, &episode);
 
-        // output current encode information (codes are for bold text)
-        g_print("%c[1m", 27);
-        if (debug) {
-            g_print("# ");
+        // encode the chapter range in segments, mkvmerge joins them so
+        // only Matroska outputs can be split
+        guint32 split = 0;
+        gint segments = g_key_file_get_integer(current_outfile,
+                "CURRENT_OUTFILE", "split", NULL);
+        if (segments > 1 && !g_str_has_suffix(filename, ".mkv")) {
+            gchar *value = g_key_file_get_value(current_outfile,
+                    "CURRENT_OUTFILE", "split", NULL);
+            hbr_warn("Only Matroska (.mkv) outputs can be split, encoding in"
+                    " one job", infile, outfiles[i], "split", value);
+            g_free(value);
+        } else if (segments > 1) {
+            split = segments;
         }
-        g_print("Encoding: %lu/%lu: %s\n", i+1, out_count, basename);
-        g_print("%c[0m", 27);
+
+        plan_builder_add(builder, outfiles[i], filename, season, episode,
+                flags, split, args, debug_args);
+
+        g_free(filename);
+        g_ptr_array_free(args, TRUE);
+        g_ptr_array_free(debug_args, TRUE);
+        free_key_file(current_outfile);
+    }
+}
+
+/**
+ * @brief Loops through the planned encodes, printing debug output or
+ *        queueing encodes
+ *
+ * @param plan     Plan for the input file
+ * @param infile   Input file path for error reporting
+ * @param episodes Episode ranges to encode, NULL for every planned encode
+ * @param queue    Queue encodes are added to
+ *
+ * @return FALSE when the plan has no outfile to encode
+ */
+gboolean encode_loop(const plan_t *plan, const gchar *infile,
+        const GArray *episodes, job_queue_t *queue) {
+    GArray *selected = plan_select(plan, episodes);
+    gsize out_count = selected->len;
+    if (out_count < 1) {
+        if (episodes != NULL) {
+            hbr_error("No outfile matches the selected episodes", infile,
+                    NULL, NULL, NULL);
+        } else {
+            hbr_error("No valid outfile sections found", infile, NULL, NULL,
+                    NULL);
+        }
+        g_array_free(selected, TRUE);
+        return FALSE;
+    }
+    GString *records = g_string_new(NULL);
+    for (gsize i = 0; i < out_count; i++) {
+        const plan_entry_t *entry = plan_get(plan,
+                g_array_index(selected, guint32, i));
+        const gchar *filename = plan_string(plan, entry->filename);
+
+        // Determine if we should produce debug output or actually run HandBrake.
+        gboolean debug = opt_debug || (entry->flags & PLAN_DEBUG);
 
         if (debug) {
-            // print full handbrake command
-            gchar *temp = g_strjoinv(" ", (gchar**)args->pdata);
+            GPtrArray *args = plan_args(plan, entry, TRUE);
+            GPtrArray *ranges = split_ranges(args, entry->split);
+            if (ranges != NULL) {
+                print_split(args, ranges, filename, i, out_count);
+                g_ptr_array_free(ranges, TRUE);
+                g_ptr_array_free(args, TRUE);
+                continue;
+            }
+            gchar *basename = g_path_get_basename(filename);
+            // output current encode information (codes are for bold text)
+            g_print("%c[1m", 27);
+            g_print("# Encoding: %lu/%lu: %s\n", i+1, out_count, basename);
+            g_print("%c[0m", 27);
+            // print full handbrake command, with the thread budget for -j
+            gchar **argv = build_thread_budget(
+                    g_strdupv((gchar **)args->pdata), opt_jobs);
+            gchar *temp = g_strjoinv(" ", argv);
             g_print("HandBrakeCLI %s\n", temp);
             g_free(temp);
+            g_strfreev(argv);
+            g_ptr_array_free(args, TRUE);
+            g_free(basename);
         } else {
             // Create directory
             gchar *dirname = g_path_get_dirname(filename);
-            if (g_mkdir_with_parents(dirname, 0777) != 0) {
+            gint64 start = timing_start();
+            gint made = g_mkdir_with_parents(dirname, 0777);
+            timing_end(t_mkdir, dirname, start);
+            if (made != 0) {
                 // TODO BUG: g_mkdir_with_parents fails due to permissions
                 // if the directory already exists, but hbr would not have
                 // permissions to create it.
-                hbr_error("Failed to make directory for encode", infile,
+                hbr_error("Failed to create output directory", infile,
                         NULL, NULL, NULL);
-                g_free(filename);
-                g_free(basename);
-                g_key_file_free(current_outfile);
-                g_strfreev(outfiles);
                 g_free(dirname);
-                return;
-            }
-            g_free(dirname);
-            if (!make_output_directory(current_outfile, "CURRENT_OUTFILE", infile)) {
-                // skip this outfile, error output comes from make_extra_directory()
-                g_free(filename);
-                g_free(basename);
-                g_ptr_array_free(args, TRUE);
-                g_key_file_free(current_outfile);
-                continue;
-            }
-            // Run handbrake
-            if (call_handbrake(args, i, opt_overwrite, opt_skip_existing, filename) == -1) {
-                hbr_error("%lu: Handbrake call failed. %s was not encoded",
-                    outfiles[i], NULL, NULL, NULL, i, filename);
-                g_free(filename);
-                g_free(basename);
-                g_ptr_array_free(args, TRUE);
-                g_key_file_free(current_outfile);
                 continue;
             }
+            g_free(dirname);
 
-            // produce a thumbnail
-            gboolean preview = FALSE;
-            if (g_key_file_has_key(current_outfile,
-                        "CURRENT_OUTFILE", "preview", NULL)) {
-                preview = g_key_file_get_boolean(current_outfile,
-                        "CURRENT_OUTFILE", "preview", NULL);
-            }
-            if (opt_preview || preview) {
-                generate_thumbnail(filename, i, out_count, debug);
+            // Queue handbrake (existing files are confirmed now so prompts
+            // don't interrupt running encodes)
+            gint64 asked = g_get_monotonic_time();
+            gboolean confirmed = confirm_encode(i, opt_overwrite,
+                    opt_skip_existing, (gchar *)filename);
+            queue->prompt_seconds += (g_get_monotonic_time() - asked) / 1e6;
+            if (confirmed) {
+                GPtrArray *args = plan_args(plan, entry, FALSE);
+                gboolean preview = opt_preview ||
+                    (entry->flags & PLAN_PREVIEW);
+                GPtrArray *ranges = split_ranges(args, entry->split);
+                const gchar *fingerprint;
+                if (ranges != NULL) {
+                    split_t *split = queue_split(queue, args, ranges,
+                            filename, i, out_count, preview);
+                    fingerprint = split->fingerprint;
+                    g_ptr_array_free(ranges, TRUE);
+                } else {
+                    job_t *job = job_new(args, filename, i, out_count,
+                            preview);
+                    job->fingerprint = output_index_fingerprint(args);
+                    fingerprint = job->fingerprint;
+                    job_queue_push(queue, job);
+                }
+                output_index_add_planned(records, filename, infile,
+                        plan_string(plan, entry->group), fingerprint,
+                        plan->header->keyfile.mtime,
+                        plan->header->keyfile.size);
+                g_ptr_array_free(args, TRUE);
             }
         }
+    }
+    // record queued outputs before any of them finish
+    gint64 start = timing_start();
+    output_index_append(records);
+    timing_end(t_index, infile, start);
+    g_string_free(records, TRUE);
+    g_array_free(selected, TRUE);
+    return TRUE;
+}
 
-        g_free(filename);
+/**
+ * @brief Print the HandBrakeCLI call of each segment of a split encode and
+ *        the mkvmerge call joining them
+ *
+ * @param args     quoted HandBrakeCLI arguments of the whole encode
+ * @param ranges   chapter ranges from split_ranges()
+ * @param filename output filename
+ * @param number   which outfile is being encoded (0 based)
+ * @param total    outfile count of the input file
+ */
+void print_split(GPtrArray *args, GPtrArray *ranges, const gchar *filename,
+        gsize number, gsize total)
+{
+    GPtrArray *segments = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < ranges->len; i++) {
+        gchar *segment = split_segment_filename(filename, i+1);
+        GPtrArray *segment_args = split_segment_args(args, ranges->pdata[i],
+                segment, TRUE);
+        gchar *basename = g_path_get_basename(segment);
+        // output current encode information (codes are for bold text)
+        g_print("%c[1m", 27);
+        g_print("# Encoding: %lu/%lu: %s (chapters %s)\n", number+1, total,
+                basename, (gchar *) ranges->pdata[i]);
+        g_print("%c[0m", 27);
+        gchar **argv = build_thread_budget(
+                g_strdupv((gchar **)segment_args->pdata), opt_jobs);
+        gchar *temp = g_strjoinv(" ", argv);
+        g_print("HandBrakeCLI %s\n", temp);
+        g_free(temp);
+        g_strfreev(argv);
         g_free(basename);
-        g_ptr_array_free(args, TRUE);
-        g_key_file_free(current_outfile);
+        g_ptr_array_free(segment_args, TRUE);
+        g_ptr_array_add(segments, segment);
     }
-    g_strfreev(outfiles);
+    gchar *basename = g_path_get_basename(filename);
+    g_print("%c[1m", 27);
+    g_print("# Joining: %lu/%lu: %s\n", number+1, total, basename);
+    g_print("%c[0m", 27);
+    gchar *command = split_join_command(filename, segments);
+    g_print("%s\n", command);
+    g_free(command);
+    g_free(basename);
+    g_ptr_array_free(segments, TRUE);
 }
 
 /**
- * @brief Create the output directory where files are to be written
+ * @brief Queue a job for each segment of a split encode. The segments are
+ *        joined when the last of them finishes.
  *
- * @param outfile     Keyfile to fetch values from
- * @param group       Group to fetch values from
- * @param infile_path Path to keyfile (for error output)
+ * @param queue    Queue the segment jobs are added to
+ * @param args     HandBrakeCLI arguments of the whole encode
+ * @param ranges   chapter ranges from split_ranges()
+ * @param filename output filename
+ * @param number   which outfile is being encoded (0 based)
+ * @param total    outfile count of the input file
+ * @param preview  generate a thumbnail of the joined output
  *
- * @return True on success
+ * @return the split, owned by the queue
  */
-gboolean make_output_directory(GKeyFile *outfile, const gchar *group,
-        const gchar* infile_path)
+split_t * queue_split(job_queue_t *queue, GPtrArray *args, GPtrArray *ranges,
+        const gchar *filename, gsize number, gsize total, gboolean preview)
 {
-    // create output directory
-    GError *error = NULL;
-    gchar *output_path = g_key_file_get_string(outfile, group,
-            "output_basedir", &error);
-    gchar *filename = build_filename(outfile, group);
-    gchar *dirname = g_path_get_dirname(filename);
-
-    if (g_mkdir_with_parents(dirname, 0777) != 0) {
-        hbr_error("Failed to create output directory", infile_path, NULL,
-                NULL, NULL);
-        g_free(output_path);
-        g_free(filename);
-        g_free(dirname);
-        return FALSE;
+    split_t *split = split_new(args, filename, number, total, preview);
+    for (guint i = 0; i < ranges->len; i++) {
+        gchar *segment = split_segment_filename(filename, i+1);
+        GPtrArray *segment_args = split_segment_args(args, ranges->pdata[i],
+                segment, FALSE);
+        job_t *job = job_new(segment_args, segment, number, total, FALSE);
+        // the whole output is recorded once the segments are joined
+        perf_key_free(job->perf_key);
+        job->perf_key = NULL;
+        job->split = split;
+        split_add_segment(split, segment);
+        job_queue_push(queue, job);
+        g_ptr_array_free(segment_args, TRUE);
+        g_free(segment);
     }
-    g_free(output_path);
-    g_free(filename);
-    g_free(dirname);
-    return TRUE;
+    return split;
 }
 
 /**
- * @brief Generates a thumbnail for the given filename
+ * @brief Record every output of a plan in the output index, replacing the
+ *        outputs indexed for the keyfile before
  *
- * @param filename       Video filename to generate a thumbnail for
- * @param outfile_count  Number of the current outfile being processed
- * @param total_outfiles Total number of outfiles being processed
- * @param debug          When true, command is printed instead of run
+ * @param plan   Plan for the input file
+ * @param infile Input file path
  */
-void generate_thumbnail(gchar *filename, int outfile_count, int total_outfiles,
-        gboolean debug)
+void index_plan(const plan_t *plan, const gchar *infile)
 {
-    errno = 0;
-    GString *ft_command = g_string_new("ffmpegthumbnailer");
-    g_string_append_printf(ft_command,
-            " -i\"%s\" -o\"%s.png\" -s0 -q10 2>&1 >/dev/null", filename,
-            filename);
-    g_print("%c[1m", 27);
-    g_print("# Generating preview: %d/%d: %s.png\n", outfile_count+1,
-            total_outfiles, filename);
-    g_print("%c[0m", 27);
-    if (debug) {
-        g_print("%s\n", ft_command->str);
-    } else if (system((char *) ft_command->str) == -1) {
-        hbr_error("Failed to run ffmpegthumbnailer: %s", NULL, NULL, NULL,
-                NULL, g_strerror(errno));
+    GString *records = g_string_new(NULL);
+    output_index_add_keyfile(records, infile);
+    for (guint32 i = 0; i < plan_count(plan); i++) {
+        const plan_entry_t *entry = plan_get(plan, i);
+        GPtrArray *args = plan_args(plan, entry, FALSE);
+        gchar *fingerprint = output_index_fingerprint(args);
+        output_index_add_planned(records, plan_string(plan, entry->filename),
+                infile, plan_string(plan, entry->group), fingerprint,
+                plan->header->keyfile.mtime, plan->header->keyfile.size);
+        g_free(fingerprint);
+        g_ptr_array_free(args, TRUE);
     }
-    g_string_free(ft_command, TRUE);
+    gint64 start = timing_start();
+    output_index_append(records);
+    timing_end(t_index, infile, start);
+    g_string_free(records, TRUE);
 }
 
 /**
- * @brief Handle the logic around calling handbrake
+ * @brief Decide if an encode should run when its output file may exist
  *
- * @param args      String containing argumenst HandBrakeCLI
  * @param out_count Which outfile section is being encoded
  * @param overwrite Overwrite existing files
  * @param skip      Skip encoding existing files
- * @param filename  output filename (also used to generate log filename)
+ * @param filename  output filename
  *
- * @return error status from hb_fork(), 0 is success, 1 on other errors
+ * @return TRUE when the encode should run
  */
-int call_handbrake(GPtrArray *args, int out_count, gboolean overwrite,
-        gboolean skip, gchar *filename)
+gboolean confirm_encode(int out_count, gboolean overwrite, gboolean skip,
+        gchar *filename)
 {
-    GString *log_filename = g_string_new(filename);
-    log_filename = g_string_append(log_filename, ".log");
-
-    g_ptr_array_insert(args, 0, g_strdup("HandBrakeCLI"));
     // file doesn't exist, go ahead
     if ( g_access((char *) filename, F_OK ) != 0 ) {
-        int r = hb_fork((gchar **)args->pdata, log_filename->str);
-        g_string_free(log_filename, TRUE);
-        return r;
+        return TRUE;
     }
     // file isn't writable, error
     if ( g_access((char *) filename, W_OK ) != 0 ) {
         hbr_error("%d: File is not writable", filename, NULL, NULL, NULL,
                 out_count);
-        g_string_free(log_filename, TRUE);
-        return 1;
+        return FALSE;
     }
     // overwrite option was set, go ahead
     if (overwrite) {
-        int r = hb_fork((gchar **)args->pdata, log_filename->str);
-        g_string_free(log_filename, TRUE);
-        return r;
+        return TRUE;
     // skip existing files
     } else if (skip) {
         g_print("File: \"%s\" already exists. Skipping encode.\n", filename);
-        g_string_free(log_filename, TRUE);
-        return 1;
+        return FALSE;
     // prompt user
     } else {
         g_print("File: \"%s\" already exists.\n", filename);
@@ -572,84 +1048,6 @@ int call_handbrake(GPtrArray *args, int out_count, gboolean overwrite,
             // clear any extra input
             while ( getchar() != '\n' ) {}
         } while (c != 'N' && c != 'Y');
-        if ( c == 'N' ) {
-            g_string_free(log_filename, TRUE);
-            return 1;
-        } else {
-            int r = hb_fork((gchar **)args->pdata, log_filename->str);
-            g_string_free(log_filename, TRUE);
-            return r;
-        }
-    }
-}
-
-/**
- * @brief Test write access, fork and exec, redirect output for logging
- *
- * @param args String containing arguments to HandBrakeCLI
- * @param log_filename Filename to log to
- *
- * @return 1 on error, 0 on success
- */
-int hb_fork(gchar *args[], gchar *log_filename)
-{
-    // test logfile was opened
-    errno = 0;
-    FILE *logfile = fopen((const char *)log_filename, "w");
-    if (logfile == NULL) {
-        hbr_error("hb_fork(): Failed to open logfile: %s", log_filename,
-                NULL, NULL, NULL, g_strerror(errno));
-        return 1;
-    }
-
-    // test pipe was opened
-    int hb_err[2];
-    pid_t hb_pid;
-    if (pipe(hb_err)<0){
-        fclose(logfile);
-        return 1;
-    }
-
-    // fork to call HandBrakeCLI
-    hb_pid = fork();
-    if (hb_pid > 0) {
-        //close write end of pipe on parent
-        close(hb_err[1]);
-    } else if (hb_pid == 0) {
-        // replace stderr with our pipe for HandBrakeCLI
-        close(hb_err[0]);
-        close(2);
-        dup2(hb_err[1], 2);
-        close(hb_err[1]);
-        errno = 0;
-        if (execvp("HandBrakeCLI", args) == -1) {
-            hbr_error("Failed to exec HandBrakeCLI: %s", log_filename, NULL,
-                    NULL, NULL, g_strerror(errno));
-        }
-        _exit(EXIT_FAILURE);
-    } else {
-        perror("hb_fork(): Failed to fork");
-        close(hb_err[1]);
-        fclose(logfile);
-        return 1;
-    }
-    // buffer output from handbrake and write to logfile
-    char *buf = g_malloc(1024*sizeof(char));
-    if (buf == NULL) {
-        hbr_error("hb_fork(): failed to allocate memory. Quitting", NULL, NULL,
-                NULL, NULL);
-        close(hb_err[1]);
-        fclose(logfile);
-        exit(EXIT_FAILURE);
-    }
-    int bytes;
-    while ( (bytes = read(hb_err[0], buf, 1024)) > 0) {
-        fwrite(buf, sizeof(char), bytes, logfile);
+        return c == 'Y';
     }
-    g_free(buf);
-    close(hb_err[1]);
-    fclose(logfile);
-    wait(NULL);
-    //TODO we can do a little better return value here if we check wait's parameter
-    return 0;
 }
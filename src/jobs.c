@@ -0,0 +1,1056 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>                      // for errno, EINTR, EAGAIN, ECHILD
+#include <fcntl.h>                      // for O_WRONLY, O_CREAT, fcntl
+#include <poll.h>                       // for poll, struct pollfd
+#include <signal.h>                     // for sigaction, SIGCHLD
+#include <stdio.h>                      // for NULL, sscanf, fwrite
+#include <stdlib.h>                     // for system, _exit
+#include <string.h>                     // for strstr, strchr
+#include <sys/resource.h>               // for struct rusage
+#include <sys/wait.h>                   // for wait4
+#include <unistd.h>                     // for fork, dup2, execvp, pipe
+#include <glib/gstdio.h>
+
+#include "build_args.h"
+#include "control.h"
+#include "jobs.h"
+#include "metrics.h"
+#include "output_index.h"
+#include "timings.h"
+#include "trace.h"
+#include "util.h"
+
+/// usage_metric names, used as sidecar keys
+static const gchar *usage_names[u_metric_count] = {
+    "wall_seconds", "user_seconds", "system_seconds", "max_rss_kib",
+    "block_reads", "block_writes", "voluntary_switches",
+    "involuntary_switches"
+};
+
+/// usage_metric labels for job_queue_print_usage()
+static const gchar *usage_labels[u_metric_count] = {
+    "wall s", "user cpu s", "system cpu s", "max rss KiB", "block reads",
+    "block writes", "voluntary cs", "involuntary cs"
+};
+
+/// longest partial line kept from HandBrakeCLI stdout
+#define MAX_OUTPUT_LINE 4096
+
+/// slots taken by the first pass of a --two-pass --turbo encode, which only
+/// analyzes the source with the fastest settings
+#define LIGHT_PASS_LOAD 0.5
+
+/// the SIGCHLD handler writes here so poll() wakes when an encode exits
+static int child_pipe[2] = { -1, -1 };
+
+static gboolean open_pipe(int fds[2], int flags);
+static void sigchld_handler(int signum);
+static gboolean reap_jobs(job_queue_t *queue);
+static void read_output(job_queue_t *queue, job_t *job);
+static void parse_progress(job_t *job, const gchar *line);
+static gdouble job_load(const job_t *job);
+static gdouble queue_load(job_queue_t *queue);
+static void start_job(job_queue_t *queue, job_t *job);
+static void finish_job(job_queue_t *queue, job_t *job, gint status,
+        const struct rusage *usage);
+static void finish_output(job_queue_t *queue, job_record_t *record,
+        const gchar *fingerprint, gboolean preview, gsize number, gsize total,
+        gboolean cancelled, const gchar *log_filename);
+static void finish_segment(job_queue_t *queue, job_t *job, gboolean success);
+static void start_join(job_queue_t *queue, split_t *split);
+static void finish_join(job_queue_t *queue, job_t *job, gint status);
+static void finish_split(job_queue_t *queue, split_t *split, gboolean joined);
+static void record_usage(job_queue_t *queue, job_t *job,
+        const struct rusage *usage);
+static void clear_record(gpointer data);
+
+/**
+ * @brief Create a job for an encode
+ *
+ * @param args     HandBrakeCLI arguments from build_args() (copied)
+ * @param filename output filename, the log is written next to it
+ * @param number   outfile number within its input file (0 based)
+ * @param total    outfile count of the input file
+ * @param preview  generate a thumbnail after the encode
+ *
+ * @return new job, free with job_free()
+ */
+job_t * job_new(GPtrArray *args, const gchar *filename, gsize number,
+        gsize total, gboolean preview)
+{
+    job_t *job = g_malloc0(sizeof(job_t));
+    job->argv = g_new0(gchar *, args->len + 2);
+    job->argv[0] = g_strdup("HandBrakeCLI");
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        job->argv[i+1] = g_strdup(args->pdata[i]);
+    }
+    job->filename = g_strdup(filename);
+    job->log_filename = g_strdup_printf("%s.log", filename);
+    job->number = number;
+    job->total = total;
+    job->preview = preview;
+    job->perf_key = perf_key_new(args);
+    gboolean two_pass = FALSE;
+    gboolean turbo = FALSE;
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        two_pass = two_pass || strcmp(args->pdata[i], "--two-pass") == 0;
+        turbo = turbo || strcmp(args->pdata[i], "--turbo") == 0;
+    }
+    job->light_first_pass = two_pass && turbo;
+    job->output_fd = -1;
+    job->eta = -1;
+    return job;
+}
+
+/**
+ * @brief Free a job created by job_new()
+ */
+void job_free(job_t *job)
+{
+    if (job == NULL) {
+        return;
+    }
+    g_strfreev(job->argv);
+    g_free(job->filename);
+    g_free(job->log_filename);
+    g_free(job->fingerprint);
+    perf_key_free(job->perf_key);
+    if (job->output_fd >= 0) {
+        close(job->output_fd);
+    }
+    if (job->output != NULL) {
+        g_string_free(job->output, TRUE);
+    }
+    g_free(job);
+}
+
+/**
+ * @brief Create an empty job queue
+ *
+ * @param max_jobs most encodes to run at once (1 to JOB_QUEUE_MAX_JOBS)
+ *
+ * @return new queue, free with job_queue_free()
+ */
+job_queue_t * job_queue_new(gint max_jobs)
+{
+    job_queue_t *queue = g_malloc0(sizeof(job_queue_t));
+    queue->pending = g_queue_new();
+    queue->running = g_hash_table_new(g_direct_hash, g_direct_equal);
+    queue->joining = g_hash_table_new(g_direct_hash, g_direct_equal);
+    queue->max_jobs = CLAMP(max_jobs, 1, JOB_QUEUE_MAX_JOBS);
+    queue->records = g_array_new(FALSE, TRUE, sizeof(job_record_t));
+    g_array_set_clear_func(queue->records, clear_record);
+    return queue;
+}
+
+/**
+ * @brief Add a job to the end of the queue. The queue takes ownership.
+ */
+void job_queue_push(job_queue_t *queue, job_t *job)
+{
+    job->id = ++queue->last_id;
+    g_queue_push_tail(queue->pending, job);
+}
+
+/**
+ * @brief Run every queued job, keeping max_jobs slots busy, and return
+ *        once all of them have finished. HandBrakeCLI progress is read
+ *        while waiting, and shown when only one job runs at a time.
+ *        hbr ctl commands are answered while waiting when control_open()
+ *        was called.
+ *
+ * @param queue queue to run
+ */
+void job_queue_run(job_queue_t *queue)
+{
+    // wake poll() when an encode exits
+    struct sigaction action = { 0 };
+    struct sigaction old_action;
+    if (child_pipe[0] < 0 && !open_pipe(child_pipe, O_NONBLOCK)) {
+        hbr_error("Failed to create pipe: %s", NULL, NULL, NULL, NULL,
+                g_strerror(errno));
+        return;
+    }
+    action.sa_handler = sigchld_handler;
+    action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGCHLD, &action, &old_action);
+
+    gint64 started = g_get_monotonic_time();
+    GArray *fds = g_array_new(FALSE, FALSE, sizeof(struct pollfd));
+    GPtrArray *readers = g_ptr_array_new();
+    while (!g_queue_is_empty(queue->pending) ||
+            g_hash_table_size(queue->running) > 0 ||
+            g_hash_table_size(queue->joining) > 0) {
+        // fill free slots
+        while (!queue->paused &&
+                !g_queue_is_empty(queue->pending) && queue_load(queue) +
+                job_load(g_queue_peek_head(queue->pending)) <=
+                queue->max_jobs) {
+            start_job(queue, g_queue_pop_head(queue->pending));
+        }
+        if (g_hash_table_size(queue->running) == 0 &&
+                g_hash_table_size(queue->joining) == 0 && !queue->paused) {
+            continue;
+        }
+
+        // wait for HandBrakeCLI output, an encode or join to exit, a
+        // control command, or the next metrics update
+        g_array_set_size(fds, 0);
+        g_ptr_array_set_size(readers, 0);
+        struct pollfd fd = { child_pipe[0], POLLIN, 0 };
+        g_array_append_val(fds, fd);
+        GHashTableIter iter;
+        gpointer job;
+        g_hash_table_iter_init(&iter, queue->running);
+        while (g_hash_table_iter_next(&iter, NULL, &job)) {
+            if (((job_t *)job)->output_fd >= 0) {
+                fd.fd = ((job_t *)job)->output_fd;
+                g_array_append_val(fds, fd);
+                g_ptr_array_add(readers, job);
+            }
+        }
+        guint control_first = fds->len;
+        control_add_fds(fds);
+        errno = 0;
+        if (poll((struct pollfd *)fds->data, fds->len,
+                    metrics_enabled() ? METRICS_INTERVAL_MS : -1) < 0 &&
+                errno != EINTR) {
+            hbr_error("Failed waiting for HandBrakeCLI: %s", NULL, NULL, NULL,
+                    NULL, g_strerror(errno));
+            break;
+        }
+        for (guint i = 0; i < readers->len; i++) {
+            if (g_array_index(fds, struct pollfd, i+1).revents != 0) {
+                read_output(queue, readers->pdata[i]);
+            }
+        }
+        gchar drain[64];
+        while (read(child_pipe[0], drain, sizeof(drain)) > 0) {
+            continue;
+        }
+        if (!reap_jobs(queue)) {
+            break;
+        }
+        if (fds->len > control_first) {
+            control_handle(queue,
+                    &g_array_index(fds, struct pollfd, control_first));
+        }
+        metrics_update(queue, FALSE);
+    }
+    metrics_update(queue, TRUE);
+    queue->run_seconds += (g_get_monotonic_time() - started) / 1e6;
+    g_ptr_array_free(readers, TRUE);
+    g_array_free(fds, TRUE);
+    sigaction(SIGCHLD, &old_action, NULL);
+}
+
+/**
+ * @brief Change how many jobs run at once. Running jobs are left alone when
+ *        it is lowered, fewer are started until they finish.
+ *
+ * @param queue    queue to change
+ * @param max_jobs most encodes to run at once (1 to JOB_QUEUE_MAX_JOBS)
+ */
+void job_queue_set_max_jobs(job_queue_t *queue, gint max_jobs)
+{
+    queue->max_jobs = CLAMP(max_jobs, 1, JOB_QUEUE_MAX_JOBS);
+    metrics_update(queue, TRUE);
+}
+
+/**
+ * @brief Cancel a job. A pending job is dropped, a running job's
+ *        HandBrakeCLI is sent SIGTERM and the job finishes once it exits.
+ *        Either way the output is recorded in the output index as not
+ *        encoded.
+ *
+ * @param queue queue holding the job
+ * @param id    id given to the job by job_queue_push()
+ *
+ * @return FALSE when no pending or running job has that id
+ */
+gboolean job_queue_cancel(job_queue_t *queue, guint id)
+{
+    for (GList *link = queue->pending->head; link != NULL;
+            link = link->next) {
+        job_t *job = link->data;
+        if (job->id != id) {
+            continue;
+        }
+        g_queue_delete_link(queue->pending, link);
+        if (job->split != NULL) {
+            // the whole output is cancelled with it
+            job->cancelled = TRUE;
+            finish_segment(queue, job, FALSE);
+            job_free(job);
+            metrics_update(queue, TRUE);
+            return TRUE;
+        }
+        if (job->fingerprint != NULL) {
+            GString *record = g_string_new(NULL);
+            output_index_add_result(record, job->filename, job->fingerprint,
+                    FALSE);
+            output_index_append(record);
+            g_string_free(record, TRUE);
+        }
+        queue->cancelled++;
+        job_free(job);
+        metrics_update(queue, TRUE);
+        return TRUE;
+    }
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, queue->running);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        job_t *job = value;
+        if (job->id == id) {
+            // finish_job() counts it once HandBrakeCLI exits
+            job->cancelled = TRUE;
+            kill(job->pid, SIGTERM);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Move a pending job to another place in the queue
+ *
+ * @param queue    queue holding the job
+ * @param id       id given to the job by job_queue_push()
+ * @param position new place among pending jobs, 1 starts next, past the
+ *                 end starts last
+ *
+ * @return FALSE when no pending job has that id
+ */
+gboolean job_queue_move(job_queue_t *queue, guint id, guint position)
+{
+    for (GList *link = queue->pending->head; link != NULL;
+            link = link->next) {
+        job_t *job = link->data;
+        if (job->id == id) {
+            g_queue_delete_link(queue->pending, link);
+            g_queue_push_nth(queue->pending, job,
+                    position > 0 ? (gint) position - 1 : 0);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Print the resources used by the queue's jobs: totals, and the
+ *        largest single job for each
+ */
+void job_queue_print_usage(const job_queue_t *queue)
+{
+    if (queue->completed + queue->failed == 0) {
+        return;
+    }
+    if (queue->cancelled > 0) {
+        g_print("%lu encodes finished, %lu failed, %lu cancelled\n",
+                queue->completed, queue->failed, queue->cancelled);
+    } else {
+        g_print("%lu encodes finished, %lu failed\n", queue->completed,
+                queue->failed);
+    }
+    g_print("  %-14s %14s %14s  %s\n", "", "total", "largest", "output");
+    for (gint i = 0; i < u_metric_count; i++) {
+        if (queue->usage_max_output[i] == NULL) {
+            continue;
+        }
+        gchar *basename = g_path_get_basename(queue->usage_max_output[i]);
+        const gchar *format = i <= u_system ? "%.3f" : "%.0f";
+        gchar *total = g_strdup_printf(format, queue->usage_total[i]);
+        gchar *largest = g_strdup_printf(format, queue->usage_max[i]);
+        // peak memory doesn't add up across jobs
+        g_print("  %-14s %14s %14s  %s\n", usage_labels[i],
+                i == u_max_rss ? "-" : total, largest, basename);
+        g_free(largest);
+        g_free(total);
+        g_free(basename);
+    }
+}
+
+/**
+ * @brief Free a queue and any jobs it still holds
+ */
+void job_queue_free(job_queue_t *queue)
+{
+    if (queue == NULL) {
+        return;
+    }
+    g_queue_free_full(queue->pending, (GDestroyNotify)job_free);
+    g_hash_table_destroy(queue->running);
+    g_hash_table_destroy(queue->joining);
+    g_free(queue->busy_slots);
+    for (gint i = 0; i < u_metric_count; i++) {
+        g_free(queue->usage_max_output[i]);
+    }
+    g_array_free(queue->records, TRUE);
+    g_free(queue);
+}
+
+/**
+ * @brief Fork and exec HandBrakeCLI with stderr written to a log file
+ *
+ * @param args         arguments to HandBrakeCLI, NULL terminated
+ * @param log_filename filename to log to
+ * @param output_fd    set to the non-blocking read end of a pipe on
+ *                     HandBrakeCLI's stdout (progress), NULL to leave stdout
+ *                     alone
+ *
+ * @return pid of HandBrakeCLI, -1 on error
+ */
+pid_t hb_fork(gchar *args[], gchar *log_filename, int *output_fd)
+{
+    // test logfile was opened
+    errno = 0;
+    int log_fd = g_open(log_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (log_fd < 0) {
+        hbr_error("hb_fork(): Failed to open logfile: %s", log_filename,
+                NULL, NULL, NULL, g_strerror(errno));
+        return -1;
+    }
+    int output_pipe[2] = { -1, -1 };
+    if (output_fd != NULL && !open_pipe(output_pipe, 0)) {
+        hbr_error("hb_fork(): Failed to create pipe: %s", log_filename,
+                NULL, NULL, NULL, g_strerror(errno));
+        close(log_fd);
+        return -1;
+    }
+
+    // fork to call HandBrakeCLI
+    pid_t hb_pid = fork();
+    if (hb_pid == 0) {
+        // replace stderr with the logfile for HandBrakeCLI
+        dup2(log_fd, 2);
+        close(log_fd);
+        if (output_fd != NULL) {
+            dup2(output_pipe[1], 1);
+        }
+        errno = 0;
+        if (execvp("HandBrakeCLI", args) == -1) {
+            hbr_error("Failed to exec HandBrakeCLI: %s", log_filename, NULL,
+                    NULL, NULL, g_strerror(errno));
+        }
+        _exit(EXIT_FAILURE);
+    } else if (hb_pid < 0) {
+        perror("hb_fork(): Failed to fork");
+    }
+    close(log_fd);
+    if (output_fd != NULL) {
+        close(output_pipe[1]);
+        if (hb_pid > 0) {
+            fcntl(output_pipe[0], F_SETFL, O_NONBLOCK);
+            *output_fd = output_pipe[0];
+        } else {
+            close(output_pipe[0]);
+        }
+    }
+    return hb_pid;
+}
+
+/**
+ * @brief Generates a thumbnail for the given filename
+ *
+ * @param filename       Video filename to generate a thumbnail for
+ * @param outfile_count  Number of the current outfile being processed
+ * @param total_outfiles Total number of outfiles being processed
+ * @param debug          When true, command is printed instead of run
+ */
+void generate_thumbnail(gchar *filename, int outfile_count, int total_outfiles,
+        gboolean debug)
+{
+    errno = 0;
+    GString *ft_command = g_string_new("ffmpegthumbnailer");
+    g_string_append_printf(ft_command,
+            " -i\"%s\" -o\"%s.png\" -s0 -q10 2>&1 >/dev/null", filename,
+            filename);
+    g_print("%c[1m", 27);
+    g_print("# Generating preview: %d/%d: %s.png\n", outfile_count+1,
+            total_outfiles, filename);
+    g_print("%c[0m", 27);
+    if (debug) {
+        g_print("%s\n", ft_command->str);
+    } else if (system((char *) ft_command->str) == -1) {
+        hbr_error("Failed to run ffmpegthumbnailer: %s", NULL, NULL, NULL,
+                NULL, g_strerror(errno));
+    }
+    g_string_free(ft_command, TRUE);
+}
+
+/**
+ * @brief Slots a job takes: part of one until the final pass of a
+ *        --two-pass --turbo encode, one otherwise. The final pass is the
+ *        last task, a subtitle scan adds a task before the first pass.
+ */
+static gdouble job_load(const job_t *job)
+{
+    if (job->light_first_pass && job->task < job->task_count) {
+        return LIGHT_PASS_LOAD;
+    }
+    if (job->light_first_pass && job->task_count == 0) {
+        // nothing reported yet
+        return LIGHT_PASS_LOAD;
+    }
+    return 1;
+}
+
+/**
+ * @brief Slots taken by the queue's running jobs
+ */
+static gdouble queue_load(job_queue_t *queue)
+{
+    gdouble load = 0;
+    GHashTableIter iter;
+    gpointer job;
+    g_hash_table_iter_init(&iter, queue->running);
+    while (g_hash_table_iter_next(&iter, NULL, &job)) {
+        load += job_load(job);
+    }
+    return load;
+}
+
+/**
+ * @brief Print progress and start a job's HandBrakeCLI process
+ */
+static void start_job(job_queue_t *queue, job_t *job)
+{
+    if (!queue->quiet) {
+        gchar *basename = g_path_get_basename(job->filename);
+        // output current encode information (codes are for bold text)
+        g_print("%c[1m", 27);
+        g_print("Encoding: %lu/%lu: %s\n", job->number+1, job->total,
+                basename);
+        g_print("%c[0m", 27);
+        g_free(basename);
+    }
+
+    // take the first free slot, light first passes can need more slots
+    // than max_jobs
+    job->slot = 0;
+    while (job->slot < queue->slot_count && queue->busy_slots[job->slot]) {
+        job->slot++;
+    }
+    if (job->slot == queue->slot_count) {
+        queue->slot_count++;
+        queue->busy_slots = g_renew(gboolean, queue->busy_slots,
+                queue->slot_count);
+    }
+    queue->busy_slots[job->slot] = TRUE;
+
+    job->started = g_get_monotonic_time();
+    if (trace_enabled()) {
+        gchar *lane = g_strdup_printf("slot %d", job->slot + 1);
+        gchar *number = g_strdup_printf("%lu/%lu", job->number+1, job->total);
+        trace_begin("encode", lane, "output", job->filename, "log",
+                job->log_filename, "outfile", number, "fingerprint",
+                job->fingerprint, NULL);
+        g_free(number);
+        g_free(lane);
+    }
+    // budgeted when the job starts, hbr ctl jobs may have changed -j. Light
+    // first passes share slots, so more than max_jobs encodes can be running
+    // and each is budgeted for all of them. The share isn't raised when they
+    // finish.
+    job->argv = build_thread_budget(job->argv, MAX(queue->max_jobs,
+                (gint) g_hash_table_size(queue->running) + 1));
+    job->pid = hb_fork(job->argv, job->log_filename, &job->output_fd);
+    if (job->pid < 0) {
+        finish_job(queue, job, -1, NULL);
+        return;
+    }
+    job->output = g_string_new(NULL);
+    g_hash_table_insert(queue->running, GINT_TO_POINTER(job->pid), job);
+    metrics_update(queue, TRUE);
+}
+
+/**
+ * @brief Record a job's result in the queue, the output index, and the
+ *        performance store, generate its thumbnail, and free it
+ *
+ * @param queue  queue the job ran in
+ * @param job    finished job
+ * @param status wait status, -1 when the job could not be started
+ * @param usage  resources used by HandBrakeCLI, NULL when not started
+ */
+static void finish_job(job_queue_t *queue, job_t *job, gint status,
+        const struct rusage *usage)
+{
+    job->status = status;
+    if (usage != NULL) {
+        // progress HandBrakeCLI wrote before exiting
+        if (job->output_fd >= 0) {
+            read_output(queue, job);
+        }
+        record_usage(queue, job, usage);
+    }
+    timing_end(t_encode, job->filename, job->started);
+    queue->busy_slots[job->slot] = FALSE;
+    gboolean success = status != -1 && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0 && !job->cancelled;
+    if (trace_enabled()) {
+        gchar *lane = g_strdup_printf("slot %d", job->slot + 1);
+        gchar *pid = job->pid > 0 ? g_strdup_printf("%d", job->pid) : NULL;
+        gchar *result;
+        if (status == -1) {
+            result = g_strdup("not started");
+        } else if (WIFSIGNALED(status)) {
+            result = g_strdup_printf("signal %d", WTERMSIG(status));
+        } else {
+            result = g_strdup_printf("exit %d", WEXITSTATUS(status));
+        }
+        trace_end("encode", lane, "pid", pid, "result", result, NULL);
+        g_free(result);
+        g_free(pid);
+        g_free(lane);
+    }
+    if (job->split != NULL) {
+        finish_segment(queue, job, success);
+        job_free(job);
+        metrics_update(queue, TRUE);
+        return;
+    }
+    job_record_t record = { 0 };
+    record.success = success;
+    record.wall_seconds = job->usage[u_wall];
+    if (success) {
+        perf_read_log(job->log_filename, &job->source_seconds, &job->avg_fps);
+        record.source_seconds = job->source_seconds;
+        record.avg_fps = job->avg_fps;
+    }
+    // the record takes the filename and key options
+    record.filename = job->filename;
+    record.perf_key = job->perf_key;
+    job->filename = NULL;
+    job->perf_key = NULL;
+    finish_output(queue, &record, job->fingerprint, job->preview, job->number,
+            job->total, job->cancelled, job->log_filename);
+    job_free(job);
+    metrics_update(queue, TRUE);
+}
+
+/**
+ * @brief Record the result of an output in the queue, the output index, and
+ *        the performance store, and generate its thumbnail
+ *
+ * @param queue        queue the output was encoded in
+ * @param record       result of the output, taken by the queue's records
+ * @param fingerprint  argument fingerprint for the output index, NULL to not
+ *                     record
+ * @param preview      generate a thumbnail after a successful encode
+ * @param number       outfile number within its input file (0 based)
+ * @param total        outfile count of the input file
+ * @param cancelled    the encode was cancelled through hbr ctl
+ * @param log_filename log named in the failure message, NULL when the
+ *                     failure was already reported
+ */
+static void finish_output(job_queue_t *queue, job_record_t *record,
+        const gchar *fingerprint, gboolean preview, gsize number, gsize total,
+        gboolean cancelled, const gchar *log_filename)
+{
+    if (fingerprint != NULL) {
+        GString *result = g_string_new(NULL);
+        output_index_add_result(result, record->filename, fingerprint,
+                record->success);
+        gint64 start = timing_start();
+        output_index_append(result);
+        timing_end(t_index, record->filename, start);
+        g_string_free(result, TRUE);
+    }
+    if (record->success) {
+        queue->completed++;
+        if (record->perf_key != NULL) {
+            perf_store_add(record->perf_key, record->source_seconds,
+                    record->avg_fps, record->wall_seconds);
+        }
+        queue->media_seconds += record->source_seconds;
+        GStatBuf buf;
+        if (g_stat(record->filename, &buf) == 0) {
+            queue->output_bytes += buf.st_size;
+            record->output_bytes = buf.st_size;
+        }
+        if (preview) {
+            // the queue doesn't start encodes while this runs
+            gint64 started = g_get_monotonic_time();
+            gint64 start = timing_start();
+            generate_thumbnail(record->filename, number, total, FALSE);
+            timing_end(t_thumbnail, record->filename, start);
+            queue->thumbnail_seconds +=
+                (g_get_monotonic_time() - started) / 1e6;
+        }
+    } else if (cancelled) {
+        queue->cancelled++;
+        hbr_info("%lu: Encode cancelled. %s was not encoded", log_filename,
+                NULL, NULL, NULL, number+1, record->filename);
+    } else {
+        queue->failed++;
+        if (log_filename != NULL) {
+            hbr_error("%lu: Handbrake call failed. %s was not encoded",
+                    log_filename, NULL, NULL, NULL, number+1,
+                    record->filename);
+        }
+    }
+    // cancelled encodes aren't reported
+    if (cancelled) {
+        clear_record(record);
+    } else {
+        g_array_append_val(queue->records, *record);
+    }
+}
+
+/**
+ * @brief Add a finished segment job to its split output. A failed or
+ *        cancelled segment drops its pending siblings and stops its running
+ *        ones. Once the last segment finishes the segments are joined and
+ *        the output is recorded.
+ *
+ * @param queue   queue the segment ran in
+ * @param job     finished segment job, freed by the caller
+ * @param success the segment was encoded
+ */
+static void finish_segment(job_queue_t *queue, job_t *job, gboolean success)
+{
+    split_t *split = job->split;
+    split->wall_seconds += job->usage[u_wall];
+    if (success) {
+        perf_read_log(job->log_filename, &job->source_seconds, &job->avg_fps);
+        split->source_seconds += job->source_seconds;
+        if (job->avg_fps > 0) {
+            split->encode_seconds += job->source_seconds / job->avg_fps;
+        }
+    } else {
+        if (job->cancelled) {
+            split->cancelled = TRUE;
+        } else {
+            split->failed = TRUE;
+        }
+        if (split->failed_log == NULL) {
+            split->failed_log = g_strdup(job->log_filename);
+        }
+        // the output can't be joined without this segment
+        GList *link = queue->pending->head;
+        while (link != NULL) {
+            GList *next = link->next;
+            job_t *sibling = link->data;
+            if (sibling->split == split) {
+                g_queue_delete_link(queue->pending, link);
+                split->remaining--;
+                job_free(sibling);
+            }
+            link = next;
+        }
+        // running siblings finish here again once they exit
+        GHashTableIter iter;
+        gpointer value;
+        g_hash_table_iter_init(&iter, queue->running);
+        while (g_hash_table_iter_next(&iter, NULL, &value)) {
+            job_t *sibling = value;
+            if (sibling->split == split && !sibling->cancelled) {
+                sibling->cancelled = TRUE;
+                kill(sibling->pid, SIGTERM);
+            }
+        }
+    }
+    if (--split->remaining > 0) {
+        return;
+    }
+    if (split->failed || split->cancelled) {
+        finish_split(queue, split, FALSE);
+    } else {
+        start_join(queue, split);
+    }
+}
+
+/**
+ * @brief Start mkvmerge joining a split's segments, tracked in the queue's
+ *        joining table until reap_jobs() sees it exit
+ */
+static void start_join(job_queue_t *queue, split_t *split)
+{
+    job_t *job = g_malloc0(sizeof(job_t));
+    job->filename = g_strdup(split->filename);
+    job->log_filename = g_strdup_printf("%s.log", split->filename);
+    job->split = split;
+    job->output_fd = -1;
+    job->eta = -1;
+    job->started = g_get_monotonic_time();
+    job->pid = split_join_start(split);
+    if (job->pid < 0) {
+        job_free(job);
+        finish_split(queue, split, FALSE);
+        return;
+    }
+    g_hash_table_insert(queue->joining, GINT_TO_POINTER(job->pid), job);
+    metrics_update(queue, TRUE);
+}
+
+/**
+ * @brief Record a split output once mkvmerge has exited
+ *
+ * @param queue  queue the split ran in
+ * @param job    job from start_join(), freed here
+ * @param status wait status of mkvmerge
+ */
+static void finish_join(job_queue_t *queue, job_t *job, gint status)
+{
+    timing_end(t_join, job->filename, job->started);
+    split_t *split = job->split;
+    job_free(job);
+    finish_split(queue, split, split_join_finish(split, status));
+}
+
+/**
+ * @brief Record the result of a split output and free the split
+ *
+ * @param queue  queue the split ran in
+ * @param split  split whose segments all finished
+ * @param joined the segments were encoded and joined
+ */
+static void finish_split(job_queue_t *queue, split_t *split, gboolean joined)
+{
+    job_record_t record = { 0 };
+    record.success = joined;
+    record.wall_seconds = split->wall_seconds;
+    if (record.success) {
+        record.source_seconds = split->source_seconds;
+        if (split->encode_seconds > 0) {
+            record.avg_fps = split->source_seconds / split->encode_seconds;
+        }
+    }
+    record.filename = g_strdup(split->filename);
+    record.perf_key = split->perf_key;
+    split->perf_key = NULL;
+    // join failures were reported by split_join_start() or
+    // split_join_finish()
+    finish_output(queue, &record, split->fingerprint, split->preview,
+            split->number, split->total, split->cancelled && !split->failed,
+            split->failed || split->cancelled ? split->failed_log : NULL);
+    split_free(split);
+    metrics_update(queue, TRUE);
+}
+
+/**
+ * @brief Add a job's resource usage to the queue's summary and write it to
+ *        a sidecar next to its log (output filename with .rusage appended)
+ *
+ * @param queue queue the job ran in
+ * @param job   finished job
+ * @param usage resources used by HandBrakeCLI, from wait4()
+ */
+static void record_usage(job_queue_t *queue, job_t *job,
+        const struct rusage *usage)
+{
+    job->usage[u_wall] = (g_get_monotonic_time() - job->started) / 1e6;
+    job->usage[u_user] = usage->ru_utime.tv_sec +
+        usage->ru_utime.tv_usec / 1e6;
+    job->usage[u_system] = usage->ru_stime.tv_sec +
+        usage->ru_stime.tv_usec / 1e6;
+    job->usage[u_max_rss] = usage->ru_maxrss;
+    job->usage[u_block_in] = usage->ru_inblock;
+    job->usage[u_block_out] = usage->ru_oublock;
+    job->usage[u_voluntary] = usage->ru_nvcsw;
+    job->usage[u_involuntary] = usage->ru_nivcsw;
+
+    GString *sidecar = g_string_new("[HandBrakeCLI]\n");
+    g_string_append_printf(sidecar, "pid=%d\n", job->pid);
+    if (WIFEXITED(job->status)) {
+        g_string_append_printf(sidecar, "exit=%d\n", WEXITSTATUS(job->status));
+    } else if (WIFSIGNALED(job->status)) {
+        g_string_append_printf(sidecar, "signal=%d\n", WTERMSIG(job->status));
+    }
+    for (gint i = 0; i < u_metric_count; i++) {
+        g_string_append_printf(sidecar, i <= u_system ? "%s=%.3f\n" :
+                "%s=%.0f\n", usage_names[i], job->usage[i]);
+
+        queue->usage_total[i] += job->usage[i];
+        if (queue->usage_max_output[i] == NULL ||
+                job->usage[i] > queue->usage_max[i]) {
+            queue->usage_max[i] = job->usage[i];
+            g_free(queue->usage_max_output[i]);
+            queue->usage_max_output[i] = g_strdup(job->filename);
+        }
+    }
+    gchar *filename = g_strdup_printf("%s.rusage", job->filename);
+    GError *error = NULL;
+    if (!g_file_set_contents(filename, sidecar->str, sidecar->len, &error)) {
+        hbr_warn("Failed to write resource usage: %s", filename, NULL, NULL,
+                NULL, error->message);
+        g_error_free(error);
+    }
+    g_free(filename);
+    g_string_free(sidecar, TRUE);
+}
+
+/**
+ * @brief GDestroyNotify clearing a job_record_t in the queue's records
+ */
+static void clear_record(gpointer data)
+{
+    job_record_t *record = data;
+    g_free(record->filename);
+    perf_key_free(record->perf_key);
+}
+
+/**
+ * @brief Create a pipe that isn't inherited by HandBrakeCLI
+ *
+ * @param fds   read and write ends
+ * @param flags extra file status flags for both ends (O_NONBLOCK)
+ *
+ * @return TRUE on success
+ */
+static gboolean open_pipe(int fds[2], int flags)
+{
+    if (pipe(fds) != 0) {
+        return FALSE;
+    }
+    for (gint i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        if (flags != 0) {
+            fcntl(fds[i], F_SETFL, flags);
+        }
+    }
+    return TRUE;
+}
+
+/**
+ * @brief SIGCHLD handler waking job_queue_run()
+ */
+static void sigchld_handler(__attribute__((unused)) int signum)
+{
+    int saved_errno = errno;
+    if (write(child_pipe[1], "", 1) < 0) {
+        // the pipe is full, poll() will wake anyway
+    }
+    errno = saved_errno;
+}
+
+/**
+ * @brief Finish every encode that has exited, keeping its resource usage
+ *
+ * @return FALSE when waiting failed
+ */
+static gboolean reap_jobs(job_queue_t *queue)
+{
+    while (TRUE) {
+        gint status;
+        struct rusage usage;
+        errno = 0;
+        pid_t pid = wait4(-1, &status, WNOHANG, &usage);
+        if (pid == 0 || (pid < 0 && errno == ECHILD)) {
+            return TRUE;
+        }
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            hbr_error("Failed waiting for HandBrakeCLI: %s", NULL, NULL, NULL,
+                    NULL, g_strerror(errno));
+            return FALSE;
+        }
+        job_t *job = g_hash_table_lookup(queue->running, GINT_TO_POINTER(pid));
+        if (job != NULL) {
+            g_hash_table_remove(queue->running, GINT_TO_POINTER(pid));
+            finish_job(queue, job, status, &usage);
+        } else if ((job = g_hash_table_lookup(queue->joining,
+                        GINT_TO_POINTER(pid))) != NULL) {
+            g_hash_table_remove(queue->joining, GINT_TO_POINTER(pid));
+            finish_join(queue, job, status);
+        }
+    }
+}
+
+/**
+ * @brief Read what HandBrakeCLI has written to stdout and update the job's
+ *        progress. Output is passed through when jobs run one at a time.
+ *        The pipe is closed once HandBrakeCLI closes it.
+ */
+static void read_output(job_queue_t *queue, job_t *job)
+{
+    gchar buffer[4096];
+    while (TRUE) {
+        ssize_t count = read(job->output_fd, buffer, sizeof(buffer));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0 && errno == EAGAIN) {
+            break;
+        }
+        if (count <= 0) {
+            close(job->output_fd);
+            job->output_fd = -1;
+            break;
+        }
+        if (queue->max_jobs == 1 && g_hash_table_size(queue->running) <= 1 &&
+                !queue->quiet) {
+            fwrite(buffer, 1, count, stdout);
+            fflush(stdout);
+        }
+        // progress lines end in \r, other output in \n
+        g_string_append_len(job->output, buffer, count);
+        gsize start = 0;
+        for (gsize i = 0; i < job->output->len; i++) {
+            gchar c = job->output->str[i];
+            if (c == '\r' || c == '\n') {
+                job->output->str[i] = '\0';
+                parse_progress(job, job->output->str + start);
+                start = i + 1;
+            }
+        }
+        g_string_erase(job->output, 0, start);
+        if (job->output->len > MAX_OUTPUT_LINE) {
+            g_string_truncate(job->output, 0);
+        }
+    }
+}
+
+/**
+ * @brief Update a job's progress from one line of HandBrakeCLI output like
+ *        "Encoding: task 1 of 2, 45.67 % (123.45 fps, avg 120.00 fps,
+ *        ETA 00h01m02s)". Other lines are ignored.
+ */
+static void parse_progress(job_t *job, const gchar *line)
+{
+    const gchar *match = strstr(line, "Encoding: task ");
+    gint task, count;
+    gdouble percent;
+    if (match == NULL || sscanf(match, "Encoding: task %d of %d, %lf %%",
+                &task, &count, &percent) != 3 || count < 1) {
+        return;
+    }
+    job->task = task;
+    job->task_count = count;
+    job->progress = CLAMP((task - 1 + percent / 100) / count, 0, 1);
+    gdouble fps;
+    match = strchr(match, '(');
+    if (match != NULL && sscanf(match, "(%lf fps", &fps) == 1) {
+        job->fps = fps;
+    }
+    gint h, m, sec;
+    match = strstr(line, "ETA ");
+    if (match != NULL && sscanf(match, "ETA %dh%dm%ds", &h, &m, &sec) == 3) {
+        job->eta = h * 3600 + m * 60 + sec;
+    } else {
+        job->eta = -1;
+    }
+}
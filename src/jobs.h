@@ -0,0 +1,205 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _jobs_h
+#define _jobs_h
+
+#include <glib.h>
+#include <sys/types.h>
+
+#include "perf_store.h"
+#include "split.h"
+
+/// most encodes -j or hbr ctl jobs may run at once
+#define JOB_QUEUE_MAX_JOBS 256
+
+/**
+ * @brief Resources used by one HandBrakeCLI run, from wait4()
+ */
+typedef enum {
+    /// seconds between fork and reaping
+    u_wall,
+    /// user CPU seconds
+    u_user,
+    /// system CPU seconds
+    u_system,
+    /// peak resident set size in KiB
+    u_max_rss,
+    /// filesystem reads in 512 byte blocks
+    u_block_in,
+    /// filesystem writes in 512 byte blocks
+    u_block_out,
+    /// voluntary context switches (mostly waiting on I/O)
+    u_voluntary,
+    /// involuntary context switches (preempted)
+    u_involuntary,
+    u_metric_count
+} usage_metric;
+
+/**
+ * @brief A single HandBrakeCLI encode waiting in or run by a job_queue_t
+ */
+typedef struct {
+    /**
+     * @brief HandBrakeCLI arguments, NULL terminated, argv[0] is HandBrakeCLI
+     */
+    gchar **argv;
+    /// output video filename
+    gchar *filename;
+    /// HandBrakeCLI stderr is written here
+    gchar *log_filename;
+    /// outfile number within its input file (0 based, for messages)
+    gsize number;
+    /// outfile count of the input file (for messages)
+    gsize total;
+    /// number given by job_queue_push(), 1 based, for hbr ctl
+    guint id;
+    /// cancelled through hbr ctl, finishes without counting as failed
+    gboolean cancelled;
+    /// generate a thumbnail after a successful encode
+    gboolean preview;
+    /// output this job encodes a segment of (or joins, in joining), NULL for
+    /// a whole encode
+    split_t *split;
+    /// --two-pass --turbo encode, its first pass takes a fraction of a slot
+    gboolean light_first_pass;
+    /// argument fingerprint recorded in the output index, NULL to not record
+    gchar *fingerprint;
+    /// options recorded in the performance store after a successful encode,
+    /// NULL to not record
+    perf_key_t *perf_key;
+    /// pid while running, 0 before start
+    pid_t pid;
+    /// queue slot while running (0 based), lane name in --trace
+    gint slot;
+    /// read end of a pipe on HandBrakeCLI's stdout, -1 once closed
+    int output_fd;
+    /// HandBrakeCLI stdout after the last complete progress line
+    GString *output;
+    /// current HandBrakeCLI task (pass) and task count, 0 until reported
+    gint task;
+    gint task_count;
+    /// fraction of the whole encode done, 0 to 1
+    gdouble progress;
+    /// current encoding speed reported by HandBrakeCLI
+    gdouble fps;
+    /// seconds left in the current task reported by HandBrakeCLI, -1 unknown
+    gint eta;
+    /// monotonic time the job started
+    gint64 started;
+    /// wait status once finished
+    gint status;
+    /// resources used by HandBrakeCLI once finished
+    gdouble usage[u_metric_count];
+    /// source length and average speed from the log once finished, 0 if
+    /// HandBrakeCLI didn't report them
+    gdouble source_seconds;
+    gdouble avg_fps;
+} job_t;
+
+/**
+ * @brief What the throughput report keeps of a finished job
+ */
+typedef struct {
+    /// output video filename
+    gchar *filename;
+    /// key options of the encode (encoder, preset, quality, vb, ...)
+    perf_key_t *perf_key;
+    gboolean success;
+    /// seconds HandBrakeCLI ran
+    gdouble wall_seconds;
+    /// source length and average speed from the log, 0 if not reported
+    gdouble source_seconds;
+    gdouble avg_fps;
+    /// size of the output file
+    guint64 output_bytes;
+} job_record_t;
+
+/**
+ * @brief Encodes to be run, at most max_jobs slots of them at a time. The
+ *        first pass of a --two-pass --turbo encode takes part of a slot, so
+ *        other encodes start alongside it. Running encodes are never
+ *        stopped, when they reach their final pass and no longer fit, new
+ *        encodes wait until they do.
+ */
+typedef struct {
+    /// jobs not started yet
+    GQueue *pending;
+    /// running jobs, pid to job_t
+    GHashTable *running;
+    /// mkvmerge runs joining split outputs, pid to a job_t with split set.
+    /// They don't take a slot.
+    GHashTable *joining;
+    /// most jobs to run at once
+    gint max_jobs;
+    /// slot_count flags, TRUE while a job runs in that slot
+    gboolean *busy_slots;
+    /// size of busy_slots, grown as jobs start. More than max_jobs when it
+    /// was lowered or first passes shared slots.
+    gint slot_count;
+    /// don't start pending jobs (hbr ctl pause)
+    gboolean paused;
+    /// don't print encodes as they start or pass HandBrakeCLI progress on
+    gboolean quiet;
+    /// id of the last job pushed
+    guint last_id;
+    /// jobs that finished with a zero exit status
+    gsize completed;
+    /// jobs that failed to start or exited with an error
+    gsize failed;
+    /// jobs cancelled before or while running
+    gsize cancelled;
+    /// source seconds encoded by successful jobs
+    gdouble media_seconds;
+    /// size of the output files of successful jobs
+    guint64 output_bytes;
+    /// usage summed over every job that ran
+    gdouble usage_total[u_metric_count];
+    /// largest usage of any one job
+    gdouble usage_max[u_metric_count];
+    /// output filename of the job with the largest usage
+    gchar *usage_max_output[u_metric_count];
+    /// job_record_t for every job that finished, in the order they did
+    GArray *records;
+    /// seconds job_queue_run() spent running encodes
+    gdouble run_seconds;
+    /// seconds encodes waited on thumbnails (made between encodes)
+    gdouble thumbnail_seconds;
+    /// seconds spent asking whether to overwrite outputs
+    gdouble prompt_seconds;
+} job_queue_t;
+
+job_t *job_new(GPtrArray *args, const gchar *filename, gsize number,
+        gsize total, gboolean preview);
+void job_free(job_t *job);
+
+job_queue_t *job_queue_new(gint max_jobs);
+void job_queue_push(job_queue_t *queue, job_t *job);
+void job_queue_run(job_queue_t *queue);
+void job_queue_set_max_jobs(job_queue_t *queue, gint max_jobs);
+gboolean job_queue_cancel(job_queue_t *queue, guint id);
+gboolean job_queue_move(job_queue_t *queue, guint id, guint position);
+void job_queue_print_usage(const job_queue_t *queue);
+void job_queue_free(job_queue_t *queue);
+
+pid_t hb_fork(gchar *args[], gchar *log_filename, int *output_fd);
+void generate_thumbnail(gchar *filename, int outfile_count, int total_outfiles,
+        gboolean debug);
+
+#endif
@@ -21,48 +21,84 @@
 #include <string.h>  // for strcmp
 
 #include "util.h"
+#include "episode.h"
 #include "keyfile.h"
+#include "keyset.h"
+#include "timings.h"
 #include "validate.h"
+#include "value.h"
 
 extern option_data_t option_data;
 
 /**
  * @brief Parses and validates the key value file.
  *
- * @param infile path for key value file.
- * @param config Global config used for validating input files.
- *               If config is NULL then infile is treated as a global config.
+ * @param infile   path for key value file.
+ * @param config   Global config used for validating input files.
+ *                 If config is NULL then infile is treated as a global config.
+ * @param episodes Only validate CONFIG and the outfiles selected by these
+ *                 episode ranges (see parse_episode_selection()). NULL
+ *                 validates every outfile.
+ * @param outfiles Output for the NULL terminated list of selected outfile
+ *                 groups in file order, must be freed with g_strfreev().
+ *                 Only set for input files that are valid. May be NULL.
  *
  * @return GKeyfile pointer. NULL on failure. Must be freed by caller.
  */
-GKeyFile * parse_validate_key_file(char *infile, GKeyFile *config)
+GKeyFile * parse_validate_key_file(char *infile, GKeyFile *config,
+        const GArray *episodes, gchar ***outfiles)
 {
     gboolean valid = TRUE;
     GKeyFile *keyfile = NULL;
     // check file is readable and does not have duplicate group names
-    if (!pre_validate_key_file(infile)) {
+    gint64 start = timing_start();
+    gboolean readable = pre_validate_key_file(infile);
+    timing_end(t_pre_validate, infile, start);
+    if (!readable) {
         return NULL;
     }
-    if ((keyfile = parse_key_file(infile)) == NULL) {
+    start = timing_start();
+    keyfile = parse_key_file(infile);
+    timing_end(t_parse, infile, start);
+    if (keyfile == NULL) {
         return NULL;
     }
 
+    start = timing_start();
     if (config == NULL) {
         // validate a global config
         if (!post_validate_config_file(keyfile, infile)) {
             valid = FALSE;
         }
     } else {
-        // validate an input file
-        if (!post_validate_input_file(keyfile, infile, config)) {
+        // validate an input file (optionally limited to selected outfiles)
+        episode_index_t *index = episode_index_new(keyfile);
+        gchar **selected = select_outfiles(index, episodes);
+        episode_index_free(index);
+        if (episodes != NULL && selected[0] == NULL) {
             valid = FALSE;
+            hbr_error("No outfile matches the selected episodes", infile,
+                    NULL, NULL, NULL);
+        } else {
+            validation_scope_t *scope = episodes ?
+                validation_scope_new(keyfile, selected) : NULL;
+            if (!post_validate_input_file(keyfile, infile, config, scope)) {
+                valid = FALSE;
+            }
+            validation_scope_free(scope);
+        }
+        if (valid && outfiles != NULL) {
+            *outfiles = selected;
+        } else {
+            g_strfreev(selected);
         }
     }
+    timing_end(t_post_validate, infile, start);
 
     if (valid) {
         return keyfile;
     } else {
-        g_key_file_free(keyfile);
+        free_key_file(keyfile);
         return NULL;
     }
 }
@@ -77,7 +113,7 @@ GKeyFile * parse_validate_key_file(char *infile, GKeyFile *config)
 GKeyFile * parse_key_file(char *infile)
 {
     GError *error = NULL;
-    GKeyFile *keyfile = g_key_file_new();
+    GKeyFile *keyfile = new_key_file();
     if (!g_key_file_load_from_file (keyfile, infile,
                 G_KEY_FILE_KEEP_COMMENTS, &error))
     {
@@ -94,13 +130,75 @@ GKeyFile * parse_key_file(char *infile)
             hbr_error("%s", NULL, NULL, NULL, NULL, error->message);
         }
         g_error_free(error);
-        g_key_file_free(keyfile);
+        free_key_file(keyfile);
         return NULL;
     }
+    return keyfile;
+}
+
+/*
+ * Values read with get_typed_value() are cached per keyfile pointer, so
+ * keyfiles are created, changed and freed through the functions below,
+ * which drop the keyfile's cached lookups. Setting keys on a keyfile
+ * nothing has been read from yet (one just made by new_key_file()) can't
+ * leave a stale lookup behind.
+ */
+
+/**
+ * @brief Creates an empty keyfile using ',' to separate lists, with no
+ *        lookups cached for it even when a freed keyfile had its address
+ *
+ * @return new GKeyFile, free with free_key_file()
+ */
+GKeyFile * new_key_file(void)
+{
+    GKeyFile *keyfile = g_key_file_new();
     g_key_file_set_list_separator(keyfile, ',');
+    typed_value_cache_forget(keyfile);
     return keyfile;
 }
 
+/**
+ * @brief Frees a keyfile along with the value lookups cached for it
+ *
+ * @param keyfile keyfile to free
+ */
+void free_key_file(GKeyFile *keyfile)
+{
+    typed_value_cache_forget(keyfile);
+    g_key_file_free(keyfile);
+}
+
+/**
+ * @brief Sets a key's raw value (as g_key_file_set_value() does)
+ */
+void set_key_value(GKeyFile *keyfile, const gchar *group, const gchar *key,
+        const gchar *value)
+{
+    typed_value_cache_forget(keyfile);
+    g_key_file_set_value(keyfile, group, key, value);
+}
+
+/**
+ * @brief Sets a key to a string, escaping it (as g_key_file_set_string()
+ *        does)
+ */
+void set_key_string(GKeyFile *keyfile, const gchar *group, const gchar *key,
+        const gchar *string)
+{
+    typed_value_cache_forget(keyfile);
+    g_key_file_set_string(keyfile, group, key, string);
+}
+
+/**
+ * @brief Removes a key from a group, if it is set
+ */
+void remove_key(GKeyFile *keyfile, const gchar *group, const gchar *key)
+{
+    typed_value_cache_forget(keyfile);
+    g_key_file_remove_key(keyfile, group, key, NULL);
+}
+
 /**
  * @brief Creates a new keyfile with group new_group that is a copy of
  *        keyfile's group
@@ -114,12 +212,8 @@ GKeyFile * parse_key_file(char *infile)
 GKeyFile * copy_group_new(GKeyFile *keyfile, const gchar *group,
         const gchar *new_group)
 {
-    GKeyFile *k = g_key_file_new();
-    g_key_file_set_list_separator(k, ',');
-
     // check group exists
     if (!g_key_file_has_group(keyfile, group)) {
-        g_key_file_free(k);
         return NULL;
     }
 
@@ -130,14 +224,15 @@ GKeyFile * copy_group_new(GKeyFile *keyfile, const gchar *group,
     // check group is not empty
     // (cannot make a new empty group via GKeyFile API)
     if (key_count == 0) {
-        g_key_file_free(k);
+        g_strfreev(key_list);
         return NULL;
     }
+    GKeyFile *k = new_key_file();
 
     // copy each key and value to new group in new key file
     for (gsize i = 0; i < key_count; i++) {
         gchar *temp = g_key_file_get_value(keyfile, group, key_list[i], NULL);
-        g_key_file_set_value(k, new_group, key_list[i], temp);
+        set_key_value(k, new_group, key_list[i], temp);
         g_free(temp);
     }
     g_strfreev(key_list);
@@ -180,12 +275,12 @@ GKeyFile * merge_key_group(GKeyFile *pref, const gchar *p_group,
         return NULL;
     } else if (k == NULL){
         // make a new keyfile if the copy failed, but pref still has good keys
-        k = g_key_file_new();
-        g_key_file_set_list_separator(k, ',');
+        k = new_key_file();
     }
 
     // copy each key and value to new group in new key file overwriting
     // values from alt
+    keyset_t *alt_keys = keyset_from_group(alt, a_group);
     for (gsize i = 0; i < key_count; i++) {
         // check new_group for conflicting options and remove them
         /* TODO FIXME merging or removing conflicts may not be working correctly
@@ -194,17 +289,20 @@ GKeyFile * merge_key_group(GKeyFile *pref, const gchar *p_group,
          */
 
         gchar *temp = g_key_file_get_value(pref, p_group, key_list[i], NULL);
-        remove_conflicts(key_list[i], temp, k, new_group, alt, a_group);
-        g_key_file_set_value(k, new_group, key_list[i], temp);
+        remove_conflicts(key_list[i], temp, k, new_group, alt, a_group,
+                alt_keys);
+        set_key_value(k, new_group, key_list[i], temp);
         g_free(temp);
     }
+    keyset_free(alt_keys);
     g_strfreev(key_list);
     return k;
 }
 
 /**
  * @brief Removes keys from modified_keyfile that conflict with key.
- *        This enables us to override conflicting options.
+ *        This enables us to override conflicting options. Negated options
+ *        (set to false) never conflict.
  *
  * @param key              The key we are checking has any conflicts
  * @param value            Value of the key, okay if NULL
@@ -216,54 +314,46 @@ GKeyFile * merge_key_group(GKeyFile *pref, const gchar *p_group,
  *                         at the same level should produce an error during
  *                         validation instead.
  * @param check_group      Group in the checked_keyfile
+ * @param checked_keys     Keyset of check_group from keyset_from_group()
  */
 void remove_conflicts(gchar *key, gchar *value, GKeyFile *modified_keyfile,
         const gchar *mod_group, GKeyFile *checked_keyfile,
-        const gchar* check_group)
+        const gchar* check_group, const keyset_t *checked_keys)
 {
-    // TODO this function doesn't remove negation conflicts (--markers --no-markers)
-    // get list of indexes for conflicts
-    GSList *conflict_indexes = g_hash_table_lookup(option_data.conflicts_index, key);
-    // return when no conflicts found
-    if (conflict_indexes == NULL) {
+    gint index = option_index(key);
+    // return when key is unknown, negated, or none of its conflicts are set
+    if (index < 0 || !option_value_active(index, value) ||
+            !keyset_intersects(keyset_conflict_mask(index),
+                checked_keys->active)) {
         return;
     }
     // iterate for each possible conflict
-    do {
-        conflict_t conflict =
-            option_data.conflicts [GPOINTER_TO_INT(conflict_indexes->data)];
-        // check if the conflict value exists
-        if (g_key_file_has_key(checked_keyfile, check_group,
-                    conflict.conflict_name, NULL)) {
-            // skip keys that don't have the necessary specific to be a conflict
-            if (conflict.value != NULL
-                    && !(g_strcmp0(value, conflict.value) == 0)) {
-                continue;
-            }
-            gchar *checked_value = g_key_file_get_value(checked_keyfile, check_group,
-                    conflict.conflict_name, NULL);
-            // check if the conflict value matches
-            if (conflict.conflict_value != NULL){
-                if (strcmp(checked_value, conflict.conflict_value) == 0) {
-                    hbr_info("Removed conflicting option", NULL, check_group,
-                            conflict.conflict_name, checked_value);
-                    hbr_info("for option", NULL, mod_group, key,
-                            value);
-                    g_key_file_remove_key(modified_keyfile, mod_group,
-                            conflict.conflict_name, NULL);
-                }
+    GSList *conflict_indexes = option_conflicts(index);
+    for (; conflict_indexes != NULL;
+            conflict_indexes = g_slist_next(conflict_indexes)) {
+        gint c = GPOINTER_TO_INT(conflict_indexes->data);
+        conflict_t conflict = option_data.conflicts[c];
+        gint conflict_index = option_data.conflict_targets[c];
+        // check if the conflict is set and enabled
+        if (conflict_index < 0 ||
+                !keyset_test(checked_keys->active, conflict_index)) {
+            continue;
+        }
+        gchar *checked_value = g_key_file_get_value(checked_keyfile, check_group,
+                conflict.conflict_name, NULL);
+        if (conflict_matches(&conflict, value, checked_value)) {
+            if (conflict.conflict_value != NULL) {
+                hbr_info("Removed conflicting option", NULL, check_group,
+                        conflict.conflict_name, checked_value);
             } else {
-                // no value to match, just remove the key
                 hbr_info("Dropping conflicting option", NULL, check_group,
                         conflict.conflict_name, checked_value);
-                hbr_info("for option", NULL, mod_group, key,
-                        value);
-                g_key_file_remove_key(modified_keyfile, mod_group,
-                        conflict.conflict_name, NULL);
             }
-            g_free(checked_value);
+            hbr_info("for option", NULL, mod_group, key, value);
+            remove_key(modified_keyfile, mod_group, conflict.conflict_name);
         }
-    } while ((conflict_indexes = g_slist_next(conflict_indexes)));
+        g_free(checked_value);
+    }
 }
 
 /**
@@ -271,8 +361,7 @@ void remove_conflicts(gchar *key, gchar *value, GKeyFile *modified_keyfile,
  */
 GKeyFile * generate_default_key_file(void)
 {
-    GKeyFile *k = g_key_file_new();
-    g_key_file_set_list_separator(k, ',');
+    GKeyFile *k = new_key_file();
     const gchar *g = "CONFIG";
     g_key_file_set_comment(k, NULL, NULL,
             " hbr (handbrake runner) config file\n"
@@ -311,6 +400,18 @@ GKeyFile * generate_default_key_file(void)
     return k;
 }
 
+/**
+ * @brief Check if a group name is an outfile section
+ *
+ * @param group group name
+ *
+ * @return TRUE when group starts with OUTFILE
+ */
+gboolean is_outfile_group(const gchar *group)
+{
+    return strncmp("OUTFILE", group, sizeof("OUTFILE")-1) == 0;
+}
+
 /**
  * @brief Counts number of outfile sections
  *
@@ -324,7 +425,7 @@ gint get_outfile_count(GKeyFile *keyfile)
     gsize len = 0;
     gchar **groups = g_key_file_get_groups(keyfile, &len);
     for (gsize i = 0; i < len; i++) {
-        if (strncmp("OUTFILE", groups[i], sizeof("OUTFILE")-1) == 0) {
+        if (is_outfile_group(groups[i])) {
             count++;
         }
     }
@@ -345,51 +446,18 @@ gchar ** get_outfile_list(GKeyFile *keyfile, gsize *outfile_count)
     gsize count = 0;
     // Fetch all groups
     gchar **groups = g_key_file_get_groups(keyfile, &count);
-    gchar **filter_groups;
-    *outfile_count = get_outfile_count(keyfile);
-    // allocate extra pointer for NULL terminated array
-    /*
-     * g_malloc0() is used because clang seems to think some filter_groups
-     * values may be uninitialized. I think this is due to the conditional
-     * in the following for loop. I could not think of any set of inputs
-     * that actually causes uninitialized values so I chose to zero the
-     * memory allocation to stop that warning.
-     */
-    filter_groups = g_malloc0(sizeof(gchar*)*(*outfile_count+1));
-    // Copy only outfile groups to new list
-    for (gsize i = 0, j = 0; i < count; i++) {
-        if (strncmp("OUTFILE", groups[i], sizeof("OUTFILE")-1) == 0) {
-            filter_groups[j] = g_strdup(groups[i]);
+    // Move only outfile groups to the front, freeing the rest
+    gsize j = 0;
+    for (gsize i = 0; i < count; i++) {
+        if (is_outfile_group(groups[i])) {
+            groups[j] = groups[i];
             j++;
+        } else {
+            g_free(groups[i]);
         }
     }
-    g_strfreev(groups);
     // NULL terminate string array so g_strfreev can free it later
-    filter_groups[*outfile_count] = NULL;
-    return filter_groups;
-}
-
-/**
- * @brief Find a group with matching episode number.
- *
- * @param keyfile keyfile to search
- * @param episode episode number to match
- *
- * @return first group name with a matching episode number
- */
-gchar * get_group_from_episode(GKeyFile *keyfile, int episode)
-{
-    gchar *group;
-    gsize count = 0;
-    gchar **groups = get_outfile_list(keyfile, &count);
-    for (gsize i = 0; i < count; i++) {
-        if ( episode ==
-                g_key_file_get_integer(keyfile, groups[i], "episode", NULL)) {
-            group = g_strdup(groups[i]);
-            g_strfreev(groups);
-            return group;
-        }
-    }
-    g_strfreev(groups);
-    return NULL;
+    groups[j] = NULL;
+    *outfile_count = j;
+    return groups;
 }
@@ -23,20 +23,29 @@
 #include <glib.h>
 
 #include "options.h"
+#include "keyset.h"
 
-GKeyFile *parse_validate_key_file(char *infile, GKeyFile *config);
+GKeyFile *parse_validate_key_file(char *infile, GKeyFile *config,
+        const GArray *episodes, gchar ***outfiles);
 GKeyFile *parse_key_file(char *infile);
+GKeyFile *new_key_file(void);
+void free_key_file(GKeyFile *keyfile);
+void set_key_value(GKeyFile *keyfile, const gchar *group, const gchar *key,
+        const gchar *value);
+void set_key_string(GKeyFile *keyfile, const gchar *group, const gchar *key,
+        const gchar *string);
+void remove_key(GKeyFile *keyfile, const gchar *group, const gchar *key);
 GKeyFile *copy_group_new(GKeyFile *keyfile, const gchar *group,
         const gchar *new_group);
 GKeyFile *merge_key_group(GKeyFile *pref, const gchar *p_group,
         GKeyFile *alt, const gchar *a_group, const gchar *new_group);
 void remove_conflicts(gchar *key, gchar *value, GKeyFile *modified_keyfile,
         const gchar *mod_group, GKeyFile *checked_keyfile,
-        const gchar *check_group);
+        const gchar *check_group, const keyset_t *checked_keys);
 GKeyFile *generate_default_key_file(void);
 
+gboolean is_outfile_group(const gchar *group);
 gint get_outfile_count(GKeyFile *keyfile);
 gchar **get_outfile_list(GKeyFile *keyfile, gsize *outfile_count);
-gchar *get_group_from_episode(GKeyFile *keyfile, int episode_number);
 
 #endif
@@ -0,0 +1,337 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+#include <string.h>  // for strcmp
+
+#include "keyset.h"
+#include "value.h"
+
+extern option_data_t option_data;
+
+#define WORD_BITS 64
+
+static void merge_removed(guint64 *removed, const keyset_t *pref,
+        GKeyFile *pref_keyfile, const gchar *p_group, const keyset_t *alt,
+        GKeyFile *alt_keyfile, const gchar *a_group);
+
+/**
+ * @brief Compile the requires and conflicts tables into per option bitsets.
+ *        Must be called after the hash tables in arg_hash_generate() exist.
+ */
+void keyset_compile(void)
+{
+    gint count = 0;
+    while (option_data.options[count].name != NULL) {
+        count++;
+    }
+    option_data.option_count = count;
+    option_data.mask_words = (count + WORD_BITS - 1) / WORD_BITS;
+    gsize words = option_data.mask_words;
+    option_data.require_masks = g_new0(guint64, words * count);
+    option_data.conflict_masks = g_new0(guint64, words * count);
+    option_data.checked_requires = g_new0(guint64, words);
+
+    for (int i = 0; option_data.requires[i].name != NULL; i++) {
+        gint index = option_index(option_data.requires[i].name);
+        if (index < 0) {
+            continue;
+        }
+        gint require_index = option_data.require_targets[i];
+        if (require_index >= 0) {
+            keyset_set(option_data.require_masks + index * words, require_index);
+        }
+        if (require_index < 0 || option_data.requires[i].require_value != NULL) {
+            keyset_set(option_data.checked_requires, index);
+        }
+    }
+    for (int i = 0; option_data.conflicts[i].name != NULL; i++) {
+        gint index = option_index(option_data.conflicts[i].name);
+        gint conflict_index = option_data.conflict_targets[i];
+        if (index >= 0 && conflict_index >= 0) {
+            keyset_set(option_data.conflict_masks + index * words, conflict_index);
+        }
+    }
+}
+
+/**
+ * @brief Free bitsets created by keyset_compile()
+ */
+void keyset_compile_cleanup(void)
+{
+    g_free(option_data.require_masks);
+    g_free(option_data.conflict_masks);
+    g_free(option_data.checked_requires);
+    option_data.require_masks = NULL;
+    option_data.conflict_masks = NULL;
+    option_data.checked_requires = NULL;
+}
+
+/**
+ * @brief Allocate an empty keyset
+ *
+ * @return new keyset, free with keyset_free()
+ */
+keyset_t * keyset_new(void)
+{
+    keyset_t *keys = g_malloc(sizeof(keyset_t));
+    keys->present = g_new0(guint64, option_data.mask_words);
+    keys->active = g_new0(guint64, option_data.mask_words);
+    return keys;
+}
+
+/**
+ * @brief Build the keyset for a group. Unknown keys are ignored.
+ *
+ * @param keyfile keyfile containing group
+ * @param group   group to read keys from
+ *
+ * @return new keyset, free with keyset_free()
+ */
+keyset_t * keyset_from_group(GKeyFile *keyfile, const gchar *group)
+{
+    keyset_t *keys = keyset_new();
+    gchar **key_list = g_key_file_get_keys(keyfile, group, NULL, NULL);
+    if (key_list == NULL) {
+        return keys;
+    }
+    for (gint i = 0; key_list[i] != NULL; i++) {
+        gint index = option_index(key_list[i]);
+        if (index < 0) {
+            continue;
+        }
+        keyset_set(keys->present, index);
+        gchar *value = g_key_file_get_value(keyfile, group, key_list[i], NULL);
+        if (option_value_active(index, value)) {
+            keyset_set(keys->active, index);
+        }
+        g_free(value);
+    }
+    g_strfreev(key_list);
+    return keys;
+}
+
+/**
+ * @brief Compute the keyset merge_key_group() would produce for p_group over
+ *        a_group, without building the merged keyfile.
+ *
+ * @param pref         keyset of the preferred group
+ * @param pref_keyfile keyfile containing p_group
+ * @param p_group      preferred group
+ * @param alt          keyset of the alternate group
+ * @param alt_keyfile  keyfile containing a_group
+ * @param a_group      alternate group
+ *
+ * @return new keyset, free with keyset_free()
+ */
+keyset_t * keyset_merge(const keyset_t *pref, GKeyFile *pref_keyfile,
+        const gchar *p_group, const keyset_t *alt, GKeyFile *alt_keyfile,
+        const gchar *a_group)
+{
+    gsize words = option_data.mask_words;
+    keyset_t *merged = keyset_new();
+    guint64 *removed = g_new0(guint64, words);
+    merge_removed(removed, pref, pref_keyfile, p_group, alt, alt_keyfile,
+            a_group);
+    for (gsize w = 0; w < words; w++) {
+        guint64 kept = alt->present[w] & ~removed[w] & ~pref->present[w];
+        merged->present[w] = pref->present[w] | kept;
+        merged->active[w] = pref->active[w] | (alt->active[w] & kept);
+    }
+    g_free(removed);
+    return merged;
+}
+
+/**
+ * @brief Free a keyset
+ */
+void keyset_free(keyset_t *keys)
+{
+    if (keys == NULL) {
+        return;
+    }
+    g_free(keys->present);
+    g_free(keys->active);
+    g_free(keys);
+}
+
+/**
+ * @brief Check if the bit for an option index is set
+ */
+gboolean keyset_test(const guint64 *bits, gint index)
+{
+    return (bits[index / WORD_BITS] >> (index % WORD_BITS)) & 1;
+}
+
+/**
+ * @brief Find the next set bit
+ *
+ * @param bits  bitset to search
+ * @param index first index to consider
+ *
+ * @return index of the next set bit at or after index, -1 when none remain
+ */
+gint keyset_next(const guint64 *bits, gint index)
+{
+    gsize w = index / WORD_BITS;
+    if (index < 0 || w >= option_data.mask_words) {
+        return -1;
+    }
+    guint64 word = bits[w] & (~(guint64)0 << (index % WORD_BITS));
+    while (word == 0) {
+        if (++w >= option_data.mask_words) {
+            return -1;
+        }
+        word = bits[w];
+    }
+    return w * WORD_BITS + __builtin_ctzll(word);
+}
+
+/**
+ * @brief Check if two bitsets share any bits
+ */
+gboolean keyset_intersects(const guint64 *a, const guint64 *b)
+{
+    for (gsize w = 0; w < option_data.mask_words; w++) {
+        if (a[w] & b[w]) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Check if any key in mask is missing from keys
+ */
+gboolean keyset_missing(const guint64 *mask, const keyset_t *keys)
+{
+    for (gsize w = 0; w < option_data.mask_words; w++) {
+        if (mask[w] & ~keys->present[w]) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Bitset of options required by the option at index
+ */
+const guint64 * keyset_require_mask(gint index)
+{
+    return option_data.require_masks + index * option_data.mask_words;
+}
+
+/**
+ * @brief Bitset of options the option at index conflicts with
+ */
+const guint64 * keyset_conflict_mask(gint index)
+{
+    return option_data.conflict_masks + index * option_data.mask_words;
+}
+
+/**
+ * @brief Check if a value enables an option. Negatable options set to false
+ *        are passed as --no-option, so they neither require nor conflict
+ *        with anything.
+ *
+ * @param index option index
+ * @param value value of the option, okay if NULL
+ *
+ * @return FALSE when the value negates the option
+ */
+gboolean option_value_active(gint index, const gchar *value)
+{
+    option_t *option = &option_data.options[index];
+    if (!option->negation_option || value == NULL) {
+        return TRUE;
+    }
+    if (option->key_type != k_boolean && option->arg_type != optional_argument) {
+        return TRUE;
+    }
+    const typed_value_t *enabled = decode_value(value, k_boolean);
+    return enabled->error != NULL || enabled->boolean;
+}
+
+/**
+ * @brief Check if a conflict rule applies to a pair of values
+ *
+ * @param conflict      conflict rule
+ * @param value         value of conflict->name, okay if NULL
+ * @param checked_value value of conflict->conflict_name
+ *
+ * @return TRUE when the conflicting key should be removed
+ */
+gboolean conflict_matches(const conflict_t *conflict, const gchar *value,
+        const gchar *checked_value)
+{
+    // skip keys that don't have the necessary specific to be a conflict
+    if (conflict->value != NULL && g_strcmp0(value, conflict->value) != 0) {
+        return FALSE;
+    }
+    // check if the conflict value matches
+    if (conflict->conflict_value != NULL) {
+        return g_strcmp0(checked_value, conflict->conflict_value) == 0;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Set the bit for an option index
+ */
+void keyset_set(guint64 *bits, gint index)
+{
+    bits[index / WORD_BITS] |= (guint64)1 << (index % WORD_BITS);
+}
+
+/**
+ * @brief Mark keys of alt that the active keys of pref remove as conflicts.
+ *        Only options whose conflict mask meets alt's active keys have their
+ *        rules checked individually.
+ */
+static void merge_removed(guint64 *removed, const keyset_t *pref,
+        GKeyFile *pref_keyfile, const gchar *p_group, const keyset_t *alt,
+        GKeyFile *alt_keyfile, const gchar *a_group)
+{
+    for (gint i = keyset_next(pref->active, 0); i >= 0;
+            i = keyset_next(pref->active, i + 1)) {
+        if (!keyset_intersects(keyset_conflict_mask(i), alt->active)) {
+            continue;
+        }
+        const gchar *name = option_data.options[i].name;
+        gchar *value = g_key_file_get_value(pref_keyfile, p_group, name, NULL);
+        GSList *conflict_indexes = option_conflicts(i);
+        for (; conflict_indexes != NULL;
+                conflict_indexes = g_slist_next(conflict_indexes)) {
+            gint c = GPOINTER_TO_INT(conflict_indexes->data);
+            conflict_t *conflict = &option_data.conflicts[c];
+            gint conflict_index = option_data.conflict_targets[c];
+            if (conflict_index < 0 ||
+                    !keyset_test(alt->active, conflict_index)) {
+                continue;
+            }
+            gchar *checked_value = g_key_file_get_value(alt_keyfile, a_group,
+                    conflict->conflict_name, NULL);
+            if (conflict_matches(conflict, value, checked_value)) {
+                keyset_set(removed, conflict_index);
+            }
+            g_free(checked_value);
+        }
+        g_free(value);
+    }
+}
@@ -0,0 +1,65 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _keyset_h
+#define _keyset_h
+
+#include <glib.h>
+
+#include "options.h"
+
+/**
+ * @brief Set of keys defined in a group, stored as bitsets over option
+ *        indexes. Each bitset is option_data.mask_words words long.
+ */
+typedef struct {
+    /**
+     * @brief keys set in the group
+     */
+    guint64 *present;
+    /**
+     * @brief keys that are set and enabled. A negatable option set to false
+     *        (passed as --no-option) is present but not active.
+     */
+    guint64 *active;
+} keyset_t;
+
+void keyset_compile(void);
+void keyset_compile_cleanup(void);
+
+keyset_t *keyset_new(void);
+keyset_t *keyset_from_group(GKeyFile *keyfile, const gchar *group);
+keyset_t *keyset_merge(const keyset_t *pref, GKeyFile *pref_keyfile,
+        const gchar *p_group, const keyset_t *alt, GKeyFile *alt_keyfile,
+        const gchar *a_group);
+void keyset_free(keyset_t *keys);
+
+void keyset_set(guint64 *bits, gint index);
+gboolean keyset_test(const guint64 *bits, gint index);
+gint keyset_next(const guint64 *bits, gint index);
+gboolean keyset_intersects(const guint64 *a, const guint64 *b);
+gboolean keyset_missing(const guint64 *mask, const keyset_t *keys);
+const guint64 *keyset_require_mask(gint index);
+const guint64 *keyset_conflict_mask(gint index);
+
+gboolean option_value_active(gint index, const gchar *value);
+gboolean conflict_matches(const conflict_t *conflict, const gchar *value,
+        const gchar *checked_value);
+
+#endif
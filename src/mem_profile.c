@@ -0,0 +1,249 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>  // for atexit
+#include <string.h>  // for strchr
+
+#include "alloc_stats.h"
+#include "mem_profile.h"
+#include "util.h"
+
+/**
+ * @brief Allocations made during every run of one phase
+ */
+typedef struct {
+    guint count;
+    guint64 allocations;
+    guint64 bytes;
+    /// most bytes the phase's thread held at once beyond what it held when
+    /// the phase started
+    gint64 peak_live;
+} phase_memory_t;
+
+/*
+ * Phases are counted with the allocation counters of the thread running
+ * them, so phases running at the same time on pool threads (diff-config)
+ * don't count each other's allocations. This leaves some limits:
+ * allocations a phase hands off to other threads aren't counted, a block
+ * freed on another thread than it was allocated on lowers that thread's
+ * live bytes, so a peak is only as exact as the phase's frees are local,
+ * and allocation sites are counted for the whole process, not per phase.
+ */
+
+/// read from pool threads, always accessed atomically
+static gint profiling = FALSE;
+static phase_memory_t phases[t_phase_count];
+/// phases end on pool threads during diff-config
+static GMutex profile_lock;
+/// timing_start() value and counters of the phase open on this thread,
+/// phases don't nest so one is enough
+static __thread gint64 open_start = 0;
+static __thread alloc_stats_t open_stats;
+
+static void mem_profile_report(void);
+static void print_sites(GArray *sites);
+static gchar ** resolve_sites(const GArray *sites, guint count);
+static gint compare_sites(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief Count allocations per phase and where they are made. The report
+ *        is printed to stderr when hbr exits.
+ */
+void mem_profile_enable(void)
+{
+    if (__atomic_load_n(&profiling, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    if (!alloc_stats_enable(TRUE)) {
+        hbr_warn("Allocations can only be counted with glibc, "
+                "ignoring --mem-profile", NULL, NULL, NULL, NULL);
+        return;
+    }
+    // phases are only marked while timings are kept
+    timings_track();
+    __atomic_store_n(&profiling, TRUE, __ATOMIC_RELEASE);
+    atexit(mem_profile_report);
+}
+
+/**
+ * @brief Mark the start of a phase on this thread, called by timing_start()
+ *
+ * @param start value timing_start() returns
+ */
+void mem_profile_phase_start(gint64 start)
+{
+    if (!__atomic_load_n(&profiling, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    alloc_stats_reset_thread_peak();
+    alloc_stats_get_thread(&open_stats);
+    open_start = start;
+}
+
+/**
+ * @brief Add the allocations since mem_profile_phase_start() to a phase,
+ *        called by timing_end(). Phases not started by timing_start() on
+ *        this thread (encodes) are not counted.
+ *
+ * @param phase phase that ended
+ * @param start value timing_start() returned for it
+ */
+void mem_profile_phase_end(timing_phase phase, gint64 start)
+{
+    if (!__atomic_load_n(&profiling, __ATOMIC_ACQUIRE) ||
+            start != open_start) {
+        return;
+    }
+    alloc_stats_t now;
+    alloc_stats_get_thread(&now);
+    g_mutex_lock(&profile_lock);
+    phase_memory_t *p = &phases[phase];
+    p->count++;
+    p->allocations += now.allocations - open_stats.allocations;
+    p->bytes += now.bytes - open_stats.bytes;
+    p->peak_live = MAX(p->peak_live, now.peak_live - open_stats.live);
+    g_mutex_unlock(&profile_lock);
+    open_start = 0;
+}
+
+/**
+ * @brief atexit() handler printing allocations per phase and the sites
+ *        that allocated most often
+ */
+static void mem_profile_report(void)
+{
+    // copy the counters first so the report's own allocations are left out
+    alloc_stats_t total;
+    alloc_stats_get(&total);
+    GArray *sites = alloc_stats_get_sites();
+    g_mutex_lock(&profile_lock);
+    g_printerr("%-14s %7s %12s %12s %14s\n", "phase", "count", "allocs",
+            "alloc KiB", "peak live KiB");
+    for (gint i = 0; i < t_phase_count; i++) {
+        phase_memory_t *p = &phases[i];
+        if (p->count == 0) {
+            continue;
+        }
+        g_printerr("%-14s %7u %12" G_GUINT64_FORMAT " %12.1f %14.1f\n",
+                timing_phase_name(i), p->count, p->allocations,
+                p->bytes / 1024.0, p->peak_live / 1024.0);
+    }
+    g_mutex_unlock(&profile_lock);
+    g_printerr("%-14s %7s %12" G_GUINT64_FORMAT " %12.1f %14.1f\n", "total",
+            "", total.allocations, total.bytes / 1024.0,
+            total.peak_live / 1024.0);
+    print_sites(sites);
+    g_array_free(sites, TRUE);
+}
+
+/**
+ * @brief Print the sites that allocated most often, with their share of
+ *        every allocation
+ *
+ * @param sites alloc_site_t from alloc_stats_get_sites(), sorted in place
+ */
+static void print_sites(GArray *sites)
+{
+    g_array_sort(sites, compare_sites);
+    guint64 allocations = 0;
+    for (guint i = 0; i < sites->len; i++) {
+        allocations += g_array_index(sites, alloc_site_t, i).allocations;
+    }
+    guint count = MIN(sites->len, MEM_PROFILE_TOP_SITES);
+    gchar **names = resolve_sites(sites, count);
+
+    g_printerr("\n%-36s %12s %6s %12s\n", "allocation site", "allocs",
+            "%", "alloc KiB");
+    for (guint i = 0; i < count; i++) {
+        alloc_site_t *site = &g_array_index(sites, alloc_site_t, i);
+        g_printerr("%-36s %12" G_GUINT64_FORMAT " %6.1f %12.1f\n", names[i],
+                site->allocations,
+                allocations > 0 ? 100.0 * site->allocations / allocations : 0.0,
+                site->bytes / 1024.0);
+    }
+    g_strfreev(names);
+}
+
+/**
+ * @brief Name the first count sites "function file:line" using addr2line,
+ *        falling back to their address when it can't be run or the
+ *        executable has no debug info
+ *
+ * @return NULL terminated array of count names, free with g_strfreev()
+ */
+static gchar ** resolve_sites(const GArray *sites, guint count)
+{
+    gchar **names = g_new0(gchar *, count + 1);
+    gchar *exe = g_file_read_link("/proc/self/exe", NULL);
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup("addr2line"));
+    g_ptr_array_add(argv, g_strdup("-f"));
+    g_ptr_array_add(argv, g_strdup("-e"));
+    g_ptr_array_add(argv, g_strdup(exe ? exe : "/proc/self/exe"));
+    for (guint i = 0; i < count; i++) {
+        guintptr address = g_array_index(sites, alloc_site_t, i).address;
+        g_ptr_array_add(argv, g_strdup_printf("%#" G_GINTPTR_MODIFIER "x",
+                    address));
+    }
+    g_ptr_array_add(argv, NULL);
+
+    // two lines for each address: function, then file:line
+    gchar *output = NULL;
+    gint status = -1;
+    g_spawn_sync(NULL, (gchar **) argv->pdata, NULL,
+            G_SPAWN_SEARCH_PATH | G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL,
+            &output, NULL, &status, NULL);
+    gchar **lines = output && status == 0 ? g_strsplit(output, "\n", -1) :
+        NULL;
+    guint line_count = lines ? g_strv_length(lines) : 0;
+    for (guint i = 0; i < count; i++) {
+        guintptr address = g_array_index(sites, alloc_site_t, i).address;
+        if (address == 0) {
+            names[i] = g_strdup("(outside hbr)");
+            continue;
+        }
+        if (2 * i + 1 < line_count && !g_str_has_prefix(lines[2*i+1], "??")) {
+            // drop the directory and addr2line's "(discriminator N)"
+            gchar *file = g_path_get_basename(lines[2*i+1]);
+            gchar *extra = strchr(file, ' ');
+            if (extra != NULL) {
+                *extra = '\0';
+            }
+            names[i] = g_strdup_printf("%s %s", lines[2*i], file);
+            g_free(file);
+        } else {
+            names[i] = g_strdup_printf("%#" G_GINTPTR_MODIFIER "x", address);
+        }
+    }
+    g_strfreev(lines);
+    g_free(output);
+    g_ptr_array_free(argv, TRUE);
+    g_free(exe);
+    return names;
+}
+
+/**
+ * @brief GCompareFunc sorting alloc_site_t by allocations, most first
+ */
+static gint compare_sites(gconstpointer a, gconstpointer b)
+{
+    guint64 x = ((const alloc_site_t *)a)->allocations;
+    guint64 y = ((const alloc_site_t *)b)->allocations;
+    return (x < y) - (x > y);
+}
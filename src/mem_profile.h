@@ -0,0 +1,34 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _mem_profile_h
+#define _mem_profile_h
+
+#include <glib.h>
+
+#include "timings.h"
+
+/// allocation sites listed by the --mem-profile report
+#define MEM_PROFILE_TOP_SITES 20
+
+void mem_profile_enable(void);
+void mem_profile_phase_start(gint64 start);
+void mem_profile_phase_end(timing_phase phase, gint64 start);
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+
+#include "metrics.h"
+#include "timings.h"
+#include "util.h"
+
+/// --metrics filename, NULL when disabled
+static gchar *metrics_filename = NULL;
+/// real time metrics were enabled, in seconds
+static gint64 batch_start = 0;
+/// monotonic time of the last rewrite
+static gint64 last_update = 0;
+
+static void append_metric(GString *out, const gchar *name, const gchar *type,
+        const gchar *help);
+static void append_label(GString *out, const gchar *name, const gchar *value);
+
+/**
+ * @brief Keep a Prometheus text format file of queue and phase metrics up
+ *        to date, for node_exporter's textfile collector
+ *
+ * @param filename file to rewrite, replaced atomically each time
+ */
+void metrics_enable(const gchar *filename)
+{
+    metrics_filename = g_strdup(filename);
+    batch_start = g_get_real_time() / G_USEC_PER_SEC;
+    timings_track();
+}
+
+/**
+ * @brief Check if metrics are being written
+ */
+gboolean metrics_enabled(void)
+{
+    return metrics_filename != NULL;
+}
+
+/**
+ * @brief Rewrite the metrics file from the queue's current state
+ *
+ * @param queue queue being run
+ * @param force rewrite even if the last rewrite was less than
+ *              METRICS_INTERVAL_MS ago
+ */
+void metrics_update(const job_queue_t *queue, gboolean force)
+{
+    if (metrics_filename == NULL) {
+        return;
+    }
+    gint64 now = g_get_monotonic_time();
+    if (!force && now - last_update < METRICS_INTERVAL_MS * 1000) {
+        return;
+    }
+    last_update = now;
+
+    GString *out = g_string_new(NULL);
+    append_metric(out, "hbr_batch_start_timestamp_seconds", "gauge",
+            "Time the batch started.");
+    g_string_append_printf(out, "hbr_batch_start_timestamp_seconds %"
+            G_GINT64_FORMAT "\n", batch_start);
+    append_metric(out, "hbr_last_update_timestamp_seconds", "gauge",
+            "Time these metrics were written.");
+    g_string_append_printf(out, "hbr_last_update_timestamp_seconds %"
+            G_GINT64_FORMAT "\n", g_get_real_time() / G_USEC_PER_SEC);
+
+    append_metric(out, "hbr_jobs_queued", "gauge",
+            "Encodes waiting to start.");
+    g_string_append_printf(out, "hbr_jobs_queued %u\n",
+            g_queue_get_length(queue->pending));
+    append_metric(out, "hbr_jobs_running", "gauge",
+            "Encodes running.");
+    g_string_append_printf(out, "hbr_jobs_running %u\n",
+            g_hash_table_size(queue->running));
+    append_metric(out, "hbr_jobs_done_total", "counter",
+            "Encodes that finished successfully.");
+    g_string_append_printf(out, "hbr_jobs_done_total %lu\n",
+            queue->completed);
+    append_metric(out, "hbr_jobs_failed_total", "counter",
+            "Encodes that failed to start or exited with an error.");
+    g_string_append_printf(out, "hbr_jobs_failed_total %lu\n",
+            queue->failed);
+    append_metric(out, "hbr_media_seconds_encoded_total", "counter",
+            "Source seconds of successful encodes.");
+    g_string_append_printf(out, "hbr_media_seconds_encoded_total %.0f\n",
+            queue->media_seconds);
+    append_metric(out, "hbr_output_bytes_total", "counter",
+            "Size of the output files of successful encodes.");
+    g_string_append_printf(out, "hbr_output_bytes_total %" G_GUINT64_FORMAT
+            "\n", queue->output_bytes);
+
+    // one series per running job
+    GString *labels = g_string_new(NULL);
+    GString *progress = g_string_new(NULL);
+    GString *fps = g_string_new(NULL);
+    GString *eta = g_string_new(NULL);
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, queue->running);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        job_t *job = value;
+        gchar *slot = g_strdup_printf("%d", job->slot + 1);
+        g_string_assign(labels, "{");
+        append_label(labels, "output", job->filename);
+        g_string_append_c(labels, ',');
+        append_label(labels, "slot", slot);
+        g_string_append_c(labels, '}');
+        g_string_append_printf(progress, "hbr_job_progress_ratio%s %.4f\n",
+                labels->str, job->progress);
+        g_string_append_printf(fps, "hbr_job_fps%s %.2f\n", labels->str,
+                job->fps);
+        if (job->eta >= 0) {
+            g_string_append_printf(eta, "hbr_job_eta_seconds%s %d\n",
+                    labels->str, job->eta);
+        }
+        g_free(slot);
+    }
+    append_metric(out, "hbr_job_progress_ratio", "gauge",
+            "Fraction of a running encode done, over all of its passes.");
+    g_string_append(out, progress->str);
+    append_metric(out, "hbr_job_fps", "gauge",
+            "Current encoding speed of a running encode.");
+    g_string_append(out, fps->str);
+    append_metric(out, "hbr_job_eta_seconds", "gauge",
+            "Seconds HandBrakeCLI estimates remain in the current pass.");
+    g_string_append(out, eta->str);
+    g_string_free(eta, TRUE);
+    g_string_free(fps, TRUE);
+    g_string_free(progress, TRUE);
+    g_string_free(labels, TRUE);
+
+    guint counts[t_phase_count];
+    gint64 totals[t_phase_count];
+    timings_get_totals(counts, totals);
+    append_metric(out, "hbr_phase_seconds_total", "counter",
+            "Time spent in each hbr phase.");
+    for (gint i = 0; i < t_phase_count; i++) {
+        g_string_append_printf(out, "hbr_phase_seconds_total{phase=\"%s\"}"
+                " %.6f\n", timing_phase_name(i), totals[i] / 1e6);
+    }
+    append_metric(out, "hbr_phase_runs_total", "counter",
+            "Times each hbr phase ran.");
+    for (gint i = 0; i < t_phase_count; i++) {
+        g_string_append_printf(out, "hbr_phase_runs_total{phase=\"%s\"} %u\n",
+                timing_phase_name(i), counts[i]);
+    }
+
+    GError *error = NULL;
+    if (!g_file_set_contents(metrics_filename, out->str, out->len, &error)) {
+        hbr_warn("Failed to write metrics: %s", metrics_filename, NULL, NULL,
+                NULL, error->message);
+        g_error_free(error);
+    }
+    g_string_free(out, TRUE);
+}
+
+/**
+ * @brief Append the HELP and TYPE lines of a metric
+ */
+static void append_metric(GString *out, const gchar *name, const gchar *type,
+        const gchar *help)
+{
+    g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help,
+            name, type);
+}
+
+/**
+ * @brief Append name="value", escaping the value
+ */
+static void append_label(GString *out, const gchar *name, const gchar *value)
+{
+    g_string_append_printf(out, "%s=\"", name);
+    for (const gchar *c = value; *c != '\0'; c++) {
+        switch (*c) {
+            case '\\':
+                g_string_append(out, "\\\\");
+                break;
+            case '"':
+                g_string_append(out, "\\\"");
+                break;
+            case '\n':
+                g_string_append(out, "\\n");
+                break;
+            default:
+                g_string_append_c(out, *c);
+        }
+    }
+    g_string_append_c(out, '"');
+}
@@ -0,0 +1,34 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _metrics_h
+#define _metrics_h
+
+#include <glib.h>
+
+#include "jobs.h"
+
+/// how often metrics are rewritten while encodes run
+#define METRICS_INTERVAL_MS 1000
+
+void metrics_enable(const gchar *filename);
+gboolean metrics_enabled(void);
+void metrics_update(const job_queue_t *queue, gboolean force);
+
+#endif
@@ -26,6 +26,7 @@
 
 #include "util.h"
 #include "options.h"
+#include "keyset.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -65,6 +66,7 @@ static option_t hbr_options[] =
         (const gchar*[]){"behindthescenes", "deleted", "featurette",
             "interview", "scene", "short", "trailer", "other"}},
     { "debug", hbr_only, k_boolean, FALSE, valid_boolean, 0, NULL},
+    { "split", hbr_only, k_integer, FALSE, valid_positive_integer, 0, NULL},
     { NULL, 0, 0, 0, NULL, 0, NULL}
 };
 
@@ -77,6 +79,7 @@ static require_t hbr_requires[] =
     { "extra", "type", "movie"},
     { "season", "type", "series"},
     { "episode", "type", "series"},
+    { "split", "chapters", NULL},
     { NULL, NULL, NULL}
 };
 
@@ -161,6 +164,8 @@ void determine_handbrake_version(gchar *arg_version)
     minor = g_ascii_strtoll(split_version[1], NULL, 10);
     patch = g_ascii_strtoll(split_version[2], NULL, 10);
     g_strfreev(split_version);
+    option_data.handbrake_version = g_strdup_printf("%d.%d.%d", major, minor,
+            patch);
 
     /*
      * Baseline version if detection fails
@@ -288,21 +293,30 @@ void determine_handbrake_version(gchar *arg_version)
 
 /**
  * @brief Generate hash tables to for look up of options, requires,
- *        and conflicts.
+ *        and conflicts. Option names are a fixed set, so they are interned
+ *        and every table is keyed on an integer quark.
  */
 void arg_hash_generate(void)
 {
     // options
-    option_data.options_index = g_hash_table_new(g_str_hash, g_str_equal);
-    for (int i = 0; option_data.options[i].name != NULL; i++) {
+    gint count = 0;
+    while (option_data.options[count].name != NULL) {
+        count++;
+    }
+    option_data.option_quarks = g_new(GQuark, count);
+    option_data.options_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (int i = 0; i < count; i++) {
+        option_data.option_quarks[i] =
+            g_quark_from_static_string(option_data.options[i].name);
         g_hash_table_insert(option_data.options_index,
-                (void *)option_data.options[i].name,
+                GUINT_TO_POINTER(option_data.option_quarks[i]),
                 GINT_TO_POINTER(i));
     }
-    option_data.customs_index = g_hash_table_new(g_str_hash, g_str_equal);
+    option_data.customs_index = g_hash_table_new(g_direct_hash, g_direct_equal);
     for (int i = 0; option_data.customs[i].name != NULL; i++) {
         g_hash_table_insert(option_data.customs_index,
-                (void *)option_data.customs[i].name,
+                GUINT_TO_POINTER(g_quark_from_static_string(
+                        option_data.customs[i].name)),
                 GINT_TO_POINTER(i));
     }
     /*
@@ -312,22 +326,41 @@ void arg_hash_generate(void)
      * the table.
      */
     // requires
-    option_data.requires_index = g_hash_table_new(g_str_hash, g_str_equal);
-    for (int i = 0; option_data.requires[i].name != NULL; i++) {
-        g_hash_table_insert(option_data.requires_index,
-                (void *)option_data.requires[i].name,
+    count = 0;
+    while (option_data.requires[count].name != NULL) {
+        count++;
+    }
+    option_data.require_targets = g_new(gint, count);
+    option_data.requires_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (int i = 0; i < count; i++) {
+        gpointer key = GUINT_TO_POINTER(
+                g_quark_from_static_string(option_data.requires[i].name));
+        g_hash_table_insert(option_data.requires_index, key,
                 g_slist_prepend(g_hash_table_lookup(option_data.requires_index,
-                        option_data.requires[i].name), GINT_TO_POINTER(i)));
+                        key), GINT_TO_POINTER(i)));
+        option_data.require_targets[i] =
+            option_index(option_data.requires[i].require_name);
     }
 
     // conflicts
-    option_data.conflicts_index = g_hash_table_new(g_str_hash, g_str_equal);
-    for (int i = 0; option_data.conflicts[i].name != NULL; i++) {
-        g_hash_table_insert(option_data.conflicts_index,
-                (void *)option_data.conflicts[i].name,
+    count = 0;
+    while (option_data.conflicts[count].name != NULL) {
+        count++;
+    }
+    option_data.conflict_targets = g_new(gint, count);
+    option_data.conflicts_index = g_hash_table_new(g_direct_hash, g_direct_equal);
+    for (int i = 0; i < count; i++) {
+        gpointer key = GUINT_TO_POINTER(
+                g_quark_from_static_string(option_data.conflicts[i].name));
+        g_hash_table_insert(option_data.conflicts_index, key,
                 g_slist_prepend(g_hash_table_lookup(option_data.conflicts_index,
-                        option_data.conflicts[i].name), GINT_TO_POINTER(i)));
+                        key), GINT_TO_POINTER(i)));
+        option_data.conflict_targets[i] =
+            option_index(option_data.conflicts[i].conflict_name);
     }
+
+    // requires/conflicts bitsets
+    keyset_compile();
     return;
 }
 
@@ -342,6 +375,11 @@ void arg_hash_cleanup(void)
     g_hash_table_destroy(option_data.requires_index);
     g_hash_table_foreach(option_data.conflicts_index, free_slist_in_hash, NULL);
     g_hash_table_destroy(option_data.conflicts_index);
+    keyset_compile_cleanup();
+    g_free(option_data.handbrake_version);
+    g_free(option_data.option_quarks);
+    g_free(option_data.require_targets);
+    g_free(option_data.conflict_targets);
     g_free(option_data.options);
     // customs is all allocated on the stack
     // never reallocated to merge like the other sets
@@ -349,6 +387,63 @@ void arg_hash_cleanup(void)
     g_free(option_data.conflicts);
 }
 
+/**
+ * @brief Look up an option index by name. Names that were never interned
+ *        cannot be options, so keys read from keyfiles are not added to the
+ *        quark table.
+ *
+ * @param name option name
+ *
+ * @return option index, -1 when name is not an option
+ */
+gint option_index(const gchar *name)
+{
+    return option_index_from_quark(g_quark_try_string(name));
+}
+
+/**
+ * @brief Look up an option index by interned name
+ *
+ * @param quark quark of the option name
+ *
+ * @return option index, -1 when quark is not an option
+ */
+gint option_index_from_quark(GQuark quark)
+{
+    gpointer index;
+    if (quark == 0 || !g_hash_table_lookup_extended(option_data.options_index,
+                GUINT_TO_POINTER(quark), NULL, &index)) {
+        return -1;
+    }
+    return GPOINTER_TO_INT(index);
+}
+
+/**
+ * @brief Get the requires entries for an option
+ *
+ * @param index option index
+ *
+ * @return list of indexes into option_data.requires, owned by requires_index
+ */
+GSList * option_requires(gint index)
+{
+    return g_hash_table_lookup(option_data.requires_index,
+            GUINT_TO_POINTER(option_data.option_quarks[index]));
+}
+
+/**
+ * @brief Get the conflicts entries for an option
+ *
+ * @param index option index
+ *
+ * @return list of indexes into option_data.conflicts, owned by conflicts_index
+ */
+GSList * option_conflicts(gint index)
+{
+    return g_hash_table_lookup(option_data.conflicts_index,
+            GUINT_TO_POINTER(option_data.option_quarks[index]));
+}
+
 /**
  * @brief GSList freeing function to be passed to g_hash_table_foreach()
  *        This frees the lists allocated for requires_index and conflicts_index.
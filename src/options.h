@@ -125,6 +125,8 @@ typedef struct {
 } require_t;
 
 typedef struct {
+    /// HandBrake version the tables were chosen for (major.minor.patch)
+    gchar *handbrake_version;
     /*
      * Pointers for dynamically allocated array that combines
      * options/hbr_options, requires/hbr_requires, and conflicts/hbr_conflicts
@@ -136,7 +138,13 @@ typedef struct {
 
     /// Hash tables are built in arg_hash_generate()
     /*
-     * Hash tables for looking up index given an option name.
+     * Interned option names, option_quarks[i] is the quark of options[i].name.
+     */
+    GQuark *option_quarks;
+    /*
+     * Hash tables for looking up index given an option name quark.
+     * Keys are quarks stored with GUINT_TO_POINTER(), use option_index()
+     * rather than looking them up directly.
      * Indexes are stored as a int inside a pointer and must be
      * accessed using the GPOINTER_TO_INT() macro.
      */
@@ -149,11 +157,40 @@ typedef struct {
      */
     GHashTable *requires_index;
     GHashTable *conflicts_index;
+    /*
+     * Option index of requires[i].require_name and conflicts[i].conflict_name
+     * resolved once, -1 when the name is not a known option.
+     */
+    gint *require_targets;
+    gint *conflict_targets;
+
+    /// Bitsets are built in keyset_compile(), see keyset.h
+    /*
+     * Number of options and number of 64 bit words in a bitset covering
+     * every option index.
+     */
+    gint option_count;
+    gsize mask_words;
+    /*
+     * Per option bitsets of the options it requires and the options it
+     * conflicts with, mask_words words for each option index.
+     */
+    guint64 *require_masks;
+    guint64 *conflict_masks;
+    /*
+     * Options with requires that a mask cannot decide alone (a specific
+     * value is required, or the required key is not a known option).
+     */
+    guint64 *checked_requires;
 } option_data_t;
 
 void determine_handbrake_version(gchar *arg_version);
 void arg_hash_generate(void);
 void arg_hash_cleanup(void);
+gint option_index(const gchar *name);
+gint option_index_from_quark(GQuark quark);
+GSList * option_requires(gint index);
+GSList * option_conflicts(gint index);
 void free_slist_in_hash( __attribute__((unused)) gpointer key,
         gpointer slist,
         __attribute__((unused)) gpointer user_data);
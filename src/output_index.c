@@ -0,0 +1,748 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>     // for errno
+#include <fcntl.h>     // for O_RDWR
+#include <stdio.h>     // for NULL
+#include <string.h>    // for memcmp, memcpy, strcmp, strchr, strlen
+#include <unistd.h>    // for close, ftruncate
+#include <sys/file.h>  // for flock
+#include <glib/gstdio.h>
+
+#include "output_index.h"
+#include "discover.h"
+#include "util.h"
+
+static const gchar journal_header[] = "hbr-output-index";
+static const gchar snapshot_magic[8] = "HBRINDX";
+
+/// most fields in a journal record
+#define MAX_FIELDS 9
+/// shortest journal worth folding into the snapshot
+#define FOLD_MIN_LINES 256
+
+typedef enum {
+    st_changed,
+    st_not_encoded,
+    st_failed,
+    st_stale,
+    st_encoded,
+    st_count
+} output_state;
+
+static const gchar *state_names[st_count] = {
+    "changed", "not encoded", "failed", "stale", "encoded"
+};
+
+/**
+ * @brief A keyfile named by the index
+ */
+typedef struct {
+    const gchar *path;
+    /// bumped by each K record, outputs planned in an older one are gone
+    guint generation;
+    /// position in the keyfile table of the snapshot being written
+    guint32 table_index;
+    /// stat() has been tried, exists/mtime/size are set
+    gboolean checked;
+    gboolean exists;
+    gint64 mtime;
+    gint64 size;
+    /// included in the status report
+    gboolean selected;
+    /// has outputs in the status report
+    gboolean reported;
+} index_keyfile_t;
+
+/**
+ * @brief Current state of one output. Strings point into the mapped
+ *        snapshot or the journal contents.
+ */
+typedef struct {
+    const gchar *output;
+    index_keyfile_t *keyfile;
+    /// keyfile generation the output was planned in
+    guint generation;
+    const gchar *group;
+    const gchar *planned;
+    gint64 planned_time;
+    gint64 keyfile_mtime;
+    gint64 keyfile_size;
+    /// NULL when never encoded
+    const gchar *encoded;
+    gint64 encoded_time;
+    gboolean failed;
+    gint64 failed_time;
+    output_state state;
+} output_record_t;
+
+/**
+ * @brief Snapshot with the journal replayed over it
+ */
+typedef struct {
+    GMappedFile *mapped;
+    /// journal contents, fields are split and unescaped in place
+    gchar *journal;
+    guint journal_lines;
+    /// snapshot outputs first (sorted), then outputs added by the journal
+    output_record_t *records;
+    guint32 snapshot_count;
+    guint32 record_count;
+    /// outputs added by the journal, output path to output_record_t
+    GHashTable *added;
+    /// keyfile path to index_keyfile_t
+    GHashTable *keyfiles;
+} output_index_t;
+
+static gchar * index_file(const gchar *name);
+static void load_snapshot(output_index_t *index, const gchar *path);
+static void replay_journal(output_index_t *index);
+static output_record_t * find_record(output_index_t *index,
+        const gchar *output);
+static index_keyfile_t * lookup_keyfile(output_index_t *index,
+        const gchar *path);
+static output_state record_state(output_record_t *record);
+static gboolean write_snapshot(output_index_t *index, const gchar *path);
+static guint32 add_string(GString *strings, GHashTable *offsets,
+        const gchar *text);
+static gint compare_outputs(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief Checksum HandBrakeCLI arguments so later encodes can tell if an
+ *        output was made with different settings
+ *
+ * @param args arguments from plan_args()
+ *
+ * @return 16 hex digit fingerprint, must be freed by caller
+ */
+gchar * output_index_fingerprint(GPtrArray *args)
+{
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        const gchar *arg = args->pdata[i];
+        // include the terminator so argument boundaries count
+        g_checksum_update(checksum, (const guchar *)arg, strlen(arg) + 1);
+    }
+    gchar *fingerprint = g_strndup(g_checksum_get_string(checksum), 16);
+    g_checksum_free(checksum);
+    return fingerprint;
+}
+
+/**
+ * @brief Add a record that an output is planned, see output_index_append()
+ *
+ * @param records       records to append to
+ * @param output        output filename
+ * @param keyfile       keyfile the output is planned from
+ * @param group         outfile group name
+ * @param fingerprint   fingerprint of the planned arguments
+ * @param keyfile_mtime keyfile modification time when planned
+ * @param keyfile_size  keyfile size when planned
+ */
+void output_index_add_planned(GString *records, const gchar *output,
+        const gchar *keyfile, const gchar *group, const gchar *fingerprint,
+        gint64 keyfile_mtime, gint64 keyfile_size)
+{
+    gchar *full_output = g_canonicalize_filename(output, NULL);
+    gchar *full_keyfile = g_canonicalize_filename(keyfile, NULL);
+    g_string_append_printf(records, "P\t%" G_GINT64_FORMAT,
+            g_get_real_time() / G_USEC_PER_SEC);
+    append_tsv_field(records, full_output);
+    append_tsv_field(records, full_keyfile);
+    append_tsv_field(records, group);
+    append_tsv_field(records, fingerprint);
+    g_string_append_printf(records, "\t%" G_GINT64_FORMAT "\t%"
+            G_GINT64_FORMAT "\n", keyfile_mtime, keyfile_size);
+    g_free(full_keyfile);
+    g_free(full_output);
+}
+
+/**
+ * @brief Add a record that a keyfile is about to be planned in full. Outputs
+ *        it planned earlier that aren't planned again are dropped.
+ *
+ * @param records records to append to
+ * @param keyfile keyfile being planned
+ */
+void output_index_add_keyfile(GString *records, const gchar *keyfile)
+{
+    gchar *full_keyfile = g_canonicalize_filename(keyfile, NULL);
+    g_string_append_printf(records, "K\t%" G_GINT64_FORMAT,
+            g_get_real_time() / G_USEC_PER_SEC);
+    append_tsv_field(records, full_keyfile);
+    g_string_append_c(records, '\n');
+    g_free(full_keyfile);
+}
+
+/**
+ * @brief Add a record of an encode's result, see output_index_append()
+ *
+ * @param records     records to append to
+ * @param output      output filename
+ * @param fingerprint fingerprint of the encode's arguments
+ * @param success     HandBrakeCLI exited successfully
+ */
+void output_index_add_result(GString *records, const gchar *output,
+        const gchar *fingerprint, gboolean success)
+{
+    gchar *full_output = g_canonicalize_filename(output, NULL);
+    g_string_append_printf(records, "R\t%" G_GINT64_FORMAT,
+            g_get_real_time() / G_USEC_PER_SEC);
+    append_tsv_field(records, full_output);
+    append_tsv_field(records, fingerprint);
+    g_string_append(records, success ? "\tok\n" : "\tfailed\n");
+    g_free(full_output);
+}
+
+/**
+ * @brief Append records to the journal. The journal is locked while
+ *        writing so several hbr processes can share it.
+ *
+ * @param records complete record lines
+ *
+ * @return TRUE on success, failures are reported as warnings
+ */
+gboolean output_index_append(const GString *records)
+{
+    gchar *path = index_file("outputs.log");
+    gchar *header = g_strdup_printf("%s\t%d\n", journal_header,
+            OUTPUT_INDEX_FORMAT);
+    gboolean result = append_locked(path, header, records, "output index");
+    g_free(header);
+    g_free(path);
+    return result;
+}
+
+/**
+ * @brief Print how many indexed outputs are encoded, stale, failed, or not
+ *        encoded, then list every output that isn't encoded
+ *
+ * @param keyfiles keyfiles (or directories of keyfiles) to report on,
+ *                 NULL for every indexed output
+ *
+ * @return TRUE when the index could be read
+ */
+gboolean output_index_status(gchar **keyfiles)
+{
+    gchar *journal_path = index_file("outputs.log");
+    gchar *snapshot_path = index_file("outputs.index");
+    output_index_t index = { 0 };
+    index.added = g_hash_table_new(g_str_hash, g_str_equal);
+    index.keyfiles = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+            g_free);
+
+    // hold the journal lock until it has been read (and maybe folded)
+    errno = 0;
+    int fd = g_open(journal_path, O_RDWR, 0);
+    if (fd >= 0 && flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    GError *error = NULL;
+    gboolean result = FALSE;
+    if (fd < 0 && errno != ENOENT) {
+        hbr_error("Failed to open output index: %s", journal_path, NULL,
+                NULL, NULL, g_strerror(errno));
+    } else if (fd >= 0 && !g_file_get_contents(journal_path, &index.journal,
+                NULL, &error)) {
+        hbr_error("Failed to read output index: %s", journal_path, NULL,
+                NULL, NULL, error->message);
+        g_error_free(error);
+    } else {
+        result = TRUE;
+        load_snapshot(&index, snapshot_path);
+        replay_journal(&index);
+        if (fd >= 0 && index.journal_lines > 0 && (index.mapped == NULL ||
+                    index.journal_lines >= MAX(FOLD_MIN_LINES,
+                        index.snapshot_count / 16)) &&
+                write_snapshot(&index, snapshot_path) &&
+                ftruncate(fd, 0) != 0) {
+            hbr_warn("Failed to empty output index journal: %s",
+                    journal_path, NULL, NULL, NULL, g_strerror(errno));
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (result && index.record_count == 0) {
+        g_print("No outfiles have been indexed. Run hbr plan first.\n");
+    } else if (result) {
+        // keyfiles to report on
+        gboolean all = keyfiles == NULL;
+        if (!all) {
+            gchar **files = discover_input_files(keyfiles);
+            for (gint i = 0; files[i] != NULL; i++) {
+                gchar *full_path = g_canonicalize_filename(files[i], NULL);
+                index_keyfile_t *keyfile = g_hash_table_lookup(
+                        index.keyfiles, full_path);
+                if (keyfile != NULL) {
+                    keyfile->selected = TRUE;
+                } else {
+                    hbr_warn("Keyfile has no indexed outfiles", files[i],
+                            NULL, NULL, NULL);
+                }
+                g_free(full_path);
+            }
+            g_strfreev(files);
+        }
+
+        // classify the live outputs
+        GPtrArray *listed = g_ptr_array_new();
+        guint counts[st_count] = { 0 };
+        guint total = 0;
+        guint keyfile_count = 0;
+        for (guint32 i = 0; i < index.record_count; i++) {
+            output_record_t *record = &index.records[i];
+            if (record->generation != record->keyfile->generation ||
+                    !(all || record->keyfile->selected)) {
+                continue;
+            }
+            if (!record->keyfile->reported) {
+                record->keyfile->reported = TRUE;
+                keyfile_count++;
+            }
+            record->state = record_state(record);
+            counts[record->state]++;
+            total++;
+            if (record->state != st_encoded) {
+                g_ptr_array_add(listed, record);
+            }
+        }
+        // snapshot outputs are already in order
+        if (g_hash_table_size(index.added) > 0) {
+            g_ptr_array_sort(listed, compare_outputs);
+        }
+
+        GString *report = g_string_new(NULL);
+        g_string_append_printf(report,
+                "Indexed %u outfiles from %u keyfiles\n", total,
+                keyfile_count);
+        for (gint i = st_count - 1; i >= 0; i--) {
+            g_string_append_printf(report, "  %-12s %u\n", state_names[i],
+                    counts[i]);
+        }
+        for (guint i = 0; i < listed->len; i++) {
+            output_record_t *record = listed->pdata[i];
+            g_string_append_printf(report, "%-12s %s (%s [%s])\n",
+                    state_names[record->state], record->output,
+                    record->keyfile->path, record->group);
+        }
+        g_print("%s", report->str);
+        g_string_free(report, TRUE);
+        g_ptr_array_free(listed, TRUE);
+    }
+
+    g_hash_table_destroy(index.added);
+    g_hash_table_destroy(index.keyfiles);
+    g_free(index.records);
+    g_free(index.journal);
+    if (index.mapped != NULL) {
+        g_mapped_file_unref(index.mapped);
+    }
+    g_free(snapshot_path);
+    g_free(journal_path);
+    return result;
+}
+
+/**
+ * @brief Location of an output index file in the user data directory.
+ *        Unlike plans the index can't be rebuilt, so it isn't in the cache.
+ *
+ * @return path, must be freed by caller
+ */
+static gchar * index_file(const gchar *name)
+{
+    return g_build_filename(g_get_user_data_dir(), "hbr", name, NULL);
+}
+
+/**
+ * @brief Map the snapshot and fill index->records with its outputs. Room
+ *        is left for one more record per journal line. A missing snapshot
+ *        is an empty one, a damaged one is reported and ignored.
+ *
+ * @param index index with the journal read
+ * @param path  snapshot path
+ */
+static void load_snapshot(output_index_t *index, const gchar *path)
+{
+    // at most one record per journal line
+    guint32 journal_lines = 0;
+    for (gchar *c = index->journal; c != NULL && (c = strchr(c, '\n'));
+            c++) {
+        journal_lines++;
+    }
+
+    const snapshot_header_t *header = NULL;
+    const snapshot_output_t *outputs = NULL;
+    const guint32 *keyfiles = NULL;
+    const gchar *strings = NULL;
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, NULL);
+    if (mapped != NULL) {
+        const gchar *data = g_mapped_file_get_contents(mapped);
+        gsize size = g_mapped_file_get_length(mapped);
+        gboolean valid = data != NULL && size >= sizeof(snapshot_header_t);
+        if (valid) {
+            header = (const snapshot_header_t *)data;
+            outputs = (const snapshot_output_t *)(header + 1);
+            keyfiles = (const guint32 *)(outputs + header->output_count);
+            strings = (const gchar *)(keyfiles + header->keyfile_count);
+            valid = memcmp(header->magic, snapshot_magic,
+                    sizeof(snapshot_magic)) == 0 &&
+                header->format == OUTPUT_INDEX_FORMAT &&
+                header->string_size > 0 &&
+                sizeof(snapshot_header_t) +
+                (guint64)header->output_count * sizeof(snapshot_output_t) +
+                (guint64)header->keyfile_count * sizeof(guint32) +
+                header->string_size == size &&
+                strings[header->string_size - 1] == '\0';
+        }
+        for (guint32 i = 0; valid && i < header->keyfile_count; i++) {
+            valid = keyfiles[i] < header->string_size;
+        }
+        for (guint32 i = 0; valid && i < header->output_count; i++) {
+            const snapshot_output_t *o = &outputs[i];
+            valid = o->output < header->string_size &&
+                o->keyfile < header->keyfile_count &&
+                o->group < header->string_size &&
+                o->planned < header->string_size &&
+                (o->encoded == SNAPSHOT_NONE ||
+                 o->encoded < header->string_size);
+        }
+        if (!valid) {
+            hbr_warn("Output index is damaged or from another version, "
+                    "ignoring it", path, NULL, NULL, NULL);
+            g_mapped_file_unref(mapped);
+            mapped = NULL;
+        }
+    }
+    index->mapped = mapped;
+    guint32 output_count = mapped != NULL ? header->output_count : 0;
+    index->records = g_new0(output_record_t, output_count + journal_lines);
+    if (mapped == NULL) {
+        return;
+    }
+
+    index_keyfile_t **table = g_new(index_keyfile_t *,
+            header->keyfile_count);
+    for (guint32 i = 0; i < header->keyfile_count; i++) {
+        table[i] = lookup_keyfile(index, strings + keyfiles[i]);
+    }
+    for (guint32 i = 0; i < output_count; i++) {
+        const snapshot_output_t *o = &outputs[i];
+        output_record_t *record = &index->records[i];
+        record->output = strings + o->output;
+        record->keyfile = table[o->keyfile];
+        record->generation = record->keyfile->generation;
+        record->group = strings + o->group;
+        record->planned = strings + o->planned;
+        record->planned_time = o->planned_time;
+        record->keyfile_mtime = o->keyfile_mtime;
+        record->keyfile_size = o->keyfile_size;
+        if (o->encoded != SNAPSHOT_NONE) {
+            record->encoded = strings + o->encoded;
+        }
+        record->encoded_time = o->encoded_time;
+        record->failed = o->failed;
+        record->failed_time = o->failed_time;
+    }
+    g_free(table);
+    index->snapshot_count = output_count;
+    index->record_count = output_count;
+}
+
+/**
+ * @brief Replay journal records over the snapshot. A partial last line
+ *        from an interrupted write is ignored.
+ *
+ *        K records mark a keyfile as fully planned again, outputs planned
+ *        from it before that are no longer in the keyfile unless a later
+ *        P record names them.
+ */
+static void replay_journal(output_index_t *index)
+{
+    if (index->journal == NULL) {
+        return;
+    }
+    gchar *line = index->journal;
+    gchar *end = strchr(line, '\n');
+    if (end == NULL) {
+        return;
+    }
+    *end = '\0';
+    gchar *expected = g_strdup_printf("%s\t%d", journal_header,
+            OUTPUT_INDEX_FORMAT);
+    if (strcmp(line, expected) != 0) {
+        hbr_warn("Output index journal has an unknown format, ignoring it",
+                NULL, NULL, NULL, NULL);
+        g_free(expected);
+        return;
+    }
+    g_free(expected);
+
+    // records for a keyfile are usually together
+    index_keyfile_t *last_keyfile = NULL;
+    for (line = end + 1; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        *end = '\0';
+        index->journal_lines++;
+        gchar *fields[MAX_FIELDS];
+        gint count = 0;
+        for (gchar *field = line; field != NULL && count < MAX_FIELDS;
+                count++) {
+            fields[count] = field;
+            field = strchr(field, '\t');
+            if (field != NULL) {
+                *field++ = '\0';
+            }
+        }
+        if (count < 3 || fields[0][0] == '\0' || fields[0][1] != '\0') {
+            continue;
+        }
+        gint64 time = g_ascii_strtoll(fields[1], NULL, 10);
+
+        if (fields[0][0] == 'K' && count == 3) {
+            index_keyfile_t *keyfile = lookup_keyfile(index,
+                    unescape_tsv_field(fields[2]));
+            keyfile->generation++;
+            continue;
+        }
+        const gchar *output = unescape_tsv_field(fields[2]);
+        output_record_t *record = find_record(index, output);
+        if (fields[0][0] == 'P' && count == 8) {
+            if (record == NULL) {
+                record = &index->records[index->record_count++];
+                record->output = output;
+                g_hash_table_insert(index->added, (gpointer)output, record);
+            }
+            unescape_tsv_field(fields[3]);
+            if (last_keyfile == NULL ||
+                    strcmp(last_keyfile->path, fields[3]) != 0) {
+                last_keyfile = lookup_keyfile(index, fields[3]);
+            }
+            record->keyfile = last_keyfile;
+            record->generation = last_keyfile->generation;
+            record->group = unescape_tsv_field(fields[4]);
+            record->planned = unescape_tsv_field(fields[5]);
+            record->planned_time = time;
+            record->keyfile_mtime = g_ascii_strtoll(fields[6], NULL, 10);
+            record->keyfile_size = g_ascii_strtoll(fields[7], NULL, 10);
+        } else if (fields[0][0] == 'R' && count == 5 && record != NULL) {
+            if (strcmp(fields[4], "ok") == 0) {
+                record->encoded = unescape_tsv_field(fields[3]);
+                record->encoded_time = time;
+                record->failed = FALSE;
+            } else {
+                record->failed = TRUE;
+                record->failed_time = time;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Find an output's record, searching the sorted snapshot outputs
+ *        then the outputs added by the journal
+ *
+ * @return record, NULL when the output isn't indexed
+ */
+static output_record_t * find_record(output_index_t *index,
+        const gchar *output)
+{
+    guint32 low = 0;
+    guint32 high = index->snapshot_count;
+    while (low < high) {
+        guint32 middle = low + (high - low) / 2;
+        gint order = strcmp(index->records[middle].output, output);
+        if (order == 0) {
+            return &index->records[middle];
+        } else if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return g_hash_table_lookup(index->added, output);
+}
+
+/**
+ * @brief Find or add a keyfile named in the index
+ *
+ * @param index index being loaded
+ * @param path  keyfile path, must stay valid as long as the index
+ */
+static index_keyfile_t * lookup_keyfile(output_index_t *index,
+        const gchar *path)
+{
+    index_keyfile_t *keyfile = g_hash_table_lookup(index->keyfiles, path);
+    if (keyfile == NULL) {
+        keyfile = g_new0(index_keyfile_t, 1);
+        keyfile->path = path;
+        keyfile->generation = 1;
+        g_hash_table_insert(index->keyfiles, (gpointer)path, keyfile);
+    }
+    return keyfile;
+}
+
+/**
+ * @brief Classify an output. A keyfile changed since it was planned makes
+ *        its outputs unknown until it is planned again. Each keyfile is
+ *        only checked once.
+ */
+static output_state record_state(output_record_t *record)
+{
+    index_keyfile_t *keyfile = record->keyfile;
+    if (!keyfile->checked) {
+        GStatBuf buf;
+        keyfile->checked = TRUE;
+        keyfile->exists = g_stat(keyfile->path, &buf) == 0;
+        if (keyfile->exists) {
+            keyfile->mtime = buf.st_mtime;
+            keyfile->size = buf.st_size;
+        }
+    }
+    if (!keyfile->exists || keyfile->mtime != record->keyfile_mtime ||
+            keyfile->size != record->keyfile_size) {
+        return st_changed;
+    }
+    if (record->failed) {
+        return st_failed;
+    }
+    if (record->encoded == NULL) {
+        return st_not_encoded;
+    }
+    if (strcmp(record->encoded, record->planned) != 0) {
+        return st_stale;
+    }
+    return st_encoded;
+}
+
+/**
+ * @brief Write every live output to a new snapshot, replaced atomically.
+ *        The caller holds the journal lock.
+ *
+ * @return TRUE on success, failures are reported as warnings
+ */
+static gboolean write_snapshot(output_index_t *index, const gchar *path)
+{
+    GPtrArray *live = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, index->keyfiles);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        ((index_keyfile_t *)value)->table_index = SNAPSHOT_NONE;
+    }
+    for (guint32 i = 0; i < index->record_count; i++) {
+        output_record_t *record = &index->records[i];
+        if (record->generation == record->keyfile->generation) {
+            g_ptr_array_add(live, record);
+        }
+    }
+    g_ptr_array_sort(live, compare_outputs);
+
+    GArray *outputs = g_array_sized_new(FALSE, TRUE,
+            sizeof(snapshot_output_t), live->len);
+    GArray *keyfiles = g_array_new(FALSE, FALSE, sizeof(guint32));
+    GString *strings = g_string_new(NULL);
+    GHashTable *offsets = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < live->len; i++) {
+        output_record_t *record = live->pdata[i];
+        if (record->keyfile->table_index == SNAPSHOT_NONE) {
+            record->keyfile->table_index = keyfiles->len;
+            guint32 offset = add_string(strings, offsets,
+                    record->keyfile->path);
+            g_array_append_val(keyfiles, offset);
+        }
+        snapshot_output_t o = { 0 };
+        o.output = add_string(strings, offsets, record->output);
+        o.keyfile = record->keyfile->table_index;
+        o.group = add_string(strings, offsets, record->group);
+        o.planned = add_string(strings, offsets, record->planned);
+        o.encoded = record->encoded == NULL ? SNAPSHOT_NONE :
+            add_string(strings, offsets, record->encoded);
+        o.failed = record->failed;
+        o.planned_time = record->planned_time;
+        o.keyfile_mtime = record->keyfile_mtime;
+        o.keyfile_size = record->keyfile_size;
+        o.encoded_time = record->encoded_time;
+        o.failed_time = record->failed_time;
+        g_array_append_val(outputs, o);
+    }
+    // the string block is never empty so its last byte can be checked
+    g_string_append_c(strings, '\0');
+
+    snapshot_header_t header = { { 0 }, 0, 0, 0, 0 };
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.format = OUTPUT_INDEX_FORMAT;
+    header.output_count = outputs->len;
+    header.keyfile_count = keyfiles->len;
+    header.string_size = strings->len;
+    GString *data = g_string_sized_new(sizeof(header) +
+            outputs->len * sizeof(snapshot_output_t) +
+            keyfiles->len * sizeof(guint32) + strings->len);
+    g_string_append_len(data, (const gchar *)&header, sizeof(header));
+    g_string_append_len(data, outputs->data,
+            outputs->len * sizeof(snapshot_output_t));
+    g_string_append_len(data, keyfiles->data,
+            keyfiles->len * sizeof(guint32));
+    g_string_append_len(data, strings->str, strings->len);
+
+    GError *error = NULL;
+    gboolean result = g_file_set_contents(path, data->str, data->len, &error);
+    if (!result) {
+        hbr_warn("Failed to write output index: %s", path, NULL, NULL, NULL,
+                error->message);
+        g_error_free(error);
+    }
+    g_string_free(data, TRUE);
+    g_hash_table_destroy(offsets);
+    g_string_free(strings, TRUE);
+    g_array_free(keyfiles, TRUE);
+    g_array_free(outputs, TRUE);
+    g_ptr_array_free(live, TRUE);
+    return result;
+}
+
+/**
+ * @brief Add a string to a snapshot string block, reusing an identical
+ *        earlier string
+ *
+ * @return offset of text in strings
+ */
+static guint32 add_string(GString *strings, GHashTable *offsets,
+        const gchar *text)
+{
+    gpointer offset;
+    if (g_hash_table_lookup_extended(offsets, text, NULL, &offset)) {
+        return GPOINTER_TO_UINT(offset);
+    }
+    guint32 start = strings->len;
+    g_string_append_len(strings, text, strlen(text) + 1);
+    // text outlives offsets, it points into the snapshot or journal
+    g_hash_table_insert(offsets, (gpointer)text, GUINT_TO_POINTER(start));
+    return start;
+}
+
+/**
+ * @brief GCompareFunc sorting output_record_t pointers by output path
+ */
+static gint compare_outputs(gconstpointer a, gconstpointer b)
+{
+    const output_record_t *record_a = *(output_record_t * const *)a;
+    const output_record_t *record_b = *(output_record_t * const *)b;
+    return strcmp(record_a->output, record_b->output);
+}
@@ -0,0 +1,98 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _output_index_h
+#define _output_index_h
+
+#include <glib.h>
+
+/*
+ * The output index records every output file hbr has planned or encoded.
+ * It lives in the user data directory as two files:
+ *
+ * outputs.log is a journal every hbr process appends to while holding a
+ * lock on it, one tab separated record per line:
+ *
+ *   P  time  output  keyfile  group  fingerprint  keyfile_mtime  keyfile_size
+ *   R  time  output  fingerprint  ok|failed
+ *   K  time  keyfile
+ *
+ * P records are written when an outfile is planned, R records when its
+ * encode finishes, and K records before "hbr plan" plans a whole keyfile.
+ * Later records replace earlier ones for the same output. Fingerprints
+ * are a checksum of the HandBrakeCLI arguments, an output is stale when
+ * its last good encode used different arguments than its plan.
+ *
+ * outputs.index is a snapshot of every live output, sorted by output path
+ * and mapped in place:
+ *
+ *   snapshot_header_t | snapshot_output_t[] | guint32 keyfiles[] | strings
+ *
+ * "hbr status" reads the snapshot and replays the journal over it. Once
+ * the journal is long it is folded into a new snapshot and emptied.
+ * Replaying records already in the snapshot gives the same result, so a
+ * crash between the two steps loses nothing.
+ */
+
+/// Bumped whenever the journal or snapshot format changes
+#define OUTPUT_INDEX_FORMAT 1
+
+/// snapshot_output_t.encoded for an output that was never encoded
+#define SNAPSHOT_NONE G_MAXUINT32
+
+typedef struct {
+    gchar magic[8];
+    guint32 format;
+    guint32 output_count;
+    guint32 keyfile_count;
+    guint32 string_size;
+} snapshot_header_t;
+
+/**
+ * @brief One live output. Fields named for strings are string offsets.
+ */
+typedef struct {
+    gint64 planned_time;
+    gint64 keyfile_mtime;
+    gint64 keyfile_size;
+    gint64 encoded_time;
+    gint64 failed_time;
+    guint32 output;
+    /// index into the keyfile table
+    guint32 keyfile;
+    guint32 group;
+    /// fingerprint of the planned arguments
+    guint32 planned;
+    /// fingerprint of the last good encode, SNAPSHOT_NONE when not encoded
+    guint32 encoded;
+    /// the last encode failed
+    guint32 failed;
+} snapshot_output_t;
+
+gchar *output_index_fingerprint(GPtrArray *args);
+void output_index_add_planned(GString *records, const gchar *output,
+        const gchar *keyfile, const gchar *group, const gchar *fingerprint,
+        gint64 keyfile_mtime, gint64 keyfile_size);
+void output_index_add_keyfile(GString *records, const gchar *keyfile);
+void output_index_add_result(GString *records, const gchar *output,
+        const gchar *fingerprint, gboolean success);
+gboolean output_index_append(const GString *records);
+gboolean output_index_status(gchar **keyfiles);
+
+#endif
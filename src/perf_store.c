@@ -0,0 +1,400 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL, sscanf
+#include <stdlib.h>  // for strtod
+#include <string.h>  // for strcmp, strchr, strstr, strncmp
+
+#include "calibrate.h"
+#include "perf_store.h"
+#include "util.h"
+
+static const gchar store_header[] = "hbr-perf";
+
+/// option names read into each perf_field, older names after newer ones
+static const gchar *field_options[pf_field_count][3] = {
+    { "encoder", NULL },
+    { "encoder-preset", "x264-preset", NULL },
+    { "quality", NULL },
+    { "vb", NULL },
+    { "width", NULL },
+    { "height", NULL },
+    { "two-pass", NULL },
+    { NULL }
+};
+
+/// filter options, collected into pf_filters
+static const gchar *filter_options[] = {
+    "deinterlace", "decomb", "detelecine", "comb-detect", "hqdn3d",
+    "denoise", "nlmeans", "nlmeans-tune", "deblock", "rotate", "grayscale",
+    "pad", "unsharp", "lapsharp", "chroma-smooth", "colorspace", NULL
+};
+
+/**
+ * @brief One past encode read from the store
+ */
+typedef struct {
+    gchar *fields[pf_field_count];
+    /// source length, 0 when unknown
+    gdouble source_seconds;
+    gdouble wall_seconds;
+} perf_record_t;
+
+/// perf_record_t of every past encode, loaded on first prediction
+static GArray *records = NULL;
+/// records may be loaded from pool threads
+static GMutex store_lock;
+
+static gchar * store_file(void);
+static void load_records(void);
+static gdouble median(GArray *values);
+static gint compare_doubles(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief Pick the options that decide encode speed out of HandBrakeCLI
+ *        arguments
+ *
+ * @param args arguments from build_args() or plan_args(), may be NULL
+ *             terminated
+ *
+ * @return new key, free with perf_key_free()
+ */
+perf_key_t * perf_key_new(GPtrArray *args)
+{
+    perf_key_t *key = g_malloc0(sizeof(perf_key_t));
+    GString *filters = g_string_new(NULL);
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        const gchar *arg = args->pdata[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            continue;
+        }
+        arg += 2;
+        const gchar *equals = strchr(arg, '=');
+        gchar *name = equals ? g_strndup(arg, equals - arg) : g_strdup(arg);
+        // flags without a value are recorded as 1
+        const gchar *value = equals ? equals + 1 : "1";
+        for (gint f = 0; f < pf_filters; f++) {
+            for (gint n = 0; field_options[f][n] != NULL; n++) {
+                if (strcmp(name, field_options[f][n]) == 0) {
+                    g_free(key->fields[f]);
+                    key->fields[f] = g_strdup(value);
+                }
+            }
+        }
+        for (gint n = 0; filter_options[n] != NULL; n++) {
+            if (strcmp(name, filter_options[n]) == 0) {
+                if (filters->len > 0) {
+                    g_string_append_c(filters, ' ');
+                }
+                g_string_append(filters, arg);
+            }
+        }
+        g_free(name);
+    }
+    for (gint f = 0; f < pf_filters; f++) {
+        if (key->fields[f] == NULL) {
+            key->fields[f] = g_strdup("");
+        }
+    }
+    key->fields[pf_filters] = g_string_free(filters, FALSE);
+    return key;
+}
+
+/**
+ * @brief Free a key from perf_key_new()
+ */
+void perf_key_free(perf_key_t *key)
+{
+    if (key == NULL) {
+        return;
+    }
+    for (gint f = 0; f < pf_field_count; f++) {
+        g_free(key->fields[f]);
+    }
+    g_free(key);
+}
+
+/**
+ * @brief Add a finished encode to the store
+ *
+ * @param key            key options of the encode
+ * @param source_seconds source length from perf_read_log(), 0 if unknown
+ * @param fps            encoding speed from perf_read_log(), 0 if unknown
+ * @param wall_seconds   how long HandBrakeCLI ran
+ *
+ * @return TRUE when the record was written
+ */
+gboolean perf_store_add(const perf_key_t *key, gdouble source_seconds,
+        gdouble fps, gdouble wall_seconds)
+{
+    GString *record = g_string_new(NULL);
+    g_string_append_printf(record, "%" G_GINT64_FORMAT,
+            g_get_real_time() / G_USEC_PER_SEC);
+    for (gint f = 0; f < pf_field_count; f++) {
+        append_tsv_field(record, key->fields[f]);
+    }
+    if (source_seconds > 0) {
+        g_string_append_printf(record, "\t%.0f", source_seconds);
+    } else {
+        g_string_append_c(record, '\t');
+    }
+    if (fps > 0) {
+        g_string_append_printf(record, "\t%.3f", fps);
+    } else {
+        g_string_append_c(record, '\t');
+    }
+    g_string_append_printf(record, "\t%.3f\n", wall_seconds);
+
+    gchar *path = store_file();
+    gchar *header = g_strdup_printf("%s\t%d\n", store_header,
+            PERF_STORE_FORMAT);
+    gboolean result = append_locked(path, header, record, "performance store");
+    g_free(header);
+    g_free(path);
+    g_string_free(record, TRUE);
+    return result;
+}
+
+/**
+ * @brief Estimate how long an encode will take from the past encodes most
+ *        like it. Past encodes must use the same encoder, among those the
+ *        ones sharing the most other key options are used. The estimate is
+ *        their median run time, scaled by source length when it is known
+ *        for both. Without past encodes of the encoder, past encodes of
+ *        other encoders are scaled by the speeds hbr calibrate measured
+ *        for both.
+ *
+ * @param key            key options of the planned encode
+ * @param source_seconds length of the planned encode's source, 0 if unknown
+ * @param prediction     filled in with the estimate
+ *
+ * @return TRUE when there was a past encode to estimate from
+ */
+gboolean perf_predict(const perf_key_t *key, gdouble source_seconds,
+        perf_prediction_t *prediction)
+{
+    g_mutex_lock(&store_lock);
+    if (records == NULL) {
+        load_records();
+    }
+    g_mutex_unlock(&store_lock);
+
+    // run time per source second and run time of the best matches
+    GArray *rates = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    GArray *walls = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    guint best = 0;
+    for (guint i = 0; i < records->len; i++) {
+        perf_record_t *record = &g_array_index(records, perf_record_t, i);
+        if (strcmp(record->fields[pf_encoder], key->fields[pf_encoder]) != 0) {
+            continue;
+        }
+        guint matched = 0;
+        for (gint f = 0; f < pf_field_count; f++) {
+            matched += strcmp(record->fields[f], key->fields[f]) == 0;
+        }
+        if (matched < best) {
+            continue;
+        }
+        if (matched > best) {
+            best = matched;
+            g_array_set_size(rates, 0);
+            g_array_set_size(walls, 0);
+        }
+        g_array_append_val(walls, record->wall_seconds);
+        if (record->source_seconds > 0) {
+            gdouble rate = record->wall_seconds / record->source_seconds;
+            g_array_append_val(rates, rate);
+        }
+    }
+    gdouble key_fps;
+    if (walls->len == 0 && calibration_fps(key->fields[pf_encoder],
+                key->fields[pf_preset], 1, &key_fps) && key_fps > 0) {
+        for (guint i = 0; i < records->len; i++) {
+            perf_record_t *record = &g_array_index(records, perf_record_t,
+                    i);
+            gdouble record_fps;
+            if (!calibration_fps(record->fields[pf_encoder],
+                        record->fields[pf_preset], 1, &record_fps)) {
+                continue;
+            }
+            gdouble wall = record->wall_seconds * record_fps / key_fps;
+            g_array_append_val(walls, wall);
+            if (record->source_seconds > 0) {
+                gdouble rate = wall / record->source_seconds;
+                g_array_append_val(rates, rate);
+            }
+        }
+    }
+
+    gboolean found = walls->len > 0;
+    if (found && source_seconds > 0 && rates->len > 0) {
+        prediction->seconds = median(rates) * source_seconds;
+        prediction->samples = rates->len;
+        prediction->matched = best;
+    } else if (found) {
+        prediction->seconds = median(walls);
+        prediction->samples = walls->len;
+        prediction->matched = best;
+    }
+    g_array_free(rates, TRUE);
+    g_array_free(walls, TRUE);
+    return found;
+}
+
+/**
+ * @brief Find the source length and encoding speed in a HandBrakeCLI log.
+ *        The source length is the first title duration of the scan. Two
+ *        pass encodes report a speed for each pass, their combined speed is
+ *        used.
+ *
+ * @param log_filename   HandBrakeCLI log
+ * @param source_seconds set to the source length, unchanged if not found
+ * @param fps            set to the encoding speed, unchanged if not found
+ *
+ * @return TRUE when both were found
+ */
+gboolean perf_read_log(const gchar *log_filename, gdouble *source_seconds,
+        gdouble *fps)
+{
+    gchar *contents = NULL;
+    if (!g_file_get_contents(log_filename, &contents, NULL, NULL)) {
+        return FALSE;
+    }
+    gboolean duration_found = FALSE;
+    // seconds per frame summed over every pass
+    gdouble frame_time = 0;
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    for (gint i = 0; lines[i] != NULL; i++) {
+        const gchar *match;
+        gint h, m, s;
+        gdouble speed;
+        if (!duration_found &&
+                (match = strstr(lines[i], "+ duration: ")) != NULL &&
+                sscanf(match, "+ duration: %d:%d:%d", &h, &m, &s) == 3) {
+            *source_seconds = h * 3600 + m * 60 + s;
+            duration_found = TRUE;
+        } else if ((match = strstr(lines[i],
+                        "average encoding speed for job is ")) != NULL &&
+                sscanf(match, "average encoding speed for job is %lf",
+                    &speed) == 1 && speed > 0) {
+            frame_time += 1 / speed;
+        }
+    }
+    g_strfreev(lines);
+    if (frame_time > 0) {
+        *fps = 1 / frame_time;
+    }
+    return duration_found && frame_time > 0;
+}
+
+/**
+ * @brief Free the records loaded for predictions
+ */
+void perf_store_cleanup(void)
+{
+    if (records == NULL) {
+        return;
+    }
+    for (guint i = 0; i < records->len; i++) {
+        perf_record_t *record = &g_array_index(records, perf_record_t, i);
+        for (gint f = 0; f < pf_field_count; f++) {
+            g_free(record->fields[f]);
+        }
+    }
+    g_array_free(records, TRUE);
+    records = NULL;
+}
+
+/**
+ * @brief Location of the store in the user data directory
+ *
+ * @return path, must be freed by caller
+ */
+static gchar * store_file(void)
+{
+    return g_build_filename(g_get_user_data_dir(), "hbr", "perf.log", NULL);
+}
+
+/**
+ * @brief Read every record of the store. A missing store has no records,
+ *        damaged records are skipped.
+ */
+static void load_records(void)
+{
+    records = g_array_new(FALSE, FALSE, sizeof(perf_record_t));
+    gchar *path = store_file();
+    gchar *contents = NULL;
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        g_free(path);
+        return;
+    }
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+    gchar *header = g_strdup_printf("%s\t%d", store_header,
+            PERF_STORE_FORMAT);
+    if (lines[0] == NULL || strcmp(lines[0], header) != 0) {
+        hbr_warn("Performance store has an unknown format, ignoring it",
+                path, NULL, NULL, NULL);
+    } else {
+        for (gint i = 1; lines[i] != NULL; i++) {
+            gchar **fields = g_strsplit(lines[i], "\t", -1);
+            // time, key fields, source_seconds, fps, wall_seconds
+            if (g_strv_length(fields) == pf_field_count + 4) {
+                perf_record_t record;
+                for (gint f = 0; f < pf_field_count; f++) {
+                    record.fields[f] = g_strdup(unescape_tsv_field(
+                                fields[f+1]));
+                }
+                record.source_seconds = strtod(fields[pf_field_count+1],
+                        NULL);
+                record.wall_seconds = strtod(fields[pf_field_count+3], NULL);
+                g_array_append_val(records, record);
+            }
+            g_strfreev(fields);
+        }
+    }
+    g_free(header);
+    g_strfreev(lines);
+    g_free(path);
+}
+
+/**
+ * @brief Median of a non-empty array of doubles, sorts values
+ */
+static gdouble median(GArray *values)
+{
+    g_array_sort(values, compare_doubles);
+    guint middle = values->len / 2;
+    if (values->len % 2 == 0) {
+        return (g_array_index(values, gdouble, middle - 1) +
+                g_array_index(values, gdouble, middle)) / 2;
+    }
+    return g_array_index(values, gdouble, middle);
+}
+
+/**
+ * @brief GCompareFunc for sorting doubles
+ */
+static gint compare_doubles(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *(const gdouble *)a;
+    gdouble y = *(const gdouble *)b;
+    return (x > y) - (x < y);
+}
@@ -0,0 +1,84 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _perf_store_h
+#define _perf_store_h
+
+#include <glib.h>
+
+/*
+ * The performance store remembers how fast past encodes ran on this host.
+ * It is an append-only journal in the user data directory, perf.log, with
+ * one tab separated record per successful encode:
+ *
+ *   time  encoder  encoder-preset  quality  vb  width  height  two-pass
+ *   filters  source_seconds  fps  wall_seconds
+ *
+ * Options that weren't given are empty. source_seconds and fps come from
+ * the HandBrakeCLI log and are empty when it didn't report them.
+ */
+
+/// Bumped whenever the record format changes
+#define PERF_STORE_FORMAT 1
+
+/**
+ * @brief The options that decide how fast an encode runs
+ */
+typedef enum {
+    pf_encoder,
+    pf_preset,
+    pf_quality,
+    pf_vb,
+    pf_width,
+    pf_height,
+    pf_two_pass,
+    /// every filter argument, in argument order
+    pf_filters,
+    pf_field_count
+} perf_field;
+
+/**
+ * @brief Key options of one encode, "" for options that weren't given
+ */
+typedef struct {
+    gchar *fields[pf_field_count];
+} perf_key_t;
+
+/**
+ * @brief Estimated run time of a planned encode
+ */
+typedef struct {
+    gdouble seconds;
+    /// past encodes the estimate is based on
+    guint samples;
+    /// key fields those encodes shared with the planned one
+    guint matched;
+} perf_prediction_t;
+
+perf_key_t *perf_key_new(GPtrArray *args);
+void perf_key_free(perf_key_t *key);
+gboolean perf_read_log(const gchar *log_filename, gdouble *source_seconds,
+        gdouble *fps);
+gboolean perf_store_add(const perf_key_t *key, gdouble source_seconds,
+        gdouble fps, gdouble wall_seconds);
+gboolean perf_predict(const perf_key_t *key, gdouble source_seconds,
+        perf_prediction_t *prediction);
+void perf_store_cleanup(void);
+
+#endif
@@ -0,0 +1,475 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>   // for errno
+#include <stdio.h>   // for NULL
+#include <string.h>  // for memcmp, memcpy, memset, strcmp
+#include <glib/gstdio.h>
+
+#include "plan.h"
+#include "episode.h"
+
+static const gchar plan_magic[8] = "HBRPLAN";
+
+static void stamp_file(plan_stamp_t *stamp, const gchar *path);
+static guint32 add_string(plan_builder_t *builder, const gchar *text);
+static guint32 add_args(plan_builder_t *builder, GPtrArray *args,
+        guint32 *count);
+static plan_t * plan_from_data(const gchar *data, gsize size);
+
+/**
+ * @brief Fill in a fingerprint for the current state of a keyfile's inputs
+ *
+ * @param fingerprint fingerprint to fill in
+ * @param keyfile     path to the keyfile
+ * @param config      path to the global config, may be NULL
+ * @param settings    command line settings that change the plan
+ *                    (kept by reference)
+ */
+void plan_fingerprint_init(plan_fingerprint_t *fingerprint,
+        const gchar *keyfile, const gchar *config, const gchar *settings)
+{
+    stamp_file(&fingerprint->keyfile, keyfile);
+    stamp_file(&fingerprint->config, config);
+    gchar *handbrake = g_find_program_in_path("HandBrakeCLI");
+    stamp_file(&fingerprint->handbrake, handbrake);
+    g_free(handbrake);
+    fingerprint->settings = settings;
+}
+
+/**
+ * @brief Location of the stored plan for a keyfile. Plans live in the user
+ *        cache directory, named after a checksum of the keyfile's full path.
+ *
+ * @param keyfile path to the keyfile
+ *
+ * @return plan path, must be freed by caller
+ */
+gchar * plan_path(const gchar *keyfile)
+{
+    gchar *full_path = g_canonicalize_filename(keyfile, NULL);
+    gchar *checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1,
+            full_path, -1);
+    gchar *basename = g_strdup_printf("%s.plan", checksum);
+    gchar *path = g_build_filename(g_get_user_cache_dir(), "hbr", "plans",
+            basename, NULL);
+    g_free(basename);
+    g_free(checksum);
+    g_free(full_path);
+    return path;
+}
+
+/**
+ * @brief Start building a plan
+ *
+ * @return new builder, consumed by plan_builder_finish()
+ */
+plan_builder_t * plan_builder_new(void)
+{
+    plan_builder_t *builder = g_malloc(sizeof(plan_builder_t));
+    builder->entries = g_array_new(FALSE, TRUE, sizeof(plan_entry_t));
+    builder->args = g_array_new(FALSE, FALSE, sizeof(guint32));
+    builder->strings = g_string_new(NULL);
+    builder->offsets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+            NULL);
+    return builder;
+}
+
+/**
+ * @brief Add an encode to a plan
+ *
+ * @param builder    builder from plan_builder_new()
+ * @param group      outfile group name
+ * @param filename   output filename
+ * @param season     season number, -1 when not set
+ * @param episode    episode number, -1 when not set
+ * @param flags      PLAN_DEBUG and PLAN_PREVIEW
+ * @param split      segments to encode in, 0 for one job
+ * @param args       arguments from build_args()
+ * @param debug_args arguments from build_args() with quoting enabled
+ */
+void plan_builder_add(plan_builder_t *builder, const gchar *group,
+        const gchar *filename, gint season, gint episode, guint32 flags,
+        guint32 split, GPtrArray *args, GPtrArray *debug_args)
+{
+    plan_entry_t entry;
+    entry.group = add_string(builder, group);
+    entry.filename = add_string(builder, filename);
+    // build_args() always ends with -i <source> -o <filename> NULL
+    const gchar *source = "";
+    for (guint i = 0; i + 1 < args->len && args->pdata[i] != NULL; i++) {
+        if (strcmp(args->pdata[i], "-i") == 0 && args->pdata[i+1] != NULL) {
+            source = args->pdata[i+1];
+        }
+    }
+    entry.source = add_string(builder, source);
+    entry.season = season;
+    entry.episode = episode;
+    entry.flags = flags;
+    entry.split = split;
+    entry.args = add_args(builder, args, &entry.arg_count);
+    entry.debug_args = add_args(builder, debug_args, &entry.debug_arg_count);
+    g_array_append_val(builder->entries, entry);
+}
+
+/**
+ * @brief Lay out a finished plan in memory
+ *
+ * @param builder     builder from plan_builder_new(), freed by this call
+ * @param fingerprint inputs the plan was built from
+ *
+ * @return new plan, free with plan_free()
+ */
+plan_t * plan_builder_finish(plan_builder_t *builder,
+        const plan_fingerprint_t *fingerprint)
+{
+    plan_header_t header;
+    memset(&header, 0, sizeof(plan_header_t));
+    memcpy(header.magic, plan_magic, sizeof(plan_magic));
+    header.format = PLAN_FORMAT;
+    header.entry_count = builder->entries->len;
+    header.keyfile = fingerprint->keyfile;
+    header.config = fingerprint->config;
+    header.handbrake = fingerprint->handbrake;
+    header.settings = add_string(builder, fingerprint->settings);
+    header.arg_count = builder->args->len;
+    header.string_size = builder->strings->len;
+
+    gsize entries_size = builder->entries->len * sizeof(plan_entry_t);
+    gsize args_size = builder->args->len * sizeof(guint32);
+    gsize size = sizeof(plan_header_t) + entries_size + args_size +
+        builder->strings->len;
+    gchar *data = g_malloc(size);
+    gchar *p = data;
+    memcpy(p, &header, sizeof(plan_header_t));
+    p += sizeof(plan_header_t);
+    memcpy(p, builder->entries->data, entries_size);
+    p += entries_size;
+    memcpy(p, builder->args->data, args_size);
+    p += args_size;
+    memcpy(p, builder->strings->str, builder->strings->len);
+
+    g_array_free(builder->entries, TRUE);
+    g_array_free(builder->args, TRUE);
+    g_string_free(builder->strings, TRUE);
+    g_hash_table_destroy(builder->offsets);
+    g_free(builder);
+
+    plan_t *plan = plan_from_data(data, size);
+    plan->data = data;
+    return plan;
+}
+
+/**
+ * @brief Map a stored plan
+ *
+ * @param path        plan file from plan_path()
+ * @param fingerprint current state of the plan's inputs
+ *
+ * @return plan, NULL when the file is missing, damaged, or out of date
+ */
+plan_t * plan_load(const gchar *path, const plan_fingerprint_t *fingerprint)
+{
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, NULL);
+    if (mapped == NULL) {
+        return NULL;
+    }
+    plan_t *plan = plan_from_data(g_mapped_file_get_contents(mapped),
+            g_mapped_file_get_length(mapped));
+    if (plan == NULL) {
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+    plan->mapped = mapped;
+
+    const plan_header_t *header = plan->header;
+    if (memcmp(&header->keyfile, &fingerprint->keyfile,
+                sizeof(plan_stamp_t)) != 0 ||
+            memcmp(&header->config, &fingerprint->config,
+                sizeof(plan_stamp_t)) != 0 ||
+            memcmp(&header->handbrake, &fingerprint->handbrake,
+                sizeof(plan_stamp_t)) != 0 ||
+            strcmp(plan_string(plan, header->settings),
+                fingerprint->settings) != 0) {
+        plan_free(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+/**
+ * @brief Store a plan. The file is replaced atomically so a running hbr
+ *        never maps a partly written plan.
+ *
+ * @param plan  plan to write
+ * @param path  plan file from plan_path()
+ * @param error set on failure
+ *
+ * @return TRUE on success
+ */
+gboolean plan_write(const plan_t *plan, const gchar *path, GError **error)
+{
+    gchar *dirname = g_path_get_dirname(path);
+    if (g_mkdir_with_parents(dirname, 0700) != 0) {
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Failed to create directory \"%s\"", dirname);
+        g_free(dirname);
+        return FALSE;
+    }
+    g_free(dirname);
+    const plan_header_t *header = plan->header;
+    gsize size = sizeof(plan_header_t) +
+        header->entry_count * sizeof(plan_entry_t) +
+        header->arg_count * sizeof(guint32) + header->string_size;
+    return g_file_set_contents(path, (const gchar *)header, size, error);
+}
+
+/**
+ * @brief Free a plan from plan_builder_finish() or plan_load()
+ */
+void plan_free(plan_t *plan)
+{
+    if (plan == NULL) {
+        return;
+    }
+    if (plan->mapped != NULL) {
+        g_mapped_file_unref(plan->mapped);
+    }
+    g_free(plan->data);
+    g_free(plan);
+}
+
+/**
+ * @brief Number of encodes in a plan
+ */
+guint32 plan_count(const plan_t *plan)
+{
+    return plan->header->entry_count;
+}
+
+/**
+ * @brief Fetch an encode from a plan
+ *
+ * @param plan plan to read
+ * @param i    entry number, less than plan_count()
+ *
+ * @return entry owned by plan
+ */
+const plan_entry_t * plan_get(const plan_t *plan, guint32 i)
+{
+    return &plan->entries[i];
+}
+
+/**
+ * @brief Fetch a string from a plan
+ *
+ * @param plan   plan to read
+ * @param offset string offset from a plan_entry_t
+ *
+ * @return string owned by plan
+ */
+const gchar * plan_string(const plan_t *plan, guint32 offset)
+{
+    return plan->strings + offset;
+}
+
+/**
+ * @brief Copy an entry's HandBrakeCLI arguments
+ *
+ * @param plan  plan containing entry
+ * @param entry entry from plan_get()
+ * @param debug use the arguments quoted for debug output
+ *
+ * @return NULL terminated argument array like build_args() returns
+ */
+GPtrArray * plan_args(const plan_t *plan, const plan_entry_t *entry,
+        gboolean debug)
+{
+    guint32 first = debug ? entry->debug_args : entry->args;
+    guint32 count = debug ? entry->debug_arg_count : entry->arg_count;
+    GPtrArray *args = g_ptr_array_new_full(count + 1, g_free);
+    for (guint32 i = 0; i < count; i++) {
+        g_ptr_array_add(args, g_strdup(plan_string(plan,
+                        plan->args[first + i])));
+    }
+    g_ptr_array_add(args, NULL);
+    return args;
+}
+
+/**
+ * @brief List the entries selected by episode ranges, in plan order. Uses
+ *        the same rules as select_outfiles().
+ *
+ * @param plan   plan to select from
+ * @param ranges episode_range_t array from parse_episode_selection(), NULL
+ *               selects every entry
+ *
+ * @return array of guint32 entry numbers, free with g_array_free()
+ */
+GArray * plan_select(const plan_t *plan, const GArray *ranges)
+{
+    guint32 count = plan_count(plan);
+    GArray *selected = g_array_sized_new(FALSE, FALSE, sizeof(guint32), count);
+    if (ranges == NULL) {
+        for (guint32 i = 0; i < count; i++) {
+            g_array_append_val(selected, i);
+        }
+        return selected;
+    }
+    gchar **groups = g_new0(gchar *, count + 1);
+    GHashTable *numbers = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint32 i = 0; i < count; i++) {
+        groups[i] = g_strdup(plan_string(plan, plan->entries[i].group));
+        g_hash_table_insert(numbers, groups[i], GUINT_TO_POINTER(i));
+    }
+    episode_index_t *index = episode_index_alloc(groups, count);
+    for (guint32 i = 0; i < count; i++) {
+        if (plan->entries[i].episode >= 0) {
+            episode_index_add(index, groups[i], plan->entries[i].season,
+                    plan->entries[i].episode);
+        }
+    }
+    gchar **outfiles = select_outfiles(index, ranges);
+    for (gint i = 0; outfiles[i] != NULL; i++) {
+        guint32 entry = GPOINTER_TO_UINT(g_hash_table_lookup(numbers,
+                    outfiles[i]));
+        g_array_append_val(selected, entry);
+    }
+    g_strfreev(outfiles);
+    g_hash_table_destroy(numbers);
+    episode_index_free(index);
+    return selected;
+}
+
+/**
+ * @brief Record a file's device, inode, size and change times, zeroes when
+ *        the file does not exist
+ */
+static void stamp_file(plan_stamp_t *stamp, const gchar *path)
+{
+    GStatBuf buf;
+    memset(stamp, 0, sizeof(plan_stamp_t));
+    if (path != NULL && g_stat(path, &buf) == 0) {
+        stamp->device = buf.st_dev;
+        stamp->inode = buf.st_ino;
+        stamp->size = buf.st_size;
+        stamp->mtime = buf.st_mtim.tv_sec;
+        stamp->mtime_nsec = buf.st_mtim.tv_nsec;
+        stamp->ctime = buf.st_ctim.tv_sec;
+        stamp->ctime_nsec = buf.st_ctim.tv_nsec;
+    }
+}
+
+/**
+ * @brief Add a string to the plan's string block, reusing an identical
+ *        earlier string
+ *
+ * @return offset of the string
+ */
+static guint32 add_string(plan_builder_t *builder, const gchar *text)
+{
+    gpointer offset;
+    if (g_hash_table_lookup_extended(builder->offsets, text, NULL, &offset)) {
+        return GPOINTER_TO_UINT(offset);
+    }
+    guint32 new_offset = builder->strings->len;
+    // include the NUL terminator
+    g_string_append_len(builder->strings, text, strlen(text) + 1);
+    g_hash_table_insert(builder->offsets, g_strdup(text),
+            GUINT_TO_POINTER(new_offset));
+    return new_offset;
+}
+
+/**
+ * @brief Add arguments to the plan's arg table
+ *
+ * @param builder builder to add to
+ * @param args    NULL terminated arguments from build_args()
+ * @param count   output for the number of arguments added
+ *
+ * @return arg table index of the first argument
+ */
+static guint32 add_args(plan_builder_t *builder, GPtrArray *args,
+        guint32 *count)
+{
+    guint32 first = builder->args->len;
+    *count = 0;
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        guint32 offset = add_string(builder, args->pdata[i]);
+        g_array_append_val(builder->args, offset);
+        (*count)++;
+    }
+    return first;
+}
+
+/**
+ * @brief Check the layout of plan data and point a new plan_t into it.
+ *        Every offset is checked so a damaged file can't be read past its
+ *        end.
+ *
+ * @param data plan data, must stay valid for the life of the plan
+ * @param size length of data
+ *
+ * @return new plan (mapped and data unset), NULL when data is not a plan
+ */
+static plan_t * plan_from_data(const gchar *data, gsize size)
+{
+    if (data == NULL || size < sizeof(plan_header_t)) {
+        return NULL;
+    }
+    const plan_header_t *header = (const plan_header_t *)data;
+    if (memcmp(header->magic, plan_magic, sizeof(plan_magic)) != 0 ||
+            header->format != PLAN_FORMAT) {
+        return NULL;
+    }
+    guint64 expected = sizeof(plan_header_t) +
+        (guint64)header->entry_count * sizeof(plan_entry_t) +
+        (guint64)header->arg_count * sizeof(guint32) + header->string_size;
+    if (expected != size || header->string_size == 0) {
+        return NULL;
+    }
+    const plan_entry_t *entries = (const plan_entry_t *)(header + 1);
+    const guint32 *args = (const guint32 *)(entries + header->entry_count);
+    const gchar *strings = (const gchar *)(args + header->arg_count);
+    guint32 string_size = header->string_size;
+    if (strings[string_size - 1] != '\0' || header->settings >= string_size) {
+        return NULL;
+    }
+    for (guint32 i = 0; i < header->arg_count; i++) {
+        if (args[i] >= string_size) {
+            return NULL;
+        }
+    }
+    for (guint32 i = 0; i < header->entry_count; i++) {
+        const plan_entry_t *e = &entries[i];
+        if (e->group >= string_size || e->filename >= string_size ||
+                e->source >= string_size ||
+                (guint64)e->args + e->arg_count > header->arg_count ||
+                (guint64)e->debug_args + e->debug_arg_count >
+                header->arg_count) {
+            return NULL;
+        }
+    }
+    plan_t *plan = g_malloc0(sizeof(plan_t));
+    plan->header = header;
+    plan->entries = entries;
+    plan->args = args;
+    plan->strings = strings;
+    return plan;
+}
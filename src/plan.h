@@ -0,0 +1,163 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _plan_h
+#define _plan_h
+
+#include <glib.h>
+
+/*
+ * An encode plan is every resolved HandBrakeCLI call for one keyfile. Plans
+ * are stored as a single binary file that is mapped and used in place:
+ *
+ *   plan_header_t | plan_entry_t[entry_count] | guint32[arg_count] | strings
+ *
+ * Strings are NUL terminated and referenced by their offset into the string
+ * block. The arg table holds string offsets, each entry owns a range of it.
+ * Files are in host byte order, a plan from another machine fails the
+ * format check and is rebuilt.
+ */
+
+/// Bumped whenever the file layout changes
+#define PLAN_FORMAT 3
+
+/// outfile section sets debug=true
+#define PLAN_DEBUG   (1 << 0)
+/// outfile section sets preview=true
+#define PLAN_PREVIEW (1 << 1)
+
+/**
+ * @brief Identity, size and change times of a file a plan was built from.
+ *        The inode change time catches edits within the same second and
+ *        edits that put the modification time back.
+ */
+typedef struct {
+    gint64 device;
+    gint64 inode;
+    gint64 size;
+    gint64 mtime;
+    gint64 mtime_nsec;
+    gint64 ctime;
+    gint64 ctime_nsec;
+} plan_stamp_t;
+
+/**
+ * @brief Everything a plan depends on. A stored plan is only used when
+ *        every field matches.
+ */
+typedef struct {
+    /// the keyfile itself
+    plan_stamp_t keyfile;
+    /// global config
+    plan_stamp_t config;
+    /// HandBrakeCLI binary found in PATH
+    plan_stamp_t handbrake;
+    /// command line settings that change the plan (HandBrake version, -o)
+    const gchar *settings;
+} plan_fingerprint_t;
+
+typedef struct {
+    gchar magic[8];
+    guint32 format;
+    guint32 entry_count;
+    plan_stamp_t keyfile;
+    plan_stamp_t config;
+    plan_stamp_t handbrake;
+    /// string offset of plan_fingerprint_t.settings
+    guint32 settings;
+    guint32 arg_count;
+    guint32 string_size;
+    guint32 reserved;
+} plan_header_t;
+
+/**
+ * @brief One planned encode. Fields named for strings are string offsets,
+ *        read them with plan_string().
+ */
+typedef struct {
+    /// outfile group name
+    guint32 group;
+    /// output filename
+    guint32 filename;
+    /// input path given to HandBrakeCLI with -i
+    guint32 source;
+    /// season number, -1 when not set
+    gint32 season;
+    /// episode number, -1 when not set
+    gint32 episode;
+    /// PLAN_DEBUG and PLAN_PREVIEW
+    guint32 flags;
+    /// segments the chapter range is encoded in, 0 to encode it in one job
+    guint32 split;
+    /// first arg table index and count of the HandBrakeCLI arguments
+    guint32 args;
+    guint32 arg_count;
+    /// same arguments with paths quoted for debug output
+    guint32 debug_args;
+    guint32 debug_arg_count;
+} plan_entry_t;
+
+/**
+ * @brief A plan built in memory or mapped from a file. Read only.
+ */
+typedef struct {
+    /// mapped plan file, NULL for a plan built in memory
+    GMappedFile *mapped;
+    /// plan data built in memory, NULL for a mapped plan
+    gchar *data;
+    const plan_header_t *header;
+    const plan_entry_t *entries;
+    const guint32 *args;
+    const gchar *strings;
+} plan_t;
+
+/**
+ * @brief Collects entries for a new plan, see plan_builder_finish()
+ */
+typedef struct {
+    GArray *entries;
+    GArray *args;
+    GString *strings;
+    /// string to offset in strings, repeated arguments are stored once
+    GHashTable *offsets;
+} plan_builder_t;
+
+void plan_fingerprint_init(plan_fingerprint_t *fingerprint,
+        const gchar *keyfile, const gchar *config, const gchar *settings);
+gchar *plan_path(const gchar *keyfile);
+
+plan_builder_t *plan_builder_new(void);
+void plan_builder_add(plan_builder_t *builder, const gchar *group,
+        const gchar *filename, gint season, gint episode, guint32 flags,
+        guint32 split, GPtrArray *args, GPtrArray *debug_args);
+plan_t *plan_builder_finish(plan_builder_t *builder,
+        const plan_fingerprint_t *fingerprint);
+
+plan_t *plan_load(const gchar *path, const plan_fingerprint_t *fingerprint);
+gboolean plan_write(const plan_t *plan, const gchar *path, GError **error);
+void plan_free(plan_t *plan);
+
+guint32 plan_count(const plan_t *plan);
+const plan_entry_t *plan_get(const plan_t *plan, guint32 i);
+const gchar *plan_string(const plan_t *plan, guint32 offset);
+GPtrArray *plan_args(const plan_t *plan, const plan_entry_t *entry,
+        gboolean debug);
+GArray *plan_select(const plan_t *plan, const GArray *ranges);
+
+#endif
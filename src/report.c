@@ -0,0 +1,379 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+#include <string.h>  // for strcmp
+
+#include "config.h"
+#include "options.h"
+#include "report.h"
+#include "util.h"
+
+extern option_data_t option_data;
+
+/**
+ * @brief Successful jobs sharing an encoder, encoder preset, or rate target
+ */
+typedef struct {
+    gchar *name;
+    guint encodes;
+    /// fps and output kbps summed over the encodes that reported them
+    gdouble fps_total;
+    guint fps_count;
+    gdouble kbps_total;
+    guint kbps_count;
+    /// vb asked for in kbps, 0 for quality or default rate control
+    gdouble requested_kbps;
+} report_group_t;
+
+/**
+ * @brief Totals of a finished batch, computed from the queue's records
+ */
+typedef struct {
+    /// source seconds encoded per second of encoding
+    gdouble media_rate;
+    /// share of slot time spent running encodes, 0 to 1
+    gdouble utilization;
+    /// average bitrate of all output, kbps
+    gdouble output_kbps;
+    /// report_group_t arrays, most encodes first, ties by name
+    GArray *encoders;
+    GArray *presets;
+    GArray *targets;
+    /// indexes of records by wall time, slowest first
+    GArray *slowest;
+} report_t;
+
+static void report_init(report_t *report, const job_queue_t *queue);
+static void report_clear(report_t *report);
+static report_group_t *find_group(GArray *groups, const gchar *name);
+static void add_to_group(report_group_t *group, const job_record_t *record);
+static void clear_group(gpointer data);
+static gint compare_groups(gconstpointer a, gconstpointer b);
+static gdouble record_kbps(const job_record_t *record);
+static void print_groups(const GArray *groups, const gchar *heading,
+        gboolean requested);
+static void append_json_groups(GString *json, const gchar *name,
+        const GArray *groups, gboolean requested);
+
+/**
+ * @brief Print the throughput of a finished batch to stdout: media encoded
+ *        per hour, slot use, time lost between encodes, speed by encoder
+ *        and encoder preset, bitrate by rate target, and the slowest jobs
+ */
+void report_print(const job_queue_t *queue)
+{
+    if (queue->records->len == 0) {
+        return;
+    }
+    report_t report;
+    report_init(&report, queue);
+    g_print("Throughput: %.0f s of media in %.3f s, %.2f media hours per hour\n",
+            queue->media_seconds, queue->run_seconds, report.media_rate);
+    g_print("  %-14s %d, %.1f%% busy\n", "slots", queue->max_jobs,
+            100 * report.utilization);
+    g_print("  %-14s %.3f s\n", "thumbnails", queue->thumbnail_seconds);
+    g_print("  %-14s %.3f s\n", "prompts", queue->prompt_seconds);
+    g_print("  %-14s %" G_GUINT64_FORMAT " bytes, %.1f kbps\n", "output",
+            queue->output_bytes, report.output_kbps);
+    print_groups(report.encoders, "encoder", FALSE);
+    print_groups(report.presets, "encoder preset", FALSE);
+    print_groups(report.targets, "rate target", TRUE);
+
+    g_print("  %-24s %10s %10s  %s\n", "slowest", "wall s", "avg fps",
+            "output");
+    for (guint i = 0; i < report.slowest->len; i++) {
+        const job_record_t *record = &g_array_index(queue->records,
+                job_record_t, g_array_index(report.slowest, guint, i));
+        gchar *basename = g_path_get_basename(record->filename);
+        g_print("  %-24s %10.3f %10.2f  %s%s\n", "", record->wall_seconds,
+                record->avg_fps, basename, record->success ? "" : " (failed)");
+        g_free(basename);
+    }
+    report_clear(&report);
+}
+
+/**
+ * @brief Write the throughput report, with the hbr and HandBrake versions,
+ *        to a JSON file
+ *
+ * @return FALSE when the file could not be written
+ */
+gboolean report_write(const job_queue_t *queue, const gchar *filename)
+{
+    report_t report;
+    report_init(&report, queue);
+    GString *json = g_string_new("{\n");
+    g_string_append_printf(json, "  \"hbr_version\": \"%s\",\n",
+            PACKAGE_VERSION);
+    g_string_append(json, "  \"handbrake_version\": ");
+    append_json_string(json, option_data.handbrake_version ?
+            option_data.handbrake_version : "");
+    g_string_append_printf(json, ",\n"
+            "  \"finished\": %" G_GINT64_FORMAT ",\n"
+            "  \"slots\": %d,\n"
+            "  \"encodes\": %lu,\n"
+            "  \"failed\": %lu,\n"
+            "  \"run_seconds\": %.3f,\n"
+            "  \"media_seconds\": %.3f,\n"
+            "  \"media_hours_per_hour\": %.4f,\n"
+            "  \"slot_utilization\": %.4f,\n"
+            "  \"thumbnail_seconds\": %.3f,\n"
+            "  \"prompt_seconds\": %.3f,\n"
+            "  \"output_bytes\": %" G_GUINT64_FORMAT ",\n"
+            "  \"output_kbps\": %.3f,\n",
+            g_get_real_time() / G_USEC_PER_SEC, queue->max_jobs,
+            queue->completed, queue->failed, queue->run_seconds,
+            queue->media_seconds, report.media_rate, report.utilization,
+            queue->thumbnail_seconds, queue->prompt_seconds,
+            queue->output_bytes, report.output_kbps);
+    append_json_groups(json, "encoders", report.encoders, FALSE);
+    append_json_groups(json, "encoder_presets", report.presets, FALSE);
+    append_json_groups(json, "rate_targets", report.targets, TRUE);
+    g_string_append(json, "  \"slowest\": [");
+    for (guint i = 0; i < report.slowest->len; i++) {
+        const job_record_t *record = &g_array_index(queue->records,
+                job_record_t, g_array_index(report.slowest, guint, i));
+        g_string_append(json, i > 0 ? ",\n    {\"output\": " :
+                "\n    {\"output\": ");
+        append_json_string(json, record->filename);
+        g_string_append_printf(json, ", \"success\": %s, "
+                "\"wall_seconds\": %.3f, \"source_seconds\": %.3f, "
+                "\"avg_fps\": %.3f, \"output_bytes\": %" G_GUINT64_FORMAT
+                "}", record->success ? "true" : "false",
+                record->wall_seconds, record->source_seconds, record->avg_fps,
+                record->output_bytes);
+    }
+    g_string_append(json, report.slowest->len > 0 ? "\n  ]\n}\n" : "]\n}\n");
+    report_clear(&report);
+
+    GError *error = NULL;
+    gboolean written = g_file_set_contents(filename, json->str, json->len,
+            &error);
+    if (!written) {
+        hbr_error("Failed to write report: %s", filename, NULL, NULL, NULL,
+                error->message);
+        g_error_free(error);
+    }
+    g_string_free(json, TRUE);
+    return written;
+}
+
+/**
+ * @brief Compute a report's totals and groups from the queue's records
+ */
+static void report_init(report_t *report, const job_queue_t *queue)
+{
+    report->encoders = g_array_new(FALSE, FALSE, sizeof(report_group_t));
+    report->presets = g_array_new(FALSE, FALSE, sizeof(report_group_t));
+    report->targets = g_array_new(FALSE, FALSE, sizeof(report_group_t));
+    g_array_set_clear_func(report->encoders, clear_group);
+    g_array_set_clear_func(report->presets, clear_group);
+    g_array_set_clear_func(report->targets, clear_group);
+    report->slowest = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    gdouble busy_seconds = 0;
+    for (guint i = 0; i < queue->records->len; i++) {
+        const job_record_t *record = &g_array_index(queue->records,
+                job_record_t, i);
+        busy_seconds += record->wall_seconds;
+
+        // keep the slowest REPORT_SLOWEST, sorted by inserting
+        guint at = report->slowest->len;
+        while (at > 0 && g_array_index(queue->records, job_record_t,
+                    g_array_index(report->slowest, guint, at-1)).wall_seconds <
+                record->wall_seconds) {
+            at--;
+        }
+        if (at < REPORT_SLOWEST) {
+            g_array_insert_val(report->slowest, at, i);
+            if (report->slowest->len > REPORT_SLOWEST) {
+                g_array_set_size(report->slowest, REPORT_SLOWEST);
+            }
+        }
+
+        if (!record->success) {
+            continue;
+        }
+        gchar **fields = record->perf_key->fields;
+        const gchar *encoder = fields[pf_encoder][0] ? fields[pf_encoder] :
+            "default";
+        add_to_group(find_group(report->encoders, encoder), record);
+        gchar *preset = fields[pf_preset][0] || fields[pf_encoder][0] ?
+            g_strdup_printf("%s %s", encoder,
+                    fields[pf_preset][0] ? fields[pf_preset] : "default") :
+            g_strdup("default");
+        add_to_group(find_group(report->presets, preset), record);
+        g_free(preset);
+        gchar *target;
+        if (fields[pf_vb][0]) {
+            target = g_strdup_printf("vb=%s", fields[pf_vb]);
+        } else if (fields[pf_quality][0]) {
+            // build_args() writes quality as a double
+            target = g_strdup_printf("quality=%g",
+                    g_ascii_strtod(fields[pf_quality], NULL));
+        } else {
+            target = g_strdup("default");
+        }
+        report_group_t *group = find_group(report->targets, target);
+        group->requested_kbps = g_ascii_strtod(fields[pf_vb], NULL);
+        add_to_group(group, record);
+        g_free(target);
+    }
+    // jobs finish in any order with -j, sort so reports are comparable
+    g_array_sort(report->encoders, compare_groups);
+    g_array_sort(report->presets, compare_groups);
+    g_array_sort(report->targets, compare_groups);
+    report->media_rate = queue->run_seconds > 0 ?
+        queue->media_seconds / queue->run_seconds : 0;
+    report->utilization = queue->run_seconds > 0 ?
+        busy_seconds / (queue->max_jobs * queue->run_seconds) : 0;
+    report->output_kbps = queue->media_seconds > 0 ?
+        queue->output_bytes * 8 / queue->media_seconds / 1000 : 0;
+}
+
+/**
+ * @brief Free what report_init() allocated
+ */
+static void report_clear(report_t *report)
+{
+    g_array_free(report->encoders, TRUE);
+    g_array_free(report->presets, TRUE);
+    g_array_free(report->targets, TRUE);
+    g_array_free(report->slowest, TRUE);
+}
+
+/**
+ * @brief Find the group with name, adding it when there is none
+ */
+static report_group_t *find_group(GArray *groups, const gchar *name)
+{
+    for (guint i = 0; i < groups->len; i++) {
+        report_group_t *group = &g_array_index(groups, report_group_t, i);
+        if (strcmp(group->name, name) == 0) {
+            return group;
+        }
+    }
+    report_group_t group = { 0 };
+    group.name = g_strdup(name);
+    g_array_append_val(groups, group);
+    return &g_array_index(groups, report_group_t, groups->len - 1);
+}
+
+/**
+ * @brief Add a successful job's speed and bitrate to a group
+ */
+static void add_to_group(report_group_t *group, const job_record_t *record)
+{
+    group->encodes++;
+    if (record->avg_fps > 0) {
+        group->fps_total += record->avg_fps;
+        group->fps_count++;
+    }
+    gdouble kbps = record_kbps(record);
+    if (kbps > 0) {
+        group->kbps_total += kbps;
+        group->kbps_count++;
+    }
+}
+
+/**
+ * @brief GDestroyNotify clearing a report_group_t
+ */
+static void clear_group(gpointer data)
+{
+    g_free(((report_group_t *)data)->name);
+}
+
+/**
+ * @brief GCompareFunc ordering report_group_t by encodes, most first, then
+ *        by name
+ */
+static gint compare_groups(gconstpointer a, gconstpointer b)
+{
+    const report_group_t *group_a = a;
+    const report_group_t *group_b = b;
+    if (group_a->encodes != group_b->encodes) {
+        return group_a->encodes > group_b->encodes ? -1 : 1;
+    }
+    return strcmp(group_a->name, group_b->name);
+}
+
+/**
+ * @brief Average bitrate of a job's output, 0 when the source length is
+ *        unknown
+ */
+static gdouble record_kbps(const job_record_t *record)
+{
+    if (record->source_seconds <= 0) {
+        return 0;
+    }
+    return record->output_bytes * 8 / record->source_seconds / 1000;
+}
+
+/**
+ * @brief Print one table of groups with their average fps and bitrate
+ *
+ * @param requested also print the requested bitrate
+ */
+static void print_groups(const GArray *groups, const gchar *heading,
+        gboolean requested)
+{
+    g_print("  %-24s %10s %10s %10s", heading, "encodes", "avg fps",
+            "avg kbps");
+    g_print(requested ? " %10s\n" : "\n", "asked kbps");
+    for (guint i = 0; i < groups->len; i++) {
+        const report_group_t *group = &g_array_index(groups, report_group_t,
+                i);
+        g_print("  %-24s %10u %10.2f %10.1f", group->name, group->encodes,
+                group->fps_count ? group->fps_total / group->fps_count : 0,
+                group->kbps_count ? group->kbps_total / group->kbps_count : 0);
+        if (requested && group->requested_kbps > 0) {
+            g_print(" %10.0f\n", group->requested_kbps);
+        } else {
+            g_print(requested ? " %10s\n" : "\n", "-");
+        }
+    }
+}
+
+/**
+ * @brief Append a "name": [groups] member to the report JSON
+ */
+static void append_json_groups(GString *json, const gchar *name,
+        const GArray *groups, gboolean requested)
+{
+    g_string_append_printf(json, "  \"%s\": [", name);
+    for (guint i = 0; i < groups->len; i++) {
+        const report_group_t *group = &g_array_index(groups, report_group_t,
+                i);
+        g_string_append(json, i > 0 ? ",\n    {\"name\": " :
+                "\n    {\"name\": ");
+        append_json_string(json, group->name);
+        g_string_append_printf(json, ", \"encodes\": %u, "
+                "\"avg_fps\": %.3f, \"avg_kbps\": %.3f", group->encodes,
+                group->fps_count ? group->fps_total / group->fps_count : 0,
+                group->kbps_count ? group->kbps_total / group->kbps_count : 0);
+        if (requested) {
+            g_string_append_printf(json, ", \"requested_kbps\": %.3f",
+                    group->requested_kbps);
+        }
+        g_string_append_c(json, '}');
+    }
+    g_string_append(json, groups->len > 0 ? "\n  ],\n" : "],\n");
+}
@@ -0,0 +1,299 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>      // for errno
+#include <fcntl.h>      // for O_WRONLY, O_CREAT, O_TRUNC
+#include <stdio.h>      // for NULL, sscanf
+#include <stdlib.h>     // for _exit
+#include <string.h>     // for strncmp, strcmp, strrchr
+#include <sys/wait.h>   // for WIFEXITED, WEXITSTATUS
+#include <unistd.h>     // for fork, dup2, execvp
+#include <glib/gstdio.h>
+
+#include "output_index.h"
+#include "split.h"
+#include "util.h"
+
+/// HandBrakeCLI argument prefix of the chapter range
+#define CHAPTERS_ARG "--chapters="
+
+/// exit status of the forked child when mkvmerge couldn't be run, mkvmerge
+/// itself exits 0, 1 or 2
+#define JOIN_EXEC_FAILED 127
+
+/**
+ * @brief Divide the chapter range of an encode into consecutive ranges of
+ *        (nearly) equal chapter counts
+ *
+ * @param args  HandBrakeCLI arguments from build_args()
+ * @param count segments wanted, fewer are made when the range has fewer
+ *              chapters
+ *
+ * @return ranges formatted for --chapters, NULL when the arguments have no
+ *         chapter range of at least two chapters
+ */
+GPtrArray * split_ranges(GPtrArray *args, guint count)
+{
+    gint first = 0;
+    gint last = 0;
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        const gchar *arg = args->pdata[i];
+        if (strncmp(arg, CHAPTERS_ARG, strlen(CHAPTERS_ARG)) == 0 &&
+                sscanf(arg + strlen(CHAPTERS_ARG), "%d-%d", &first,
+                    &last) == 1) {
+            // a single chapter
+            last = first;
+        }
+    }
+    if (first < 1 || last <= first || count < 2) {
+        return NULL;
+    }
+    guint chapters = last - first + 1;
+    count = MIN(count, chapters);
+    GPtrArray *ranges = g_ptr_array_new_with_free_func(g_free);
+    gint start = first;
+    for (guint i = 0; i < count; i++) {
+        // earlier segments take a chapter each of what doesn't divide evenly
+        gint end = start + chapters / count - 1 + (i < chapters % count);
+        if (end == start) {
+            g_ptr_array_add(ranges, g_strdup_printf("%d", start));
+        } else {
+            g_ptr_array_add(ranges, g_strdup_printf("%d-%d", start, end));
+        }
+        start = end + 1;
+    }
+    return ranges;
+}
+
+/**
+ * @brief Name a segment of an output: Movie.mkv becomes Movie.part1.mkv
+ *
+ * @param filename final output filename
+ * @param segment  segment number, 1 based
+ *
+ * @return new filename, free with g_free()
+ */
+gchar * split_segment_filename(const gchar *filename, guint segment)
+{
+    const gchar *extension = strrchr(filename, '.');
+    if (extension == NULL || strchr(extension, G_DIR_SEPARATOR) != NULL) {
+        return g_strdup_printf("%s.part%u", filename, segment);
+    }
+    return g_strdup_printf("%.*s.part%u%s", (gint) (extension - filename),
+            filename, segment, extension);
+}
+
+/**
+ * @brief Copy an encode's arguments for one segment
+ *
+ * @param args             HandBrakeCLI arguments from build_args()
+ * @param range            chapter range of the segment, from split_ranges()
+ * @param segment_filename output of the segment
+ * @param quoted           args were built with quoting (for debug mode)
+ *
+ * @return new NULL terminated arguments
+ */
+GPtrArray * split_segment_args(GPtrArray *args, const gchar *range,
+        const gchar *segment_filename, gboolean quoted)
+{
+    GPtrArray *segment_args = g_ptr_array_new_full(args->len, g_free);
+    for (guint i = 0; i < args->len && args->pdata[i] != NULL; i++) {
+        const gchar *arg = args->pdata[i];
+        if (strncmp(arg, CHAPTERS_ARG, strlen(CHAPTERS_ARG)) == 0) {
+            g_ptr_array_add(segment_args, g_strconcat(CHAPTERS_ARG, range,
+                        NULL));
+        } else if (i > 0 && strcmp(args->pdata[i-1], "-o") == 0) {
+            g_ptr_array_add(segment_args, quoted ?
+                    g_shell_quote(segment_filename) :
+                    g_strdup(segment_filename));
+        } else {
+            g_ptr_array_add(segment_args, g_strdup(arg));
+        }
+    }
+    g_ptr_array_add(segment_args, NULL);
+    return segment_args;
+}
+
+/**
+ * @brief mkvmerge arguments appending the segments into the output
+ *
+ * @return new NULL terminated argument vector, free with g_strfreev()
+ */
+static gchar ** join_argv(const gchar *filename, GPtrArray *segments)
+{
+    gchar **argv = g_new0(gchar *, 2 * segments->len + 4);
+    gint n = 0;
+    argv[n++] = g_strdup("mkvmerge");
+    argv[n++] = g_strdup("-o");
+    argv[n++] = g_strdup(filename);
+    for (guint i = 0; i < segments->len; i++) {
+        if (i > 0) {
+            argv[n++] = g_strdup("+");
+        }
+        argv[n++] = g_strdup(segments->pdata[i]);
+    }
+    return argv;
+}
+
+/**
+ * @brief The mkvmerge call joining segments, quoted for debug output
+ *
+ * @return new string, free with g_free()
+ */
+gchar * split_join_command(const gchar *filename, GPtrArray *segments)
+{
+    gchar **argv = join_argv(filename, segments);
+    GString *command = g_string_new(argv[0]);
+    for (gint i = 1; argv[i] != NULL; i++) {
+        g_string_append_c(command, ' ');
+        if (strcmp(argv[i], "+") == 0 || strcmp(argv[i], "-o") == 0) {
+            g_string_append(command, argv[i]);
+        } else {
+            gchar *quoted = g_shell_quote(argv[i]);
+            g_string_append(command, quoted);
+            g_free(quoted);
+        }
+    }
+    g_strfreev(argv);
+    return g_string_free(command, FALSE);
+}
+
+/**
+ * @brief Start tracking a split output, add its segments with
+ *        split_add_segment()
+ *
+ * @param args     HandBrakeCLI arguments of the whole encode
+ * @param filename final output filename
+ * @param number   outfile number within its input file (0 based)
+ * @param total    outfile count of the input file
+ * @param preview  generate a thumbnail of the joined output
+ *
+ * @return new split, freed by the job queue once its segments are joined
+ */
+split_t * split_new(GPtrArray *args, const gchar *filename, gsize number,
+        gsize total, gboolean preview)
+{
+    split_t *split = g_malloc0(sizeof(split_t));
+    split->filename = g_strdup(filename);
+    split->fingerprint = output_index_fingerprint(args);
+    split->perf_key = perf_key_new(args);
+    split->number = number;
+    split->total = total;
+    split->preview = preview;
+    split->segments = g_ptr_array_new_with_free_func(g_free);
+    return split;
+}
+
+/**
+ * @brief Add the next segment to a split, its job must set job->split
+ */
+void split_add_segment(split_t *split, const gchar *segment_filename)
+{
+    g_ptr_array_add(split->segments, g_strdup(segment_filename));
+    split->remaining++;
+}
+
+/**
+ * @brief Start appending the segments into the final output with mkvmerge,
+ *        which keeps each segment's chapter markers with their times moved
+ *        to match. mkvmerge's output is logged next to the final output.
+ *        The caller reaps it and passes its status to split_join_finish().
+ *
+ * @return pid of mkvmerge, -1 when it couldn't be started
+ */
+pid_t split_join_start(split_t *split)
+{
+    gchar *log_filename = g_strdup_printf("%s.log", split->filename);
+    errno = 0;
+    int log_fd = g_open(log_filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (log_fd < 0) {
+        hbr_error("%lu: Failed to open mkvmerge log, %s was not joined: %s",
+                log_filename, NULL, NULL, NULL, split->number+1,
+                split->filename, g_strerror(errno));
+        g_free(log_filename);
+        return -1;
+    }
+    gchar **argv = join_argv(split->filename, split->segments);
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(log_fd, 1);
+        dup2(log_fd, 2);
+        close(log_fd);
+        errno = 0;
+        if (execvp(argv[0], argv) == -1) {
+            hbr_error("Failed to exec mkvmerge: %s", log_filename, NULL,
+                    NULL, NULL, g_strerror(errno));
+        }
+        _exit(JOIN_EXEC_FAILED);
+    } else if (pid < 0) {
+        hbr_error("%lu: Failed to fork mkvmerge, %s was not joined: %s",
+                log_filename, NULL, NULL, NULL, split->number+1,
+                split->filename, g_strerror(errno));
+    }
+    close(log_fd);
+    g_strfreev(argv);
+    g_free(log_filename);
+    return pid;
+}
+
+/**
+ * @brief Check how the mkvmerge run started by split_join_start() ended.
+ *        Segments are removed once joined.
+ *
+ * @param split  split that was joined
+ * @param status wait status of mkvmerge
+ *
+ * @return FALSE when mkvmerge couldn't be run or failed
+ */
+gboolean split_join_finish(split_t *split, gint status)
+{
+    gchar *log_filename = g_strdup_printf("%s.log", split->filename);
+    // mkvmerge exits 1 when it only warned
+    gboolean joined = WIFEXITED(status) && WEXITSTATUS(status) <= 1;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == JOIN_EXEC_FAILED) {
+        hbr_error("%lu: Failed to run mkvmerge, %s was not joined",
+                log_filename, NULL, NULL, NULL, split->number+1,
+                split->filename);
+    } else if (!joined) {
+        hbr_error("%lu: mkvmerge failed, %s was not joined", log_filename,
+                NULL, NULL, NULL, split->number+1, split->filename);
+    } else {
+        for (guint i = 0; i < split->segments->len; i++) {
+            g_unlink(split->segments->pdata[i]);
+        }
+    }
+    g_free(log_filename);
+    return joined;
+}
+
+/**
+ * @brief Free a split created by split_new()
+ */
+void split_free(split_t *split)
+{
+    if (split == NULL) {
+        return;
+    }
+    g_free(split->filename);
+    g_free(split->fingerprint);
+    perf_key_free(split->perf_key);
+    g_ptr_array_free(split->segments, TRUE);
+    g_free(split->failed_log);
+    g_free(split);
+}
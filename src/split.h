@@ -0,0 +1,75 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _split_h
+#define _split_h
+
+#include <glib.h>
+#include <sys/types.h>
+
+#include "perf_store.h"
+
+/**
+ * @brief An output encoded as chapter range segments by several jobs, joined
+ *        with mkvmerge once the last of them finishes
+ */
+typedef struct {
+    /// final output filename, mkvmerge's output is logged next to it
+    gchar *filename;
+    /// argument fingerprint of the whole encode for the output index, NULL
+    /// to not record
+    gchar *fingerprint;
+    /// options of the whole encode for the performance store, NULL to not
+    /// record
+    perf_key_t *perf_key;
+    /// outfile number within its input file (0 based) and outfile count
+    gsize number;
+    gsize total;
+    /// generate a thumbnail of the joined output
+    gboolean preview;
+    /// segment filenames in chapter order
+    GPtrArray *segments;
+    /// segment jobs that haven't finished
+    guint remaining;
+    /// a segment failed or was cancelled, the segments aren't joined
+    gboolean failed;
+    gboolean cancelled;
+    /// log of the first segment that failed or was cancelled
+    gchar *failed_log;
+    /// summed over the segments that finished
+    gdouble wall_seconds;
+    gdouble source_seconds;
+    /// source seconds divided by average speed, summed over the segments
+    gdouble encode_seconds;
+} split_t;
+
+GPtrArray *split_ranges(GPtrArray *args, guint count);
+gchar *split_segment_filename(const gchar *filename, guint segment);
+GPtrArray *split_segment_args(GPtrArray *args, const gchar *range,
+        const gchar *segment_filename, gboolean quoted);
+gchar *split_join_command(const gchar *filename, GPtrArray *segments);
+
+split_t *split_new(GPtrArray *args, const gchar *filename, gsize number,
+        gsize total, gboolean preview);
+void split_add_segment(split_t *split, const gchar *segment_filename);
+pid_t split_join_start(split_t *split);
+gboolean split_join_finish(split_t *split, gint status);
+void split_free(split_t *split);
+
+#endif
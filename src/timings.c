@@ -0,0 +1,263 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+#include <stdlib.h>  // for atexit
+
+#include "mem_profile.h"
+#include "timings.h"
+#include "trace.h"
+#include "util.h"
+
+static const gchar *phase_names[t_phase_count] = {
+    "version", "discover", "plan load", "pre-validate", "parse",
+    "post-validate", "merge", "build args", "filename", "plan write", "mkdir", "encode",
+    "thumbnail", "join", "index"
+};
+
+/**
+ * @brief One timed phase of one file or job
+ */
+typedef struct {
+    timing_phase phase;
+    /// file, group or job the phase ran for, may be NULL
+    gchar *subject;
+    /// microseconds since timings_enable()
+    gint64 start;
+    gint64 duration;
+} timing_sample_t;
+
+/// phases are being counted and totaled
+static gboolean tracking = FALSE;
+/// phases ended and their total microseconds, per phase
+static guint phase_counts[t_phase_count];
+static gint64 phase_totals[t_phase_count];
+/// timing_sample_t for every phase that ended, NULL unless --timings
+static GArray *samples = NULL;
+/// monotonic time timings were enabled
+static gint64 program_start = 0;
+/// --timings-file filename
+static gchar *dump_filename = NULL;
+/// phases end on pool threads during diff-config
+static GMutex timings_lock;
+
+static void timings_report(void);
+static void write_dump(void);
+static gint compare_durations(gconstpointer a, gconstpointer b);
+static gint64 percentile(const GArray *durations, guint percent);
+
+/**
+ * @brief Start recording phase timings. The summary is printed to stderr
+ *        when hbr exits.
+ *
+ * @param filename also write every sample here as tab separated values,
+ *                 may be NULL
+ */
+void timings_enable(const gchar *filename)
+{
+    if (samples != NULL) {
+        return;
+    }
+    timings_track();
+    samples = g_array_new(FALSE, FALSE, sizeof(timing_sample_t));
+    dump_filename = g_strdup(filename);
+    atexit(timings_report);
+}
+
+/**
+ * @brief Count and total phases without printing them, for readers of
+ *        timings_get_totals()
+ */
+void timings_track(void)
+{
+    if (!tracking) {
+        tracking = TRUE;
+        program_start = g_get_monotonic_time();
+    }
+}
+
+/**
+ * @brief Copy how many times each phase ended and their total time
+ *
+ * @param counts filled with t_phase_count counts
+ * @param totals filled with t_phase_count totals in microseconds
+ */
+void timings_get_totals(guint *counts, gint64 *totals)
+{
+    g_mutex_lock(&timings_lock);
+    for (gint i = 0; i < t_phase_count; i++) {
+        counts[i] = phase_counts[i];
+        totals[i] = phase_totals[i];
+    }
+    g_mutex_unlock(&timings_lock);
+}
+
+/**
+ * @brief Name of a phase as shown in reports
+ */
+const gchar * timing_phase_name(timing_phase phase)
+{
+    return phase_names[phase];
+}
+
+/**
+ * @brief Start timing a phase
+ *
+ * @return start time for timing_end(), 0 when neither timings nor a trace
+ *         are enabled
+ */
+gint64 timing_start(void)
+{
+    if (!tracking && !trace_enabled()) {
+        return 0;
+    }
+    gint64 start = g_get_monotonic_time();
+    mem_profile_phase_start(start);
+    return start;
+}
+
+/**
+ * @brief Record a phase that began at start, and write it to the trace
+ *
+ * @param phase   phase that ended
+ * @param subject file, group or job it ran for (copied), may be NULL
+ * @param start   value from timing_start()
+ */
+void timing_end(timing_phase phase, const gchar *subject, gint64 start)
+{
+    if (start == 0) {
+        return;
+    }
+    gint64 duration = g_get_monotonic_time() - start;
+    mem_profile_phase_end(phase, start);
+    // encodes are traced by the job queue on their own lanes
+    if (phase != t_encode) {
+        trace_span(phase_names[phase], NULL, start, duration,
+                "file", subject, NULL);
+    }
+    if (!tracking) {
+        return;
+    }
+    g_mutex_lock(&timings_lock);
+    phase_counts[phase]++;
+    phase_totals[phase] += duration;
+    if (samples != NULL) {
+        timing_sample_t sample;
+        sample.phase = phase;
+        sample.subject = g_strdup(subject);
+        sample.start = start - program_start;
+        sample.duration = duration;
+        g_array_append_val(samples, sample);
+    }
+    g_mutex_unlock(&timings_lock);
+}
+
+/**
+ * @brief atexit() handler printing a table of phase counts, totals, and
+ *        percentiles, then writing the dump file if requested
+ */
+static void timings_report(void)
+{
+    g_mutex_lock(&timings_lock);
+    gint64 wall = g_get_monotonic_time() - program_start;
+    GArray *durations[t_phase_count];
+    for (gint i = 0; i < t_phase_count; i++) {
+        durations[i] = g_array_new(FALSE, FALSE, sizeof(gint64));
+    }
+    for (guint i = 0; i < samples->len; i++) {
+        timing_sample_t *sample = &g_array_index(samples, timing_sample_t, i);
+        g_array_append_val(durations[sample->phase], sample->duration);
+    }
+
+    g_printerr("%-14s %7s %11s %6s %10s %10s %10s %10s\n", "phase", "count",
+            "total ms", "%wall", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    for (gint i = 0; i < t_phase_count; i++) {
+        GArray *d = durations[i];
+        if (d->len == 0) {
+            g_array_free(d, TRUE);
+            continue;
+        }
+        g_array_sort(d, compare_durations);
+        gint64 total = 0;
+        for (guint j = 0; j < d->len; j++) {
+            total += g_array_index(d, gint64, j);
+        }
+        g_printerr("%-14s %7u %11.3f %6.1f %10.3f %10.3f %10.3f %10.3f\n",
+                phase_names[i], d->len, total / 1000.0,
+                wall > 0 ? 100.0 * total / wall : 0.0,
+                percentile(d, 50) / 1000.0, percentile(d, 90) / 1000.0,
+                percentile(d, 99) / 1000.0,
+                g_array_index(d, gint64, d->len - 1) / 1000.0);
+        g_array_free(d, TRUE);
+    }
+    g_printerr("%-14s %7s %11.3f\n", "wall", "", wall / 1000.0);
+
+    if (dump_filename != NULL) {
+        write_dump();
+    }
+    for (guint i = 0; i < samples->len; i++) {
+        g_free(g_array_index(samples, timing_sample_t, i).subject);
+    }
+    g_array_free(samples, TRUE);
+    samples = NULL;
+    g_free(dump_filename);
+    g_mutex_unlock(&timings_lock);
+}
+
+/**
+ * @brief Write every sample in the order phases ended:
+ *        phase, subject, start and duration in microseconds
+ */
+static void write_dump(void)
+{
+    GString *dump = g_string_new("phase\tsubject\tstart_us\tduration_us\n");
+    for (guint i = 0; i < samples->len; i++) {
+        timing_sample_t *sample = &g_array_index(samples, timing_sample_t, i);
+        g_string_append_printf(dump, "%s\t%s\t%" G_GINT64_FORMAT "\t%"
+                G_GINT64_FORMAT "\n", phase_names[sample->phase],
+                sample->subject ? sample->subject : "", sample->start,
+                sample->duration);
+    }
+    GError *error = NULL;
+    if (!g_file_set_contents(dump_filename, dump->str, dump->len, &error)) {
+        hbr_error("Failed to write timings: %s", dump_filename, NULL, NULL,
+                NULL, error->message);
+        g_error_free(error);
+    }
+    g_string_free(dump, TRUE);
+}
+
+/**
+ * @brief GCompareFunc for sorting gint64 durations
+ */
+static gint compare_durations(gconstpointer a, gconstpointer b)
+{
+    gint64 x = *(const gint64 *)a;
+    gint64 y = *(const gint64 *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Nearest rank percentile of sorted, non-empty durations
+ */
+static gint64 percentile(const GArray *durations, guint percent)
+{
+    guint rank = (durations->len * percent + 99) / 100;
+    return g_array_index(durations, gint64, rank > 0 ? rank - 1 : 0);
+}
@@ -0,0 +1,56 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _timings_h
+#define _timings_h
+
+#include <glib.h>
+
+/**
+ * @brief Phases timed by --timings and drawn by --trace. Phases don't nest,
+ *        so their totals can be compared (encode, thumbnail and join overlap
+ *        other phases with -j).
+ */
+typedef enum {
+    t_version,
+    t_discover,
+    t_plan_load,
+    t_pre_validate,
+    t_parse,
+    t_post_validate,
+    t_merge,
+    t_build_args,
+    t_filename,
+    t_plan_write,
+    t_mkdir,
+    t_encode,
+    t_thumbnail,
+    t_join,
+    t_index,
+    t_phase_count
+} timing_phase;
+
+void timings_enable(const gchar *dump_filename);
+void timings_track(void);
+void timings_get_totals(guint *counts, gint64 *totals);
+const gchar *timing_phase_name(timing_phase phase);
+gint64 timing_start(void);
+void timing_end(timing_phase phase, const gchar *subject, gint64 start);
+
+#endif
@@ -0,0 +1,301 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>   // for errno
+#include <fcntl.h>   // for O_WRONLY, O_CREAT, O_TRUNC, O_CLOEXEC
+#include <stdio.h>   // for NULL
+#include <stdlib.h>  // for atexit
+#include <unistd.h>  // for write, close, getpid
+#include <glib/gstdio.h>
+
+#include "trace.h"
+#include "util.h"
+
+/// trace file descriptor, -1 when tracing is off
+static int trace_fd = -1;
+/// no event has been written yet (events after the first need a comma)
+static gboolean first_event = TRUE;
+/// pid of hbr, shared by every event
+static gint trace_pid = 0;
+/// lane name to trace thread id
+static GHashTable *lanes = NULL;
+/// trace thread id of the calling thread's lane, 0 until it writes an event
+static GPrivate thread_lane = G_PRIVATE_INIT(NULL);
+/// events are written from pool threads during diff-config
+static GMutex trace_lock;
+
+static void trace_close(void);
+static gint lane_id(const gchar *lane);
+static void write_event(GString *event);
+static void append_args(GString *out, const gchar *first_key, va_list args);
+
+/**
+ * @brief Start writing a trace, it is finished when hbr exits
+ *
+ * @param filename trace file, replaced if it exists
+ *
+ * @return TRUE when the trace file was created
+ */
+gboolean trace_open(const gchar *filename)
+{
+    if (trace_fd >= 0) {
+        return TRUE;
+    }
+    errno = 0;
+    trace_fd = g_open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0666);
+    if (trace_fd < 0) {
+        hbr_error("Failed to create trace: %s", filename, NULL, NULL, NULL,
+                g_strerror(errno));
+        return FALSE;
+    }
+    trace_pid = getpid();
+    lanes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    GString *event = g_string_new("{\"name\":\"process_name\",\"ph\":\"M\"");
+    g_string_append_printf(event, ",\"pid\":%d,\"tid\":0,\"args\":"
+            "{\"name\":\"hbr\"}}", trace_pid);
+    write_event(event);
+    g_string_free(event, TRUE);
+    // the main thread is always the first lane
+    lane_id(NULL);
+    atexit(trace_close);
+    return TRUE;
+}
+
+/**
+ * @brief Check if a trace is being written, so callers can skip
+ *        formatting arguments
+ */
+gboolean trace_enabled(void)
+{
+    return trace_fd >= 0;
+}
+
+/**
+ * @brief Write a complete span
+ *
+ * @param name      span name
+ * @param lane      lane to draw the span on, NULL for the calling thread
+ * @param start     g_get_monotonic_time() when the span began
+ * @param duration  length in microseconds
+ * @param first_key first argument name, followed by its string value and
+ *                  more name/value pairs, NULL terminated. NULL values are
+ *                  skipped.
+ */
+void trace_span(const gchar *name, const gchar *lane, gint64 start,
+        gint64 duration, const gchar *first_key, ...)
+{
+    va_list args;
+    va_start(args, first_key);
+    trace_span_valist(name, lane, start, duration, first_key, args);
+    va_end(args);
+}
+
+/**
+ * @brief trace_span() taking a va_list of arguments
+ */
+void trace_span_valist(const gchar *name, const gchar *lane, gint64 start,
+        gint64 duration, const gchar *first_key, va_list args)
+{
+    if (trace_fd < 0) {
+        return;
+    }
+    GString *event = g_string_new("{\"name\":");
+    append_json_string(event, name);
+    g_string_append_printf(event, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT,
+            trace_pid, lane_id(lane), start, duration);
+    append_args(event, first_key, args);
+    g_string_append_c(event, '}');
+    write_event(event);
+    g_string_free(event, TRUE);
+}
+
+/**
+ * @brief Begin a span that is ended by trace_end() on the same lane. Used
+ *        for spans that should show in the trace while they run.
+ *
+ * @param name      span name
+ * @param lane      lane to draw the span on, NULL for the calling thread
+ * @param first_key name/value argument pairs as in trace_span()
+ */
+void trace_begin(const gchar *name, const gchar *lane,
+        const gchar *first_key, ...)
+{
+    if (trace_fd < 0) {
+        return;
+    }
+    GString *event = g_string_new("{\"name\":");
+    append_json_string(event, name);
+    g_string_append_printf(event, ",\"ph\":\"B\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%" G_GINT64_FORMAT, trace_pid, lane_id(lane),
+            g_get_monotonic_time());
+    va_list args;
+    va_start(args, first_key);
+    append_args(event, first_key, args);
+    va_end(args);
+    g_string_append_c(event, '}');
+    write_event(event);
+    g_string_free(event, TRUE);
+}
+
+/**
+ * @brief End the last span begun on lane. Arguments are merged with those
+ *        given to trace_begin().
+ */
+void trace_end(const gchar *name, const gchar *lane,
+        const gchar *first_key, ...)
+{
+    if (trace_fd < 0) {
+        return;
+    }
+    GString *event = g_string_new("{\"name\":");
+    append_json_string(event, name);
+    g_string_append_printf(event, ",\"ph\":\"E\",\"pid\":%d,\"tid\":%d,"
+            "\"ts\":%" G_GINT64_FORMAT, trace_pid, lane_id(lane),
+            g_get_monotonic_time());
+    va_list args;
+    va_start(args, first_key);
+    append_args(event, first_key, args);
+    va_end(args);
+    g_string_append_c(event, '}');
+    write_event(event);
+    g_string_free(event, TRUE);
+}
+
+/**
+ * @brief atexit() handler closing the JSON array
+ */
+static void trace_close(void)
+{
+    g_mutex_lock(&trace_lock);
+    if (write(trace_fd, "\n]\n", 3) != 3) {
+        hbr_warn("Failed to finish trace", NULL, NULL, NULL, NULL);
+    }
+    close(trace_fd);
+    trace_fd = -1;
+    g_hash_table_destroy(lanes);
+    lanes = NULL;
+    g_mutex_unlock(&trace_lock);
+}
+
+/**
+ * @brief Find the trace thread id of a lane, naming new lanes in the trace
+ *
+ * @param lane lane name, NULL for the calling thread
+ *
+ * @return trace thread id
+ */
+static gint lane_id(const gchar *lane)
+{
+    gint id;
+    gchar *name = NULL;
+    g_mutex_lock(&trace_lock);
+    if (lane == NULL) {
+        id = GPOINTER_TO_INT(g_private_get(&thread_lane));
+        if (id == 0) {
+            id = g_hash_table_size(lanes) + 1;
+            g_private_set(&thread_lane, GINT_TO_POINTER(id));
+            name = id == 1 ? g_strdup("main") : g_strdup_printf("thread %d",
+                    id);
+            g_hash_table_insert(lanes, g_strdup_printf("#%d", id),
+                    GINT_TO_POINTER(id));
+        }
+    } else {
+        id = GPOINTER_TO_INT(g_hash_table_lookup(lanes, lane));
+        if (id == 0) {
+            id = g_hash_table_size(lanes) + 1;
+            name = g_strdup(lane);
+            g_hash_table_insert(lanes, g_strdup(lane), GINT_TO_POINTER(id));
+        }
+    }
+    g_mutex_unlock(&trace_lock);
+
+    if (name != NULL) {
+        GString *event = g_string_new("{\"name\":\"thread_name\",\"ph\":\"M\"");
+        g_string_append_printf(event, ",\"pid\":%d,\"tid\":%d,\"args\":"
+                "{\"name\":", trace_pid, id);
+        append_json_string(event, name);
+        g_string_append(event, "}}");
+        write_event(event);
+        g_string_free(event, TRUE);
+        // keep lanes in the order they were created
+        event = g_string_new("{\"name\":\"thread_sort_index\",\"ph\":\"M\"");
+        g_string_append_printf(event, ",\"pid\":%d,\"tid\":%d,\"args\":"
+                "{\"sort_index\":%d}}", trace_pid, id, id);
+        write_event(event);
+        g_string_free(event, TRUE);
+        g_free(name);
+    }
+    return id;
+}
+
+/**
+ * @brief Write one event to the trace file. Each event is a single write()
+ *        so nothing is left buffered if hbr dies.
+ */
+static void write_event(GString *event)
+{
+    g_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        g_string_prepend(event, first_event ? "[\n" : ",\n");
+        first_event = FALSE;
+        gsize written = 0;
+        while (written < event->len) {
+            ssize_t n = write(trace_fd, event->str + written,
+                    event->len - written);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            written += n;
+        }
+    }
+    g_mutex_unlock(&trace_lock);
+}
+
+/**
+ * @brief Append name/value string pairs as the event's "args" object
+ */
+static void append_args(GString *out, const gchar *first_key, va_list args)
+{
+    if (first_key == NULL) {
+        return;
+    }
+    g_string_append(out, ",\"args\":{");
+    gboolean first = TRUE;
+    for (const gchar *key = first_key; key != NULL;
+            key = va_arg(args, const gchar *)) {
+        const gchar *value = va_arg(args, const gchar *);
+        if (value == NULL) {
+            continue;
+        }
+        if (!first) {
+            g_string_append_c(out, ',');
+        }
+        first = FALSE;
+        append_json_string(out, key);
+        g_string_append_c(out, ':');
+        append_json_string(out, value);
+    }
+    g_string_append_c(out, '}');
+}
@@ -0,0 +1,46 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _trace_h
+#define _trace_h
+
+#include <glib.h>
+
+/*
+ * --trace writes a Chrome trace-event file (JSON array format) that can be
+ * opened in chrome://tracing or ui.perfetto.dev. Events are written to the
+ * file as they happen, so a trace cut short by a crash still loads.
+ *
+ * Spans are drawn on lanes (trace threads). NULL puts a span on the lane of
+ * the calling thread, otherwise lanes are named, like the job queue's
+ * "slot N" lanes.
+ */
+
+gboolean trace_open(const gchar *filename);
+gboolean trace_enabled(void);
+void trace_span(const gchar *name, const gchar *lane, gint64 start,
+        gint64 duration, const gchar *first_key, ...) G_GNUC_NULL_TERMINATED;
+void trace_span_valist(const gchar *name, const gchar *lane, gint64 start,
+        gint64 duration, const gchar *first_key, va_list args);
+void trace_begin(const gchar *name, const gchar *lane,
+        const gchar *first_key, ...) G_GNUC_NULL_TERMINATED;
+void trace_end(const gchar *name, const gchar *lane,
+        const gchar *first_key, ...) G_GNUC_NULL_TERMINATED;
+
+#endif
@@ -17,7 +17,12 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>     // for errno, EINTR
+#include <fcntl.h>     // for O_WRONLY, O_APPEND, O_CREAT
 #include <stdio.h>
+#include <unistd.h>    // for write, close
+#include <sys/file.h>  // for flock
+#include <glib/gstdio.h>
 
 #include "util.h"
 
@@ -196,3 +201,137 @@ GDataInputStream * open_datastream(const gchar *infile)
     g_object_unref(filestream);
     return datastream;
 }
+
+/**
+ * @brief Append str to out as a quoted JSON string
+ */
+void append_json_string(GString *out, const gchar *str)
+{
+    g_string_append_c(out, '"');
+    for (const gchar *c = str; *c != '\0'; c++) {
+        switch (*c) {
+            case '"':
+                g_string_append(out, "\\\"");
+                break;
+            case '\\':
+                g_string_append(out, "\\\\");
+                break;
+            case '\n':
+                g_string_append(out, "\\n");
+                break;
+            case '\t':
+                g_string_append(out, "\\t");
+                break;
+            default:
+                if ((guchar)*c < 0x20) {
+                    g_string_append_printf(out, "\\u%04x", (guchar)*c);
+                } else {
+                    g_string_append_c(out, *c);
+                }
+        }
+    }
+    g_string_append_c(out, '"');
+}
+
+/**
+ * @brief Append a tab and a field, escaping tabs, newlines, and backslashes
+ */
+void append_tsv_field(GString *records, const gchar *field)
+{
+    g_string_append_c(records, '\t');
+    for (const gchar *c = field; *c != '\0'; c++) {
+        switch (*c) {
+            case '\\':
+                g_string_append(records, "\\\\");
+                break;
+            case '\t':
+                g_string_append(records, "\\t");
+                break;
+            case '\n':
+                g_string_append(records, "\\n");
+                break;
+            default:
+                g_string_append_c(records, *c);
+        }
+    }
+}
+
+/**
+ * @brief Undo append_tsv_field() escaping in place
+ *
+ * @return field
+ */
+gchar * unescape_tsv_field(gchar *field)
+{
+    gchar *out = field;
+    for (gchar *c = field; *c != '\0'; c++) {
+        if (*c == '\\' && c[1] != '\0') {
+            c++;
+            *out++ = (*c == 't') ? '\t' : (*c == 'n') ? '\n' : *c;
+        } else {
+            *out++ = *c;
+        }
+    }
+    *out = '\0';
+    return field;
+}
+
+/**
+ * @brief Append records to a journal shared by hbr processes, holding an
+ *        exclusive lock so records from concurrent runs don't interleave
+ *
+ * @param path    journal path, created along with its directory if needed
+ * @param header  first line of a new journal
+ * @param records complete lines to append
+ * @param what    journal description for messages
+ *
+ * @return TRUE when every record was written
+ */
+gboolean append_locked(const gchar *path, const gchar *header,
+        const GString *records, const gchar *what)
+{
+    if (records->len == 0) {
+        return TRUE;
+    }
+    gchar *dirname = g_path_get_dirname(path);
+    int fd = -1;
+    errno = 0;
+    if (g_mkdir_with_parents(dirname, 0700) == 0) {
+        fd = g_open(path, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    }
+    g_free(dirname);
+    if (fd < 0 || flock(fd, LOCK_EX) != 0) {
+        hbr_warn("Failed to open %s: %s", path, NULL, NULL, NULL, what,
+                g_strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return FALSE;
+    }
+    GString *data = g_string_new(NULL);
+    GStatBuf buf;
+    if (fstat(fd, &buf) == 0 && buf.st_size == 0) {
+        g_string_append(data, header);
+    }
+    g_string_append_len(data, records->str, records->len);
+
+    gboolean result = TRUE;
+    gsize written = 0;
+    while (written < data->len) {
+        errno = 0;
+        ssize_t count = write(fd, data->str + written, data->len - written);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count < 0) {
+            hbr_warn("Failed to write %s: %s", path, NULL, NULL, NULL, what,
+                    g_strerror(errno));
+            result = FALSE;
+            break;
+        }
+        written += count;
+    }
+    close(fd);
+    g_string_free(data, TRUE);
+    return result;
+}
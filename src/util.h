@@ -37,4 +37,10 @@ void hbr_info(const gchar *format, const gchar *path, const gchar *section,
 
 GDataInputStream *open_datastream(const gchar *infile);
 
+void append_json_string(GString *out, const gchar *str);
+void append_tsv_field(GString *records, const gchar *field);
+gchar *unescape_tsv_field(gchar *field);
+gboolean append_locked(const gchar *path, const gchar *header,
+        const GString *records, const gchar *what);
+
 #endif
@@ -22,15 +22,33 @@
 #include <glib/gstdio.h>// for g_access
 #include <math.h>       // for fabs
 #include <stdio.h>      // for NULL
-#include <string.h>     // for strnlen, strrchr, strncmp, strcmp
+#include <string.h>     // for strnlen, strrchr, strcmp
 #include <sys/param.h>  // for MAXPATHLEN
 
 #include "util.h"
 #include "validate.h"
 #include "keyfile.h"
+#include "keyset.h"
+#include "value.h"
 
 extern option_data_t option_data;
 
+/*
+ * Scope of the validation in progress, for validators that look beyond the
+ * group they are called on. See group_in_scope().
+ */
+static const validation_scope_t *current_scope = NULL;
+
+static keyset_t * outfile_keys(GKeyFile *input_keyfile, const gchar *group,
+        GKeyFile *merged_configs, const keyset_t *config_keys);
+static gchar * outfile_value(GKeyFile *input_keyfile, const gchar *group,
+        GKeyFile *merged_configs, const gchar *key);
+static gboolean option_requires_met(gint index, const keyset_t *keys,
+        GKeyFile *input_keyfile, const gchar *group, GKeyFile *merged_configs,
+        const gchar *infile);
+static gsize audio_track_count(option_t *option, const gchar *group,
+        GKeyFile *config, const gchar *config_path);
+
 /**
  * @brief Check that a file can be read, and no group names are duplicate, and
  *        no keys within groups are duplicate
@@ -70,11 +88,13 @@ gboolean pre_validate_key_file(const gchar *infile)
  * @param infile         path to keyfile being validated (for error printing)
  * @param config_keyfile global config keyfile, used to check dependencies of
  *                       the input_keyfile
+ * @param scope          groups to validate from validation_scope_new(), NULL
+ *                       validates every group
  *
  * @return TRUE when a keyfile is valid
  */
 gboolean post_validate_input_file(GKeyFile *input_keyfile, const gchar *infile,
-        GKeyFile *config_keyfile)
+        GKeyFile *config_keyfile, const validation_scope_t *scope)
 {
     gboolean valid = TRUE;
 
@@ -84,7 +104,7 @@ gboolean post_validate_input_file(GKeyFile *input_keyfile, const gchar *infile,
         hbr_error("Keyfile missing [CONFIG] section", infile, NULL, NULL, NULL);
     }
     // validate config section
-    if (!post_validate_common(input_keyfile, infile, config_keyfile)) {
+    if (!post_validate_common(input_keyfile, infile, config_keyfile, scope)) {
         valid = FALSE; // errors printed during post_validate_config_section()
     }
 
@@ -95,12 +115,12 @@ gboolean post_validate_input_file(GKeyFile *input_keyfile, const gchar *infile,
     }
 
     // check required keys exist (type, file naming stuff)
-    if (!has_required_keys(input_keyfile, infile, config_keyfile)) {
+    if (!has_required_keys(input_keyfile, infile, config_keyfile, scope)) {
         return FALSE; // errors printed during has_required_keys()
     }
 
     // check required keys exist (requires)
-    if (!has_requires(input_keyfile, infile, config_keyfile)) {
+    if (!has_requires(input_keyfile, infile, config_keyfile, scope)) {
         return FALSE; // errors printed during has_requires()
     }
 
@@ -136,16 +156,16 @@ gboolean post_validate_config_file(GKeyFile *keyfile, const gchar *infile)
         i++;
     }
     g_strfreev(group_names);
-    if (!post_validate_common(keyfile, infile, NULL)) {
+    if (!post_validate_common(keyfile, infile, NULL, NULL)) {
         valid = FALSE; // errors printed during post_validate_config_section()
     }
     // check required keys exist
-    if (!has_required_keys(keyfile, infile, NULL)) {
+    if (!has_required_keys(keyfile, infile, NULL, NULL)) {
         valid = FALSE; // errors printed during has_required_keys()
     }
 
     // check required keys exist (requires)
-    if (!has_requires(keyfile, infile, NULL)) {
+    if (!has_requires(keyfile, infile, NULL, NULL)) {
         valid = FALSE; // errors printed during has_requires()
     }
 
@@ -162,11 +182,13 @@ gboolean post_validate_config_file(GKeyFile *keyfile, const gchar *infile)
  * @param infile          path to keyfile being validated (for error printing)
  * @param config_keyfile  global config keyfile or NULL if keyfile is a global
  *                        config
+ * @param scope           groups to validate from validation_scope_new(), NULL
+ *                        validates every group
  *
  * @return TRUE when a config section is valid
  */
 gboolean post_validate_common(GKeyFile *keyfile, const gchar *infile,
-        GKeyFile *config_keyfile)
+        GKeyFile *config_keyfile, const validation_scope_t *scope)
 {
     gboolean valid = TRUE;
     gboolean checking_local_config = config_keyfile != NULL;
@@ -177,7 +199,7 @@ gboolean post_validate_common(GKeyFile *keyfile, const gchar *infile,
     int i = 0;
     while (group_names[i] != NULL && checking_local_config) {
         if (strcmp(group_names[i], "CONFIG") != 0 &&
-                strncmp(group_names[i], "OUTFILE", 7) != 0) {
+                !is_outfile_group(group_names[i])) {
             valid = FALSE;
             hbr_error("Invalid section in config file", infile, group_names[i],
                     NULL, NULL);
@@ -185,7 +207,7 @@ gboolean post_validate_common(GKeyFile *keyfile, const gchar *infile,
         i++;
     }
     // check for unknown keys
-    if (unknown_keys_exist(keyfile, infile)) {
+    if (unknown_keys_exist(keyfile, infile, scope)) {
         valid = FALSE;
     }
     // TODO check keys that don't belong in global config
@@ -216,23 +238,87 @@ gboolean post_validate_common(GKeyFile *keyfile, const gchar *infile,
 
     i = 0;
     option_t *options = option_data.options;
+    current_scope = scope;
     while (group_names[i] != NULL) {
-        int j = 0;
-        while (options[j].name != NULL) {
-            if (g_key_file_has_key(keyfile, group_names[i], options[j].name, NULL)) {
-                if (!options[j].valid_option(&options[j],  group_names[i],
-                            keyfile, infile)) {
-                    valid = FALSE;
-                }
+        if (!group_in_scope(i, scope)) {
+            i++;
+            continue;
+        }
+        // visit set keys in option table order
+        keyset_t *keys = keyset_from_group(keyfile, group_names[i]);
+        for (gint j = keyset_next(keys->present, 0); j >= 0;
+                j = keyset_next(keys->present, j + 1)) {
+            if (!options[j].valid_option(&options[j],  group_names[i],
+                        keyfile, infile)) {
+                valid = FALSE;
             }
-            j++;
         }
+        keyset_free(keys);
         i++;
     }
+    current_scope = NULL;
     g_strfreev(group_names);
     return valid;
 }
 
+/**
+ * @brief Build the validation scope of a keyfile: CONFIG and the selected
+ *        outfile groups
+ *
+ * @param keyfile  keyfile to be validated, its groups must not change while
+ *                 the scope is used
+ * @param outfiles NULL terminated list of outfile group names to validate
+ *
+ * @return new scope, free with validation_scope_free()
+ */
+validation_scope_t * validation_scope_new(GKeyFile *keyfile, gchar **outfiles)
+{
+    GHashTable *selected = g_hash_table_new(g_str_hash, g_str_equal);
+    for (gsize i = 0; outfiles[i] != NULL; i++) {
+        g_hash_table_add(selected, outfiles[i]);
+    }
+    gchar **groups = g_key_file_get_groups(keyfile, NULL);
+    validation_scope_t *scope = g_malloc(sizeof(validation_scope_t));
+    scope->count = g_strv_length(groups);
+    scope->groups = g_new(gboolean, scope->count);
+    for (gsize i = 0; i < scope->count; i++) {
+        scope->groups[i] = strcmp(groups[i], "CONFIG") == 0 ||
+            g_hash_table_contains(selected, groups[i]);
+    }
+    g_strfreev(groups);
+    g_hash_table_destroy(selected);
+    return scope;
+}
+
+/**
+ * @brief Free a scope from validation_scope_new()
+ */
+void validation_scope_free(validation_scope_t *scope)
+{
+    if (scope == NULL) {
+        return;
+    }
+    g_free(scope->groups);
+    g_free(scope);
+}
+
+/**
+ * @brief Check if a group is part of a validation scope. CONFIG is always
+ *        in scope.
+ *
+ * @param group position of the group in g_key_file_get_groups() order
+ * @param scope scope from validation_scope_new(), NULL for every group
+ *
+ * @return TRUE when group should be validated
+ */
+gboolean group_in_scope(gsize group, const validation_scope_t *scope)
+{
+    if (scope == NULL) {
+        return TRUE;
+    }
+    return group < scope->count && scope->groups[group];
+}
+
 /**
  * @brief Verifies merged result of each outfile has all keys that any other
  *        defined keys require.
@@ -240,11 +326,13 @@ gboolean post_validate_common(GKeyFile *keyfile, const gchar *infile,
  * @param input_keyfile File to be tested
  * @param infile Path for input_keyfile (for error messages)
  * @param config_keyfile Global config or NULL
+ * @param scope groups to check from validation_scope_new(), NULL checks
+ *              every outfile
  *
  * @return TRUE when all requires are fulfilled
  */
 gboolean has_requires(GKeyFile *input_keyfile, const gchar *infile,
-        GKeyFile *config_keyfile) {
+        GKeyFile *config_keyfile, const validation_scope_t *scope) {
     gboolean valid = TRUE;
     gchar **group_names = g_key_file_get_groups(input_keyfile, NULL);
     int i = 0;
@@ -255,88 +343,39 @@ gboolean has_requires(GKeyFile *input_keyfile, const gchar *infile,
                 config_keyfile, "CONFIG", "CONFIG");
     }
     if (merged_configs == NULL) {
+        g_strfreev(group_names);
         return FALSE;
     }
+    keyset_t *config_keys = keyset_from_group(merged_configs, "CONFIG");
     // iterate over each outfile section
     while (group_names[i] != NULL) {
-        GKeyFile *test_keyfile = NULL;
-        if (strncmp("OUTFILE", group_names[i], sizeof("OUTFILE")-1) == 0) {
-            // merge outfile section with config. maintain same names
-            if (g_key_file_has_group(input_keyfile, "CONFIG")) {
-                test_keyfile = merge_key_group(input_keyfile, group_names[i],
-                        merged_configs, "CONFIG", group_names[i]);
-            } else {
-                // no config section. just update pointer
-                test_keyfile = input_keyfile;
-            }
-            // check each key for requires
-            gchar **keys = g_key_file_get_keys(test_keyfile, group_names[i],
-                    NULL, NULL);
-            int j = 0;
-            while (keys[j] != NULL) {
-                /* Special case to skip boolean keys that can be negated
-                 * This ignores requires when a option is specified as false
-                 * (this should mean it's not enabled, and it's requires are not
-                 * necessary)
-                 */
-                gint option_index = GPOINTER_TO_INT(
-                        g_hash_table_lookup(option_data.options_index,
-                            keys[j]));
-                if (option_data.options[option_index].key_type == k_boolean &&
-                        option_data.options[option_index].negation_option) {
-                    if (g_key_file_get_boolean(test_keyfile, group_names[i],
-                                keys[j], NULL) == FALSE) {
-                        j++;
-                        continue;
-                    }
+        if (is_outfile_group(group_names[i]) &&
+                group_in_scope(i, scope)) {
+            keyset_t *keys = outfile_keys(input_keyfile, group_names[i],
+                    merged_configs, config_keys);
+            /* Only active keys are checked. This ignores requires when a
+             * negatable option is specified as false (this should mean it's
+             * not enabled, and it's requires are not necessary)
+             */
+            for (gint j = keyset_next(keys->active, 0); j >= 0;
+                    j = keyset_next(keys->active, j + 1)) {
+                if (!keyset_missing(keyset_require_mask(j), keys) &&
+                        !keyset_test(option_data.checked_requires, j)) {
+                    continue;
                 }
-                GSList* requires_list =
-                    g_hash_table_lookup(option_data.requires_index, keys[j]);
-                /* iterate over gslist (pointers are actually int which
-                   are the index to the requires table) */
-                while (requires_list != NULL) {
-                    gint index = GPOINTER_TO_INT(requires_list->data);
-                    // check if require is defined
-                    if (!g_key_file_has_key(test_keyfile, group_names[i],
-                                option_data.requires[index].require_name,
-                                NULL)) {
-                        gchar *value = g_key_file_get_value(
-                                test_keyfile, group_names[i], keys[j], NULL);
-                        hbr_error("Key \"%s\" requires \"%s\" but it is not"
-                                " set", infile, group_names[i], keys[j], value,
-                                keys[j], option_data.requires[index].require_name);
-                        valid = FALSE;
-                        g_free(value);
-                    } else {
-                        // if require has specific value check it
-                        gchar *requires_value = g_key_file_get_value(
-                                test_keyfile, group_names[i],
-                                option_data.requires[index].require_name, NULL);
-                        if (option_data.requires[index].require_value != NULL &&
-                                strcmp(requires_value,
-                                    option_data.requires[index].require_value) != 0) {
-                            hbr_error("Key \"%s\" requires setting \"%s=%s\"",
-                                    infile, group_names[i], keys[j], NULL,
-                                    keys[j], option_data.requires[index].require_name,
-                                    option_data.requires[index].require_value);
-                            valid = FALSE;
-                        }
-                        g_free(requires_value);
-                    }
-                    requires_list = requires_list->next;
+                if (!option_requires_met(j, keys, input_keyfile,
+                            group_names[i], merged_configs, infile)) {
+                    valid = FALSE;
                 }
-                j++;
             }
-            g_strfreev(keys);
-        }
-        if (test_keyfile && test_keyfile != input_keyfile) {
-            g_key_file_free(test_keyfile);
+            keyset_free(keys);
         }
         i++;
     }
+    keyset_free(config_keys);
     // Free the merged configs unless it still points to input_keyfile
     if (merged_configs != input_keyfile) {
-        g_key_file_free(merged_configs);
+        free_key_file(merged_configs);
     }
     g_strfreev(group_names);
     return valid;
@@ -349,12 +388,16 @@ gboolean has_requires(GKeyFile *input_keyfile, const gchar *infile,
  * @param input_keyfile File to be tested
  * @param infile Path for input_keyfile (for error messages)
  * @param config_keyfile Global config or NULL
+ * @param scope groups to check from validation_scope_new(), NULL checks
+ *              every outfile
  *
  * @return TRUE when all required keys are present
  */
 gboolean has_required_keys(GKeyFile *input_keyfile, const gchar *infile,
-        GKeyFile *config_keyfile)
+        GKeyFile *config_keyfile, const validation_scope_t *scope)
 {
+    const gchar *required_keys[] = {"type", "iso_filename", "name", "title",
+        NULL};
     gboolean valid = TRUE;
     gchar **group_names = g_key_file_get_groups(input_keyfile, NULL);
     int i = 0;
@@ -365,81 +408,164 @@ gboolean has_required_keys(GKeyFile *input_keyfile, const gchar *infile,
                 config_keyfile, "CONFIG", "CONFIG");
     }
     if (merged_configs == NULL) {
+        g_strfreev(group_names);
         return FALSE;
     }
+    // build mask of required keys
+    keyset_t *required = keyset_new();
+    for (int j = 0; required_keys[j] != NULL; j++) {
+        keyset_set(required->present, option_index(required_keys[j]));
+    }
+    keyset_t *config_keys = keyset_from_group(merged_configs, "CONFIG");
     // iterate over each outfile section
     while (group_names[i] != NULL) {
-        GKeyFile *test_keyfile = NULL;
-        if (strncmp("OUTFILE", group_names[i], sizeof("OUTFILE")-1) == 0) {
-            // merge outfile section with config. maintain same names
-            if (g_key_file_has_group(input_keyfile, "CONFIG")) {
-                test_keyfile = merge_key_group(input_keyfile, group_names[i],
-                        merged_configs, "CONFIG", group_names[i]);
-            } else {
-                // no config section. just update pointer
-                test_keyfile = input_keyfile;
-            }
-            // check we have a type
-            if (!g_key_file_has_key(test_keyfile, group_names[i],
-                        "type", NULL)) {
-                valid = FALSE;
-                hbr_error("Missing key definition for \"type\"", infile,
-                        group_names[i], NULL, NULL);
-            }
-            // check we have a iso_filename
-            if (!g_key_file_has_key(test_keyfile, group_names[i],
-                        "iso_filename", NULL)) {
-                valid = FALSE;
-                hbr_error("Missing key definition for \"iso_filename\"", infile,
-                        group_names[i], NULL, NULL);
-            }
-            // check we have a name
-            if (!g_key_file_has_key(test_keyfile, group_names[i],
-                        "name", NULL)) {
-                valid = FALSE;
-                hbr_error("Missing key definition for \"name\"", infile,
-                        group_names[i], NULL, NULL);
-            }
-            // check we have a title
-            if (!g_key_file_has_key(test_keyfile, group_names[i],
-                        "title", NULL)) {
-                valid = FALSE;
-                hbr_error("Missing key definition for \"title\"", infile,
-                        group_names[i], NULL, NULL);
+        if (is_outfile_group(group_names[i]) &&
+                group_in_scope(i, scope)) {
+            keyset_t *keys = outfile_keys(input_keyfile, group_names[i],
+                    merged_configs, config_keys);
+            if (keyset_missing(required->present, keys)) {
+                for (int j = 0; required_keys[j] != NULL; j++) {
+                    if (!keyset_test(keys->present,
+                                option_index(required_keys[j]))) {
+                        valid = FALSE;
+                        hbr_error("Missing key definition for \"%s\"",
+                                infile, group_names[i], NULL, NULL,
+                                required_keys[j]);
+                    }
+                }
             }
-        }
-        if (test_keyfile && test_keyfile != input_keyfile) {
-            g_key_file_free(test_keyfile);
+            keyset_free(keys);
         }
         i++;
     }
+    keyset_free(config_keys);
+    keyset_free(required);
     // Free the merged configs unless it still points to input_keyfile
     if (merged_configs != input_keyfile) {
-        g_key_file_free(merged_configs);
+        free_key_file(merged_configs);
     }
     g_strfreev(group_names);
     return valid;
 }
 
+/**
+ * @brief Build the keyset an outfile section has once merged with CONFIG
+ *
+ * @param input_keyfile  keyfile containing group
+ * @param group          outfile group
+ * @param merged_configs keyfile holding the merged CONFIG section
+ * @param config_keys    keyset of the merged CONFIG section
+ *
+ * @return new keyset, free with keyset_free()
+ */
+static keyset_t * outfile_keys(GKeyFile *input_keyfile, const gchar *group,
+        GKeyFile *merged_configs, const keyset_t *config_keys)
+{
+    keyset_t *keys = keyset_from_group(input_keyfile, group);
+    // no config section, outfile keys are used alone
+    if (!g_key_file_has_group(input_keyfile, "CONFIG")) {
+        return keys;
+    }
+    keyset_t *merged = keyset_merge(keys, input_keyfile, group, config_keys,
+            merged_configs, "CONFIG");
+    keyset_free(keys);
+    return merged;
+}
+
+/**
+ * @brief Fetch a key's value as it would appear in an outfile merged with
+ *        CONFIG
+ *
+ * @return value, must be freed by caller. NULL when not set.
+ */
+static gchar * outfile_value(GKeyFile *input_keyfile, const gchar *group,
+        GKeyFile *merged_configs, const gchar *key)
+{
+    if (g_key_file_has_key(input_keyfile, group, key, NULL)) {
+        return g_key_file_get_value(input_keyfile, group, key, NULL);
+    }
+    if (g_key_file_has_group(input_keyfile, "CONFIG")) {
+        return g_key_file_get_value(merged_configs, "CONFIG", key, NULL);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check each require of one option in an outfile and print errors
+ *
+ * @param index          index of the option being checked
+ * @param keys           merged keyset of the outfile
+ * @param input_keyfile  keyfile containing group
+ * @param group          outfile group
+ * @param merged_configs keyfile holding the merged CONFIG section
+ * @param infile         path for input_keyfile (for error messages)
+ *
+ * @return TRUE when every require of the option is fulfilled
+ */
+static gboolean option_requires_met(gint index, const keyset_t *keys,
+        GKeyFile *input_keyfile, const gchar *group, GKeyFile *merged_configs,
+        const gchar *infile)
+{
+    gboolean valid = TRUE;
+    const gchar *key = option_data.options[index].name;
+    GSList* requires_list = option_requires(index);
+    /* iterate over gslist (pointers are actually int which
+       are the index to the requires table) */
+    for (; requires_list != NULL; requires_list = requires_list->next) {
+        gint r = GPOINTER_TO_INT(requires_list->data);
+        require_t *require = &option_data.requires[r];
+        gint require_index = option_data.require_targets[r];
+        // check if require is defined
+        if (require_index < 0 || !keyset_test(keys->present, require_index)) {
+            gchar *value = outfile_value(input_keyfile, group, merged_configs,
+                    key);
+            hbr_error("Key \"%s\" requires \"%s\" but it is not"
+                    " set", infile, group, key, value,
+                    key, require->require_name);
+            valid = FALSE;
+            g_free(value);
+        } else if (require->require_value != NULL) {
+            // if require has specific value check it
+            gchar *requires_value = outfile_value(input_keyfile, group,
+                    merged_configs, require->require_name);
+            if (g_strcmp0(requires_value, require->require_value) != 0) {
+                hbr_error("Key \"%s\" requires setting \"%s=%s\"",
+                        infile, group, key, NULL,
+                        key, require->require_name,
+                        require->require_value);
+                valid = FALSE;
+            }
+            g_free(requires_value);
+        }
+    }
+    return valid;
+}
 
 /**
  * @brief Checks a keyfile for unknown key names and prints errors
  *
  * @param keyfile keyfile to be checked
  * @param infile  path to keyfile (for error printing)
+ * @param scope   groups to check from validation_scope_new(), NULL checks
+ *                every group
  *
  * @return TRUE if unknown keys exist
  */
-gboolean unknown_keys_exist(GKeyFile *keyfile, const gchar *infile)
+gboolean unknown_keys_exist(GKeyFile *keyfile, const gchar *infile,
+        const validation_scope_t *scope)
 {
     gchar **groups = g_key_file_get_groups(keyfile, NULL);
     int i = 0;
     gboolean unknown_found = FALSE;
     while (groups[i] != NULL) {
+        if (!group_in_scope(i, scope)) {
+            i++;
+            continue;
+        }
         gchar **keys = g_key_file_get_keys(keyfile, groups[i], NULL, NULL);
         int j = 0;
         while (keys[j] != NULL) {
-            if (!g_hash_table_contains(option_data.options_index, keys[j])) {
+            if (option_index(keys[j]) < 0) {
                 gchar *value = g_key_file_get_value(keyfile, groups[i], keys[j],
                         NULL);
                 hbr_error("Invalid key", infile, groups[i], keys[j], value);
@@ -598,8 +724,10 @@ gboolean has_duplicate_keys(const gchar *infile)
 gboolean check_custom_format(GKeyFile *config, const gchar *group, option_t *option,
         const gchar *config_path)
 {
+    // option points into option_data.options
     gint custom_index = GPOINTER_TO_INT(
-            g_hash_table_lookup(option_data.customs_index, option->name));
+            g_hash_table_lookup(option_data.customs_index, GUINT_TO_POINTER(
+                    option_data.option_quarks[option - option_data.options])));
     gboolean valid = TRUE;
     g_key_file_set_list_separator(config, ':');
     GError *error = NULL;
@@ -729,7 +857,7 @@ gboolean valid_type(option_t *option, const gchar *group, GKeyFile *config,
                 config_path);
     }
 
-    if (strncmp(group, "OUTFILE", 7) == 0) {
+    if (is_outfile_group(group)) {
         type_outfile_warnings(type, has_season, has_episode, has_year, group,
                 config, config_path);
     }
@@ -754,7 +882,8 @@ void type_config_warnings(gchar *type, gboolean has_season,
     int i = 0;
     gchar **group_names = (g_key_file_get_groups(config, NULL));
     while (group_names[i] != NULL) {
-        if (strncmp(group_names[i], "OUTFILE", 7) == 0) {
+        if (is_outfile_group(group_names[i]) &&
+                group_in_scope(i, current_scope)) {
             // if outfile has type defined, ignore it, valid_type will
             // be called on it later
             if (g_key_file_has_key(config, group_names[i], "type", NULL)) {
@@ -993,7 +1122,6 @@ gboolean valid_integer(option_t *option, const gchar *group, GKeyFile *config,
 gboolean valid_integer_set(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_integer_set: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -1002,33 +1130,26 @@ gboolean valid_integer_list(option_t *option, const gchar *group, GKeyFile *conf
 {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gsize count;
-    gint *values = g_key_file_get_integer_list(config, group, option->name,
-            &count, &error);
-    if (values == NULL || error != NULL) {
+    const typed_value_t *value = get_typed_value(config, group, option->name,
+            k_integer_list);
+    if (value->integers == NULL || value->error != NULL) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
-        if (g_error_matches(error, G_KEY_FILE_ERROR,
+        if (g_error_matches(value->error, G_KEY_FILE_ERROR,
                     G_KEY_FILE_ERROR_INVALID_VALUE)) {
             hbr_error("Value should be comma-separated integer list", config_path, group,
-                    option->name, string_value);
+                    option->name, value->text);
         } else {
             // use glib error message for non-user error
-            hbr_error(error->message, config_path, group,
-                    option->name, string_value);
+            hbr_error(value->error->message, config_path, group,
+                    option->name, value->text);
         }
-        g_error_free(error);
-        g_free(string_value);
     }
-    g_free(values);
     return valid;
 }
 
 gboolean valid_integer_list_set(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_integer_list_set: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -1037,22 +1158,17 @@ gboolean valid_positive_integer(option_t *option, const gchar *group,
 {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gint value = g_key_file_get_integer(config, group, option->name, &error);
-    if (value == 0 && error != NULL) {
+    const typed_value_t *value = get_typed_value(config, group, option->name,
+            k_integer);
+    if (value->integer == 0 && value->error != NULL) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
         hbr_error("Value should be a positive integer", config_path, group,
-                option->name, string_value);
-        g_error_free(error);
-        g_free(string_value);
+                option->name, value->text);
     }
-    if (value < 0) {
+    if (value->integer < 0) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
         hbr_error("Value should be a positive integer", config_path, group,
-                option->name, string_value);
-        g_free(string_value);
+                option->name, value->text);
     }
     return valid;
 }
@@ -1061,19 +1177,13 @@ gboolean valid_double_list(option_t *option, const gchar *group,
         GKeyFile *config,  const gchar *config_path) {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gsize value_count = 0;
-    gdouble *values = g_key_file_get_double_list(config, group, option->name,
-            &value_count, &error);
-    if (values == NULL && error != NULL) {
+    const typed_value_t *value = get_typed_value(config, group, option->name,
+            k_double_list);
+    if (value->doubles == NULL && value->error != NULL) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
         hbr_error("Value should be a comma separated double list", config_path,
-                group, option->name, string_value);
-        g_error_free(error);
-        g_free(string_value);
+                group, option->name, value->text);
     }
-    g_free(values);
     return valid;
 }
 
@@ -1082,29 +1192,23 @@ gboolean valid_positive_double_list(option_t *option, const gchar *group,
 {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gsize value_count = 0;
-    gdouble *values = g_key_file_get_double_list(config, group, option->name,
-            &value_count, NULL);
-    if (values == NULL) {
+    const typed_value_t *values = get_typed_value(config, group, option->name,
+            k_double_list);
+    if (values->doubles == NULL) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
         hbr_error("Value should be a comma separated positive double list", config_path,
-                group, option->name, string_value);
-        g_error_free(error);
-        g_free(string_value);
+                group, option->name, values->text);
     } else {
-        for (gsize i = 0; i < value_count; i++) {
-            if (values[i] < 0.0) {
+        for (gsize i = 0; i < values->count; i++) {
+            if (values->doubles[i] < 0.0) {
                 valid = FALSE;
-                gchar *value = g_strdup_printf("%f", values[i]);
+                gchar *value = g_strdup_printf("%f", values->doubles[i]);
                 hbr_error("Value is not a positive double",
                         config_path, group, option->name, value);
                 g_free(value);
             }
         }
     }
-    g_free(values);
     return valid;
 }
 
@@ -1112,7 +1216,6 @@ gboolean valid_string(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
-    g_print("valid_string: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -1153,24 +1256,20 @@ gboolean valid_string_list_set(option_t *option, const gchar *group, GKeyFile *c
          const gchar *config_path)
 {
     assert(option->valid_values_count != 0 && option->valid_values != NULL);
-    GError *error = NULL;
-    gsize list_count = 0;
-    gchar **string_list = g_key_file_get_string_list(config, group, option->name,
-            &list_count, &error);
+    const typed_value_t *value = get_typed_value(config, group, option->name,
+            k_string_list);
     gboolean all_valid = TRUE;
-    if (error != NULL) {
+    if (value->error != NULL) {
         all_valid = FALSE;
-        gchar *value = g_key_file_get_value(config, group, option->name, NULL);
         /* re-using glib error message because the potential errors should only
          * occur from programmer error
          */
-        hbr_error(error->message, config_path, group, option->name, value);
-        g_free(value);
-        g_error_free(error);
+        hbr_error(value->error->message, config_path, group, option->name,
+                value->text);
     } else {
-        for (gsize i = 0; i < list_count; i++) {
+        gchar **string_list = value->strings;
+        for (gsize i = 0; i < value->count; i++) {
             gboolean valid = TRUE;
-            g_strstrip(string_list[i]);
             for (int j = 0; j < option->valid_values_count; j++) {
                 if (strcmp(string_list[i], ((gchar **)option->valid_values)[j]) == 0) {
                     // found a match, stop searching
@@ -1187,7 +1286,6 @@ gboolean valid_string_list_set(option_t *option, const gchar *group, GKeyFile *c
             }
         }
     }
-    g_strfreev(string_list);
     return all_valid;
 }
 
@@ -1195,7 +1293,6 @@ gboolean valid_string_list(option_t *option, const gchar *group, GKeyFile *confi
          const gchar *config_path)
 {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
-    g_print("valid_string_list (we didn't actually validate anything): %s\n", option->name);  //TODO REMOVE
     return TRUE; //TODO incomplete
 }
 
@@ -1203,7 +1300,6 @@ gboolean valid_filename_exists(option_t *option, const gchar *group, GKeyFile *c
          const gchar *config_path)
 {
     gboolean valid = TRUE;
-    g_print("valid_filename_exists: %s\n", option->name);  //TODO REMOVE
     GError *error = NULL;
     gchar *filename = g_key_file_get_value(config, group, option->name, &error);
     // check file exists and can be opened
@@ -1220,28 +1316,24 @@ gboolean valid_filename_exists_list(option_t *option, const gchar *group, GKeyFi
          const gchar *config_path)
 {
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gsize filename_count = 0;
-    gchar **filenames = g_key_file_get_string_list(config, group, option->name,
-            &filename_count, &error);
-    if (error) {
+    const typed_value_t *filenames = get_typed_value(config, group,
+            option->name, k_path_list);
+    if (filenames->error) {
         valid = FALSE;
-        hbr_error(error->message, config_path, group, option->name, NULL);
-        g_error_free(error);
-    } else if ( filename_count < 1) {
+        hbr_error(filenames->error->message, config_path, group, option->name,
+                NULL);
+    } else if ( filenames->count < 1) {
         valid = FALSE;
         hbr_error("File not specified", config_path, group, option->name,
                 NULL);
     } else {
-        for (gsize i = 0; i < filename_count; i++) {
-            g_strstrip(filenames[i]);
-            if (g_access(filenames[i], R_OK) != 0) {
+        for (gsize i = 0; i < filenames->count; i++) {
+            if (g_access(filenames->strings[i], R_OK) != 0) {
                 valid = FALSE;
                 hbr_error("Could not read file specified", config_path, group,
-                        option->name, filenames[i]);
+                        option->name, filenames->strings[i]);
             }
         }
-        g_strfreev(filenames);
     }
     return valid;
 }
@@ -1249,53 +1341,76 @@ gboolean valid_filename_exists_list(option_t *option, const gchar *group, GKeyFi
 gboolean valid_filename_dne(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_filename_dne: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_startstop_at(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_startstop_at: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_previews(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_previews: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
+/**
+ * @brief Count the audio tracks selected by the audio key
+ *
+ * @param option      option being validated (for error printing)
+ * @param group       group to check for the audio key
+ * @param config      keyfile containing group
+ * @param config_path path to config (for error printing)
+ *
+ * @return number of audio tracks, 0 when audio is not set or is invalid
+ */
+static gsize audio_track_count(option_t *option, const gchar *group,
+        GKeyFile *config, const gchar *config_path)
+{
+    const typed_value_t *audio_tracks = get_typed_value(config, group,
+            "audio", k_integer_list);
+    if (audio_tracks == NULL) {
+        return 0;
+    }
+    if (audio_tracks->error != NULL) {
+        hbr_error(audio_tracks->error->message, config_path, group,
+                option->name, NULL);
+    }
+    return audio_tracks->count;
+}
+
 gboolean valid_audio(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
     // check for 'none'
-    gchar *value = g_key_file_get_value(config, group, option->name, NULL);
+    const typed_value_t *tracks = get_typed_value(config, group, option->name,
+            k_integer_list);
+    const gchar *value = tracks->text;
     if (strcmp(value, "none") == 0) {
         return TRUE;
     }
 
     gboolean valid = TRUE;
-    // try to parse list of integers
-    gsize integer_count = 0;
-    GError *error = NULL;
-    gint *values = g_key_file_get_integer_list(config, group, option->name,
-            &integer_count, &error);
-    if (error != NULL) {
+    gsize integer_count = tracks->count;
+    gint *values = NULL;
+    if (tracks->error != NULL) {
         // parser failed
-        if (g_error_matches(error, G_KEY_FILE_ERROR,
+        if (g_error_matches(tracks->error, G_KEY_FILE_ERROR,
                     G_KEY_FILE_ERROR_INVALID_VALUE)) {
             hbr_error("Value should be integer", config_path, group,
                     option->name, value);
         } else {
             // use glib error message for non-user error
-            hbr_error(error->message, config_path, group, option->name, value);
+            hbr_error(tracks->error->message, config_path, group,
+                    option->name, value);
         }
         valid = FALSE;
-        g_error_free(error);
     } else {
-        // sort list
+        // sort a copy, the decoded list is shared
+        values = g_new(gint, integer_count);
+        memcpy(values, tracks->integers, integer_count * sizeof(gint));
         gsize i = 0;
         gint temp;
         while (i < integer_count) {
@@ -1318,7 +1433,6 @@ gboolean valid_audio(option_t *option, const gchar *group, GKeyFile *config,
         }
     }
 
-    g_free(value);
     g_free(values);
     return valid;
 }
@@ -1328,28 +1442,15 @@ gboolean valid_audio_encoder(option_t *option, const gchar *group, GKeyFile *con
 {
     // verify audio encoder count is the same as audio track count
     gboolean valid = TRUE;
-    gsize audio_count = 0;
-    GError *error = NULL;
-    if (g_key_file_has_key(config, group, "audio", NULL)) {
-        gint *audio_tracks = g_key_file_get_integer_list(config, group,
-                "audio", &audio_count, &error);
-        if (error != NULL) {
-            hbr_error(error->message, config_path, group, option->name, NULL);
-            g_error_free(error);
-        }
-        g_free(audio_tracks);
-    }
-    error = NULL;
-    gsize  audio_encoder_count;
-    gchar **audio_encoders = g_key_file_get_string_list(config, group,
-            option->name, &audio_encoder_count, &error);
-    if (error != NULL) {
-        hbr_error(error->message, config_path, group, option->name, NULL);
-        g_error_free(error);
-    }
-    g_strfreev(audio_encoders);
-    gchar *aencoder_string = g_key_file_get_value(config, group, option->name,
-            NULL);
+    gsize audio_count = audio_track_count(option, group, config, config_path);
+    const typed_value_t *audio_encoders = get_typed_value(config, group,
+            option->name, k_string_list);
+    if (audio_encoders->error != NULL) {
+        hbr_error(audio_encoders->error->message, config_path, group,
+                option->name, NULL);
+    }
+    gsize audio_encoder_count = audio_encoders->count;
+    const gchar *aencoder_string = audio_encoders->text;
     /* TODO:
      * I ignored when audio_encoder_count is 1, but in this case HandBrakeCLI
      * just uses its default encoder for all subsequent audio tracks. My desired
@@ -1363,7 +1464,6 @@ gboolean valid_audio_encoder(option_t *option, const gchar *group, GKeyFile *con
                 option->name, aencoder_string, audio_encoder_count, audio_count);
         valid = FALSE;
     }
-    g_free(aencoder_string);
 
     // rest of verification can use valid_string_list_set
     if (!valid_string_list_set(option, group, config, config_path)) {
@@ -1375,7 +1475,6 @@ gboolean valid_audio_encoder(option_t *option, const gchar *group, GKeyFile *con
 gboolean valid_audio_quality(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_audio_quality: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -1393,30 +1492,36 @@ gboolean valid_audio_bitrate(option_t *option, const gchar *group, GKeyFile *con
     int valid_bitrates_count = sizeof(valid_bitrates)/sizeof(valid_bitrates[0]);
 
     // get bitrates
-    gsize bitrate_count, aencoder_count;
     // errors ignored because valid_integer_list above should fail and return
-    gint *bitrates = g_key_file_get_integer_list(config, group, option->name,
-            &bitrate_count, NULL);
-    gchar *bitrates_string = g_key_file_get_value(config, group,
-            option->name, NULL);
+    const typed_value_t *bitrate_value = get_typed_value(config, group,
+            option->name, k_integer_list);
+    gsize bitrate_count = bitrate_value->count;
+    const gint *bitrates = bitrate_value->integers;
+    const gchar *bitrates_string = bitrate_value->text;
 
     gboolean valid = TRUE;
-    GError *error = NULL;
     // get audio encoders
-    gchar **audio_encoders = g_key_file_get_string_list(config, group,
-            "aencoder", &aencoder_count, &error);
-    if (error != NULL) {
+    gsize aencoder_count = 0;
+    gchar **audio_encoders = NULL;
+    const typed_value_t *aencoder_value = get_typed_value(config, group,
+            "aencoder", k_string_list);
+    if (aencoder_value == NULL || aencoder_value->error != NULL) {
         hbr_error("Could not verify audio track bitrates because audio encoder(s)"
                 " were not specified", config_path, group, option->name,
                 bitrates_string);
         valid = FALSE;
-        g_error_free(error);
+    } else {
+        aencoder_count = aencoder_value->count;
+        audio_encoders = aencoder_value->strings;
     }
 
     // verify matching number of track/rates
     gsize audio_count = 0;
-    gint *audio_tracks = g_key_file_get_integer_list(config, group,
-            "audio", &audio_count, NULL);
+    const typed_value_t *audio_tracks = get_typed_value(config, group,
+            "audio", k_integer_list);
+    if (audio_tracks != NULL) {
+        audio_count = audio_tracks->count;
+    }
     if ( bitrate_count != 1 && bitrate_count != audio_count) {
         hbr_error("Number of track bitrates (%lu) specified does not match the"
                 " number of audio tracks (%lu)", config_path, group,
@@ -1433,8 +1538,6 @@ gboolean valid_audio_bitrate(option_t *option, const gchar *group, GKeyFile *con
             }
         }
 
-        // remove leading/trailing whitespace for consistent values
-        g_strstrip(audio_encoders[i]);
         // verify value is in range for audio codec
         gint lower_bitrate = valid_bitrates[0];
         gint upper_bitrate = valid_bitrates[valid_bitrates_count-1];
@@ -1502,10 +1605,6 @@ gboolean valid_audio_bitrate(option_t *option, const gchar *group, GKeyFile *con
             g_free(bad_bitrate);
         }
     }
-    g_free(bitrates_string);
-    g_free(bitrates);
-    g_free(audio_tracks);
-    g_strfreev(audio_encoders);
     return valid;
 }
 
@@ -1513,27 +1612,28 @@ gboolean valid_audio_compression(option_t *option, const gchar *group, GKeyFile
          const gchar *config_path)
 {
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gsize compression_count = 0;
-    gdouble *compressions = g_key_file_get_double_list(config, group,
-            option->name, &compression_count, &error);
-    if (compressions == NULL && error != NULL) {
-        hbr_error(error->message, config_path, group, option->name, NULL);
-        g_error_free(error);
+    const typed_value_t *compression_value = get_typed_value(config, group,
+            option->name, k_double_list);
+    if (compression_value->doubles == NULL &&
+            compression_value->error != NULL) {
+        hbr_error(compression_value->error->message, config_path, group,
+                option->name, NULL);
         return FALSE;
     }
-    error = NULL;
+    gsize compression_count = compression_value->count;
+    const gdouble *compressions = compression_value->doubles;
+    const gchar *compressions_value = compression_value->text;
     gsize encoder_count = 0;
-    gchar **encoders = g_key_file_get_string_list(config, group, "aencoder",
-            &encoder_count, &error);
-    gchar *compressions_value =  g_key_file_get_value(config, group,
-            option->name, NULL);
+    gchar **encoders = NULL;
+    const typed_value_t *encoder_value = get_typed_value(config, group,
+            "aencoder", k_string_list);
+    if (encoder_value != NULL) {
+        encoder_count = encoder_value->count;
+        encoders = encoder_value->strings;
+    }
     if (compressions == NULL) {
         hbr_error("Encoder not specified. Unable to verify audio compression ",
                 config_path, group, option->name, compressions_value);
-        g_free (compressions_value);
-        g_free(encoders);
-        g_error_free(error);
         return FALSE;
     }
     if ( compression_count != 1 && compression_count != encoder_count) {
@@ -1556,7 +1656,6 @@ gboolean valid_audio_compression(option_t *option, const gchar *group, GKeyFile
             j = &i; // reference compression with same index as encoder
         }
         for (i = 0; i < count; i++) {
-            g_strstrip(encoders[i]);
             gdouble lower_compression = 0.0, upper_compression = 0.0;
             gboolean compressible = FALSE;
             gchar *value = g_strdup_printf("%f", compressions[*j]);
@@ -1590,9 +1689,6 @@ gboolean valid_audio_compression(option_t *option, const gchar *group, GKeyFile
             g_free(value);
         }
     }
-    g_free(compressions_value);
-    g_free(compressions);
-    g_free(encoders);
     return valid;
 }
 
@@ -1600,25 +1696,24 @@ gboolean valid_video_quality(option_t *option, const gchar *group, GKeyFile *con
          const gchar *config_path)
 {
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gdouble value = g_key_file_get_double(config, group, option->name,
-            &error);
-    gchar *string = g_key_file_get_value(config, group, option->name, NULL);
-    if (error != NULL) {
+    const typed_value_t *quality = get_typed_value(config, group,
+            option->name, k_double);
+    gdouble value = quality->number;
+    const gchar *string = quality->text;
+    if (quality->error != NULL) {
         hbr_error("Value should be floating point number", config_path, group,
                 option->name, string);
-        g_error_free(error);
         valid = FALSE;
     }
     // quality depends on encoder, but is an integer within a range
-    error = NULL;
-    gchar *encoder = g_key_file_get_string(config, group, "encoder", &error);
-    if (error != NULL) {
+    const typed_value_t *encoder_value = get_typed_value(config, group,
+            "encoder", k_string);
+    if (encoder_value == NULL || encoder_value->error != NULL) {
         valid = FALSE;
         hbr_warn("Encoder not specified. Unable to verify video quality",
                  config_path, group, option->name, string);
-        g_error_free(error);
     } else {
+        const gchar *encoder = encoder_value->string;
         gint lower_value = 0, upper_value = 0;
         if (strcmp(encoder, "x264") == 0 || strcmp(encoder, "x265") == 0 ) {
             lower_value = 0;
@@ -1647,8 +1742,6 @@ gboolean valid_video_quality(option_t *option, const gchar *group, GKeyFile *con
                       lower_value, upper_value, encoder);
         }
     }
-    g_free(encoder);
-    g_free(string);
     return valid;
 }
 
@@ -1657,22 +1750,17 @@ gboolean valid_video_bitrate(option_t *option, const gchar *group, GKeyFile *con
 {
     assert(option->valid_values_count == 0 && option->valid_values == NULL);
     gboolean valid = TRUE;
-    GError *error = NULL;
-    gint value = g_key_file_get_integer(config, group, option->name, &error);
-    if (value == 0 && error != NULL) {
+    const typed_value_t *value = get_typed_value(config, group, option->name,
+            k_integer);
+    if (value->integer == 0 && value->error != NULL) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
         hbr_error("Value should be integer in range [0,1000000]", config_path,
-                group, option->name, string_value);
-        g_error_free(error);
-        g_free(string_value);
+                group, option->name, value->text);
     }
-    if (value < 0 || value > 1000000) {
+    if (value->integer < 0 || value->integer > 1000000) {
         valid = FALSE;
-        gchar* string_value = g_key_file_get_value(config, group, option->name, NULL);
         hbr_error("Value should be integer in range [0,1000000]", config_path,
-                group, option->name, string_value);
-        g_free(string_value);
+                group, option->name, value->text);
     }
     return valid;
 }
@@ -1680,7 +1768,6 @@ gboolean valid_video_bitrate(option_t *option, const gchar *group, GKeyFile *con
 gboolean valid_video_framerate(option_t *option, const gchar *group,
         GKeyFile *config, const gchar *config_path)
 {
-    g_print("valid_video_framerate: %s\n", option->name);  //TODO REMOVE
     // try to interpret it with valid_string_set style lookup
     // if that fails grab a double and verify in range 1-1000
     return FALSE; //TODO incomplete
@@ -1689,7 +1776,6 @@ gboolean valid_video_framerate(option_t *option, const gchar *group,
 gboolean valid_chroma(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_chroma: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -1746,7 +1832,6 @@ gboolean valid_crop(option_t *option, const gchar *group, GKeyFile *config,
 gboolean valid_pixel_aspect(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_pixel_aspect: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -1917,7 +2002,6 @@ gboolean valid_deinterlace(option_t *option, const gchar *group, GKeyFile *confi
 gboolean valid_detelecine(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_detelecine: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2004,7 +2088,6 @@ gboolean valid_iso_639(option_t *option, const gchar *group, GKeyFile *config,
 gboolean valid_iso_639_list(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_iso639_list: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2012,7 +2095,6 @@ gboolean valid_iso_639_list(option_t *option, const gchar *group, GKeyFile *conf
 gboolean valid_native_dub(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_native_dub: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2057,44 +2139,29 @@ gboolean valid_gain(option_t *option, const gchar *group, GKeyFile *config,
 {
     gboolean valid = valid_double_list(option, group, config, config_path);
 
-    GError *error = NULL;
-    gsize gain_count = 0;
-    gdouble *gains = g_key_file_get_double_list(config, group, option->name,
-            &gain_count, &error);
-    if (error != NULL) {
-        hbr_error(error->message, config_path, group, option->name, NULL);
-        g_error_free(error);
+    const typed_value_t *gains = get_typed_value(config, group, option->name,
+            k_double_list);
+    if (gains->error != NULL) {
+        hbr_error(gains->error->message, config_path, group, option->name,
+                NULL);
     }
+    gsize gain_count = gains->count;
     for (gsize i = 0; i < gain_count; i++) {
-        if (gains[i] < -20.0 || gains[i] > 20.0) {
-            gchar *gain = g_strdup_printf("%f", gains[i]);
+        if (gains->doubles[i] < -20.0 || gains->doubles[i] > 20.0) {
+            gchar *gain = g_strdup_printf("%f", gains->doubles[i]);
             hbr_warn("Gain value exceeds +-20dB", config_path, group,
                     option->name, gain);
             g_free(gain);
         }
     }
-    g_free(gains);
     // verify gain_count with audio count
-    error = NULL;
-    gsize audio_count = 0;
-    if (g_key_file_has_key(config, group, "audio", NULL)) {
-        gint *audio_tracks = g_key_file_get_integer_list(config, group,
-                "audio", &audio_count, &error);
-        if (error != NULL) {
-            hbr_error(error->message, config_path, group, option->name, NULL);
-            g_error_free(error);
-        }
-        g_free(audio_tracks);
-    }
-    gchar *gains_string = g_key_file_get_value(config, group, option->name,
-            NULL);
+    gsize audio_count = audio_track_count(option, group, config, config_path);
     if ( gain_count != 1 && gain_count != audio_count) {
         hbr_error("Number of audio tracks (%lu) specified does not match the"
                 " number of gain tracks (%lu)", config_path, group,
-                option->name, gains_string, audio_count, gain_count);
+                option->name, gains->text, audio_count, gain_count);
         valid = FALSE;
     }
-    g_free(gains_string);
     return valid;
 }
 
@@ -2103,22 +2170,22 @@ gboolean valid_drc(option_t *option, const gchar *group, GKeyFile *config,
 {
     gboolean all_valid = TRUE;
     // try to parse as double list
-    gsize drc_count = 0;
-    GError *error = NULL;
-    gdouble* drc_list = g_key_file_get_double_list(config, group, option->name,
-            &drc_count, &error);
-    gchar *value = g_key_file_get_value(config, group, option->name, NULL);
-    if (error != NULL) {
+    const typed_value_t *drc = get_typed_value(config, group, option->name,
+            k_double_list);
+    gsize drc_count = drc->count;
+    const gdouble *drc_list = drc->doubles;
+    const gchar *value = drc->text;
+    if (drc->error != NULL) {
         all_valid = FALSE;
-        if (g_error_matches(error, G_KEY_FILE_ERROR,
+        if (g_error_matches(drc->error, G_KEY_FILE_ERROR,
                     G_KEY_FILE_ERROR_INVALID_VALUE)) {
             hbr_error("Value should be decimal number", config_path, group,
                     option->name, value);
         } else {
             // use glib error message for non-user error
-            hbr_error(error->message, config_path, group, option->name, value);
+            hbr_error(drc->error->message, config_path, group, option->name,
+                    value);
         }
-        g_error_free(error);
     } else {
         // check range on list items (valid range for dynamic compression is 1.0-4.0)
         for (gsize i = 0; i < drc_count; i++) {
@@ -2133,10 +2200,10 @@ gboolean valid_drc(option_t *option, const gchar *group, GKeyFile *config,
          *     drc_count > audio_count: drops extra drc
          *     drc_count = 1          : drc is applied to all tracks
          */
-        if (drc_count > 1 && g_key_file_has_key(config, group, "audio", NULL)) {
-            gsize audio_count = 0;
-            g_strfreev(g_key_file_get_string_list(config, group, "audio",
-                        &audio_count, NULL));
+        const typed_value_t *audio = get_typed_value(config, group, "audio",
+                k_string_list);
+        if (drc_count > 1 && audio != NULL) {
+            gsize audio_count = audio->count;
             if (audio_count > drc_count) {
                 hbr_warn("DRC was not specified for all audio tracks:",
                         config_path, group, option->name, value);
@@ -2147,8 +2214,6 @@ gboolean valid_drc(option_t *option, const gchar *group, GKeyFile *config,
             }
         }
     }
-    g_free(value);
-    g_free(drc_list);
     return all_valid;
 }
 
@@ -2200,8 +2265,82 @@ gboolean valid_chapters(option_t *option, const gchar *group, GKeyFile *config,
 gboolean valid_encopts(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_encopts: %s\n", option->name);  //TODO REMOVE
-    return FALSE; //TODO incomplete
+    assert(option->valid_values_count == 0 && option->valid_values == NULL);
+    gchar *value = g_key_file_get_value(config, group, option->name, NULL);
+    gboolean valid = encopts_valid(value);
+    if (!valid) {
+        hbr_error("Value should be encoder options as name=value pairs "
+                "separated by colons (e.g. ref=4:bframes=3), with threads "
+                "a thread count, 0 or auto", config_path,
+                group, option->name, value);
+    }
+    g_free(value);
+    return valid;
+}
+
+/**
+ * @brief Check the form of an encoder options string. Names are letters,
+ *        digits, '-' and '_', values can't be empty, and threads (the
+ *        thread count injected for -j) must be a thread count, or 0 or
+ *        auto to let the encoder choose.
+ *
+ * @param encopts encoder options, NULL is not valid
+ *
+ * @return TRUE when every option is well formed
+ */
+gboolean encopts_valid(const gchar *encopts)
+{
+    if (encopts == NULL || encopts[0] == '\0') {
+        return FALSE;
+    }
+    gboolean valid = TRUE;
+    gchar **pairs = g_strsplit(encopts, ":", -1);
+    for (gint i = 0; valid && pairs[i] != NULL; i++) {
+        gchar *equals = strchr(pairs[i], '=');
+        gsize name_length = equals != NULL ? (gsize) (equals - pairs[i]) :
+            strlen(pairs[i]);
+        valid = name_length > 0 && (equals == NULL || equals[1] != '\0');
+        for (gsize j = 0; valid && j < name_length; j++) {
+            valid = g_ascii_isalnum(pairs[i][j]) || pairs[i][j] == '-' ||
+                pairs[i][j] == '_';
+        }
+        if (valid && equals != NULL && name_length == strlen("threads") &&
+                strncmp(pairs[i], "threads", name_length) == 0 &&
+                strcmp(equals + 1, "auto") != 0) {
+            gchar *end = NULL;
+            gint64 threads = g_ascii_strtoll(equals + 1, &end, 10);
+            valid = end != equals + 1 && *end == '\0' && threads >= 0;
+        }
+    }
+    g_strfreev(pairs);
+    return valid;
+}
+
+/**
+ * @brief Encoder presets HandBrakeCLI accepts for an encoder
+ *
+ * @param encoder video encoder name
+ *
+ * @return NULL terminated preset names, NULL when the encoder takes no
+ *         encoder preset
+ */
+const gchar * const * encoder_presets(const gchar *encoder)
+{
+    static const gchar *group_1_encoder[] = { "x264", "x264_10bit", "x265",
+        "x265_10bit", "x265_12bit", NULL };
+    static const gchar *group_1_presets[] = {"ultrafast", "superfast",
+        "veryfast", "faster", "fast", "medium", "slow", "slower",
+        "veryslow", "placebo", NULL };
+    static const gchar *group_2_encoder[] = { "VP8", "VP9", NULL };
+    static const gchar *group_2_presets[] = { "veryfast", "faster", "fast",
+        "medium", "slow", "slower", "veryslow", NULL };
+    if (g_strv_contains(group_1_encoder, encoder)) {
+        return group_1_presets;
+    }
+    if (g_strv_contains(group_2_encoder, encoder)) {
+        return group_2_presets;
+    }
+    return NULL;
 }
 
 gboolean valid_encoder_preset(option_t *option, const gchar *group, GKeyFile *config,
@@ -2209,7 +2348,7 @@ gboolean valid_encoder_preset(option_t *option, const gchar *group, GKeyFile *co
 {
     gboolean valid = TRUE;
 
-    gboolean group_1_valid = FALSE, group_2_valid = FALSE;
+    gboolean valid_preset = FALSE;
     gchar *preset = NULL;
     GError *error = NULL;
     gchar *encoder = g_key_file_get_value(config, group, "encoder", &error);
@@ -2230,28 +2369,13 @@ gboolean valid_encoder_preset(option_t *option, const gchar *group, GKeyFile *co
         } else {
             g_strstrip(preset);
 
-            const gchar *group_1_encoder[] = { "x264", "x264_10bit", "x265",
-                "x265_10bit", "x265_12bit", NULL };
-            if (g_strv_contains(group_1_encoder, encoder)) {
-                const gchar *group_1_presets[] = {"ultrafast", "superfast",
-                    "veryfast", "faster", "fast", "medium", "slow", "slower",
-                    "veryslow", "placebo", NULL };
-                if (g_strv_contains(group_1_presets, preset)) {
-                    group_1_valid = TRUE;
-                }
-            }
-
-            const gchar *group_2_encoder[] = { "VP8", "VP9", NULL };
-            if (g_strv_contains(group_2_encoder, encoder)) {
-                const gchar *group_2_presets[] = { "veryfast", "faster", "fast",
-                    "medium", "slow", "slower", "veryslow", NULL };
-                if (g_strv_contains(group_2_presets, preset)) {
-                    group_2_valid = TRUE;
-                }
+            const gchar * const *presets = encoder_presets(encoder);
+            if (presets != NULL && g_strv_contains(presets, preset)) {
+                valid_preset = TRUE;
             }
         }
     }
-    if (!group_1_valid && !group_2_valid) {
+    if (!valid_preset) {
         if (encoder != NULL && preset != NULL) {
             hbr_error("Invalid encoder preset for encoder (%s)", config_path,
                     group, option->name, preset, encoder);
@@ -2261,13 +2385,12 @@ gboolean valid_encoder_preset(option_t *option, const gchar *group, GKeyFile *co
         }
     }
 
-    return valid && (group_1_valid || group_2_valid);
+    return valid && valid_preset;
 }
 
 gboolean valid_encoder_tune(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_encoder_tune: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2340,21 +2463,18 @@ gboolean valid_encoder_profile(option_t *option, const gchar *group, GKeyFile *c
 gboolean valid_encoder_level(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_encoder_level: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_nlmeans(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_nlmeans: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_nlmeans_tune(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_nlmeans_tune: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2364,32 +2484,17 @@ gboolean valid_dither(option_t *option, const gchar *group, GKeyFile *config,
     gboolean valid = valid_string_list_set(option, group, config,
             config_path);
 
-    GError *error = NULL;
-    gsize dither_count = 0;
-    gchar **dithers = g_key_file_get_string_list(config, group, option->name,
-            &dither_count, &error);
-    g_strfreev(dithers);
+    const typed_value_t *dithers = get_typed_value(config, group,
+            option->name, k_string_list);
+    gsize dither_count = dithers->count;
     // get the audio count, verify same count
-    error = NULL;
-    gsize audio_count = 0;
-    if (g_key_file_has_key(config, group, "audio", NULL)) {
-        gint *audio_tracks = g_key_file_get_integer_list(config, group,
-                "audio", &audio_count, &error);
-        if (error != NULL) {
-            hbr_error(error->message, config_path, group, option->name, NULL);
-            g_error_free(error);
-        }
-        g_free(audio_tracks);
-    }
-    gchar *gains_string = g_key_file_get_value(config, group, option->name,
-            NULL);
+    gsize audio_count = audio_track_count(option, group, config, config_path);
     if (dither_count != 1 && dither_count != audio_count) {
         hbr_error("Number of audio tracks (%lu) specified does not match the"
                 " number of dither tracks (%lu)", config_path, group,
-                option->name, gains_string, audio_count, dither_count);
+                option->name, dithers->text, audio_count, dither_count);
         valid = FALSE;
     }
-    g_free(gains_string);
 
     return valid;
 }
@@ -2397,14 +2502,12 @@ gboolean valid_dither(option_t *option, const gchar *group, GKeyFile *config,
 gboolean valid_subtitle_forced(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_subtitle_forced: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_subtitle_burned(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_subtitle_burned: %s\n", option->name);  //TODO REMOVE
     // only applies to 1.2.0 and newer, otherwise it's just an integer
     return FALSE; //TODO incomplete
 }
@@ -2412,14 +2515,12 @@ gboolean valid_subtitle_burned(option_t *option, const gchar *group, GKeyFile *c
 gboolean valid_subtitle_default(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_subtitle_default: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_codeset(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_codeset: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2514,7 +2615,6 @@ gboolean valid_rotate(option_t *option, const gchar *group, GKeyFile *config,
 gboolean valid_qsv_decoding(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_qsv_decoding: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
@@ -2538,27 +2638,23 @@ gboolean valid_comb_detect(option_t *option, const gchar *group, GKeyFile *confi
 gboolean valid_pad(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_pad: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_unsharp(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_unsharp: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_filespec(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_filespec: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
 
 gboolean valid_preset_name(option_t *option, const gchar *group, GKeyFile *config,
          const gchar *config_path)
 {
-    g_print("valid_preset_name: %s\n", option->name);  //TODO REMOVE
     return FALSE; //TODO incomplete
 }
@@ -25,17 +25,33 @@
 
 #include "options.h"
 
+/**
+ * @brief Groups of one keyfile to validate, by their position in
+ *        g_key_file_get_groups() order. Built once per keyfile so checks
+ *        compare positions rather than group names.
+ */
+typedef struct {
+    /// TRUE for each group in scope, CONFIG is always in scope
+    gboolean *groups;
+    /// number of groups in the keyfile
+    gsize count;
+} validation_scope_t;
+
 gboolean pre_validate_key_file(const gchar *infile);
 gboolean post_validate_input_file(GKeyFile *input_keyfile, const gchar *infile,
-        GKeyFile *config_keyfile);
+        GKeyFile *config_keyfile, const validation_scope_t *scope);
 gboolean post_validate_config_file(GKeyFile *keyfile, const gchar *infile);
 gboolean post_validate_common(GKeyFile *keyfile, const gchar *infile,
-        GKeyFile *config_keyfile);
+        GKeyFile *config_keyfile, const validation_scope_t *scope);
+validation_scope_t *validation_scope_new(GKeyFile *keyfile, gchar **outfiles);
+void validation_scope_free(validation_scope_t *scope);
+gboolean group_in_scope(gsize group, const validation_scope_t *scope);
 gboolean has_required_keys(GKeyFile *input_keyfile, const gchar *infile,
-        GKeyFile *config_keyfile);
+        GKeyFile *config_keyfile, const validation_scope_t *scope);
 gboolean has_requires(GKeyFile *input_keyfile, const gchar *infile,
-        GKeyFile *config_keyfile);
-gboolean unknown_keys_exist(GKeyFile *keyfile, const gchar *infile);
+        GKeyFile *config_keyfile, const validation_scope_t *scope);
+gboolean unknown_keys_exist(GKeyFile *keyfile, const gchar *infile,
+        const validation_scope_t *scope);
 gboolean has_duplicate_groups(const gchar *infile);
 gboolean has_duplicate_keys(const gchar *infile);
 gboolean check_custom_format (GKeyFile *config, const gchar *group,
@@ -46,6 +62,8 @@ void type_config_warnings(gchar *type, gboolean has_season,
 void type_outfile_warnings(gchar *type, gboolean has_season,
         gboolean has_episode, gboolean has_year, const gchar *group,
         GKeyFile *config, const gchar *config_path);
+const gchar * const * encoder_presets(const gchar *encoder);
+gboolean encopts_valid(const gchar *encopts);
 /*
  * Input validation for hbr specific options
  */
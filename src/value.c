@@ -0,0 +1,320 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>   // for NULL
+
+#include "value.h"
+
+extern option_data_t option_data;
+
+/*
+ * One cache per key_type, mapping the original value text to the decoded
+ * typed_value_t. Identical values repeated across groups, outfiles, and
+ * keyfiles are only decoded once.
+ */
+static GHashTable *value_cache[k_path_list+1];
+
+/*
+ * Guards value_cache and scratch so values can be decoded from several
+ * threads. Values are never modified once cached, so readers don't need it.
+ */
+static GMutex value_lock;
+
+/*
+ * Lookups already made in each keyfile: the keyfile pointer maps to a table
+ * of its group names, each mapping an option index and key_type to the
+ * shared decoded value (or missing_value when the key is not set), so
+ * repeated lookups don't touch the keyfile at all. Keyfiles are made,
+ * changed and freed through the keyfile.c helpers (new_key_file(),
+ * set_key_value(), set_key_string(), remove_key(), free_key_file()), which
+ * forget the keyfile's entries so neither an edit nor a reused pointer
+ * serves a stale value. Guarded by value_lock.
+ */
+static GHashTable *lookup_cache = NULL;
+
+/// cached in lookup_cache for keys that are not set
+static const typed_value_t missing_value;
+
+/*
+ * Scratch keyfile used for decoding so values are interpreted exactly as
+ * the g_key_file_get_*() family would interpret them in place.
+ */
+static GKeyFile *scratch = NULL;
+
+static const typed_value_t * get_indexed_value(GKeyFile *keyfile,
+        const gchar *group, const gchar *key, gint index, key_type type);
+static const typed_value_t * read_value(GKeyFile *keyfile,
+        const gchar *group, const gchar *key, key_type type);
+static typed_value_t * typed_value_new(const gchar *text, key_type type);
+static void typed_value_free(gpointer data);
+
+/**
+ * @brief Fetch a key's value decoded as type
+ *
+ * @param keyfile keyfile to fetch the value from
+ * @param group   group containing key
+ * @param key     key name
+ * @param type    type to decode the value as
+ *
+ * @return shared decoded value, NULL when the key does not exist
+ */
+const typed_value_t * get_typed_value(GKeyFile *keyfile, const gchar *group,
+        const gchar *key, key_type type)
+{
+    // keys that aren't options (or lookups before the option tables are
+    // built) are read from the keyfile every time
+    gint index = option_data.options_index != NULL ? option_index(key) : -1;
+    if (index < 0) {
+        return read_value(keyfile, group, key, type);
+    }
+    return get_indexed_value(keyfile, group, key, index, type);
+}
+
+/**
+ * @brief Fetch an option's value decoded according to option->key_type
+ *
+ * @param keyfile keyfile to fetch the value from
+ * @param group   group containing the option
+ * @param option  option to fetch
+ *
+ * @return shared decoded value, NULL when the option is not set
+ */
+const typed_value_t * get_option_value(GKeyFile *keyfile, const gchar *group,
+        option_t *option)
+{
+    if (option >= option_data.options &&
+            option < option_data.options + option_data.option_count) {
+        return get_indexed_value(keyfile, group, option->name,
+                option - option_data.options, option->key_type);
+    }
+    return get_typed_value(keyfile, group, option->name, option->key_type);
+}
+
+/**
+ * @brief Drop the lookups cached for a keyfile, call before the keyfile is
+ *        freed or modified. Decoded values stay shared.
+ */
+void typed_value_cache_forget(GKeyFile *keyfile)
+{
+    g_mutex_lock(&value_lock);
+    if (lookup_cache != NULL) {
+        g_hash_table_remove(lookup_cache, keyfile);
+    }
+    g_mutex_unlock(&value_lock);
+}
+
+/**
+ * @brief Decode text as type, reusing an earlier decode of the same text
+ *
+ * @param text raw value text (as stored in a keyfile)
+ * @param type type to decode the value as
+ *
+ * @return shared decoded value
+ */
+const typed_value_t * decode_value(const gchar *text, key_type type)
+{
+    g_mutex_lock(&value_lock);
+    if (value_cache[type] == NULL) {
+        value_cache[type] = g_hash_table_new_full(g_str_hash, g_str_equal,
+                NULL, typed_value_free);
+    }
+    typed_value_t *value = g_hash_table_lookup(value_cache[type], text);
+    if (value == NULL) {
+        value = typed_value_new(text, type);
+        // key is owned by value, freed in typed_value_free()
+        g_hash_table_insert(value_cache[type], value->text, value);
+    }
+    g_mutex_unlock(&value_lock);
+    return value;
+}
+
+/**
+ * @brief Free all decoded values
+ */
+void typed_value_cache_cleanup(void)
+{
+    if (lookup_cache != NULL) {
+        g_hash_table_destroy(lookup_cache);
+        lookup_cache = NULL;
+    }
+    for (int i = 0; i <= k_path_list; i++) {
+        if (value_cache[i] != NULL) {
+            g_hash_table_destroy(value_cache[i]);
+            value_cache[i] = NULL;
+        }
+    }
+    if (scratch != NULL) {
+        g_key_file_free(scratch);
+        scratch = NULL;
+    }
+}
+
+/**
+ * @brief Fetch an option's value through lookup_cache
+ *
+ * @param keyfile keyfile to fetch the value from
+ * @param group   group containing the option
+ * @param key     option name
+ * @param index   option index of key
+ * @param type    type to decode the value as
+ *
+ * @return shared decoded value, NULL when the option is not set
+ */
+static const typed_value_t * get_indexed_value(GKeyFile *keyfile,
+        const gchar *group, const gchar *key, gint index, key_type type)
+{
+    gpointer slot = GINT_TO_POINTER(index * (k_path_list + 1) + type);
+    g_mutex_lock(&value_lock);
+    if (lookup_cache == NULL) {
+        lookup_cache = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                NULL, (GDestroyNotify) g_hash_table_destroy);
+    }
+    GHashTable *groups = g_hash_table_lookup(lookup_cache, keyfile);
+    if (groups == NULL) {
+        groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                (GDestroyNotify) g_hash_table_destroy);
+        g_hash_table_insert(lookup_cache, keyfile, groups);
+    }
+    GHashTable *slots = g_hash_table_lookup(groups, group);
+    if (slots == NULL) {
+        slots = g_hash_table_new(g_direct_hash, g_direct_equal);
+        g_hash_table_insert(groups, g_strdup(group), slots);
+    }
+    const typed_value_t *value = g_hash_table_lookup(slots, slot);
+    g_mutex_unlock(&value_lock);
+    if (value != NULL) {
+        return value == &missing_value ? NULL : value;
+    }
+
+    value = read_value(keyfile, group, key, type);
+    g_mutex_lock(&value_lock);
+    // the keyfile may have been forgotten while the value was read
+    groups = lookup_cache != NULL ?
+        g_hash_table_lookup(lookup_cache, keyfile) : NULL;
+    slots = groups != NULL ? g_hash_table_lookup(groups, group) : NULL;
+    if (slots != NULL) {
+        g_hash_table_insert(slots, slot,
+                (gpointer) (value != NULL ? value : &missing_value));
+    }
+    g_mutex_unlock(&value_lock);
+    return value;
+}
+
+/**
+ * @brief Read a key's value from the keyfile and decode it as type
+ *
+ * @return shared decoded value, NULL when the key does not exist
+ */
+static const typed_value_t * read_value(GKeyFile *keyfile,
+        const gchar *group, const gchar *key, key_type type)
+{
+    gchar *text = g_key_file_get_value(keyfile, group, key, NULL);
+    if (text == NULL) {
+        return NULL;
+    }
+    const typed_value_t *value = decode_value(text, type);
+    g_free(text);
+    return value;
+}
+
+/**
+ * @brief Decode text into a new typed value
+ *
+ * @param text raw value text
+ * @param type type to decode the value as
+ *
+ * @return newly allocated value, free with typed_value_free()
+ */
+static typed_value_t * typed_value_new(const gchar *text, key_type type)
+{
+    if (scratch == NULL) {
+        scratch = g_key_file_new();
+        g_key_file_set_list_separator(scratch, ',');
+    }
+    const gchar *g = "VALUE";
+    const gchar *k = "value";
+    g_key_file_set_value(scratch, g, k, text);
+
+    typed_value_t *value = g_malloc0(sizeof(typed_value_t));
+    value->key_type = type;
+    value->text = g_strdup(text);
+    value->count = 1;
+    switch (type) {
+        case k_boolean:
+            value->boolean = g_key_file_get_boolean(scratch, g, k,
+                    &value->error);
+            break;
+        case k_integer:
+            value->integer = g_key_file_get_integer(scratch, g, k,
+                    &value->error);
+            break;
+        case k_double:
+            value->number = g_key_file_get_double(scratch, g, k,
+                    &value->error);
+            break;
+        case k_string:
+        case k_path:
+            value->string = g_key_file_get_string(scratch, g, k,
+                    &value->error);
+            break;
+        case k_string_list:
+        case k_path_list:
+            value->strings = g_key_file_get_string_list(scratch, g, k,
+                    &value->count, &value->error);
+            if (value->strings == NULL) {
+                value->count = 0;
+            }
+            for (gsize i = 0; i < value->count; i++) {
+                g_strstrip(value->strings[i]);
+            }
+            break;
+        case k_integer_list:
+            value->integers = g_key_file_get_integer_list(scratch, g, k,
+                    &value->count, &value->error);
+            if (value->integers == NULL) {
+                value->count = 0;
+            }
+            break;
+        case k_double_list:
+            value->doubles = g_key_file_get_double_list(scratch, g, k,
+                    &value->count, &value->error);
+            if (value->doubles == NULL) {
+                value->count = 0;
+            }
+            break;
+    }
+    return value;
+}
+
+/**
+ * @brief GDestroyNotify for values stored in value_cache
+ */
+static void typed_value_free(gpointer data)
+{
+    typed_value_t *value = data;
+    if (value->error != NULL) {
+        g_error_free(value->error);
+    }
+    g_free(value->text);
+    g_free(value->string);
+    g_strfreev(value->strings);
+    g_free(value->integers);
+    g_free(value->doubles);
+    g_free(value);
+}
@@ -0,0 +1,75 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _value_h
+#define _value_h
+
+#include <glib.h>
+
+#include "options.h"
+
+/**
+ * @brief A key value decoded once as a particular key_type.
+ *        Values are shared through a cache keyed on the original text, so
+ *        callers must treat them as read-only and never free them. Lookups
+ *        of options are also cached per keyfile, group and option, free
+ *        keyfiles with free_key_file() so their entries are dropped.
+ */
+typedef struct {
+    /**
+     * @brief type the text was decoded as
+     */
+    key_type key_type;
+    /**
+     * @brief original text as returned by g_key_file_get_value()
+     */
+    gchar *text;
+    /**
+     * @brief error from decoding text as key_type, NULL when decoding worked
+     */
+    GError *error;
+    /**
+     * @brief number of elements for list types, 1 for other types
+     */
+    gsize count;
+    /// k_boolean value
+    gboolean boolean;
+    /// k_integer value
+    gint integer;
+    /// k_double value
+    gdouble number;
+    /// k_string and k_path value (unescaped)
+    gchar *string;
+    /// k_string_list and k_path_list values (leading/trailing space removed)
+    gchar **strings;
+    /// k_integer_list values
+    gint *integers;
+    /// k_double_list values
+    gdouble *doubles;
+} typed_value_t;
+
+const typed_value_t *get_typed_value(GKeyFile *keyfile, const gchar *group,
+        const gchar *key, key_type type);
+const typed_value_t *get_option_value(GKeyFile *keyfile, const gchar *group,
+        option_t *option);
+const typed_value_t *decode_value(const gchar *text, key_type type);
+void typed_value_cache_forget(GKeyFile *keyfile);
+void typed_value_cache_cleanup(void);
+
+#endif
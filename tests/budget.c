@@ -0,0 +1,276 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Test-only wrapper for the performance budget tests:
+ *
+ *   budget BASELINE NAME -- COMMAND [ARG...]
+ *
+ * Runs COMMAND, measuring its wall time, the system calls it makes itself
+ * (counted with ptrace, its children are not traced), and its peak RSS.
+ * BASELINE holds one line per measurement name plus the tolerance each
+ * measurement may grow by:
+ *
+ *   # name       wall_ms  syscalls  max_rss_kib
+ *   tolerance    3.0      1.25      1.5
+ *   debug-100k   2900     41000     820000
+ *
+ * Nothing is printed when COMMAND stays within its budgets. Each exceeded
+ * budget is printed and the exit status is 1. COMMAND's own output goes
+ * where the wrapper's does. With HBR_BUDGET_UPDATE set, NAME's line in
+ * BASELINE is replaced with the measurements instead of being checked.
+ */
+
+#include <errno.h>          // for errno
+#include <signal.h>         // for SIGTRAP
+#include <stdio.h>          // for printf
+#include <stdlib.h>         // for exit
+#include <string.h>         // for strcmp
+#include <sys/ptrace.h>     // for ptrace
+#include <sys/resource.h>   // for struct rusage
+#include <sys/wait.h>       // for wait4
+#include <unistd.h>         // for fork, execvp
+#include <glib.h>
+
+/**
+ * @brief What is measured, in baseline column order
+ */
+typedef enum {
+    b_wall_ms,
+    b_syscalls,
+    b_max_rss_kib,
+    b_count
+} budget_measure;
+
+static const gchar *measure_names[b_count] = {
+    "wall ms", "syscalls", "max rss KiB"
+};
+
+static gboolean read_baseline(const gchar *filename, const gchar *name,
+        gdouble *tolerance, gdouble *baseline);
+static gboolean update_baseline(const gchar *filename, const gchar *name,
+        const gdouble *measured);
+static gint run_traced(char *argv[], gdouble *measured);
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5 || strcmp(argv[3], "--") != 0) {
+        fprintf(stderr, "usage: %s BASELINE NAME -- COMMAND [ARG...]\n",
+                argv[0]);
+        exit(2);
+    }
+    const gchar *baseline_file = argv[1];
+    const gchar *name = argv[2];
+
+    gdouble measured[b_count];
+    gint status = run_traced(argv + 4, measured);
+    if (status != 0) {
+        fprintf(stderr, "%s: command exited with status %d\n", name, status);
+        exit(1);
+    }
+
+    if (g_getenv("HBR_BUDGET_UPDATE") != NULL) {
+        exit(update_baseline(baseline_file, name, measured) ?
+                EXIT_SUCCESS : 1);
+    }
+
+    gdouble tolerance[b_count];
+    gdouble baseline[b_count];
+    if (!read_baseline(baseline_file, name, tolerance, baseline)) {
+        exit(1);
+    }
+    gint over = 0;
+    for (gint i = 0; i < b_count; i++) {
+        gdouble budget = baseline[i] * tolerance[i];
+        if (measured[i] > budget) {
+            printf("%s: %s %.0f over budget %.0f (baseline %.0f)\n", name,
+                    measure_names[i], measured[i], budget, baseline[i]);
+            over++;
+        }
+    }
+    exit(over > 0 ? 1 : EXIT_SUCCESS);
+}
+
+/**
+ * @brief Find the tolerance line and the line for name in a baseline file
+ *
+ * @return FALSE when the file can't be read or either line is missing
+ */
+static gboolean read_baseline(const gchar *filename, const gchar *name,
+        gdouble *tolerance, gdouble *baseline)
+{
+    gchar *contents = NULL;
+    GError *error = NULL;
+    if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+        fprintf(stderr, "%s: %s\n", name, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    gboolean found_tolerance = FALSE;
+    gboolean found_name = FALSE;
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for (gint i = 0; lines[i] != NULL; i++) {
+        gchar **fields = g_strsplit_set(g_strstrip(lines[i]), " \t", -1);
+        // drop the empty fields between repeated separators
+        gint count = 0;
+        for (gint j = 0; fields[j] != NULL; j++) {
+            if (fields[j][0] != '\0') {
+                fields[count++] = fields[j];
+            } else {
+                g_free(fields[j]);
+            }
+        }
+        fields[count] = NULL;
+        gdouble *values = NULL;
+        if (count == b_count + 1 && strcmp(fields[0], "tolerance") == 0) {
+            values = tolerance;
+            found_tolerance = TRUE;
+        } else if (count == b_count + 1 && strcmp(fields[0], name) == 0) {
+            values = baseline;
+            found_name = TRUE;
+        }
+        for (gint j = 0; values != NULL && j < b_count; j++) {
+            values[j] = g_ascii_strtod(fields[j+1], NULL);
+        }
+        g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    if (!found_tolerance || !found_name) {
+        fprintf(stderr, "%s: no %s line in %s\n", name,
+                found_tolerance ? name : "tolerance", filename);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Replace the line for name in a baseline file, or append one
+ *
+ * @return FALSE when the file can't be read or written
+ */
+static gboolean update_baseline(const gchar *filename, const gchar *name,
+        const gdouble *measured)
+{
+    gchar *contents = NULL;
+    GError *error = NULL;
+    if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+        fprintf(stderr, "%s: %s\n", name, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+    gchar *line = g_strdup_printf("%-14s %8.0f %9.0f %11.0f", name,
+            measured[b_wall_ms], measured[b_syscalls],
+            measured[b_max_rss_kib]);
+    GString *updated = g_string_new(NULL);
+    gboolean replaced = FALSE;
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    for (gint i = 0; lines[i] != NULL; i++) {
+        if (lines[i+1] == NULL && lines[i][0] == '\0') {
+            break;
+        }
+        gchar **fields = g_strsplit_set(lines[i], " \t", 2);
+        if (!replaced && strcmp(fields[0], name) == 0) {
+            g_string_append_printf(updated, "%s\n", line);
+            replaced = TRUE;
+        } else {
+            g_string_append_printf(updated, "%s\n", lines[i]);
+        }
+        g_strfreev(fields);
+    }
+    if (!replaced) {
+        g_string_append_printf(updated, "%s\n", line);
+    }
+    gboolean written = g_file_set_contents(filename, updated->str, -1, &error);
+    if (!written) {
+        fprintf(stderr, "%s: %s\n", name, error->message);
+        g_error_free(error);
+    }
+    g_strfreev(lines);
+    g_string_free(updated, TRUE);
+    g_free(line);
+    g_free(contents);
+    return written;
+}
+
+/**
+ * @brief Run argv under ptrace, counting the system calls it enters
+ *
+ * @param argv     command to run
+ * @param measured filled with b_count measurements
+ *
+ * @return exit status of the command, 128 + signal when it was killed
+ */
+static gint run_traced(char *argv[], gdouble *measured)
+{
+    gint64 start = g_get_monotonic_time();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(2);
+    }
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+    }
+
+    guint64 syscalls = 0;
+    gboolean in_syscall = FALSE;
+    gboolean options_set = FALSE;
+    struct rusage usage;
+    gint status;
+    for (;;) {
+        if (wait4(pid, &status, 0, &usage) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("wait4");
+            exit(2);
+        }
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            break;
+        }
+        gint signal = 0;
+        gint stop = WSTOPSIG(status);
+        if (!options_set && stop == SIGTRAP) {
+            // the stop after exec, trace system calls from here on
+            ptrace(PTRACE_SETOPTIONS, pid, NULL,
+                    (void *) (PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+            options_set = TRUE;
+        } else if (stop == (SIGTRAP | 0x80)) {
+            // stops alternate between entering and leaving a call
+            if (!in_syscall) {
+                syscalls++;
+            }
+            in_syscall = !in_syscall;
+        } else {
+            // pass other signals on to the command
+            signal = stop;
+        }
+        ptrace(PTRACE_SYSCALL, pid, NULL, (void *) (glong) signal);
+    }
+
+    measured[b_wall_ms] = (g_get_monotonic_time() - start) / 1000.0;
+    measured[b_syscalls] = syscalls;
+    measured[b_max_rss_kib] = usage.ru_maxrss;
+    return WIFEXITED(status) ? WEXITSTATUS(status) :
+        128 + WTERMSIG(status);
+}
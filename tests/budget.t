@@ -0,0 +1,21 @@
+Performance budgets, only run by make budget (CRAM_BUDGET set). Each run is
+checked against tests/budget/baseline for wall time, system calls made by
+hbr itself, and peak RSS. Record new baselines with
+HBR_BUDGET_UPDATE=1 make budget.
+  $ [ -n "$CRAM_BUDGET" ] || exit 80
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$CRAM_FAKE_HB:$PATH"
+  $ gen() { "$CRAM_HBR_GEN" -n "$1" -p series -N Show -S 1 -f show.iso -t 1 -a 1 -s 1 -C 1-4 -r 3 --seed=1 --hbversion=1.3.0 | sed -e 's/^specific_name=$/specific_name=Episode/' -e 's@^input_basedir=$@input_basedir='"$PWD"'@' -e 's@^output_basedir=$@output_basedir='"$PWD"'/out@'; }
+  $ touch show.iso && mkdir out
+
+Debug output for 100000 outfiles, catches extra passes over the keyfile and
+per-outfile scans of every group
+  $ gen 100000 > debug.hbr
+  $ "$CRAM_BUDGET" "$TESTDIR"/budget/baseline debug-100k -- "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -d debug.hbr > /dev/null 2>&1
+
+Encoding 2000 outfiles with the HandBrakeCLI stand-in, catches overhead in
+the job queue and progress handling
+  $ gen 2000 > encode.hbr
+  $ "$CRAM_BUDGET" "$TESTDIR"/budget/baseline encode-2k -- "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -j 8 encode.hbr > /dev/null 2>&1
+  $ ls out | grep -c -E '\.(mkv|mp4|m4v)$'
+  2000
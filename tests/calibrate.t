@@ -0,0 +1,58 @@
+hbr calibrate encodes a sample clip with each encoder preset at each level
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data" TMPDIR="$PWD/tmp"
+  $ mkdir tmp
+  $ export PATH="$CRAM_FAKE_HB:$TESTDIR/calibrate:$PATH"
+  $ printf 'clip' > clip.mkv
+  $ "$CRAM_HBR" calibrate "$CRAM_HBR_ARGS" --clip clip.mkv --encoders x264,theora --presets fast,slow --levels 2,1
+  Calibrating 3 encoder presets with clip.mkv
+    encoder preset                1 job     2 jobs  scaling  best -j
+    x264 fast                    250.00     500.00    2.00x        2
+    x264 slow                    250.00     500.00    2.00x        2
+    theora                       250.00     500.00    2.00x        2
+  Wrote calibration profile: */data/hbr/calibration (glob)
+  $ grep -A3 '^\[x264 fast\]' data/hbr/calibration
+  [x264 fast]
+  jobs=1;2;
+  fps=250;500;
+  scaling=1;2;
+  $ grep -c '^handbrake_version=1.3.0' data/hbr/calibration
+  3
+  $ ls tmp
+
+Without --clip a test pattern is generated with ffmpeg once and kept
+  $ FAKE_HB_FPS=100 "$CRAM_HBR" calibrate "$CRAM_HBR_ARGS" --encoders x265 --presets slow --levels 1
+  Generating a 10 second sample clip with ffmpeg
+  Calibrating 1 encoder presets with sample-10s.mkv
+    encoder preset                1 job  scaling  best -j
+    x265 slow                    100.00    1.00x        1
+  Wrote calibration profile: */data/hbr/calibration (glob)
+  $ ls cache/hbr/calibrate
+  sample-10s.mkv
+  $ grep -c '^\[' data/hbr/calibration
+  4
+
+An encoder that fails is skipped
+  $ FAKE_HB_FAIL=all "$CRAM_HBR" calibrate "$CRAM_HBR_ARGS" --clip clip.mkv --encoders x264 --presets fast,slow 2>/dev/null
+  Calibrating 2 encoder presets with clip.mkv
+    encoder preset                1 job     2 jobs     4 jobs  scaling  best -j
+    x264 fast                failed
+    x264 slow                skipped, x264 failed
+  [1]
+  $ ls tmp/hbr-calibrate-*/ |grep log$
+  x264-fast-1-1.mkv.log
+  $ "$CRAM_HBR" calibrate "$CRAM_HBR_ARGS" --encoders h266 2>&1
+  hbr   ERROR: Unknown encoder for HandBrake 1.3.0: h266
+  [1]
+  $ "$CRAM_HBR" calibrate "$CRAM_HBR_ARGS" --levels 1,0 2>&1
+  hbr   ERROR: Calibration levels must be from 1 to 256: 0
+  [1]
+  $ "$CRAM_HBR" calibrate "$CRAM_HBR_ARGS" --levels 2,100000 2>&1
+  hbr   ERROR: Calibration levels must be from 1 to 256: 100000
+  [1]
+
+Estimates for an encoder without past encodes use the calibrated speeds
+  $ cp "$TESTDIR"/diff_config/library/a.hbr a.hbr
+  $ PATH="$TESTDIR/perf:$PATH" "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/diff_config/new.conf -y a.hbr >/dev/null 2>&1
+  $ "$CRAM_HBR" diff-config "$CRAM_HBR_ARGS" "$TESTDIR"/diff_config/new.conf "$TESTDIR"/perf/x265.conf a.hbr 2>&1 |head -2
+  Checked 2 outfiles in 1 keyfiles
+  Changed 2 outfiles (estimated 0.0 encode hours from past encodes)
@@ -0,0 +1,67 @@
+A running batch answers hbr ctl on a socket in $XDG_RUNTIME_DIR
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data" XDG_RUNTIME_DIR="$PWD/run"
+  $ export PATH="$CRAM_FAKE_HB:$PATH"
+  $ cp "$TESTDIR"/episode/series.hbr series.hbr
+  $ "$CRAM_HBR" ctl status 2>&1
+  hbr   ERROR: No running hbr batch found: (*/run/hbr) (glob)
+  [1]
+  $ FAKE_HB_HANG=1 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -e 1:1-3 series.hbr >out 2>err &
+  $ until "$CRAM_HBR" ctl status >/dev/null 2>&1; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl status |sed 's/^hbr [0-9]*:/hbr PID:/'
+  hbr PID: running, 1 of 1 jobs running
+  2 queued, 0 done, 0 failed, 0 cancelled
+  eta -
+  running:
+      id slot progress      fps       eta  output
+       1    1     0.0%     0.00         -  A - s01e001.mkv
+  queued:
+      id  output
+       2  A - s01e002.mkv
+       3  A - s01e003.mkv
+
+Pending jobs can be reordered and new starts paused
+  $ "$CRAM_HBR" ctl move 3 1
+  moved job 3 to position 1
+  $ "$CRAM_HBR" ctl move 1 1 2>&1
+  hbr   ERROR: no queued job 1
+  [1]
+  $ "$CRAM_HBR" ctl pause
+  paused, running encodes continue
+
+Cancelling the hung encode doesn't start another while paused
+  $ "$CRAM_HBR" ctl cancel 1
+  cancelled job 1
+  $ until "$CRAM_HBR" ctl status |grep -q '1 cancelled'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl status |sed 's/^hbr [0-9]*:/hbr PID:/'
+  hbr PID: paused, 0 of 1 jobs running
+  2 queued, 0 done, 0 failed, 1 cancelled
+  eta -
+  queued:
+      id  output
+       3  A - s01e003.mkv
+       2  A - s01e002.mkv
+  $ "$CRAM_HBR" ctl jobs 0 2>&1
+  hbr   ERROR: jobs must be from 1 to 256: 0
+  [1]
+  $ "$CRAM_HBR" ctl jobs 2147483647 2>&1
+  hbr   ERROR: jobs must be from 1 to 256: 2147483647
+  [1]
+  $ "$CRAM_HBR" ctl jobs 2
+  running at most 2 jobs at once
+  $ "$CRAM_HBR" ctl bogus 2>&1
+  hbr   ERROR: unknown command 'bogus'. Expected status, pause, resume, jobs N, cancel ID, or move ID POSITION
+  [1]
+
+Resuming finishes the batch in the new order and removes the socket
+  $ "$CRAM_HBR" ctl resume
+  resumed
+  $ wait
+  $ grep -o 'Encoding: .*' out
+  Encoding: 1/3: A - s01e001.mkv
+  Encoding: 3/3: A - s01e003.mkv
+  Encoding: 2/3: A - s01e002.mkv
+  $ grep -o '[0-9]* encodes finished.*' out
+  2 encodes finished, 0 failed, 1 cancelled
+  $ cat err
+  hbr    INFO: 1: Encode cancelled. A - s01e001.mkv was not encoded: (A - s01e001.mkv.log)
+  $ ls run/hbr
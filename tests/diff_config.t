@@ -0,0 +1,35 @@
+Outfiles that use the changed key from the global config are reported
+  $ "$CRAM_HBR" diff-config "$CRAM_HBR_ARGS" "$TESTDIR"/diff_config/old.conf "$TESTDIR"/diff_config/new.conf "$TESTDIR"/diff_config/library 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  Checked 4 outfiles in 2 keyfiles
+  Changed 2 outfiles (estimated 2.0 encode hours at 60 minutes each)
+  
+  Argument changes:
+        2 - --encoder-preset=fast
+        2 + --encoder-preset=slow
+  
+  Changed outfiles:
+  TESTDIR/diff_config/library/a.hbr [OUTFILE1]
+      - --encoder-preset=fast
+      + --encoder-preset=slow
+  TESTDIR/diff_config/library/a.hbr [OUTFILE2]
+      - --encoder-preset=fast
+      + --encoder-preset=slow
+
+Episode selection and encode time
+  $ "$CRAM_HBR" diff-config "$CRAM_HBR_ARGS" --encode-minutes=90 -e 2 "$TESTDIR"/diff_config/old.conf "$TESTDIR"/diff_config/new.conf "$TESTDIR"/diff_config/library/a.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  Checked 1 outfiles in 1 keyfiles
+  Changed 1 outfiles (estimated 1.5 encode hours at 90 minutes each)
+  
+  Argument changes:
+        1 - --encoder-preset=fast
+        1 + --encoder-preset=slow
+  
+  Changed outfiles:
+  TESTDIR/diff_config/library/a.hbr [OUTFILE2]
+      - --encoder-preset=fast
+      + --encoder-preset=slow
+
+Identical configs change nothing
+  $ "$CRAM_HBR" diff-config "$CRAM_HBR_ARGS" "$TESTDIR"/diff_config/old.conf "$TESTDIR"/diff_config/old.conf "$TESTDIR"/diff_config/library 2>&1
+  Checked 4 outfiles in 2 keyfiles
+  Changed 0 outfiles (estimated 0.0 encode hours at 60 minutes each)
@@ -0,0 +1,38 @@
+Directories are searched recursively for keyfiles
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/directory 2>&1
+  \x1b[1m# Encoding: 1/1: Movie (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/movie.iso' -o 'Movie (2000).mkv' (esc)
+  \x1b[1m# Encoding: 1/1: Show - s01e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/s1e1.iso' -o 'Show - s01e001.mkv' (esc)
+  \x1b[1m# Encoding: 1/1: Show - s01e002.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/s1e2.iso' -o 'Show - s01e002.mkv' (esc)
+  \x1b[1m# Encoding: 1/1: Show - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/s2e1.iso' -o 'Show - s02e001.mkv' (esc)
+  \x1b[1m# Encoding: 1/1: Show - s02e002.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/s2e2.iso' -o 'Show - s02e002.mkv' (esc)
+
+Files and directories can be mixed, files keep their position
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/directory/movie.hbr "$TESTDIR"/directory/show/season2 2>&1
+  \x1b[1m# Encoding: 1/1: Movie (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/movie.iso' -o 'Movie (2000).mkv' (esc)
+  \x1b[1m# Encoding: 1/1: Show - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/s2e1.iso' -o 'Show - s02e001.mkv' (esc)
+  \x1b[1m# Encoding: 1/1: Show - s02e002.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/s2e2.iso' -o 'Show - s02e002.mkv' (esc)
+
+Directory without keyfiles
+  $ mkdir nothing
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty nothing 2>&1
+  hbr WARNING: No keyfiles (*.hbr) found in directory: (nothing)
+
+A keyfile that fails is skipped, the rest of the batch runs and hbr exits
+with an error
+  $ mkdir batch
+  $ cp "$TESTDIR"/directory/movie.hbr batch
+  $ printf '[CONFIG]\ntype=movie\nname=Empty\nyear=2001\niso_filename=e.iso\n' > batch/empty.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty batch 2>&1
+  hbr   ERROR: No OUTFILE sections found: (batch/empty.hbr)
+  hbr   ERROR: Could not complete input file: (batch/empty.hbr)
+  \x1b[1m# Encoding: 1/1: Movie (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/movie.iso' -o 'Movie (2000).mkv' (esc)
+  [1]
@@ -0,0 +1,69 @@
+Only the selected outfile is validated with -e
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 1 "$TESTDIR"/episode/one_bad_outfile.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/1: A - s01e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/test.iso' -o 'A - s01e001.mkv' (esc)
+
+Selecting the invalid outfile fails
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 2 "$TESTDIR"/episode/one_bad_outfile.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr   ERROR: Value should be a positive integer: (TESTDIR/episode/one_bad_outfile.hbr) [OUTFILE_B] season=x
+  hbr   ERROR: Could not complete input file: (TESTDIR/episode/one_bad_outfile.hbr)
+
+Without -e every outfile is validated
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/episode/one_bad_outfile.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr   ERROR: Value should be a positive integer: (TESTDIR/episode/one_bad_outfile.hbr) [OUTFILE_B] season=x
+  hbr   ERROR: Could not complete input file: (TESTDIR/episode/one_bad_outfile.hbr)
+
+Range of episodes (missing episode numbers in a range are ignored)
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 2-5 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/3: A - s01e002.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=2 -i '/test.iso' -o 'A - s01e002.mkv' (esc)
+  \x1b[1m# Encoding: 2/3: A - s01e003.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=3 -i '/test.iso' -o 'A - s01e003.mkv' (esc)
+  \x1b[1m# Encoding: 3/3: A - s01e005.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=4 -i '/test.iso' -o 'A - s01e005.mkv' (esc)
+
+List of episodes (encoded in file order, matching every season)
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 5,1 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/3: A - s01e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/test.iso' -o 'A - s01e001.mkv' (esc)
+  \x1b[1m# Encoding: 2/3: A - s01e005.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=4 -i '/test.iso' -o 'A - s01e005.mkv' (esc)
+  \x1b[1m# Encoding: 3/3: A - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=5 -i '/test.iso' -o 'A - s02e001.mkv' (esc)
+
+Range without a season matches its episodes in every season
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 1-2 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/3: A - s01e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/test.iso' -o 'A - s01e001.mkv' (esc)
+  \x1b[1m# Encoding: 2/3: A - s01e002.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=2 -i '/test.iso' -o 'A - s01e002.mkv' (esc)
+  \x1b[1m# Encoding: 3/3: A - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=5 -i '/test.iso' -o 'A - s02e001.mkv' (esc)
+
+Episode from a specific season
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 2:1 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/1: A - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=5 -i '/test.iso' -o 'A - s02e001.mkv' (esc)
+
+Open ended range (the range isn't counted through)
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 3-2147483647 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/2: A - s01e003.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=3 -i '/test.iso' -o 'A - s01e003.mkv' (esc)
+  \x1b[1m# Encoding: 2/2: A - s01e005.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=4 -i '/test.iso' -o 'A - s01e005.mkv' (esc)
+
+Open ended range in a specific season
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 2:0-2147483647 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/1: A - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=5 -i '/test.iso' -o 'A - s02e001.mkv' (esc)
+
+Episode that does not exist
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 7 "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr WARNING: Could not find specified episode (-e 7)
+  hbr   ERROR: No outfile matches the selected episodes: (TESTDIR/episode/series.hbr)
+  hbr   ERROR: Could not complete input file: (TESTDIR/episode/series.hbr)
+
+Invalid selection
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 1-x "$TESTDIR"/episode/series.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr   ERROR: Option parsing failed: Invalid episode selection "1-x"
+  
@@ -0,0 +1,353 @@
+/*
+ * hbr - handbrake runner
+ * Copyright (C) 2016 Joshua Honeycutt
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Test-only stand-in for HandBrakeCLI. It accepts any arguments hbr builds,
+ * pretends to scan and encode -i into -o, and writes progress to stdout and
+ * a HandBrake-like log to stderr. What it simulates is set through the
+ * environment, since hbr passes it no extra arguments:
+ *
+ *   FAKE_HB_VERSION   version printed by --version (1.3.0)
+ *   FAKE_HB_DURATION  source length in seconds (1350)
+ *   FAKE_HB_SECONDS   seconds the encode takes, split between passes (0)
+ *   FAKE_HB_CPU       share of that time spent burning CPU, 0 to 1 (0)
+ *   FAKE_HB_STEPS     progress updates per pass (4)
+ *   FAKE_HB_SIZE      output file size in bytes (5)
+ *   FAKE_HB_FPS       reported speed when FAKE_HB_SECONDS is 0 (250)
+ *   FAKE_HB_FAIL      titles that fail, comma-separated, or "all"
+ *   FAKE_HB_FAIL_AT   percent of the encode done before failing (0)
+ *   FAKE_HB_EXIT      exit status of a failed encode (2)
+ *   FAKE_HB_HANG      titles that stop making progress, or "all"
+ *   FAKE_HB_HANG_AT   percent of the encode done before hanging (0)
+ *
+ * --two-pass encodes report two tasks, a subtitle scan (--subtitle=scan)
+ * adds a task before them, --json switches progress to HandBrake's JSON
+ * blocks.
+ */
+
+#include <fcntl.h>   // for open
+#include <stdio.h>   // for printf, fprintf
+#include <stdlib.h>  // for exit
+#include <string.h>  // for strcmp
+#include <unistd.h>  // for ftruncate, pause
+#include <glib.h>
+
+/// frames per second of the pretend source
+#define SOURCE_FPS 24
+
+/**
+ * @brief The encode to simulate, from the arguments and environment
+ */
+typedef struct {
+    const gchar *input;
+    const gchar *output;
+    gint title;
+    gboolean json;
+    gboolean two_pass;
+    gboolean subtitle_scan;
+    gboolean scan_only;
+    gint duration;
+    gdouble seconds;
+    gdouble cpu;
+    gint steps;
+    gint64 size;
+    gdouble fps;
+    /// percent done when the encode fails or hangs, -1 when it doesn't
+    gdouble fail_at;
+    gint exit_status;
+    gdouble hang_at;
+} fake_encode_t;
+
+static const gchar * env_string(const gchar *name, const gchar *fallback);
+static gdouble env_double(const gchar *name, gdouble fallback);
+static gboolean env_title_listed(const gchar *name, gint title);
+static void parse_args(fake_encode_t *encode, int argc, char *argv[]);
+static void log_line(const gchar *format, ...) G_GNUC_PRINTF(1, 2);
+static void burn(gdouble seconds, gdouble cpu);
+static void report_progress(const fake_encode_t *encode, gint pass,
+        gint passes, gdouble fraction, gdouble fps, gdouble eta);
+static void report_done(const fake_encode_t *encode, gint error);
+
+static gint64 started = 0;
+static gint sequence = 0;
+
+int main(int argc, char *argv[])
+{
+    started = g_get_monotonic_time();
+    fake_encode_t encode;
+    parse_args(&encode, argc, argv);
+
+    log_line("HandBrake %s (fake) - Linux x86_64",
+            env_string("FAKE_HB_VERSION", "1.3.0"));
+    if (encode.json) {
+        printf("Version: {\n    \"Name\": \"HandBrake\",\n"
+                "    \"VersionString\": \"%s\"\n}\n",
+                env_string("FAKE_HB_VERSION", "1.3.0"));
+    }
+    log_line("scan: scanning title %d", encode.title);
+    fprintf(stderr, "+ title %d:\n  + duration: %02d:%02d:%02d\n",
+            encode.title, encode.duration / 3600,
+            encode.duration / 60 % 60, encode.duration % 60);
+    if (encode.scan_only) {
+        exit(EXIT_SUCCESS);
+    }
+    if (encode.input == NULL || encode.output == NULL) {
+        log_line("ERROR: Missing input or output");
+        report_done(&encode, 1);
+        exit(1);
+    }
+
+    int fd = open(encode.output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0666);
+    if (fd < 0) {
+        log_line("ERROR: Failed to open output file %s", encode.output);
+        report_done(&encode, 1);
+        exit(1);
+    }
+
+    gint passes = (encode.two_pass ? 2 : 1) + (encode.subtitle_scan ? 1 : 0);
+    gint steps = passes * encode.steps;
+    gdouble step_seconds = encode.seconds / steps;
+    gdouble frames = (gdouble) encode.duration * SOURCE_FPS;
+    // a step covers frames / encode.steps frames of one pass
+    gdouble fps = step_seconds > 0 ? frames / encode.steps / step_seconds :
+        encode.fps;
+    for (gint step = 0; step <= steps; step++) {
+        gdouble done = 100.0 * step / steps;
+        if (encode.fail_at >= 0 && done >= encode.fail_at) {
+            log_line("ERROR: simulated failure at %.2f %%", done);
+            log_line("libhb: work result = %d", encode.exit_status);
+            report_done(&encode, encode.exit_status);
+            close(fd);
+            exit(encode.exit_status);
+        }
+        if (encode.hang_at >= 0 && done >= encode.hang_at) {
+            log_line("simulated hang at %.2f %%", done);
+            fflush(stdout);
+            for (;;) {
+                pause();
+            }
+        }
+        if (step > 0) {
+            burn(step_seconds, encode.cpu);
+        }
+        gint pass = step == 0 ? 1 : (step - 1) / encode.steps + 1;
+        gdouble fraction = (gdouble) (step - (pass - 1) * encode.steps) /
+            encode.steps;
+        report_progress(&encode, pass, passes, fraction, fps,
+                (steps - step) * step_seconds);
+        if (pass == passes && ftruncate(fd, (gint64) (encode.size *
+                        fraction)) != 0) {
+            log_line("ERROR: Failed to write output file %s", encode.output);
+        }
+    }
+    close(fd);
+
+    gdouble elapsed = (g_get_monotonic_time() - started) / 1e6;
+    gdouble average = step_seconds > 0 && elapsed > 0 ?
+        frames * passes / elapsed : encode.fps;
+    log_line("work: average encoding speed for job is %f fps", average);
+    log_line("libhb: work result = 0");
+    report_done(&encode, 0);
+    fprintf(stderr, "\nEncode done!\n");
+    log_line("HandBrake has exited.");
+    exit(EXIT_SUCCESS);
+}
+
+/**
+ * @brief Read the arguments HandBrakeCLI would care about and the settings
+ *        from the environment
+ */
+static void parse_args(fake_encode_t *encode, int argc, char *argv[])
+{
+    memset(encode, 0, sizeof(fake_encode_t));
+    encode->title = 1;
+    for (gint i = 1; i < argc; i++) {
+        const gchar *next = i + 1 < argc ? argv[i+1] : NULL;
+        if (strcmp(argv[i], "--version") == 0) {
+            printf("HandBrake %s\n", env_string("FAKE_HB_VERSION", "1.3.0"));
+            exit(EXIT_SUCCESS);
+        } else if (strcmp(argv[i], "-i") == 0 ||
+                strcmp(argv[i], "--input") == 0) {
+            encode->input = next;
+            i++;
+        } else if (g_str_has_prefix(argv[i], "--input=")) {
+            encode->input = argv[i] + strlen("--input=");
+        } else if (strcmp(argv[i], "-o") == 0 ||
+                strcmp(argv[i], "--output") == 0) {
+            encode->output = next;
+            i++;
+        } else if (g_str_has_prefix(argv[i], "--output=")) {
+            encode->output = argv[i] + strlen("--output=");
+        } else if (strcmp(argv[i], "-t") == 0 && next != NULL) {
+            encode->title = atoi(next);
+            i++;
+        } else if (g_str_has_prefix(argv[i], "--title=")) {
+            encode->title = atoi(argv[i] + strlen("--title="));
+        } else if (strcmp(argv[i], "--json") == 0) {
+            encode->json = TRUE;
+        } else if (strcmp(argv[i], "--two-pass") == 0 ||
+                strcmp(argv[i], "-2") == 0) {
+            encode->two_pass = TRUE;
+        } else if (strcmp(argv[i], "--subtitle=scan") == 0 ||
+                (strcmp(argv[i], "-s") == 0 && next != NULL &&
+                 strcmp(next, "scan") == 0)) {
+            encode->subtitle_scan = TRUE;
+        } else if (strcmp(argv[i], "--scan") == 0) {
+            encode->scan_only = TRUE;
+        }
+    }
+    encode->duration = env_double("FAKE_HB_DURATION", 1350);
+    encode->seconds = env_double("FAKE_HB_SECONDS", 0);
+    encode->cpu = CLAMP(env_double("FAKE_HB_CPU", 0), 0, 1);
+    encode->steps = MAX(1, env_double("FAKE_HB_STEPS", 4));
+    encode->size = env_double("FAKE_HB_SIZE", 5);
+    encode->fps = env_double("FAKE_HB_FPS", 250);
+    encode->exit_status = env_double("FAKE_HB_EXIT", 2);
+    encode->fail_at = env_title_listed("FAKE_HB_FAIL", encode->title) ?
+        env_double("FAKE_HB_FAIL_AT", 0) : -1;
+    encode->hang_at = env_title_listed("FAKE_HB_HANG", encode->title) ?
+        env_double("FAKE_HB_HANG_AT", 0) : -1;
+}
+
+static const gchar * env_string(const gchar *name, const gchar *fallback)
+{
+    const gchar *value = g_getenv(name);
+    return value != NULL && value[0] != '\0' ? value : fallback;
+}
+
+static gdouble env_double(const gchar *name, gdouble fallback)
+{
+    const gchar *value = g_getenv(name);
+    return value != NULL && value[0] != '\0' ?
+        g_ascii_strtod(value, NULL) : fallback;
+}
+
+/**
+ * @brief Check if an environment variable lists title, or is "all"
+ */
+static gboolean env_title_listed(const gchar *name, gint title)
+{
+    const gchar *value = g_getenv(name);
+    if (value == NULL) {
+        return FALSE;
+    }
+    if (strcmp(value, "all") == 0) {
+        return TRUE;
+    }
+    gchar **titles = g_strsplit(value, ",", -1);
+    gboolean listed = FALSE;
+    for (gint i = 0; titles[i] != NULL && !listed; i++) {
+        listed = (titles[i][0] != '\0' && atoi(titles[i]) == title);
+    }
+    g_strfreev(titles);
+    return listed;
+}
+
+/**
+ * @brief Write a timestamped log line to stderr like libhb
+ */
+static void log_line(const gchar *format, ...)
+{
+    gint64 elapsed = (g_get_monotonic_time() - started) / G_USEC_PER_SEC;
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "[%02" G_GINT64_FORMAT ":%02" G_GINT64_FORMAT ":%02"
+            G_GINT64_FORMAT "] ", elapsed / 3600, elapsed / 60 % 60,
+            elapsed % 60);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+/**
+ * @brief Spend seconds, cpu of them spinning and the rest asleep
+ */
+static void burn(gdouble seconds, gdouble cpu)
+{
+    gint64 spin_until = g_get_monotonic_time() + seconds * cpu * 1e6;
+    volatile gdouble sink = 0;
+    while (g_get_monotonic_time() < spin_until) {
+        for (gint i = 0; i < 10000; i++) {
+            sink += i * 0.5;
+        }
+    }
+    g_usleep(seconds * (1 - cpu) * 1e6);
+}
+
+/**
+ * @brief Write progress to stdout like HandBrakeCLI does
+ *
+ * @param encode   encode being simulated
+ * @param pass     current pass, from 1
+ * @param passes   pass count
+ * @param fraction part of the current pass done
+ * @param fps      current speed
+ * @param eta      seconds left
+ */
+static void report_progress(const fake_encode_t *encode, gint pass,
+        gint passes, gdouble fraction, gdouble fps, gdouble eta)
+{
+    gint seconds = eta + 0.5;
+    if (encode->json) {
+        printf("Progress: {\n"
+                "    \"State\": \"WORKING\",\n"
+                "    \"Working\": {\n"
+                "        \"ETASeconds\": %d,\n"
+                "        \"Hours\": %d,\n"
+                "        \"Minutes\": %d,\n"
+                "        \"Pass\": %d,\n"
+                "        \"PassCount\": %d,\n"
+                "        \"PassID\": %d,\n"
+                "        \"Paused\": 0,\n"
+                "        \"Progress\": %f,\n"
+                "        \"Rate\": %f,\n"
+                "        \"RateAvg\": %f,\n"
+                "        \"Seconds\": %d,\n"
+                "        \"SequenceID\": %d\n"
+                "    }\n"
+                "}\n", seconds, seconds / 3600, seconds / 60 % 60, pass,
+                passes, passes == 1 ? -1 : pass, fraction, fps, fps,
+                seconds % 60, ++sequence);
+    } else {
+        printf("\rEncoding: task %d of %d, %.2f %% (%.2f fps, avg %.2f fps, "
+                "ETA %02dh%02dm%02ds)", pass, passes, fraction * 100, fps,
+                fps, seconds / 3600, seconds / 60 % 60, seconds % 60);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @brief Report the end of the encode on stdout
+ */
+static void report_done(const fake_encode_t *encode, gint error)
+{
+    if (encode->json) {
+        printf("Progress: {\n"
+                "    \"State\": \"WORKDONE\",\n"
+                "    \"WorkDone\": {\n"
+                "        \"Error\": %d,\n"
+                "        \"SequenceID\": %d\n"
+                "    }\n"
+                "}\n", error, ++sequence);
+    } else {
+        printf("\n");
+    }
+    fflush(stdout);
+}
@@ -0,0 +1,45 @@
+The HandBrakeCLI stand-in answers --version
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$CRAM_FAKE_HB:$PATH"
+  $ HandBrakeCLI --version
+  HandBrake 1.3.0
+  $ FAKE_HB_VERSION=1.2.0 HandBrakeCLI --version
+  HandBrake 1.2.0
+
+It reports progress per pass and writes the output
+  $ FAKE_HB_STEPS=2 FAKE_HB_SIZE=1000 HandBrakeCLI --title=1 --two-pass -i in.iso -o out.mkv 2>/dev/null | tr '\r' '\n'
+  
+  Encoding: task 1 of 2, 0.00 % (250.00 fps, avg 250.00 fps, ETA 00h00m00s)
+  Encoding: task 1 of 2, 50.00 % (250.00 fps, avg 250.00 fps, ETA 00h00m00s)
+  Encoding: task 1 of 2, 100.00 % (250.00 fps, avg 250.00 fps, ETA 00h00m00s)
+  Encoding: task 2 of 2, 50.00 % (250.00 fps, avg 250.00 fps, ETA 00h00m00s)
+  Encoding: task 2 of 2, 100.00 % (250.00 fps, avg 250.00 fps, ETA 00h00m00s)
+  $ wc -c < out.mkv
+  1000
+  $ FAKE_HB_STEPS=1 HandBrakeCLI --json -i in.iso -o out.mkv 2>/dev/null | grep -E '"(State|Progress|Error)"'
+      "State": "WORKING",
+          "Progress": 0.000000,
+      "State": "WORKING",
+          "Progress": 1.000000,
+      "State": "WORKDONE",
+          "Error": 0,
+
+Failures and hangs are picked by title
+  $ FAKE_HB_FAIL=2,3 FAKE_HB_FAIL_AT=50 HandBrakeCLI --title=3 -i in.iso -o out.mkv 2>&1 >/dev/null | grep ERROR | cut -c12-
+  ERROR: simulated failure at 50.00 %
+  $ FAKE_HB_FAIL=2,3 HandBrakeCLI --title=1 -i in.iso -o out.mkv >/dev/null 2>&1
+  $ FAKE_HB_HANG=all timeout 1 HandBrakeCLI -i in.iso -o out.mkv >/dev/null 2>&1
+  [124]
+
+hbr runs it like HandBrakeCLI, detecting its version
+  $ cp "$TESTDIR"/episode/series.hbr series.hbr
+  $ FAKE_HB_FAIL=3 FAKE_HB_SIZE=4096 "$CRAM_HBR" -c "$TESTDIR"/configs/empty -y -j 2 -e 1:1-3 series.hbr 2>err | grep -o '[0-9]* encodes finished.*'
+  2 encodes finished, 1 failed
+  $ cat err
+  hbr   ERROR: 3: Handbrake call failed. A - s01e003.mkv was not encoded: (A - s01e003.mkv.log)
+  $ stat -c '%s %n' "A - s01e001.mkv" "A - s01e002.mkv" "A - s01e003.mkv"
+  4096 A - s01e001.mkv
+  4096 A - s01e002.mkv
+  0 A - s01e003.mkv
+  $ grep -h 'average encoding speed' "A - s01e001.mkv.log" | cut -c12-
+  work: average encoding speed for job is 250.000000 fps
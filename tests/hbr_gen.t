@@ -0,0 +1,43 @@
+Generate more sections than fit in one allocation step
+  $ "$CRAM_HBR_GEN" -n 1200 -p series -N Show -S 1 > big.hbr
+  $ grep -c '^\[OUTFILE' big.hbr
+  1200
+  $ tail -n 8 big.hbr
+  [OUTFILE1200]
+  iso_filename=
+  title=0
+  episode=1199
+  specific_name=
+  chapters=
+  audio=
+  subtitle=
+
+Episode lists grow as needed
+  $ "$CRAM_HBR_GEN" -l "$TESTDIR"/hbr_gen/episodes > list.hbr
+  $ grep -c '^\[OUTFILE' list.hbr
+  45
+  $ grep -A 4 '^\[OUTFILE45\]' list.hbr
+  [OUTFILE45]
+  iso_filename=
+  title=0
+  episode=45
+  specific_name=Episode 45
+  $ "$CRAM_HBR_GEN" -l "$TESTDIR"/hbr_gen/bad_episodes 2>&1 | sed -e 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr   ERROR: Failed to parse line: 2: (TESTDIR/hbr_gen/bad_episodes)
+  hbr   ERROR: Failed to parse episode list
+  hbr   ERROR: hbr file generation failed
+
+Random options come from the valid values and repeat with the same seed
+  $ "$CRAM_HBR_GEN" -n 3 -p series -N Show -S 1 -f show.iso -t 1 -a 1 -s 1 -C 1-4 -r 2 --random-keys=format,encoder,audio-fallback --seed=5 --hbversion=1.3.0 > random.hbr
+  $ "$CRAM_HBR_GEN" -n 3 -p series -N Show -S 1 -f show.iso -t 1 -a 1 -s 1 -C 1-4 -r 2 --random-keys=format,encoder,audio-fallback --seed=5 --hbversion=1.3.0 | cmp - random.hbr
+  $ grep -c -E '^(format|encoder|audio-fallback)=' random.hbr
+  6
+  $ "$CRAM_HBR_GEN" -n 1 -r 1 --random-keys=chapters --hbversion=1.3.0 2>&1
+  hbr   ERROR: Option has no list of valid values: chapters
+  hbr   ERROR: hbr file generation failed
+  [1]
+
+Generated random options validate
+  $ "$CRAM_HBR_GEN" -n 50 -p series -N Show -S 1 -f show.iso -t 1 -a 1 -s 1 -C 1-4 -r 4 --seed=1 --hbversion=1.3.0 | sed -e 's/^specific_name=$/specific_name=Episode/' -e 's@^input_basedir=$@input_basedir='"$TESTDIR"'@' -e 's@^output_basedir=$@output_basedir='"$PWD"'@' > valid.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -d valid.hbr 2>&1 | grep -c -E 'ERROR|Encoding: '
+  50
@@ -0,0 +1,25 @@
+Allocations per phase and the top allocation sites are printed on exit
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d --mem-profile -c "$TESTDIR"/configs/empty "$TESTDIR"/episode/series.hbr 2>profile >/dev/null
+  $ cut -c1-22 profile |sed -n '1,/^total/p'
+  phase            count
+  version              1
+  discover             1
+  plan load            1
+  pre-validate         2
+  parse                2
+  post-validate        2
+  merge                6
+  build args           5
+  filename             5
+  index                1
+  total                 
+  $ sed -n '/^allocation site/,$p' profile |sed -n 1p
+  allocation site                            allocs      %    alloc KiB
+  $ sed -n '/^allocation site/,$p' profile |sed 1d |wc -l |tr -d ' '
+  20
+
+Without --mem-profile nothing is counted or printed
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/episode/series.hbr 2>&1 >/dev/null |grep -c 'allocation site'
+  0
+  [1]
@@ -0,0 +1,21 @@
+Batch metrics are kept in Prometheus text format
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$TESTDIR/perf:$PATH"
+  $ cp "$TESTDIR"/diff_config/library/a.hbr a.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" --metrics hbr.prom -c "$TESTDIR"/diff_config/new.conf -y -j 2 a.hbr >/dev/null 2>&1
+  $ grep -v -e '^#' -e timestamp hbr.prom |grep -v '^hbr_phase'
+  hbr_jobs_queued 0
+  hbr_jobs_running 0
+  hbr_jobs_done_total 2
+  hbr_jobs_failed_total 0
+  hbr_media_seconds_encoded_total 2700
+  hbr_output_bytes_total 10
+  $ grep -c '^hbr_phase_seconds_total{phase=' hbr.prom
+  15
+  $ grep '^hbr_phase_runs_total{phase="encode"}' hbr.prom
+  hbr_phase_runs_total{phase="encode"} 2
+  $ grep '^# TYPE' hbr.prom |head -4
+  # TYPE hbr_batch_start_timestamp_seconds gauge
+  # TYPE hbr_last_update_timestamp_seconds gauge
+  # TYPE hbr_jobs_queued gauge
+  # TYPE hbr_jobs_running gauge
@@ -0,0 +1,20 @@
+Successful encodes are added to the performance store
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$TESTDIR/perf:$PATH"
+  $ cp "$TESTDIR"/diff_config/library/a.hbr a.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/diff_config/new.conf -y a.hbr >/dev/null 2>&1
+  $ head -n 1 data/hbr/perf.log |tr '\t' ' '
+  hbr-perf 1
+  $ sed 1d data/hbr/perf.log |cut -f2-11 |tr '\t' '|'
+  x264|slow|20.000000||||||1350|250.000
+  x264|slow|20.000000||||||1350|250.000
+
+diff-config estimates encode time from past encodes like the changed ones
+  $ "$CRAM_HBR" diff-config "$CRAM_HBR_ARGS" "$TESTDIR"/diff_config/old.conf "$TESTDIR"/diff_config/new.conf a.hbr 2>&1 |head -2
+  Checked 2 outfiles in 1 keyfiles
+  Changed 2 outfiles (estimated 0.0 encode hours from past encodes)
+
+Past encodes are only used for the same encoder
+  $ "$CRAM_HBR" diff-config "$CRAM_HBR_ARGS" "$TESTDIR"/diff_config/new.conf "$TESTDIR"/perf/x265.conf a.hbr 2>&1 |head -2
+  Checked 2 outfiles in 1 keyfiles
+  Changed 2 outfiles (estimated 2.0 encode hours at 60 minutes each)
@@ -0,0 +1,37 @@
+Write a plan for a keyfile
+  $ cp "$TESTDIR"/episode/series.hbr series.hbr
+  $ touch -d 2020-01-01 series.hbr
+  $ export XDG_CACHE_HOME="$PWD/cache"
+  $ "$CRAM_HBR" plan "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty series.hbr 2>&1 |sed -e 's@'"$PWD"'@PWD@g' -e 's@[0-9a-f]\{40\}@HASH@'
+  Planned 5 encodes: PWD/cache/hbr/plans/HASH.plan
+
+A valid plan is used without reading the keyfile again
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d --timings-file timings.tsv -c "$TESTDIR"/configs/empty -e 1,2:1 series.hbr 2>/dev/null
+  \x1b[1m# Encoding: 1/2: A - s01e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/test.iso' -o 'A - s01e001.mkv' (esc)
+  \x1b[1m# Encoding: 2/2: A - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=5 -i '/test.iso' -o 'A - s02e001.mkv' (esc)
+  $ grep -c 'parse.series.hbr' timings.tsv
+  0
+  [1]
+
+Changing the keyfile invalidates the plan, even without changing its size
+or modification time
+  $ sed -i 's/title=5/title=9/' series.hbr
+  $ touch -d 2020-01-01 series.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 2:1 series.hbr 2>&1
+  \x1b[1m# Encoding: 1/1: A - s02e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=9 -i '/test.iso' -o 'A - s02e001.mkv' (esc)
+
+Changing an option that affects the plan invalidates it
+  $ touch -d 2020-01-01 series.hbr
+  $ "$CRAM_HBR" plan "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty series.hbr >/dev/null
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -o "$PWD" -e 1:1 series.hbr 2>&1 |sed 's@'"$PWD"'@PWD@g'
+  \x1b[1m# Encoding: 1/1: A - s01e001.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 -i '/test.iso' -o 'PWD/A - s01e001.mkv' (esc)
+
+Episodes missing from a plan
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty -e 7 series.hbr 2>&1
+  hbr WARNING: Could not find specified episode (-e 7)
+  hbr   ERROR: No outfile matches the selected episodes: (series.hbr)
+  [1]
@@ -0,0 +1,64 @@
+A throughput report is printed once the batch finishes
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$CRAM_FAKE_HB:$PATH"
+  $ cp "$TESTDIR"/report/batch.hbr batch.hbr
+  $ FAKE_HB_SIZE=168750 FAKE_HB_FAIL=4 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -j 2 --report report.json batch.hbr 2>/dev/null > out
+  [1]
+  $ sed -n '/^Throughput/,$p' out |cut -c1-12
+  Throughput: 
+    slots     
+    thumbnails
+    prompts   
+    output    
+    encoder   
+    x264      
+    x265      
+    encoder pr
+    x264 defau
+    x264 fast 
+    x265 defau
+    rate targe
+    quality=20
+    vb=1500   
+    slowest   
+              
+              
+              
+              
+  $ sed -n '/^Throughput/,$p' out |grep -E '^  (x26|quality|vb)'
+    x264                              2     250.00        1.0
+    x265                              1     250.00        1.0
+    x264 default                      1     250.00        1.0
+    x264 fast                         1     250.00        1.0
+    x265 default                      1     250.00        1.0
+    quality=20                        2     250.00        1.0          -
+    vb=1500                           1     250.00        1.0       1500
+  $ grep -o 'output  *[0-9]* bytes.*' out
+  output         506250 bytes, 1.0 kbps
+  $ sed -n '/^  slowest/,$p' out |grep -o 'Show - .*' |sort
+  Show - s01e001.mkv
+  Show - s01e002.mkv
+  Show - s01e003.mkv
+  Show - s01e004.mkv (failed)
+
+The same report is written as JSON with --report
+  $ grep -E '^  "(handbrake_version|slots|encodes|failed|media_seconds|output_bytes)"' report.json
+    "handbrake_version": "1.3.0",
+    "slots": 2,
+    "encodes": 3,
+    "failed": 1,
+    "media_seconds": 4050.000,
+    "output_bytes": 506250,
+  $ grep -o '{"name": "[^"]*"' report.json
+  {"name": "x264"
+  {"name": "x265"
+  {"name": "x264 default"
+  {"name": "x264 fast"
+  {"name": "x265 default"
+  {"name": "quality=20"
+  {"name": "vb=1500"
+  $ grep -o '"output": "[^"]*", "success": [a-z]*' report.json |sort
+  "output": "Show - s01e001.mkv", "success": true
+  "output": "Show - s01e002.mkv", "success": true
+  "output": "Show - s01e003.mkv", "success": true
+  "output": "Show - s01e004.mkv", "success": false
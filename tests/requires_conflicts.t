@@ -0,0 +1,19 @@
+Key requiring a specific value of another key
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/requires_conflicts/missing_require.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr WARNING: Year not specified: (TESTDIR/requires_conflicts/missing_require.hbr) [OUTFILE_A]
+  hbr   ERROR: Key "season" requires setting "type=series": (TESTDIR/requires_conflicts/missing_require.hbr) [OUTFILE_A] season= 
+  hbr   ERROR: Could not complete input file: (TESTDIR/requires_conflicts/missing_require.hbr)
+
+Outfile key overrides a conflicting CONFIG key (only for that outfile)
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/requires_conflicts/override_conflict.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr    INFO: Dropping conflicting option [MERGED_CONFIG] decomb=bob
+  hbr    INFO: for option [CURRENT_OUTFILE] deinterlace=slow
+  \x1b[1m# Encoding: 1/2: A (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --deinterlace=slow -i '/test.iso' -o 'A (2000).mkv' (esc)
+  \x1b[1m# Encoding: 2/2: B (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=2 --decomb=bob -i '/test.iso' -o 'B (2000).mkv' (esc)
+
+Negated key does not conflict (CONFIG key is kept)
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/requires_conflicts/negated_conflict.hbr 2>&1 |sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/1: A (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --decomb=bob -i '/test.iso' -o 'A (2000).mkv' (esc)
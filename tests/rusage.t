@@ -0,0 +1,35 @@
+Each encode's resource usage is written next to its log
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$TESTDIR/status:$PATH"
+  $ cp "$TESTDIR"/episode/series.hbr series.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -e 1:2-3 series.hbr 2>/dev/null |grep -v Encoding |sed '/^Throughput/,$d' |sed 's/ *[-0-9.]* *[0-9.]*  A - s01e00[23].mkv$//'
+  \x1b[0m1 encodes finished, 1 failed (esc)
+                            total        largest  output
+    wall s
+    user cpu s
+    system cpu s
+    max rss KiB
+    block reads
+    block writes
+    voluntary cs
+    involuntary cs
+  $ cut -d= -f1 "A - s01e003.mkv.rusage"
+  [HandBrakeCLI]
+  pid
+  exit
+  wall_seconds
+  user_seconds
+  system_seconds
+  max_rss_kib
+  block_reads
+  block_writes
+  voluntary_switches
+  involuntary_switches
+  $ grep exit "A - s01e002.mkv.rusage" "A - s01e003.mkv.rusage"
+  A - s01e002.mkv.rusage:exit=0
+  A - s01e003.mkv.rusage:exit=1
+
+Nothing is summarized when no encodes ran
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -d series.hbr |grep -c finished
+  0
+  [1]
@@ -0,0 +1,65 @@
+split=N encodes a chapter range as N segment jobs joined with mkvmerge
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$CRAM_FAKE_HB:$TESTDIR/split:$PATH"
+  $ cp "$TESTDIR"/split/series.hbr series.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -d series.hbr 2>&1
+  hbr WARNING: Only Matroska (.mkv) outputs can be split, encoding in one job: (series.hbr) [OUTFILE_C] split=2
+  \x1b[1m# Encoding: 1/3: Show - s01e001.part1.mkv (chapters 1-3) (esc)
+  \x1b[0mHandBrakeCLI --title=1 --chapters=1-3 -i '/test.iso' -o 'Show - s01e001.part1.mkv' (esc)
+  \x1b[1m# Encoding: 1/3: Show - s01e001.part2.mkv (chapters 4-5) (esc)
+  \x1b[0mHandBrakeCLI --title=1 --chapters=4-5 -i '/test.iso' -o 'Show - s01e001.part2.mkv' (esc)
+  \x1b[1m# Joining: 1/3: Show - s01e001.mkv (esc)
+  \x1b[0mmkvmerge -o 'Show - s01e001.mkv' 'Show - s01e001.part1.mkv' + 'Show - s01e001.part2.mkv' (esc)
+  \x1b[1m# Encoding: 2/3: Show - s01e002.mkv (esc)
+  \x1b[0mHandBrakeCLI --title=2 --chapters=3 -i '/test.iso' -o 'Show - s01e002.mkv' (esc)
+  \x1b[1m# Encoding: 3/3: Show - s01e003.mp4 (esc)
+  \x1b[0mHandBrakeCLI --format=av_mp4 --title=3 --chapters=1-4 -i '/test.iso' -o 'Show - s01e003.mp4' (esc)
+
+The segments are joined once both finish and removed, mkvmerge's output is
+logged next to the joined file
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -j 2 -e 1:1 series.hbr 2>&1 |grep -E 'Encoding|finished'
+  \x1b[1mEncoding: 1/1: Show - s01e001.part1.mkv (esc)
+  \x1b[0m\x1b[1mEncoding: 1/1: Show - s01e001.part2.mkv (esc)
+  \x1b[0m1 encodes finished, 0 failed (esc)
+  $ ls |grep s01e001
+  Show - s01e001.mkv
+  Show - s01e001.mkv.log
+  Show - s01e001.part1.mkv.log
+  Show - s01e001.part1.mkv.rusage
+  Show - s01e001.part2.mkv.log
+  Show - s01e001.part2.mkv.rusage
+  $ wc -c < "Show - s01e001.mkv"
+  10
+  $ cat "Show - s01e001.mkv.log"
+  Appended Show - s01e001.part1.mkv
+  Appended Show - s01e001.part2.mkv
+
+A failed join keeps the segments
+  $ MKVMERGE_FAIL="no space left" "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -e 1:1 series.hbr 2>&1 >/dev/null
+  hbr   ERROR: 1: mkvmerge failed, Show - s01e001.mkv was not joined: (Show - s01e001.mkv.log)
+  [1]
+  $ ls |grep 'part.\.mkv$'
+  Show - s01e001.part1.mkv
+  Show - s01e001.part2.mkv
+
+A failed segment drops the segments still queued and fails the output
+  $ FAKE_HB_FAIL=1 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -e 1:1 series.hbr 2>&1 >/dev/null
+  hbr   ERROR: 1: Handbrake call failed. Show - s01e001.mkv was not encoded: (Show - s01e001.part1.mkv.log)
+  [1]
+  $ FAKE_HB_FAIL=1 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -e 1:1 series.hbr 2>/dev/null |grep -c Encoding
+  1
+
+Cancelling a running segment stops the other running segments
+  $ export XDG_RUNTIME_DIR="$PWD/run"
+  $ FAKE_HB_HANG=1 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -j 2 -e 1:1 series.hbr >out 2>err &
+  $ until "$CRAM_HBR" ctl status 2>/dev/null |grep -q '2 of 2 jobs running'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl cancel 1
+  cancelled job 1
+  $ wait
+  $ cat err
+  hbr    INFO: 1: Encode cancelled. Show - s01e001.mkv was not encoded: (Show - s01e001.part1.mkv.log)
+
+split needs a chapter range
+  $ printf '[CONFIG]\ntype=series\nname=Show\nseason=1\niso_filename=test.iso\n\n[OUTFILE_A]\ntitle=1\nepisode=1\nsplit=2\n' > nochapters.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -d nochapters.hbr 2>&1 |head -1
+  hbr   ERROR: Key "split" requires "chapters" but it is not set: (nochapters.hbr) [OUTFILE_A] split=2
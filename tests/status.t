@@ -0,0 +1,76 @@
+Nothing is indexed before the first plan
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$TESTDIR/status:$PATH"
+  $ cp "$TESTDIR"/episode/series.hbr series.hbr
+  $ touch -d 2020-01-01 series.hbr
+  $ "$CRAM_HBR" status
+  No outfiles have been indexed. Run hbr plan first.
+
+Planning indexes every outfile
+  $ "$CRAM_HBR" plan "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty series.hbr >/dev/null
+  $ "$CRAM_HBR" status |sed 's@'"$PWD"'@PWD@g'
+  Indexed 5 outfiles from 1 keyfiles
+    encoded      0
+    stale        0
+    failed       0
+    not encoded  5
+    changed      0
+  not encoded  PWD/A - s01e001.mkv (PWD/series.hbr [OUTFILE_A])
+  not encoded  PWD/A - s01e002.mkv (PWD/series.hbr [OUTFILE_B])
+  not encoded  PWD/A - s01e003.mkv (PWD/series.hbr [OUTFILE_C])
+  not encoded  PWD/A - s01e005.mkv (PWD/series.hbr [OUTFILE_D])
+  not encoded  PWD/A - s02e001.mkv (PWD/series.hbr [OUTFILE_E])
+
+Encode results are recorded as jobs finish
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y -j 2 -e 1:1-3 series.hbr >/dev/null 2>&1
+  [1]
+  $ "$CRAM_HBR" status |sed 's@'"$PWD"'@PWD@g'
+  Indexed 5 outfiles from 1 keyfiles
+    encoded      2
+    stale        0
+    failed       1
+    not encoded  2
+    changed      0
+  failed       PWD/A - s01e003.mkv (PWD/series.hbr [OUTFILE_C])
+  not encoded  PWD/A - s01e005.mkv (PWD/series.hbr [OUTFILE_D])
+  not encoded  PWD/A - s02e001.mkv (PWD/series.hbr [OUTFILE_E])
+
+A keyfile changed since it was planned
+  $ sed -i 's/title=1$/title=11/' series.hbr
+  $ touch -d 2020-01-02 series.hbr
+  $ "$CRAM_HBR" status |head -6
+  Indexed 5 outfiles from 1 keyfiles
+    encoded      0
+    stale        0
+    failed       0
+    not encoded  0
+    changed      5
+
+Planning it again shows the encode made with other arguments is stale
+  $ "$CRAM_HBR" plan "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty series.hbr >/dev/null
+  $ "$CRAM_HBR" status |sed 's@'"$PWD"'@PWD@g'
+  Indexed 5 outfiles from 1 keyfiles
+    encoded      1
+    stale        1
+    failed       1
+    not encoded  2
+    changed      0
+  stale        PWD/A - s01e001.mkv (PWD/series.hbr [OUTFILE_A])
+  failed       PWD/A - s01e003.mkv (PWD/series.hbr [OUTFILE_C])
+  not encoded  PWD/A - s01e005.mkv (PWD/series.hbr [OUTFILE_D])
+  not encoded  PWD/A - s02e001.mkv (PWD/series.hbr [OUTFILE_E])
+
+Outfiles removed from a keyfile leave the index when it is planned
+  $ sed -i '/OUTFILE_E/,$d' series.hbr
+  $ "$CRAM_HBR" plan "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty series.hbr >/dev/null
+  $ "$CRAM_HBR" status series.hbr missing.hbr 2>&1 |sed 's@'"$PWD"'@PWD@g'
+  hbr WARNING: Keyfile has no indexed outfiles: (missing.hbr)
+  Indexed 4 outfiles from 1 keyfiles
+    encoded      1
+    stale        1
+    failed       1
+    not encoded  1
+    changed      0
+  stale        PWD/A - s01e001.mkv (PWD/series.hbr [OUTFILE_A])
+  failed       PWD/A - s01e003.mkv (PWD/series.hbr [OUTFILE_C])
+  not encoded  PWD/A - s01e005.mkv (PWD/series.hbr [OUTFILE_D])
@@ -0,0 +1,45 @@
+Phase timings are printed on exit
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d --timings -c "$TESTDIR"/configs/empty "$TESTDIR"/episode/series.hbr 2>&1 >/dev/null |cut -c1-22
+  phase            count
+  version              1
+  discover             1
+  plan load            1
+  pre-validate         2
+  parse                2
+  post-validate        2
+  merge                6
+  build args           5
+  filename             5
+  index                1
+  wall                  
+
+Every sample can be written as tab separated values
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d --timings-file timings.tsv -c "$TESTDIR"/configs/empty "$TESTDIR"/episode/series.hbr >/dev/null 2>&1
+  $ cut -f1,2 timings.tsv |tr '\t' ' ' |sed 's@'"$TESTDIR"'@TESTDIR@g' |uniq -c
+        1 phase subject
+        1 version 
+        1 pre-validate TESTDIR/configs/empty
+        1 parse TESTDIR/configs/empty
+        1 post-validate TESTDIR/configs/empty
+        1 discover 
+        1 plan load TESTDIR/episode/series.hbr
+        1 pre-validate TESTDIR/episode/series.hbr
+        1 parse TESTDIR/episode/series.hbr
+        1 post-validate TESTDIR/episode/series.hbr
+        2 merge TESTDIR/episode/series.hbr
+        1 build args TESTDIR/episode/series.hbr
+        1 filename TESTDIR/episode/series.hbr
+        1 merge TESTDIR/episode/series.hbr
+        1 build args TESTDIR/episode/series.hbr
+        1 filename TESTDIR/episode/series.hbr
+        1 merge TESTDIR/episode/series.hbr
+        1 build args TESTDIR/episode/series.hbr
+        1 filename TESTDIR/episode/series.hbr
+        1 merge TESTDIR/episode/series.hbr
+        1 build args TESTDIR/episode/series.hbr
+        1 filename TESTDIR/episode/series.hbr
+        1 merge TESTDIR/episode/series.hbr
+        1 build args TESTDIR/episode/series.hbr
+        1 filename TESTDIR/episode/series.hbr
+        1 index TESTDIR/episode/series.hbr
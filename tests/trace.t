@@ -0,0 +1,47 @@
+Traces are Chrome trace-event JSON
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data"
+  $ export PATH="$TESTDIR/status:$PATH"
+  $ cp "$TESTDIR"/episode/series.hbr series.hbr
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d --trace trace.json -c "$TESTDIR"/configs/empty series.hbr >/dev/null
+  $ head -c 2 trace.json
+  [
+  $ tail -n 1 trace.json
+  ]
+  $ grep -o '"name":"[^"]*","ph":"[^"]*"' trace.json |uniq -c
+        1 "name":"process_name","ph":"M"
+        1 "name":"thread_name","ph":"M"
+        1 "name":"thread_sort_index","ph":"M"
+        1 "name":"version","ph":"X"
+        1 "name":"pre-validate","ph":"X"
+        1 "name":"parse","ph":"X"
+        1 "name":"post-validate","ph":"X"
+        1 "name":"discover","ph":"X"
+        1 "name":"plan load","ph":"X"
+        1 "name":"pre-validate","ph":"X"
+        1 "name":"parse","ph":"X"
+        1 "name":"post-validate","ph":"X"
+        2 "name":"merge","ph":"X"
+        1 "name":"build args","ph":"X"
+        1 "name":"filename","ph":"X"
+        1 "name":"merge","ph":"X"
+        1 "name":"build args","ph":"X"
+        1 "name":"filename","ph":"X"
+        1 "name":"merge","ph":"X"
+        1 "name":"build args","ph":"X"
+        1 "name":"filename","ph":"X"
+        1 "name":"merge","ph":"X"
+        1 "name":"build args","ph":"X"
+        1 "name":"filename","ph":"X"
+        1 "name":"merge","ph":"X"
+        1 "name":"build args","ph":"X"
+        1 "name":"filename","ph":"X"
+        1 "name":"index","ph":"X"
+
+Encodes are drawn on one lane per job slot with their results
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" --trace trace.json -c "$TESTDIR"/configs/empty -y -e 1:3 series.hbr >/dev/null 2>&1
+  [1]
+  $ grep -o '"name":"slot [0-9]*"' trace.json
+  "name":"slot 1"
+  $ grep -o '"ph":"[BE]".*}' trace.json |sed 's/"pid":"*[0-9]*"*/PID/g; s/"ts":[0-9]*/TS/'
+  "ph":"B",PID,"tid":2,TS,"args":{"output":"A - s01e003.mkv","log":"A - s01e003.mkv.log","outfile":"1/1","fingerprint":"31d8946325a21420"}}
+  "ph":"E",PID,"tid":2,TS,"args":{PID,"result":"exit 1"}}
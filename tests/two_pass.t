@@ -0,0 +1,57 @@
+First passes of --two-pass --turbo encodes take half a -j slot, so two of
+them start at once with -j 1
+  $ export XDG_CACHE_HOME="$PWD/cache" XDG_DATA_HOME="$PWD/data" XDG_RUNTIME_DIR="$PWD/run"
+  $ export PATH="$CRAM_FAKE_HB:$PATH"
+  $ cp "$TESTDIR"/two_pass/series.hbr series.hbr
+  $ FAKE_HB_HANG=all FAKE_HB_HANG_AT=25 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y series.hbr >out 2>err &
+  $ until "$CRAM_HBR" ctl status 2>/dev/null |grep -q '2 of 1 jobs'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl status |grep -A3 '^running'
+  running:
+      id slot progress      fps       eta  output
+       1    1     0.0%   250.00         -  Show - s01e001.mkv
+       2    2     0.0%   250.00         -  Show - s01e002.mkv
+  $ for id in 1 2 3; do "$CRAM_HBR" ctl cancel $id >/dev/null 2>&1; sleep 0.2; done
+  $ wait
+
+With a subtitle scan the first pass is the second of three tasks, it
+still takes half a slot, so the next encode starts when another is
+cancelled
+  $ cp "$TESTDIR"/two_pass/scan.hbr scan.hbr
+  $ FAKE_HB_HANG=all FAKE_HB_HANG_AT=60 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y scan.hbr >out 2>err &
+  $ until "$CRAM_HBR" ctl status 2>/dev/null |grep -q '^ *1 .*50.0%'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl cancel 2
+  cancelled job 2
+  $ until "$CRAM_HBR" ctl status |grep -q '^ *3 .*50.0%'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl status |awk '/^running/,/^queued/ { print $1, $3, $NF }'
+  running:  running:
+  id progress output
+  1 50.0% s01e001.mkv
+  3 50.0% s01e003.mkv
+  $ for id in 1 3; do "$CRAM_HBR" ctl cancel $id >/dev/null 2>&1; done
+  $ wait
+
+Once both reach their final pass they don't fit, both keep running and
+the next encode waits until they fit again
+  $ FAKE_HB_HANG=all FAKE_HB_HANG_AT=80 "$CRAM_HBR" "$CRAM_HBR_ARGS" -c "$TESTDIR"/configs/empty -y series.hbr >out 2>err &
+  $ until "$CRAM_HBR" ctl status 2>/dev/null |grep -q '^ *2 .*62.5%'; do sleep 0.1; done
+  $ until "$CRAM_HBR" ctl status |grep -q '^ *1 .*62.5%'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl status |awk '/^running/,0 { print $1, $NF }'
+  running: running:
+  id output
+  1 s01e001.mkv
+  2 s01e002.mkv
+  queued: queued:
+  id output
+  3 s01e003.mkv
+  $ "$CRAM_HBR" ctl cancel 1
+  cancelled job 1
+  $ sleep 0.5
+  $ "$CRAM_HBR" ctl status |grep -c '^ *3 .*%'
+  0
+  [1]
+  $ "$CRAM_HBR" ctl cancel 2 >/dev/null
+  $ until "$CRAM_HBR" ctl status |grep -q '^ *3 .*62.5%'; do sleep 0.1; done
+  $ "$CRAM_HBR" ctl cancel 3 >/dev/null
+  $ wait
+  $ grep -c 'Encode cancelled' err
+  3
@@ -0,0 +1,30 @@
+Good Input
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/valid_encopts/good.hbr 2>&1 | sed 's@'"$TESTDIR"'@TESTDIR@g'
+  \x1b[1m# Encoding: 1/5: good (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x264 --encopts=ref=4:bframes=3 -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[1m# Encoding: 2/5: good (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x264 --encopts=no-fast-pskip:threads=2 -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[1m# Encoding: 3/5: good (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x265 -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[1m# Encoding: 4/5: good (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=VP9 --encopts=deadline=good -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[1m# Encoding: 5/5: good (2000).mkv (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x264 --encopts=threads=0 -i '/test.iso' -o 'good (2000).mkv' (esc)
+
+With -j, x264 and x265 encodes get their share of the CPUs unless encopts
+already sets a thread count
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -j 256 -c "$TESTDIR"/configs/empty "$TESTDIR"/valid_encopts/good.hbr 2>&1 | grep HandBrakeCLI
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x264 --encopts=ref=4:bframes=3:threads=1 -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x264 --encopts=no-fast-pskip:threads=2 -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x265 --encopts=pools=1 -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=VP9 --encopts=deadline=good -i '/test.iso' -o 'good (2000).mkv' (esc)
+  \x1b[0mHandBrakeCLI --title=1 --encoder=x264 --encopts=threads=0 -i '/test.iso' -o 'good (2000).mkv' (esc)
+
+Bad values
+  $ "$CRAM_HBR" "$CRAM_HBR_ARGS" -d -c "$TESTDIR"/configs/empty "$TESTDIR"/valid_encopts/bad.hbr 2>&1 | sed 's@'"$TESTDIR"'@TESTDIR@g'
+  hbr   ERROR: Value should be encoder options as name=value pairs separated by colons (e.g. ref=4:bframes=3), with threads a thread count, 0 or auto: (TESTDIR/valid_encopts/bad.hbr) [OUTFILE1] encopts=ref=
+  hbr   ERROR: Value should be encoder options as name=value pairs separated by colons (e.g. ref=4:bframes=3), with threads a thread count, 0 or auto: (TESTDIR/valid_encopts/bad.hbr) [OUTFILE2] encopts=:ref=4
+  hbr   ERROR: Value should be encoder options as name=value pairs separated by colons (e.g. ref=4:bframes=3), with threads a thread count, 0 or auto: (TESTDIR/valid_encopts/bad.hbr) [OUTFILE3] encopts=ref 4
+  hbr   ERROR: Value should be encoder options as name=value pairs separated by colons (e.g. ref=4:bframes=3), with threads a thread count, 0 or auto: (TESTDIR/valid_encopts/bad.hbr) [OUTFILE4] encopts=threads=-1
+  hbr   ERROR: Value should be encoder options as name=value pairs separated by colons (e.g. ref=4:bframes=3), with threads a thread count, 0 or auto: (TESTDIR/valid_encopts/bad.hbr) [OUTFILE5] encopts=threads=many
+  hbr   ERROR: Could not complete input file: (TESTDIR/valid_encopts/bad.hbr)